@@ -0,0 +1,80 @@
+#include "base64.h"
+#include <cstdint>
+#ifdef __SSSE3__
+  #include <immintrin.h>
+#endif // __SSSE3__
+
+namespace base64 {
+
+namespace {
+
+char constexpr alphabet[]{"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"};
+
+char *encode_tail(std::byte const *input, size_t const size, char *output) {
+  /// Encode whole groups of three bytes one at a time, then the padded remainder
+  size_t i{0};
+  for(; i + 3 <= size; i += 3) {
+    uint32_t const group{static_cast<uint32_t>(input[i]) << 16 | static_cast<uint32_t>(input[i + 1]) << 8 | static_cast<uint32_t>(input[i + 2])};
+    *output++ = alphabet[group >> 18];
+    *output++ = alphabet[(group >> 12) & 0x3F];
+    *output++ = alphabet[(group >> 6) & 0x3F];
+    *output++ = alphabet[group & 0x3F];
+  }
+  if(size - i == 1) {
+    uint32_t const group{static_cast<uint32_t>(input[i]) << 16};
+    *output++ = alphabet[group >> 18];
+    *output++ = alphabet[(group >> 12) & 0x3F];
+    *output++ = '=';
+    *output++ = '=';
+  } else if(size - i == 2) {
+    uint32_t const group{static_cast<uint32_t>(input[i]) << 16 | static_cast<uint32_t>(input[i + 1]) << 8};
+    *output++ = alphabet[group >> 18];
+    *output++ = alphabet[(group >> 12) & 0x3F];
+    *output++ = alphabet[(group >> 6) & 0x3F];
+    *output++ = '=';
+  }
+  return output;
+}
+
+} // anonymous namespace
+
+size_t encoded_size(size_t const input_size) {
+  /// Number of characters the encoding of the given number of bytes takes, including padding
+  return (input_size + 2) / 3 * 4;
+}
+
+void encode_append(std::span<std::byte const> input, std::string &output) {
+  /// Append the base64 encoding of some bytes to a string
+  size_t const offset{output.size()};
+  size_t const new_size{offset + encoded_size(input.size())};
+  output.resize_and_overwrite(new_size, [&](char *const buffer, size_t /*buffer_size*/){
+    std::byte const *source{input.data()};
+    std::byte const *const source_end{source + input.size()};
+    char *destination{buffer + offset};
+    #ifdef __SSSE3__
+      // twelve bytes become sixteen characters per step; each load reads sixteen, so stop while that stays in bounds
+      __m128i const gather{_mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10)}; // each 32-bit lane holds one three-byte group, big-endian within 16-bit halves
+      __m128i const mask_ac{_mm_set1_epi32(0x0FC0FC00)};
+      __m128i const shift_ac{_mm_set1_epi32(0x04000040)};
+      __m128i const mask_bd{_mm_set1_epi32(0x003F03F0)};
+      __m128i const shift_bd{_mm_set1_epi32(0x01000010)};
+      __m128i const offsets{_mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0)};
+      while(source_end - source >= 16) {
+        __m128i const bytes{_mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(source)), gather)};
+        __m128i const indices{_mm_or_si128(                                     // one 6-bit index per byte
+          _mm_mulhi_epu16(_mm_and_si128(bytes, mask_ac), shift_ac),
+          _mm_mullo_epi16(_mm_and_si128(bytes, mask_bd), shift_bd)
+        )};
+        __m128i range{_mm_subs_epu8(indices, _mm_set1_epi8(51))};               // 0 for letters, 1 to 12 for digits and symbols
+        range = _mm_or_si128(range, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), indices), _mm_set1_epi8(13))); // 13 for upper case
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination), _mm_add_epi8(indices, _mm_shuffle_epi8(offsets, range)));
+        source += 12;
+        destination += 16;
+      }
+    #endif // __SSSE3__
+    encode_tail(source, static_cast<size_t>(source_end - source), destination);
+    return new_size;
+  });
+}
+
+} // namespace base64
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include <string>
+
+namespace base64 {
+  /// Standard base64 encoder (RFC 4648, with padding), vectorised where SSSE3 is available.
+  ///
+  /// Output is appended to an existing string, so large payloads such as
+  /// images can be encoded straight into a request body without a copy.
+
+size_t encoded_size(size_t input_size);
+void encode_append(std::span<std::byte const> input, std::string &output);
+
+} // namespace base64
@@ -0,0 +1,213 @@
+#include "completion_cache.h"
+#include <array>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#ifdef __EMSCRIPTEN__
+  #include <emscripten.h>
+#endif // __EMSCRIPTEN__
+#include <nlohmann/json.hpp>
+
+namespace chat {
+
+namespace {
+
+#ifdef __EMSCRIPTEN__
+  std::array<char, 33> key_name(hash_128 const &key) {
+    /// Format a key as 32 hex digits, for use as an IndexedDB key
+    std::array<char, 33> result{};
+    std::string_view constexpr digits{"0123456789abcdef"};
+    for(size_t i{0}; i != 16; ++i) {
+      result[i]      = digits[(key.high >> (60 - i * 4)) & 0xF];
+      result[i + 16] = digits[(key.low  >> (60 - i * 4)) & 0xF];
+    }
+    return result;
+  }
+#endif // __EMSCRIPTEN__
+
+} // anonymous namespace
+
+completion_cache::completion_cache(std::string const &this_persistent_name, size_t const this_max_memory_bytes)
+  : max_memory_bytes{this_max_memory_bytes},
+    persistent_name{this_persistent_name} {
+  /// Construct an empty cache; the persistent tier is off until enabled
+}
+
+bool completion_cache::is_reproducible(nlohmann::json const &request) {
+  /// Whether a chat completion request's sampling parameters make its result deterministic enough to cache
+  if(request.value("n", 1) != 1) return false;                                  // several samples are requested precisely because they differ
+  if(request.value("stream", false)) return false;
+  return request.value("temperature", 1.0) <= 0.0;                              // greedy decoding; the API defaults to 1
+}
+
+hash_128 completion_cache::make_key(std::string_view canonical_body) {
+  /// Hash a canonical request body into a cache key
+  return hash_bytes_128(canonical_body);
+}
+
+void completion_cache::get(hash_128 const &key, callback &&on_result) {
+  /// Look up a response, from memory immediately, or from the persistent tier if enabled; the callback receives nullopt on a miss
+  auto const time_start{std::chrono::steady_clock::now()};
+  if(auto const it{index.find(key)}; it != index.end()) {
+    entries.splice(entries.begin(), entries, it->second);                       // move to the front of the LRU list
+    stats.memory_hits++;
+    stats.last_hit_us = std::chrono::duration<float, std::micro>{std::chrono::steady_clock::now() - time_start}.count();
+    on_result(it->second->response);
+    return;
+  }
+  if(!persistent) {
+    stats.misses++;
+    on_result(std::nullopt);
+    return;
+  }
+  load_persistent(key, std::move(on_result));
+}
+
+void completion_cache::put(hash_128 const &key, std::string_view response) {
+  /// Cache a response in memory, and in the persistent tier if enabled
+  store_memory(key, response);
+  if(persistent) store_persistent(key, response);
+}
+
+void completion_cache::set_persistent(bool const enabled) {
+  /// Enable or disable the persistent tier
+  persistent = enabled;
+  #ifndef __EMSCRIPTEN__
+    if(!persistent || file.is_open()) return;
+    file.open(persistent_name, std::ios::binary | std::ios::in | std::ios::out | std::ios::app);
+    if(!file) file.open(persistent_name, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc); // create it
+    if(!file) {
+      std::cerr << "ERROR: Unable to open completion cache file " << persistent_name << std::endl;
+      persistent = false;
+      return;
+    }
+    // index the existing records: 16-byte key, 32-bit size, then the response
+    file.seekg(0, std::ios::end);
+    auto const file_size{static_cast<uint64_t>(file.tellg())};
+    file.seekg(0);
+    for(;;) {
+      std::array<uint64_t, 2> key_words;
+      uint32_t size;
+      if(!file.read(reinterpret_cast<char*>(key_words.data()), sizeof(key_words)) || !file.read(reinterpret_cast<char*>(&size), sizeof(size))) break;
+      auto const offset{static_cast<uint64_t>(file.tellg())};
+      if(offset + size > file_size) break;                                      // truncated by an interrupted write
+      file_index[hash_128{.low{key_words[0]}, .high{key_words[1]}}] = {offset, size};
+      file.seekg(size, std::ios::cur);
+    }
+    file.clear();
+  #endif // __EMSCRIPTEN__
+}
+
+bool completion_cache::get_persistent() const {
+  /// Whether the persistent tier is enabled
+  return persistent;
+}
+
+completion_cache::statistics const &completion_cache::get_statistics() const {
+  /// Return hit and miss counters
+  return stats;
+}
+
+void completion_cache::store_memory(hash_128 const &key, std::string_view response) {
+  /// Add a response to the memory tier, evicting the least recently used until it fits
+  if(response.size() > max_memory_bytes) return;
+  if(auto const it{index.find(key)}; it != index.end()) {
+    memory_bytes -= it->second->response.size();
+    entries.erase(it->second);
+    index.erase(it);
+  }
+  while(memory_bytes + response.size() > max_memory_bytes) {
+    memory_bytes -= entries.back().response.size();
+    index.erase(entries.back().key);
+    entries.pop_back();
+  }
+  entries.emplace_front(entry{
+    .key{key},
+    .response{std::string{response}},
+  });
+  index.emplace(key, entries.begin());
+  memory_bytes += response.size();
+}
+
+void completion_cache::load_persistent(hash_128 const &key, callback &&on_result) {
+  /// Look a response up in the persistent tier, promoting it to memory on a hit
+  #ifdef __EMSCRIPTEN__
+    struct pending_load {
+      completion_cache &owner;
+      hash_128 key;
+      callback on_result;
+    };
+    emscripten_idb_async_load(
+      persistent_name.c_str(),
+      key_name(key).data(),
+      new pending_load{*this, key, std::move(on_result)},
+      [](void *arg, void *buffer, int size){
+        std::unique_ptr<pending_load> const load{static_cast<pending_load*>(arg)};
+        std::string_view const response{static_cast<char const*>(buffer), static_cast<size_t>(size)};
+        load->owner.stats.persistent_hits++;
+        load->owner.store_memory(load->key, response);
+        load->on_result(response);
+      },
+      [](void *arg){                                                            // also called when the key isn't found
+        std::unique_ptr<pending_load> const load{static_cast<pending_load*>(arg)};
+        load->owner.stats.misses++;
+        load->on_result(std::nullopt);
+      }
+    );
+  #else
+    auto const it{file_index.find(key)};
+    if(it == file_index.end()) {
+      stats.misses++;
+      on_result(std::nullopt);
+      return;
+    }
+    auto const [offset, size]{it->second};
+    std::string response(size, '\0');
+    file.seekg(static_cast<std::streamoff>(offset));
+    if(!file.read(response.data(), size)) {
+      file.clear();
+      std::cerr << "ERROR: Unable to read completion cache file " << persistent_name << std::endl;
+      stats.misses++;
+      on_result(std::nullopt);
+      return;
+    }
+    stats.persistent_hits++;
+    store_memory(key, response);
+    on_result(response);
+  #endif // __EMSCRIPTEN__
+}
+
+void completion_cache::store_persistent(hash_128 const &key, std::string_view response) {
+  /// Write a response to the persistent tier
+  #ifdef __EMSCRIPTEN__
+    emscripten_idb_async_store(                                                 // the data is copied before this returns
+      persistent_name.c_str(),
+      key_name(key).data(),
+      const_cast<char*>(response.data()),
+      static_cast<int>(response.size()),
+      nullptr,
+      [](void */*arg*/){},
+      [](void */*arg*/){
+        std::cerr << "ERROR: Unable to store completion in IndexedDB" << std::endl;
+      }
+    );
+  #else
+    if(file_index.contains(key)) return;
+    std::array<uint64_t, 2> const key_words{key.low, key.high};
+    auto const size{static_cast<uint32_t>(response.size())};
+    file.seekp(0, std::ios::end);
+    auto const offset{static_cast<uint64_t>(file.tellp()) + sizeof(key_words) + sizeof(size)};
+    file.write(reinterpret_cast<char const*>(key_words.data()), sizeof(key_words));
+    file.write(reinterpret_cast<char const*>(&size), sizeof(size));
+    file.write(response.data(), static_cast<std::streamsize>(response.size()));
+    file.flush();
+    if(!file) {
+      file.clear();
+      std::cerr << "ERROR: Unable to write completion cache file " << persistent_name << std::endl;
+      return;
+    }
+    file_index[key] = {offset, size};
+  #endif // __EMSCRIPTEN__
+}
+
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#ifndef __EMSCRIPTEN__
+  #include <fstream>
+#endif // __EMSCRIPTEN__
+#include <nlohmann/json_fwd.hpp>
+#include "hash_128.h"
+
+namespace chat {
+
+class completion_cache {
+  /// Exact-match cache of chat completion responses, for reproducible requests only.
+  ///
+  /// Requests are keyed by a 128-bit hash of their canonical body, which is the
+  /// dump of an nlohmann::json object: keys sorted, no whitespace.  Responses are
+  /// held in an LRU memory tier bounded by size, and optionally in a persistent
+  /// tier: IndexedDB on the web, an append-only file on native builds.  Memory
+  /// hits are answered synchronously; persistent lookups may complete later.
+public:
+  struct statistics {
+    uint64_t memory_hits{0};
+    uint64_t persistent_hits{0};
+    uint64_t misses{0};
+    float last_hit_us{0.0f};                                                    // lookup time of the most recent memory hit
+  };
+
+  using callback = std::function<void(std::optional<std::string_view> response)>;
+
+private:
+  struct entry {
+    hash_128 key;
+    std::string response;
+  };
+
+  std::list<entry> entries;                                                     // most recently used first
+  std::unordered_map<hash_128, std::list<entry>::iterator> index;
+  size_t memory_bytes{0};
+  size_t max_memory_bytes;
+
+  bool persistent{false};
+  std::string persistent_name;                                                  // IndexedDB database name on the web, file path on native
+  #ifndef __EMSCRIPTEN__
+    std::fstream file;
+    std::unordered_map<hash_128, std::pair<uint64_t, uint32_t>> file_index;     // offset and size of each response in the file
+  #endif // __EMSCRIPTEN__
+
+  statistics stats;
+
+public:
+  explicit completion_cache(std::string const &persistent_name, size_t max_memory_bytes = 16 * 1024 * 1024);
+
+  static bool is_reproducible(nlohmann::json const &request);
+  static hash_128 make_key(std::string_view canonical_body);
+
+  void get(hash_128 const &key, callback &&on_result);
+  void put(hash_128 const &key, std::string_view response);
+
+  void set_persistent(bool enabled);
+  bool get_persistent() const;
+  statistics const &get_statistics() const;
+
+private:
+  void store_memory(hash_128 const &key, std::string_view response);
+  void load_persistent(hash_128 const &key, callback &&on_result);
+  void store_persistent(hash_128 const &key, std::string_view response);
+};
+
+}
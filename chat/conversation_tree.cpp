@@ -0,0 +1,274 @@
+#include "conversation_tree.h"
+#include <algorithm>
+#include <cassert>
+
+namespace chat {
+
+void conversation_tree::node_deleter::operator()(node *target) const {
+  /// Destroy a node and any ancestors it solely owned, iteratively so very long conversations can't overflow the stack
+  std::shared_ptr<node> next{std::move(target->parent)};
+  owner->nodes.erase(target->id);
+  owner->released.emplace_back(target->id);
+  owner->texts.remove(target->text);
+  delete target;
+  while(next && next.use_count() == 1) {                                        // we hold the last reference, so detach its parent before releasing it
+    std::shared_ptr<node> after{std::move(next->parent)};
+    next.reset();
+    next = std::move(after);
+  }
+}
+
+std::span<conversation_tree::node* const> conversation_tree::path() const {
+  /// Return the messages of the active branch, from the first to the last
+  if(!active_path_valid) {
+    active_path.clear();
+    for(node *this_node{branches[active].leaf.get()}; this_node; this_node = this_node->parent.get()) {
+      active_path.emplace_back(this_node);
+    }
+    std::reverse(active_path.begin(), active_path.end());
+    active_path_valid = true;
+  }
+  return active_path;
+}
+
+std::span<conversation_tree::branch const> conversation_tree::get_branches() const {
+  /// Return all branches of the conversation
+  return branches;
+}
+
+conversation_tree::branch_id conversation_tree::get_active_branch() const {
+  /// Return the id of the branch being viewed and extended
+  return branches[active].id;
+}
+
+void conversation_tree::switch_branch(branch_id const id) {
+  /// Make another branch active
+  for(size_t i{0}; i != branches.size(); ++i) {
+    if(branches[i].id != id) continue;
+    if(i == active) return;
+    active = i;
+    active_path_valid = false;
+    return;
+  }
+}
+
+conversation_tree::branch_id conversation_tree::fork(size_t const path_index) {
+  /// Create and activate a new branch ending at the given message of the active branch, sharing everything up to it
+  assert(path_index < path().size() && "conversation_tree::fork index out of range");
+  std::shared_ptr<node> leaf{branches[active].leaf};
+  while(leaf->depth != path_index) leaf = leaf->parent;
+
+  branch_id const id{next_branch_id++};
+  branches.emplace_back(branch{
+    .id{id},
+    .leaf{std::move(leaf)},
+  });
+  active = branches.size() - 1;
+  active_path_valid = false;
+  return id;
+}
+
+void conversation_tree::remove_branch(branch_id const id) {
+  /// Remove a branch, releasing any messages not shared with other branches; the last branch can't be removed
+  if(branches.size() == 1) return;
+  auto const it{std::find_if(branches.begin(), branches.end(), [&](branch const &this_branch){return this_branch.id == id;})};
+  if(it == branches.end()) return;
+  auto const index{static_cast<size_t>(it - branches.begin())};
+  bool const was_active{index == active};
+  bool const before_active{index < active};
+  branches.erase(it);
+  if(before_active || active == branches.size()) --active;
+  if(was_active || before_active) active_path_valid = false;                    // another branch is now active, or the active one has moved
+}
+
+std::optional<conversation_tree::branch_id> conversation_tree::find_branch_containing(node_id const id) const {
+  /// Return the active branch if it contains the given message, otherwise any other branch that does
+  node const *const target{find(id)};
+  if(!target) return std::nullopt;
+  auto const contains{[&](branch const &this_branch){
+    node const *this_node{this_branch.leaf.get()};
+    while(this_node && this_node->depth > target->depth) this_node = this_node->parent.get();
+    return this_node == target;
+  }};
+  if(contains(branches[active])) return branches[active].id;
+  for(auto const &this_branch : branches) {
+    if(contains(this_branch)) return this_branch.id;
+  }
+  return std::nullopt;
+}
+
+conversation_tree::node_id conversation_tree::append(message &&new_message) {
+  /// Add a message to the end of the active branch
+  auto &leaf{branches[active].leaf};
+  leaf = make_node(leaf, new_message.role, std::move(new_message.text));
+  if(active_path_valid) active_path.emplace_back(leaf.get());
+  return leaf->id;
+}
+
+std::optional<conversation_tree::node_id> conversation_tree::append(branch_id const id, message &&new_message) {
+  /// Add a message to the end of a specific branch, if it still exists
+  if(id == get_active_branch()) return append(std::move(new_message));
+  branch *const target{find_branch(id)};
+  if(!target) return std::nullopt;
+  target->leaf = make_node(target->leaf, new_message.role, std::move(new_message.text));
+  return target->leaf->id;
+}
+
+void conversation_tree::set_role(size_t const path_index, message::roles const role) {
+  /// Change the role of a message on the active branch
+  prepare_edit(path_index).role = role;
+}
+
+void conversation_tree::set_text(size_t const path_index, std::string &&text) {
+  /// Change the text of a message on the active branch
+  nodes.texts.set(prepare_edit(path_index).text, std::move(text));
+}
+
+void conversation_tree::attach_image(size_t const path_index, image &&new_image) {
+  /// Add an image to a message on the active branch
+  node &target{prepare_edit(path_index)};
+  auto images{target.images ? std::make_shared<std::vector<image>>(*target.images) : std::make_shared<std::vector<image>>()}; // copied, as other nodes may share the list
+  images->emplace_back(std::move(new_image));
+  target.images = std::move(images);
+}
+
+void conversation_tree::detach_image(size_t const path_index, size_t const image_index) {
+  /// Remove an image from a message on the active branch
+  node &target{prepare_edit(path_index)};
+  if(!target.images || image_index >= target.images->size()) return;
+  auto images{std::make_shared<std::vector<image>>(*target.images)};
+  images->erase(images->begin() + static_cast<std::ptrdiff_t>(image_index));
+  target.images = images->empty() ? nullptr : std::move(images);
+}
+
+conversation_tree::node const *conversation_tree::find(node_id const id) const {
+  /// Look up any live message by id
+  auto const it{nodes.nodes.find(id)};
+  return it == nodes.nodes.end() ? nullptr : it->second;
+}
+
+void conversation_tree::for_each_node(std::function<void(node const&)> const &callback) const {
+  /// Call a function for every live message on any branch, in no particular order
+  for(auto const &[id, this_node] : nodes.nodes) {
+    callback(*this_node);
+  }
+}
+
+std::string_view conversation_tree::get_text(node const &target) const {
+  /// Return the text of a message, decompressing it if necessary; the view is only valid until the next call into the tree
+  return nodes.texts.get(target.text);
+}
+
+std::span<image const> conversation_tree::get_images(node const &target) const {
+  /// Return the images attached to a message, if any
+  if(!target.images) return {};
+  return *target.images;
+}
+
+size_t conversation_tree::size() const {
+  /// Return the number of distinct messages held across all branches
+  return nodes.nodes.size();
+}
+
+conversation_tree::change_set conversation_tree::take_changes() {
+  /// Return and clear the list of nodes created, edited and released since the last call, for keeping external indexes in sync
+  change_set changes;
+  changes.updated.reserve(updated.size());
+  for(node_id const id : updated) {
+    if(nodes.nodes.contains(id)) changes.updated.emplace_back(id);
+  }
+  updated.clear();
+  changes.released = std::move(nodes.released);
+  nodes.released.clear();
+  return changes;
+}
+
+void conversation_tree::restore(size_t const node_count, std::function<restored_node(size_t index)> const &get_node, std::span<std::optional<size_t> const> branch_leaves, size_t const active_branch) {
+  /// Replace the whole tree with nodes and branches loaded from elsewhere; every node's parent must precede it, and nodes on no branch are discarded
+  branches.clear();                                                             // releases all existing nodes
+  std::vector<std::shared_ptr<node>> restored;
+  restored.reserve(node_count);
+  for(size_t i{0}; i != node_count; ++i) {
+    auto [parent, content, images]{get_node(i)};
+    assert((!parent || *parent < i) && "conversation_tree::restore parent must precede its child");
+    restored.emplace_back(make_node(parent ? restored[*parent] : nullptr, content.role, std::move(content.text), std::move(images)));
+  }
+  for(auto const &leaf : branch_leaves) {
+    branches.emplace_back(branch{
+      .id{next_branch_id++},
+      .leaf{leaf ? restored[*leaf] : nullptr},
+    });
+  }
+  if(branches.empty()) branches.emplace_back(branch{.id{next_branch_id++}, .leaf{}});
+  active = active_branch < branches.size() ? active_branch : 0;
+  active_path_valid = false;
+}
+
+void conversation_tree::maintain() {
+  /// Let texts that haven't been read or edited recently be compressed; call about once per frame
+  nodes.texts.maintain();
+}
+
+message_store::statistics conversation_tree::get_storage_statistics() const {
+  /// Return the sizes of the hot and cold text tiers
+  return nodes.texts.get_statistics();
+}
+
+conversation_tree::node &conversation_tree::prepare_edit(size_t const path_index) {
+  /// Return a node of the active branch for editing, first copying the path from it to the leaf if any of it is shared
+  assert(path_index < path().size() && "conversation_tree::prepare_edit index out of range");
+  auto &leaf{branches[active].leaf};
+
+  bool shared{false};
+  std::shared_ptr<node> const *owner{&leaf};                                    // the reference that owns each node in turn, walking from the leaf
+  for(;; owner = &(*owner)->parent) {
+    if(owner->use_count() != 1) shared = true;                                  // referenced by another branch, or by another child
+    if((*owner)->depth == path_index) break;
+  }
+  node &target{**owner};
+  if(!shared) {
+    updated.emplace(target.id);
+    return target;
+  }
+
+  // copy the target and its descendants on this branch, leaving the originals to the other branches that share them
+  std::vector<node const*> originals;
+  for(node const *this_node{leaf.get()}; this_node != &target; this_node = this_node->parent.get()) {
+    originals.emplace_back(this_node);
+  }
+  std::shared_ptr<node> copy{make_node(target.parent, target.role, std::string{get_text(target)}, target.images)};
+  node &copied_target{*copy};
+  for(auto it{originals.rbegin()}; it != originals.rend(); ++it) {
+    copy = make_node(std::move(copy), (*it)->role, std::string{get_text(**it)}, (*it)->images);
+  }
+  leaf = std::move(copy);                                                       // may release originals no longer used by any branch
+  active_path_valid = false;
+  return copied_target;
+}
+
+std::shared_ptr<conversation_tree::node> conversation_tree::make_node(std::shared_ptr<node> parent, message::roles const role, std::string &&text, std::shared_ptr<std::vector<image> const> images) {
+  /// Create a node owned by this tree
+  unsigned int const depth{parent ? parent->depth + 1 : 0};
+  std::shared_ptr<node> const result{
+    new node{
+      .parent{std::move(parent)},
+      .id{next_node_id++},
+      .depth{depth},
+      .role{role},
+      .text{nodes.texts.add(std::move(text))},
+      .images{std::move(images)},
+    },
+    node_deleter{&nodes},
+  };
+  nodes.nodes.emplace(result->id, result.get());
+  updated.emplace(result->id);
+  return result;
+}
+
+conversation_tree::branch *conversation_tree::find_branch(branch_id const id) {
+  /// Look up a branch by id
+  auto const it{std::find_if(branches.begin(), branches.end(), [&](branch const &this_branch){return this_branch.id == id;})};
+  return it == branches.end() ? nullptr : &*it;
+}
+
+}
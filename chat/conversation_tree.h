@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "chat/image.h"
+#include "chat/message.h"
+#include "chat/message_store.h"
+
+namespace chat {
+
+class conversation_tree {
+  /// A conversation as a persistent tree of turns, with any number of branches.
+  ///
+  /// Each node owns a reference to its parent, and each branch owns its leaf,
+  /// so branches forked from the same message share their common prefix.
+  /// Editing a message that is shared with another branch copies only the
+  /// path from that message to the branch's leaf; a message owned by a single
+  /// branch is edited in place.  Switching branches is O(1).
+  ///
+  /// Texts live in a tiered message_store, so those not read recently are
+  /// compressed; call maintain() periodically to let them go cold.
+public:
+  using node_id = uint32_t;
+  using branch_id = uint32_t;
+
+  struct node {
+    std::shared_ptr<node> parent;                                               // null for the first message of a conversation
+    node_id id{0};                                                              // unique for the lifetime of the tree; a copied node gets a new id
+    unsigned int depth{0};                                                      // index of this message within its path
+    message::roles role{message::roles::user};
+    message_store::handle text{0};                                              // read with get_text()
+    std::shared_ptr<std::vector<image> const> images{};                         // attachments, shared with copies of the node as they're never edited in place
+  };
+
+  struct branch {
+    branch_id id{0};
+    std::shared_ptr<node> leaf;                                                 // last message of the branch, or null if it is empty
+  };
+
+  struct restored_node {
+    std::optional<size_t> parent;                                               // index of an earlier node, or none for the first message
+    message content;
+    std::shared_ptr<std::vector<image> const> images{};
+  };
+
+  struct change_set {
+    std::vector<node_id> updated;                                               // nodes created or edited since the last call, still alive
+    std::vector<node_id> released;                                              // nodes destroyed since the last call
+  };
+
+private:
+  struct registry {
+    std::unordered_map<node_id, node*> nodes;                                   // every live node by id
+    std::vector<node_id> released;
+    message_store texts;
+  };
+
+  struct node_deleter {
+    registry *owner;
+    void operator()(node *target) const;
+  };
+
+  mutable registry nodes;                                                       // must outlive the branches, so is declared first; reading texts updates their recency
+  std::vector<branch> branches{{}};                                             // always at least one, possibly empty
+  size_t active{0};                                                             // index into branches
+  node_id next_node_id{0};
+  branch_id next_branch_id{1};
+  std::unordered_set<node_id> updated;
+
+  mutable std::vector<node*> active_path;                                       // cached root-to-leaf path of the active branch
+  mutable bool active_path_valid{false};
+
+public:
+  conversation_tree() = default;
+  conversation_tree(conversation_tree const&) = delete;
+  conversation_tree &operator=(conversation_tree const&) = delete;
+
+  std::span<node* const> path() const;
+
+  std::span<branch const> get_branches() const;
+  branch_id get_active_branch() const;
+  void switch_branch(branch_id id);
+  branch_id fork(size_t path_index);
+  void remove_branch(branch_id id);
+  std::optional<branch_id> find_branch_containing(node_id id) const;
+
+  node_id append(message &&new_message);
+  std::optional<node_id> append(branch_id id, message &&new_message);
+  void set_role(size_t path_index, message::roles role);
+  void set_text(size_t path_index, std::string &&text);
+  void attach_image(size_t path_index, image &&new_image);
+  void detach_image(size_t path_index, size_t image_index);
+
+  node const *find(node_id id) const;
+  std::string_view get_text(node const &target) const;
+  std::span<image const> get_images(node const &target) const;
+  void for_each_node(std::function<void(node const&)> const &callback) const;
+  size_t size() const;
+
+  change_set take_changes();
+
+  void restore(size_t node_count, std::function<restored_node(size_t index)> const &get_node, std::span<std::optional<size_t> const> branch_leaves, size_t active_branch);
+
+  void maintain();
+  message_store::statistics get_storage_statistics() const;
+
+private:
+  node &prepare_edit(size_t path_index);
+  std::shared_ptr<node> make_node(std::shared_ptr<node> parent, message::roles role, std::string &&text, std::shared_ptr<std::vector<image> const> images = {});
+  branch *find_branch(branch_id id);
+};
+
+}
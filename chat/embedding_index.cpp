@@ -0,0 +1,295 @@
+#include "embedding_index.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <queue>
+#ifdef __SSE__
+  #include <immintrin.h>
+#endif // __SSE__
+
+namespace chat {
+
+namespace {
+
+float dot_product(float const *lhs, float const *rhs, size_t const count) {
+  /// Dot product of two cache-line-aligned rows whose length is a multiple of 16 floats
+  #if defined(__AVX__)
+    __m256 sum0{_mm256_setzero_ps()};
+    __m256 sum1{_mm256_setzero_ps()};
+    for(size_t i{0}; i != count; i += 16) {
+      sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(_mm256_load_ps(lhs + i),     _mm256_load_ps(rhs + i)));
+      sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(_mm256_load_ps(lhs + i + 8), _mm256_load_ps(rhs + i + 8)));
+    }
+    __m256 const sum{_mm256_add_ps(sum0, sum1)};
+    __m128 quad{_mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1))};
+  #elif defined(__SSE__)
+    __m128 sum0{_mm_setzero_ps()};
+    __m128 sum1{_mm_setzero_ps()};
+    __m128 sum2{_mm_setzero_ps()};
+    __m128 sum3{_mm_setzero_ps()};
+    for(size_t i{0}; i != count; i += 16) {
+      sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_load_ps(lhs + i),      _mm_load_ps(rhs + i)));
+      sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_load_ps(lhs + i + 4),  _mm_load_ps(rhs + i + 4)));
+      sum2 = _mm_add_ps(sum2, _mm_mul_ps(_mm_load_ps(lhs + i + 8),  _mm_load_ps(rhs + i + 8)));
+      sum3 = _mm_add_ps(sum3, _mm_mul_ps(_mm_load_ps(lhs + i + 12), _mm_load_ps(rhs + i + 12)));
+    }
+    __m128 quad{_mm_add_ps(_mm_add_ps(sum0, sum1), _mm_add_ps(sum2, sum3))};
+  #endif // __AVX__
+  #if defined(__SSE__)
+    quad = _mm_add_ps(quad, _mm_movehl_ps(quad, quad));                         // horizontal sum
+    quad = _mm_add_ss(quad, _mm_shuffle_ps(quad, quad, 0b01));
+    return _mm_cvtss_f32(quad);
+  #else
+    float sum{0.0f};
+    for(size_t i{0}; i != count; ++i) {
+      sum += lhs[i] * rhs[i];
+    }
+    return sum;
+  #endif // __SSE__
+}
+
+float squared_length(std::span<float const> vector) {
+  /// Squared length of an arbitrary vector, used for normalisation
+  float sum{0.0f};
+  for(float const value : vector) {
+    sum += value * value;
+  }
+  return sum;
+}
+
+struct closer_first {
+  bool operator()(embedding_index::result const &lhs, embedding_index::result const &rhs) const {
+    return lhs.similarity < rhs.similarity;                                     // max-heap on similarity
+  }
+};
+struct further_first {
+  bool operator()(embedding_index::result const &lhs, embedding_index::result const &rhs) const {
+    return lhs.similarity > rhs.similarity;                                     // min-heap on similarity
+  }
+};
+
+} // anonymous namespace
+
+embedding_index::embedding_index(unsigned int const this_dimensions, unsigned int const this_max_links, unsigned int const this_ef_construction)
+  : dimensions{this_dimensions},
+    stride{(this_dimensions + floats_per_line - 1) / floats_per_line * floats_per_line},
+    max_links{this_max_links},
+    max_links_level0{this_max_links * 2},
+    ef_construction{this_ef_construction},
+    level_multiplier{1.0 / std::log(static_cast<double>(this_max_links))} {
+  /// Construct an empty index for vectors of the given dimensionality
+  assert(dimensions != 0 && "embedding_index dimensions must be non-zero");
+  assert(max_links > 1 && "embedding_index needs at least two links per node");
+}
+
+unsigned int embedding_index::get_dimensions() const {
+  /// Return the dimensionality of vectors in this index
+  return dimensions;
+}
+
+size_t embedding_index::size() const {
+  /// Return the number of vectors in the index
+  return count;
+}
+
+void embedding_index::reserve(size_t const capacity) {
+  /// Preallocate storage for the given number of vectors
+  arena.reserve(capacity * stride);
+  links_level0.reserve(capacity * (1 + max_links_level0));
+  links_upper.reserve(capacity);
+  visited.reserve(capacity);
+}
+
+embedding_index::slot embedding_index::add(std::span<float const> vector) {
+  /// Normalise and insert a vector, returning its slot
+  assert(vector.size() == dimensions && "embedding_index::add vector has the wrong number of dimensions");
+  auto const id{static_cast<slot>(count)};
+  ++count;
+
+  arena.resize(count * stride, 0.0f);                                           // padding stays zero so it never contributes to dot products
+  float *const target{arena.data() + id * stride};
+  float const norm{std::sqrt(std::max(squared_length(vector), 1e-30f))};
+  for(size_t i{0}; i != dimensions; ++i) {
+    target[i] = vector[i] / norm;
+  }
+  links_level0.resize(count * (1 + max_links_level0), 0);
+  visited.resize(count, 0);
+
+  auto const level{static_cast<unsigned int>(-std::log(std::uniform_real_distribution<double>{std::numeric_limits<double>::min(), 1.0}(random_engine)) * level_multiplier)};
+  links_upper.emplace_back(level);
+
+  if(id == 0) {
+    entry_point = id;
+    max_level = level;
+    return id;
+  }
+
+  std::vector<result> entry_points{{
+    .id{entry_point},
+    .similarity{similarity(target, entry_point)},
+  }};
+  for(unsigned int this_level{max_level}; this_level > level; --this_level) {   // greedy descent through the levels above this node
+    entry_points = search_layer(target, entry_points, 1, this_level);
+  }
+
+  for(unsigned int this_level{std::min(level, max_level)};; --this_level) {
+    std::vector<result> candidates{search_layer(target, entry_points, ef_construction, this_level)};
+    std::vector<slot> const selected{select_neighbours(candidates, max_links)};
+    set_neighbours(id, this_level, selected);
+
+    unsigned int const level_max_links{this_level == 0 ? max_links_level0 : max_links};
+    for(slot const neighbour : selected) {                                      // link back from each neighbour, pruning its links if it has too many
+      std::span<slot const> const existing{neighbours(neighbour, this_level)};
+      if(existing.size() < level_max_links) {
+        std::vector<slot> extended{existing.begin(), existing.end()};
+        extended.emplace_back(id);
+        set_neighbours(neighbour, this_level, extended);
+        continue;
+      }
+      std::vector<result> neighbour_candidates;
+      neighbour_candidates.reserve(existing.size() + 1);
+      float const *const neighbour_row{row(neighbour)};
+      for(slot const other : existing) {
+        neighbour_candidates.emplace_back(result{
+          .id{other},
+          .similarity{similarity(neighbour_row, other)},
+        });
+      }
+      neighbour_candidates.emplace_back(result{
+        .id{id},
+        .similarity{similarity(neighbour_row, id)},
+      });
+      std::sort(neighbour_candidates.begin(), neighbour_candidates.end(), further_first{}); // most similar first
+      set_neighbours(neighbour, this_level, select_neighbours(std::move(neighbour_candidates), level_max_links));
+    }
+
+    entry_points = std::move(candidates);
+    if(this_level == 0) break;
+  }
+
+  if(level > max_level) {
+    max_level = level;
+    entry_point = id;
+  }
+  return id;
+}
+
+std::vector<embedding_index::result> embedding_index::search(std::span<float const> query, size_t const k, unsigned int const ef) const {
+  /// Return the approximate k nearest vectors to the query by cosine similarity, most similar first
+  /// Not thread safe: searches share scratch state
+  assert(query.size() == dimensions && "embedding_index::search query has the wrong number of dimensions");
+  if(count == 0 || k == 0) return {};
+
+  std::vector<float, aligned_allocator<float>> normalised(stride, 0.0f);
+  float const norm{std::sqrt(std::max(squared_length(query), 1e-30f))};
+  for(size_t i{0}; i != dimensions; ++i) {
+    normalised[i] = query[i] / norm;
+  }
+
+  std::vector<result> entry_points{{
+    .id{entry_point},
+    .similarity{similarity(normalised.data(), entry_point)},
+  }};
+  for(unsigned int this_level{max_level}; this_level != 0; --this_level) {
+    entry_points = search_layer(normalised.data(), entry_points, 1, this_level);
+  }
+  std::vector<result> results{search_layer(normalised.data(), entry_points, std::max(ef, static_cast<unsigned int>(k)), 0)};
+  if(results.size() > k) results.resize(k);
+  return results;
+}
+
+float const *embedding_index::row(slot const id) const {
+  /// Return the aligned arena row for a slot
+  return arena.data() + id * stride;
+}
+
+float embedding_index::similarity(float const *query, slot const id) const {
+  /// Cosine similarity of a normalised, aligned, padded query to a stored vector
+  return dot_product(query, row(id), stride);
+}
+
+std::span<embedding_index::slot const> embedding_index::neighbours(slot const id, unsigned int const level) const {
+  /// Return the links of a node on a given level
+  if(level == 0) {
+    uint32_t const *const links{links_level0.data() + id * (1 + max_links_level0)};
+    return {links + 1, links[0]};
+  }
+  return links_upper[id][level - 1];
+}
+
+void embedding_index::set_neighbours(slot const id, unsigned int const level, std::span<slot const> new_neighbours) {
+  /// Replace the links of a node on a given level
+  if(level == 0) {
+    uint32_t *const links{links_level0.data() + id * (1 + max_links_level0)};
+    links[0] = static_cast<uint32_t>(new_neighbours.size());
+    std::copy(new_neighbours.begin(), new_neighbours.end(), links + 1);
+    return;
+  }
+  links_upper[id][level - 1].assign(new_neighbours.begin(), new_neighbours.end());
+}
+
+std::vector<embedding_index::result> embedding_index::search_layer(float const *query, std::span<result const> entry_points, unsigned int const ef, unsigned int const level) const {
+  /// Best-first search of one level of the graph, returning up to ef closest nodes, most similar first
+  if(++visit_generation == 0) {                                                 // generation counter wrapped, so old marks are ambiguous
+    std::fill(visited.begin(), visited.end(), 0);
+    visit_generation = 1;
+  }
+
+  std::priority_queue<result, std::vector<result>, closer_first> candidates;
+  std::priority_queue<result, std::vector<result>, further_first> nearest;
+  for(auto const &entry : entry_points) {
+    visited[entry.id] = visit_generation;
+    candidates.push(entry);
+    nearest.push(entry);
+  }
+  while(nearest.size() > ef) nearest.pop();
+
+  while(!candidates.empty()) {
+    result const current{candidates.top()};
+    if(nearest.size() == ef && current.similarity < nearest.top().similarity) break; // nothing left can improve the result set
+    candidates.pop();
+
+    std::span<slot const> const links{neighbours(current.id, level)};
+    for(size_t i{0}; i != links.size(); ++i) {
+      if(i + 1 != links.size()) __builtin_prefetch(row(links[i + 1]));          // hide the memory latency of the next row behind this dot product
+      slot const neighbour{links[i]};
+      if(visited[neighbour] == visit_generation) continue;
+      visited[neighbour] = visit_generation;
+
+      float const neighbour_similarity{similarity(query, neighbour)};
+      if(nearest.size() == ef && neighbour_similarity <= nearest.top().similarity) continue;
+      result const candidate{
+        .id{neighbour},
+        .similarity{neighbour_similarity},
+      };
+      candidates.push(candidate);
+      nearest.push(candidate);
+      if(nearest.size() > ef) nearest.pop();
+    }
+  }
+
+  std::vector<result> results(nearest.size());
+  for(auto it{results.rbegin()}; it != results.rend(); ++it) {
+    *it = nearest.top();
+    nearest.pop();
+  }
+  return results;
+}
+
+std::vector<embedding_index::slot> embedding_index::select_neighbours(std::vector<result> candidates, unsigned int const max_count) const {
+  /// Choose diverse links from candidates sorted most similar first: a candidate is skipped if it is closer to an already selected node than to the target
+  std::vector<slot> selected;
+  selected.reserve(max_count);
+  for(auto const &candidate : candidates) {
+    if(selected.size() == max_count) break;
+    float const *const candidate_row{row(candidate.id)};
+    bool const diverse{std::none_of(selected.begin(), selected.end(), [&](slot const other){
+      return similarity(candidate_row, other) > candidate.similarity;
+    })};
+    if(diverse) selected.emplace_back(candidate.id);
+  }
+  return selected;
+}
+
+}
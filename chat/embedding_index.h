@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <random>
+#include <span>
+#include <vector>
+
+namespace chat {
+
+class embedding_index {
+  /// Approximate nearest neighbour index over embedding vectors (HNSW).
+  ///
+  /// Vectors are normalised on insertion and stored in one contiguous arena
+  /// with each row padded to a whole number of cache lines, so similarity is
+  /// a plain dot product over aligned rows.  Level 0 links are also kept in a
+  /// flat array; the rare upper-level links are stored per node.
+public:
+  using slot = uint32_t;
+
+  struct result {
+    slot id{0};                                                                 // insertion-order id of the matching vector
+    float similarity{0.0f};                                                     // cosine similarity to the query
+  };
+
+private:
+  static size_t constexpr alignment{64};                                        // cache line size
+  static size_t constexpr floats_per_line{alignment / sizeof(float)};
+
+  template<typename T>
+  struct aligned_allocator {
+    using value_type = T;
+    aligned_allocator() = default;
+    template<typename U> aligned_allocator(aligned_allocator<U> const&) {}
+    T *allocate(size_t count) {
+      return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t{alignment}));
+    }
+    void deallocate(T *ptr, size_t /*count*/) {
+      ::operator delete(ptr, std::align_val_t{alignment});
+    }
+    template<typename U> bool operator==(aligned_allocator<U> const&) const {
+      return true;
+    }
+  };
+
+  unsigned int const dimensions;
+  size_t const stride;                                                          // floats per arena row, rounded up to whole cache lines
+  unsigned int const max_links;                                                 // M: links per node on upper levels
+  unsigned int const max_links_level0;                                          // 2M: links per node on level 0
+  unsigned int const ef_construction;
+  double const level_multiplier;                                                // 1 / ln(M)
+
+  std::vector<float, aligned_allocator<float>> arena;                           // normalised vectors, one padded row per slot
+  std::vector<uint32_t> links_level0;                                           // per slot: link count followed by max_links_level0 slots
+  std::vector<std::vector<std::vector<slot>>> links_upper;                      // per slot, per level above 0: linked slots
+  slot entry_point{0};
+  unsigned int max_level{0};
+  size_t count{0};
+
+  std::mt19937 random_engine{0x5EED};
+
+  mutable std::vector<uint32_t> visited;                                        // per slot: visit generation, to avoid clearing between searches
+  mutable uint32_t visit_generation{0};
+
+public:
+  explicit embedding_index(unsigned int dimensions, unsigned int max_links = 16, unsigned int ef_construction = 200);
+
+  unsigned int get_dimensions() const;
+  size_t size() const;
+
+  void reserve(size_t capacity);
+  slot add(std::span<float const> vector);
+
+  std::vector<result> search(std::span<float const> query, size_t k, unsigned int ef = 64) const;
+
+private:
+  float const *row(slot id) const;
+  float similarity(float const *query, slot id) const;
+
+  std::span<slot const> neighbours(slot id, unsigned int level) const;
+  void set_neighbours(slot id, unsigned int level, std::span<slot const> new_neighbours);
+
+  std::vector<result> search_layer(float const *query, std::span<result const> entry_points, unsigned int ef, unsigned int level) const;
+  std::vector<slot> select_neighbours(std::vector<result> candidates, unsigned int max_count) const;
+};
+
+}
@@ -0,0 +1,480 @@
+#include "file_transfer.h"
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <nlohmann/json.hpp>
+#include "emscripten_fetch_manager.h"
+
+namespace chat {
+
+namespace {
+
+std::string const api_url{"https://api.openai.com/v1/"};
+
+bool is_retryable(unsigned short const status) {
+  /// Whether a failed part might succeed if sent again: network failures, timeouts, rate limiting and server errors
+  return status == 0 || status == 408 || status == 429 || status >= 500;
+}
+
+std::string make_boundary() {
+  /// A random multipart boundary, long enough not to turn up in the data by chance
+  std::random_device random;
+  std::string boundary{"----file_transfer"};
+  for(unsigned int i{0}; i != 4; ++i) {
+    std::array<char, 9> buffer{};
+    std::snprintf(buffer.data(), buffer.size(), "%08x", random());
+    boundary += buffer.data();
+  }
+  return boundary;
+}
+
+std::string_view as_text(std::span<std::byte const> data) {
+  /// View a response body as text
+  return {reinterpret_cast<char const*>(data.data()), data.size()};
+}
+
+} // anonymous namespace
+
+file_transfer::file_transfer(emscripten_fetch_manager &this_fetcher, std::string const &this_api_key)
+  : fetcher{this_fetcher},
+    api_key{this_api_key} {
+  /// Transfer files with the given key, which may change later
+}
+
+file_transfer::transfer_id file_transfer::upload(upload_params &&params) {
+  /// Start uploading a file, calling back with the id of the created file or an error
+  transfer_id const id{next_id++};
+  auto const target{std::make_shared<transfer>(transfer{
+    .status{
+      .id{id},
+      .upload{true},
+      .name{params.filename},
+      .bytes_done{0},
+      .bytes_total{params.size},
+      .parts_in_flight{0},
+      .retries{0},
+    },
+    .config{config},
+    .boundary{make_boundary()},
+    .read{std::move(params.read)},
+    .on_upload{std::move(params.on_done)},
+  })};
+  transfers.emplace(id, target);
+  if(params.size == 0) {
+    finish(target, std::unexpected{"the Uploads API doesn't accept empty files"});
+    return id;
+  }
+  nlohmann::json const request = {
+    {"filename", std::move(params.filename)},
+    {"purpose", std::move(params.purpose)},
+    {"mime_type", std::move(params.mime_type)},
+    {"bytes", params.size},
+  };
+  std::string const url{api_url + "uploads"};
+  fetcher.fetch({
+    .method{"POST"},
+    .url{url},
+    .headers{make_headers("application/json")},
+    .body{request.dump()},
+    .on_success{[this, target](unsigned short /*status*/, std::span<std::byte const> data){
+      if(target->finished) return;
+      try {
+        target->remote_id = nlohmann::json::parse(data).at("id").get<std::string>();
+      } catch(std::exception const &e) {
+        finish(target, std::unexpected{std::string{"invalid Upload: "} + e.what()});
+        return;
+      }
+      target->parts.resize(static_cast<size_t>((target->status.bytes_total + target->config.part_size - 1) / target->config.part_size));
+      schedule(target);
+    }},
+    .on_error{[this, target](unsigned short status, std::string_view status_text, std::span<std::byte const> data){
+      if(target->finished) return;
+      finish(target, std::unexpected{"creating the Upload failed with " + std::to_string(status) + " " + std::string{status_text} + ": " + std::string{as_text(data)}});
+    }},
+  });
+  return id;
+}
+
+file_transfer::transfer_id file_transfer::download(download_params &&params) {
+  /// Start downloading a file into a sink, calling back with its size or an error
+  transfer_id const id{next_id++};
+  auto const target{std::make_shared<transfer>(transfer{
+    .status{
+      .id{id},
+      .upload{false},
+      .name{params.file_id},
+      .bytes_done{0},
+      .bytes_total{0},
+      .parts_in_flight{0},
+      .retries{0},
+    },
+    .config{config},
+    .remote_id{params.file_id},
+    .write{std::move(params.write)},
+    .on_download{std::move(params.on_done)},
+  })};
+  transfers.emplace(id, target);
+  std::string const url{api_url + "files/" + params.file_id};
+  fetcher.fetch({
+    .url{url},
+    .headers{make_headers()},
+    .on_success{[this, target](unsigned short /*status*/, std::span<std::byte const> data){
+      if(target->finished) return;
+      try {
+        target->status.bytes_total = nlohmann::json::parse(data).at("bytes").get<uint64_t>();
+      } catch(std::exception const &e) {
+        finish(target, std::unexpected{std::string{"invalid file object: "} + e.what()});
+        return;
+      }
+      target->parts.resize(static_cast<size_t>((target->status.bytes_total + target->config.part_size - 1) / target->config.part_size));
+      if(target->parts.empty()) {
+        finish(target, {});
+        return;
+      }
+      schedule(target);
+    }},
+    .on_error{[this, target](unsigned short status, std::string_view status_text, std::span<std::byte const> data){
+      if(target->finished) return;
+      finish(target, std::unexpected{"looking up the file failed with " + std::to_string(status) + " " + std::string{status_text} + ": " + std::string{as_text(data)}});
+    }},
+  });
+  return id;
+}
+
+void file_transfer::cancel(transfer_id const id) {
+  /// Abandon a transfer, cancelling the Upload if it was one; parts in flight are ignored when they return
+  auto const it{transfers.find(id)};
+  if(it == transfers.end()) return;
+  finish(it->second, std::unexpected{"cancelled"});
+}
+
+void file_transfer::update() {
+  /// Start parts whose retry time has come; call once a frame
+  std::vector<std::shared_ptr<transfer>> active;                                // copied, as finishing a transfer removes it from the map
+  active.reserve(transfers.size());
+  for(auto const &[id, target] : transfers) {
+    active.emplace_back(target);
+  }
+  for(auto const &target : active) {
+    if(!target->finished && !target->parts.empty()) schedule(target);
+  }
+}
+
+file_transfer::settings const &file_transfer::get_settings() const {
+  /// Part size, parallelism and retry limit for new transfers
+  return config;
+}
+
+void file_transfer::set_settings(settings const &new_config) {
+  /// Change the settings for new transfers; those already started keep theirs
+  config = new_config;
+  config.part_size = std::clamp<size_t>(config.part_size, 1u << 20, 64u << 20);
+  config.parallelism = std::max(config.parallelism, 1u);
+  config.max_attempts = std::max(config.max_attempts, 1u);
+}
+
+std::vector<file_transfer::progress> file_transfer::get_progress() const {
+  /// Progress of every transfer in progress, oldest first
+  std::vector<progress> result;
+  result.reserve(transfers.size());
+  for(auto const &[id, target] : transfers) {
+    result.emplace_back(target->status);
+  }
+  return result;
+}
+
+file_transfer::statistics const &file_transfer::get_statistics() const {
+  /// Totals, and the memory held in part buffers
+  return stats;
+}
+
+file_transfer::reader file_transfer::file_reader(std::string const &path) {
+  /// Read an upload from a file in the virtual filesystem, which on the web is already held whole in memory
+  auto const stream{std::make_shared<std::ifstream>(path, std::ios::binary)};
+  return [stream](uint64_t const offset, std::span<std::byte> destination, std::function<void(bool success)> &&done){
+    stream->clear();
+    stream->seekg(static_cast<std::streamoff>(offset));
+    stream->read(reinterpret_cast<char*>(destination.data()), static_cast<std::streamsize>(destination.size()));
+    done(stream->gcount() == static_cast<std::streamsize>(destination.size()));
+  };
+}
+
+file_transfer::sink file_transfer::file_writer(std::string const &path) {
+  /// Write a download to a file in the virtual filesystem, which on the web holds it whole in memory
+  auto const stream{std::make_shared<std::ofstream>(path, std::ios::binary | std::ios::trunc)};
+  return [stream](std::span<std::byte const> data){
+    stream->write(reinterpret_cast<char const*>(data.data()), static_cast<std::streamsize>(data.size()));
+    return stream->good();
+  };
+}
+
+void file_transfer::schedule(std::shared_ptr<transfer> const &target) {
+  /// Start waiting parts, in order, while there's room in the transfer's parallelism
+  auto const now{clock::now()};
+  unsigned int limit{target->config.parallelism};
+  size_t end{target->parts.size()};
+  if(!target->status.upload) {
+    if(!target->ranges_confirmed) limit = 1;                                    // one part alone, until the server shows it honours ranges
+    end = std::min(end, target->next_delivery + limit);                         // don't run ahead of the sink by more than can be in flight, bounding what's held
+  }
+  for(size_t index{0}; index != end && target->status.parts_in_flight < limit && !target->finished; ++index) {
+    auto &this_part{target->parts[index]};
+    if(this_part.state != part_states::waiting || this_part.retry_at > now) continue;
+    this_part.state = part_states::started;
+    ++target->status.parts_in_flight;
+    if(target->status.upload) {
+      read_upload_part(target, index);
+    } else {
+      fetch_download_part(target, index);
+    }
+  }
+  if(target->status.upload && !target->completing && !target->finished && std::ranges::all_of(target->parts, [](part const &this_part){return this_part.state == part_states::done;})) {
+    complete_upload(target);
+  }
+}
+
+void file_transfer::read_upload_part(std::shared_ptr<transfer> const &target, size_t const index) {
+  /// Read one part of an upload straight into the body of its form, then send it
+  uint64_t const offset{index * target->config.part_size};
+  size_t const size{static_cast<size_t>(std::min<uint64_t>(target->config.part_size, target->status.bytes_total - offset))};
+  std::string const preamble{
+    "--" + target->boundary + "\r\n"
+    "Content-Disposition: form-data; name=\"data\"; filename=\"part\"\r\n"
+    "Content-Type: application/octet-stream\r\n"
+    "\r\n"
+  };
+  std::string const epilogue{"\r\n--" + target->boundary + "--\r\n"};
+  auto const body{std::make_shared<std::string>()};
+  body->reserve(preamble.size() + size + epilogue.size());
+  body->append(preamble);
+  body->resize(preamble.size() + size);
+  body->append(epilogue);
+  add_buffered(body->size());
+  target->read(offset, std::as_writable_bytes(std::span{body->data() + preamble.size(), size}), [this, target, index, body](bool const success){
+    if(target->finished) {
+      release_buffered(body->size());
+      return;
+    }
+    if(!success) {
+      release_buffered(body->size());
+      --target->status.parts_in_flight;
+      finish(target, std::unexpected{"couldn't read part " + std::to_string(index) + " of the file"});
+      return;
+    }
+    send_upload_part(target, index, body);
+  });
+}
+
+void file_transfer::send_upload_part(std::shared_ptr<transfer> const &target, size_t const index, std::shared_ptr<std::string> const &body) {
+  /// Send a part that's been read, retrying it alone if it fails
+  size_t const body_size{body->size()};
+  size_t const data_size{static_cast<size_t>(std::min<uint64_t>(target->config.part_size, target->status.bytes_total - index * target->config.part_size))};
+  std::string const url{api_url + "uploads/" + target->remote_id + "/parts"};
+  ++stats.parts_sent;
+  fetcher.fetch({
+    .method{"POST"},
+    .url{url},
+    .headers{make_headers("multipart/form-data; boundary=" + target->boundary)},
+    .body{std::move(*body)},                                                    // a retry reads the part again rather than keeping a copy
+    .on_success{[this, target, index, body_size, data_size](unsigned short /*status*/, std::span<std::byte const> data){
+      release_buffered(body_size);
+      if(target->finished) return;
+      --target->status.parts_in_flight;
+      auto &this_part{target->parts[index]};
+      try {
+        this_part.upload_part_id = nlohmann::json::parse(data).at("id").get<std::string>();
+      } catch(std::exception const &e) {
+        retry_or_fail(target, index, 0, std::string{"invalid Upload part: "} + e.what());
+        return;
+      }
+      this_part.state = part_states::done;
+      target->status.bytes_done += data_size;
+      stats.bytes_uploaded += data_size;
+      schedule(target);
+    }},
+    .on_error{[this, target, index, body_size](unsigned short status, std::string_view status_text, std::span<std::byte const> data){
+      release_buffered(body_size);
+      if(target->finished) return;
+      --target->status.parts_in_flight;
+      retry_or_fail(target, index, status, std::string{status_text} + ": " + std::string{as_text(data)});
+    }},
+  });
+}
+
+void file_transfer::complete_upload(std::shared_ptr<transfer> const &target) {
+  /// Complete the Upload with every part in order, which creates the file
+  target->completing = true;
+  nlohmann::json request = {
+    {"part_ids", nlohmann::json::array()},
+  };
+  for(auto const &this_part : target->parts) {
+    request["part_ids"].emplace_back(this_part.upload_part_id);
+  }
+  std::string const url{api_url + "uploads/" + target->remote_id + "/complete"};
+  fetcher.fetch({
+    .method{"POST"},
+    .url{url},
+    .headers{make_headers("application/json")},
+    .body{request.dump()},
+    .on_success{[this, target](unsigned short /*status*/, std::span<std::byte const> data){
+      if(target->finished) return;
+      try {
+        finish(target, nlohmann::json::parse(data).at("file").at("id").get<std::string>());
+      } catch(std::exception const &e) {
+        finish(target, std::unexpected{std::string{"invalid completed Upload: "} + e.what()});
+      }
+    }},
+    .on_error{[this, target](unsigned short status, std::string_view status_text, std::span<std::byte const> data){
+      if(target->finished) return;
+      finish(target, std::unexpected{"completing the Upload failed with " + std::to_string(status) + " " + std::string{status_text} + ": " + std::string{as_text(data)}});
+    }},
+  });
+}
+
+void file_transfer::fetch_download_part(std::shared_ptr<transfer> const &target, size_t const index) {
+  /// Request one byte range of a download
+  uint64_t const offset{index * target->config.part_size};
+  uint64_t const size{std::min<uint64_t>(target->config.part_size, target->status.bytes_total - offset)};
+  std::string const url{api_url + "files/" + target->remote_id + "/content"};
+  std::vector<std::string> headers{make_headers()};
+  headers.emplace_back("Range");
+  headers.emplace_back("bytes=" + std::to_string(offset) + '-' + std::to_string(offset + size - 1));
+  fetcher.fetch({
+    .url{url},
+    .headers{std::move(headers)},
+    .on_success{[this, target, index, size](unsigned short status, std::span<std::byte const> data){
+      if(target->finished) return;
+      --target->status.parts_in_flight;
+      auto &this_part{target->parts[index]};
+      if(status == 200 && index == 0 && data.size() == target->status.bytes_total) { // the server ignored the range and sent everything, which can only be passed on whole
+        target->status.bytes_done = data.size();
+        stats.bytes_downloaded += data.size();
+        if(!target->write(data)) {
+          finish(target, std::unexpected{"the sink refused the data"});
+          return;
+        }
+        finish(target, {});
+        return;
+      }
+      if(data.size() != size) {
+        retry_or_fail(target, index, 0, "expected " + std::to_string(size) + " bytes, received " + std::to_string(data.size()));
+        return;
+      }
+      target->ranges_confirmed = true;
+      this_part.state = part_states::done;
+      target->status.bytes_done += data.size();
+      stats.bytes_downloaded += data.size();
+      if(index == target->next_delivery) {
+        ++target->next_delivery;                                                // straight to the sink, without a copy
+        if(!target->write(data)) {
+          finish(target, std::unexpected{"the sink refused the data"});
+          return;
+        }
+      } else {
+        this_part.downloaded.assign(data.begin(), data.end());
+        add_buffered(data.size());
+      }
+      deliver_download_parts(target);
+    }},
+    .on_error{[this, target, index](unsigned short status, std::string_view status_text, std::span<std::byte const> data){
+      if(target->finished) return;
+      --target->status.parts_in_flight;
+      retry_or_fail(target, index, status, std::string{status_text} + ": " + std::string{as_text(data)});
+    }},
+  });
+}
+
+void file_transfer::deliver_download_parts(std::shared_ptr<transfer> const &target) {
+  /// Pass held parts to the sink while the next one in order has arrived, then finish or start more
+  while(target->next_delivery != target->parts.size() && target->parts[target->next_delivery].state == part_states::done) {
+    auto &this_part{target->parts[target->next_delivery++]};
+    bool const accepted{target->write(this_part.downloaded)};
+    release_buffered(this_part.downloaded.size());
+    this_part.downloaded = {};                                                  // free the memory, not just the size
+    if(!accepted) {
+      finish(target, std::unexpected{"the sink refused the data"});
+      return;
+    }
+  }
+  if(target->next_delivery == target->parts.size()) {
+    finish(target, {});
+    return;
+  }
+  schedule(target);
+}
+
+void file_transfer::retry_or_fail(std::shared_ptr<transfer> const &target, size_t const index, unsigned short const status, std::string_view message) {
+  /// Put a failed part back to wait for its backoff, or fail the transfer once the error is permanent or attempts run out
+  auto &this_part{target->parts[index]};
+  ++this_part.attempts;
+  if(!is_retryable(status) || this_part.attempts >= target->config.max_attempts) {
+    finish(target, std::unexpected{"part " + std::to_string(index) + " failed with " + std::to_string(status) + " after " + std::to_string(this_part.attempts) + " attempts: " + std::string{message}});
+    return;
+  }
+  std::cerr << "ERROR: Part " << index << " of " << target->status.name << " failed with " << status << ", retrying" << std::endl;
+  clock::duration const backoff{std::min(initial_backoff * (1 << std::min(this_part.attempts - 1, 8u)), max_backoff)};
+  this_part.state = part_states::waiting;
+  this_part.retry_at = clock::now() + backoff;
+  ++target->status.retries;
+  ++stats.parts_retried;
+}
+
+void file_transfer::finish(std::shared_ptr<transfer> const &target, std::expected<std::string, std::string> const &result) {
+  /// End a transfer and report its result, cancelling an unfinished Upload so the server can discard its parts
+  target->finished = true;
+  for(auto &this_part : target->parts) {
+    release_buffered(this_part.downloaded.size());
+    this_part.downloaded = {};
+  }
+  transfers.erase(target->status.id);
+  if(!result) {
+    std::cerr << "ERROR: Transfer of " << target->status.name << " failed: " << result.error() << std::endl;
+    if(target->status.upload && !target->remote_id.empty()) {
+      std::string const url{api_url + "uploads/" + target->remote_id + "/cancel"};
+      fetcher.fetch({
+        .method{"POST"},
+        .url{url},
+        .headers{make_headers()},
+        .on_success{[](unsigned short /*status*/, std::span<std::byte const> /*data*/){}},
+        .on_error{[](unsigned short status, std::string_view status_text, std::span<std::byte const> /*data*/){
+          std::cerr << "ERROR cancelling Upload: " << status << ": " << status_text << std::endl;
+        }},
+      });
+    }
+  }
+  if(target->status.upload) {
+    if(target->on_upload) target->on_upload(result);
+  } else if(target->on_download) {
+    if(result) {
+      target->on_download(target->status.bytes_total);
+    } else {
+      target->on_download(std::unexpected{result.error()});
+    }
+  }
+}
+
+void file_transfer::add_buffered(size_t const bytes) {
+  /// Count memory taken by a part buffer
+  stats.buffered_bytes += bytes;
+  stats.peak_buffered_bytes = std::max(stats.peak_buffered_bytes, stats.buffered_bytes);
+}
+
+void file_transfer::release_buffered(size_t const bytes) {
+  /// Count memory given back by a part buffer
+  stats.buffered_bytes -= bytes;
+}
+
+std::vector<std::string> file_transfer::make_headers(std::string_view content_type) const {
+  /// Authorisation, and a content type if there's a body
+  std::vector<std::string> headers{"Authorization", "Bearer " + api_key};
+  if(!content_type.empty()) {
+    headers.emplace_back("Content-Type");
+    headers.emplace_back(content_type);
+  }
+  return headers;
+}
+
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <expected>
+#include <functional>
+#include <map>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+class emscripten_fetch_manager;
+
+namespace chat {
+
+class file_transfer {
+  /// Uploads and downloads of large files through the Uploads and Files APIs, a part at a time.
+  ///
+  /// An upload creates an Upload, sends the file as parts of part_size bytes
+  /// with up to parallelism in flight, then completes it with the part ids
+  /// in order.  A download looks up the file's size, then requests byte
+  /// ranges the same way and passes them to a sink in order.  A failed part
+  /// is retried on its own with exponential backoff.  Only parts being read
+  /// or sent, and downloaded parts waiting for an earlier one, are held in
+  /// memory, so peak memory is bounded by part_size x parallelism, provided
+  /// the reader and sink don't hold the file themselves.  file_reader() and
+  /// file_writer() use the virtual filesystem, which on the web keeps the
+  /// whole file in memory; gui::browser_file streams browser files instead.
+public:
+  using clock = std::chrono::steady_clock;
+  using transfer_id = uint32_t;
+  using reader = std::function<void(uint64_t offset, std::span<std::byte> destination, std::function<void(bool success)> &&done)>; // fill destination from offset in the file, now or later
+  using sink = std::function<bool(std::span<std::byte const> data)>;            // the next bytes of a download, in order; false to abort
+  using upload_callback = std::function<void(std::expected<std::string, std::string> const &file_id)>;
+  using download_callback = std::function<void(std::expected<uint64_t, std::string> const &size)>;
+
+  struct settings {
+    size_t part_size{8u << 20};                                                 // the Uploads API accepts parts of up to 64MB
+    unsigned int parallelism{4};
+    unsigned int max_attempts{5};                                               // per part
+  };
+
+  struct upload_params {
+    std::string filename;
+    std::string purpose;                                                        // such as "batch" or "fine-tune"
+    std::string mime_type;                                                      // such as "text/jsonl"
+    uint64_t size{0};
+    reader read;
+    upload_callback on_done;
+  };
+
+  struct download_params {
+    std::string file_id;
+    sink write;
+    download_callback on_done;
+  };
+
+  struct progress {
+    transfer_id id{0};
+    bool upload{true};
+    std::string name;                                                           // the filename of an upload, or the id of a downloaded file
+    uint64_t bytes_done{0};
+    uint64_t bytes_total{0};                                                    // zero until a download's size is known
+    unsigned int parts_in_flight{0};
+    unsigned int retries{0};
+  };
+
+  struct statistics {
+    uint64_t bytes_uploaded{0};
+    uint64_t bytes_downloaded{0};
+    uint64_t parts_sent{0};
+    uint64_t parts_retried{0};
+    size_t buffered_bytes{0};                                                   // held in part buffers right now
+    size_t peak_buffered_bytes{0};
+  };
+
+private:
+  enum class part_states {
+    waiting,
+    started,                                                                    // being read or sent
+    done,
+  };
+
+  struct part {
+    part_states state{part_states::waiting};
+    unsigned int attempts{0};
+    clock::time_point retry_at{};
+    std::string upload_part_id{};
+    std::vector<std::byte> downloaded{};                                        // held until the parts before it reach the sink
+  };
+
+  struct transfer {
+    progress status;
+    settings config;                                                            // as when the transfer started
+    std::string remote_id{};                                                    // the Upload's id once created, or the downloaded file's id
+    std::string boundary{};                                                     // separating the form fields of each part
+    std::vector<part> parts{};                                                  // empty until the Upload is created or the size is known
+    size_t next_delivery{0};                                                    // the first downloaded part not yet given to the sink
+    bool ranges_confirmed{false};                                               // the server honoured the first range request, so the rest can go in parallel
+    bool completing{false};
+    bool finished{false};                                                       // succeeded, failed or cancelled, so late callbacks are ignored
+    reader read{};
+    sink write{};
+    upload_callback on_upload{};
+    download_callback on_download{};
+  };
+
+  emscripten_fetch_manager &fetcher;
+  std::string const &api_key;
+  settings config;
+  std::map<transfer_id, std::shared_ptr<transfer>> transfers;
+  transfer_id next_id{1};
+  statistics stats;
+
+  static clock::duration constexpr initial_backoff{std::chrono::seconds{1}};
+  static clock::duration constexpr max_backoff{std::chrono::seconds{32}};
+
+public:
+  file_transfer(emscripten_fetch_manager &fetcher, std::string const &api_key);
+
+  transfer_id upload(upload_params &&params);
+  transfer_id download(download_params &&params);
+  void cancel(transfer_id id);
+  void update();
+
+  settings const &get_settings() const;
+  void set_settings(settings const &new_config);
+  std::vector<progress> get_progress() const;
+  statistics const &get_statistics() const;
+
+  static reader file_reader(std::string const &path);
+  static sink file_writer(std::string const &path);
+
+private:
+  void schedule(std::shared_ptr<transfer> const &target);
+  void read_upload_part(std::shared_ptr<transfer> const &target, size_t index);
+  void send_upload_part(std::shared_ptr<transfer> const &target, size_t index, std::shared_ptr<std::string> const &body);
+  void complete_upload(std::shared_ptr<transfer> const &target);
+  void fetch_download_part(std::shared_ptr<transfer> const &target, size_t index);
+  void deliver_download_parts(std::shared_ptr<transfer> const &target);
+  void retry_or_fail(std::shared_ptr<transfer> const &target, size_t index, unsigned short status, std::string_view message);
+  void finish(std::shared_ptr<transfer> const &target, std::expected<std::string, std::string> const &result);
+  void add_buffered(size_t bytes);
+  void release_buffered(size_t bytes);
+  std::vector<std::string> make_headers(std::string_view content_type = {}) const;
+};
+
+}
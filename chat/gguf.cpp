@@ -0,0 +1,292 @@
+#include "gguf.h"
+#include <cstdint>
+#include <cstring>
+
+namespace chat {
+
+namespace {
+
+enum class value_types : uint32_t {                                             // from gguf_type
+  uint8,
+  int8,
+  uint16,
+  int16,
+  uint32,
+  int32,
+  float32,
+  boolean,
+  string,
+  array,
+  uint64,
+  int64,
+  float64,
+};
+
+class reader {
+  /// Bounds-checked sequential reads from the file; any read past the end sets the failure flag and returns zeroes
+  std::span<std::byte const> data;
+  size_t position{0};
+  bool failed{false};
+
+public:
+  explicit reader(std::span<std::byte const> this_data)
+    : data{this_data} {
+    /// Start reading at the beginning of the file
+  }
+
+  template<typename T>
+  T read() {
+    /// Read a little-endian scalar
+    T result{};
+    if(data.size() - position < sizeof(T)) {
+      failed = true;
+      position = data.size();
+      return result;
+    }
+    std::memcpy(&result, data.data() + position, sizeof(T));
+    position += sizeof(T);
+    return result;
+  }
+
+  std::string read_string() {
+    /// Read a length-prefixed string
+    auto const length{read<uint64_t>()};
+    if(data.size() - position < length) {
+      failed = true;
+      position = data.size();
+      return {};
+    }
+    std::string result{reinterpret_cast<char const*>(data.data() + position), static_cast<size_t>(length)};
+    position += static_cast<size_t>(length);
+    return result;
+  }
+
+  size_t get_position() const {
+    /// Offset of the next read
+    return position;
+  }
+
+  bool ok() const {
+    /// Whether every read so far was within the file
+    return !failed;
+  }
+};
+
+std::expected<gguf::value, std::string> read_scalar(reader &input, value_types const type) {
+  /// Read one metadata value of a non-array type
+  switch(type) {
+  case value_types::uint8:   return uint64_t{input.read<uint8_t>()};
+  case value_types::int8:    return int64_t{input.read<int8_t>()};
+  case value_types::uint16:  return uint64_t{input.read<uint16_t>()};
+  case value_types::int16:   return int64_t{input.read<int16_t>()};
+  case value_types::uint32:  return uint64_t{input.read<uint32_t>()};
+  case value_types::int32:   return int64_t{input.read<int32_t>()};
+  case value_types::float32: return double{input.read<float>()};
+  case value_types::boolean: return input.read<uint8_t>() != 0;
+  case value_types::string:  return input.read_string();
+  case value_types::uint64:  return input.read<uint64_t>();
+  case value_types::int64:   return input.read<int64_t>();
+  case value_types::float64: return input.read<double>();
+  case value_types::array:
+    break;
+  }
+  return std::unexpected{"unsupported metadata type " + std::to_string(static_cast<uint32_t>(type))};
+}
+
+std::expected<gguf::value, std::string> read_value(reader &input, value_types const type) {
+  /// Read one metadata value, gathering arrays into a vector of strings, floats or integers
+  if(type != value_types::array) return read_scalar(input, type);
+  auto const element_type{static_cast<value_types>(input.read<uint32_t>())};
+  auto const count{input.read<uint64_t>()};
+  if(!input.ok()) return std::unexpected{"truncated array"};
+  auto const gather{[&]<typename T>(std::vector<T> &elements) -> std::expected<gguf::value, std::string> {
+    elements.reserve(static_cast<size_t>(std::min<uint64_t>(count, 1u << 20))); // don't trust the count for the reservation
+    for(uint64_t i{0}; i != count; ++i) {
+      auto element{read_scalar(input, element_type)};
+      if(!element) return std::unexpected{element.error()};
+      if(!input.ok()) return std::unexpected{"truncated array"};
+      std::visit([&](auto &&scalar){
+        using scalar_type = std::decay_t<decltype(scalar)>;
+        if constexpr(std::is_same_v<T, std::string>) {
+          if constexpr(std::is_same_v<scalar_type, std::string>) elements.emplace_back(std::move(scalar));
+        } else if constexpr(std::is_arithmetic_v<scalar_type>) {
+          elements.emplace_back(static_cast<T>(scalar));
+        }
+      }, *element);
+    }
+    return gguf::array{std::move(elements)};
+  }};
+  switch(element_type) {
+  case value_types::string:
+    {
+      std::vector<std::string> elements;
+      return gather(elements);
+    }
+  case value_types::float32:
+  case value_types::float64:
+    {
+      std::vector<float> elements;
+      return gather(elements);
+    }
+  case value_types::uint8:
+  case value_types::int8:
+  case value_types::uint16:
+  case value_types::int16:
+  case value_types::uint32:
+  case value_types::int32:
+  case value_types::boolean:
+  case value_types::uint64:
+  case value_types::int64:
+    {
+      std::vector<int64_t> elements;
+      return gather(elements);
+    }
+  case value_types::array:
+    break;
+  }
+  return std::unexpected{"unsupported array element type " + std::to_string(static_cast<uint32_t>(element_type))};
+}
+
+std::expected<uint64_t, std::string> tensor_bytes(gguf::tensor const &target) {
+  /// Size of a tensor's data, checking its shape suits its type and the size doesn't overflow
+  auto const count{target.element_count()};
+  if(!count) return std::unexpected{target.name + " has too many elements"};
+  std::string const too_large{target.name + " is too large"};
+  switch(target.type) {
+  case gguf::tensor_types::f32:
+    if(*count > UINT64_MAX / 4) return std::unexpected{too_large};
+    return *count * 4;
+  case gguf::tensor_types::f16:
+    if(*count > UINT64_MAX / 2) return std::unexpected{too_large};
+    return *count * 2;
+  case gguf::tensor_types::q8_0:
+    if(target.dimensions.empty() || target.dimensions.front() % 32 != 0) return std::unexpected{target.name + " rows aren't whole Q8_0 blocks"};
+    if(*count / 32 > UINT64_MAX / 34) return std::unexpected{too_large};
+    return *count / 32 * 34;
+  }
+  return std::unexpected{target.name + " has unsupported type " + std::to_string(static_cast<uint32_t>(target.type)) + ", only F32, F16 and Q8_0 are supported"};
+}
+
+} // anonymous namespace
+
+std::optional<uint64_t> gguf::tensor::element_count() const {
+  /// Total number of elements, or nothing if that doesn't fit in 64 bits
+  uint64_t count{1};
+  for(uint64_t const dimension : dimensions) {
+    if(dimension != 0 && count > UINT64_MAX / dimension) return std::nullopt;   // a crafted file could otherwise wrap to a small size that passes the bounds check
+    count *= dimension;
+  }
+  return count;
+}
+
+std::expected<gguf, std::string> gguf::load(std::vector<std::byte> &&contents) {
+  /// Parse a GGUF file's metadata and tensor directory, taking ownership of its contents
+  auto const owner{std::make_shared<std::vector<std::byte> const>(std::move(contents))};
+  return load(std::shared_ptr<std::byte const>{owner, owner->data()}, owner->size());
+}
+
+std::expected<gguf, std::string> gguf::load(std::shared_ptr<std::byte const> &&contents, size_t const size) {
+  /// Parse a GGUF file's metadata and tensor directory, sharing ownership of its contents with whatever allocated them
+  gguf result;
+  result.storage = std::move(contents);
+  result.file = {result.storage.get(), size};
+  reader input{result.file};
+
+  if(input.read<uint32_t>() != 0x46554747) return std::unexpected{"not a GGUF file"}; // "GGUF", little-endian
+  if(auto const version{input.read<uint32_t>()}; version < 2 || version > 3) return std::unexpected{"unsupported GGUF version " + std::to_string(version)};
+  auto const tensor_count{input.read<uint64_t>()};
+  auto const metadata_count{input.read<uint64_t>()};
+  if(!input.ok()) return std::unexpected{"truncated header"};
+
+  for(uint64_t i{0}; i != metadata_count; ++i) {
+    std::string key{input.read_string()};
+    auto const type{static_cast<value_types>(input.read<uint32_t>())};
+    auto value{read_value(input, type)};
+    if(!value) return std::unexpected{"metadata " + key + ": " + value.error()};
+    if(!input.ok()) return std::unexpected{"truncated metadata"};
+    result.metadata.insert_or_assign(std::move(key), std::move(*value));
+  }
+
+  std::vector<std::pair<tensor, uint64_t>> directory;                           // with offsets relative to the data section
+  directory.reserve(static_cast<size_t>(std::min<uint64_t>(tensor_count, 1u << 16)));
+  for(uint64_t i{0}; i != tensor_count; ++i) {
+    tensor info{
+      .name{input.read_string()},
+      .type{},
+      .dimensions{},
+      .data{},
+    };
+    auto const dimension_count{input.read<uint32_t>()};
+    if(dimension_count > 4) return std::unexpected{info.name + " has too many dimensions"};
+    for(uint32_t j{0}; j != dimension_count; ++j) {
+      info.dimensions.emplace_back(input.read<uint64_t>());
+    }
+    info.type = static_cast<tensor_types>(input.read<uint32_t>());
+    auto const offset{input.read<uint64_t>()};
+    if(!input.ok()) return std::unexpected{"truncated tensor directory"};
+    directory.emplace_back(std::move(info), offset);
+  }
+
+  uint64_t alignment{32};
+  if(auto const configured{result.get_uint("general.alignment")}) alignment = *configured;
+  if(alignment == 0 || (alignment & (alignment - 1)) != 0) return std::unexpected{"invalid alignment"};
+  uint64_t const data_start{(input.get_position() + alignment - 1) & ~(alignment - 1)};
+
+  for(auto &[info, offset] : directory) {
+    auto const bytes{tensor_bytes(info)};
+    if(!bytes) return std::unexpected{bytes.error()};
+    if(data_start > result.file.size() || offset > result.file.size() - data_start || *bytes > result.file.size() - data_start - offset) { // without sums that could wrap
+      return std::unexpected{info.name + " extends past the end of the file"};
+    }
+    info.data = result.file.subspan(static_cast<size_t>(data_start + offset), static_cast<size_t>(*bytes));
+    std::string name{info.name};
+    result.tensors.insert_or_assign(std::move(name), std::move(info));
+  }
+  return result;
+}
+
+gguf::value const *gguf::find(std::string const &key) const {
+  /// Look up a metadata value of any type
+  auto const it{metadata.find(key)};
+  return it == metadata.end() ? nullptr : &it->second;
+}
+
+std::expected<uint64_t, std::string> gguf::get_uint(std::string const &key) const {
+  /// Look up a non-negative integer
+  auto const *const found{find(key)};
+  if(!found) return std::unexpected{"missing " + key};
+  if(auto const *const unsigned_value{std::get_if<uint64_t>(found)}) return *unsigned_value;
+  if(auto const *const signed_value{std::get_if<int64_t>(found)}; signed_value && *signed_value >= 0) return static_cast<uint64_t>(*signed_value);
+  return std::unexpected{key + " is not a non-negative integer"};
+}
+
+std::expected<float, std::string> gguf::get_float(std::string const &key) const {
+  /// Look up a number as a float
+  auto const *const found{find(key)};
+  if(!found) return std::unexpected{"missing " + key};
+  if(auto const *const float_value{std::get_if<double>(found)}) return static_cast<float>(*float_value);
+  if(auto const *const unsigned_value{std::get_if<uint64_t>(found)}) return static_cast<float>(*unsigned_value);
+  if(auto const *const signed_value{std::get_if<int64_t>(found)}) return static_cast<float>(*signed_value);
+  return std::unexpected{key + " is not a number"};
+}
+
+std::expected<std::string_view, std::string> gguf::get_string(std::string const &key) const {
+  /// Look up a string
+  auto const *const found{find(key)};
+  if(!found) return std::unexpected{"missing " + key};
+  if(auto const *const string_value{std::get_if<std::string>(found)}) return std::string_view{*string_value};
+  return std::unexpected{key + " is not a string"};
+}
+
+gguf::tensor const *gguf::find_tensor(std::string const &name) const {
+  /// Look up a tensor by name
+  auto const it{tensors.find(name)};
+  return it == tensors.end() ? nullptr : &it->second;
+}
+
+size_t gguf::size() const {
+  /// Size of the whole file in memory
+  return file.size();
+}
+
+}
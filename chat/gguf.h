@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+namespace chat {
+
+class gguf {
+  /// Reader for model files in the GGUF format: typed metadata followed by aligned tensor data.
+  ///
+  /// The file is held in memory and tensors are views into it, so nothing
+  /// is copied after loading.  Only the tensor types the local backend can
+  /// compute with are accepted.
+public:
+  enum class tensor_types : uint32_t {                                          // values from ggml_type
+    f32 = 0,
+    f16 = 1,
+    q8_0 = 8,                                                                   // blocks of 32 int8 values sharing an f16 scale
+  };
+
+  struct tensor {
+    std::string name;
+    tensor_types type{tensor_types::f32};
+    std::vector<uint64_t> dimensions;                                           // innermost first, so a matrix is {columns, rows}
+    std::span<std::byte const> data;
+
+    std::optional<uint64_t> element_count() const;
+  };
+
+  using array = std::variant<std::vector<std::string>, std::vector<float>, std::vector<int64_t>>;
+  using value = std::variant<uint64_t, int64_t, double, bool, std::string, array>;
+
+private:
+  std::shared_ptr<std::byte const> storage;                                     // owns the file, however it was allocated
+  std::span<std::byte const> file;
+  std::unordered_map<std::string, value> metadata;
+  std::unordered_map<std::string, tensor> tensors;
+
+public:
+  gguf(gguf const&) = delete;                                                   // tensors are views into the file
+  gguf(gguf&&) = default;                                                       // which moving leaves in place
+  gguf &operator=(gguf const&) = delete;
+  gguf &operator=(gguf&&) = default;
+
+  static std::expected<gguf, std::string> load(std::vector<std::byte> &&contents);
+  static std::expected<gguf, std::string> load(std::shared_ptr<std::byte const> &&contents, size_t size);
+
+  value const *find(std::string const &key) const;
+  std::expected<uint64_t, std::string> get_uint(std::string const &key) const;
+  std::expected<float, std::string> get_float(std::string const &key) const;
+  std::expected<std::string_view, std::string> get_string(std::string const &key) const;
+  template<typename T> std::expected<std::span<T const>, std::string> get_array(std::string const &key) const;
+
+  tensor const *find_tensor(std::string const &name) const;
+  size_t size() const;
+
+private:
+  gguf() = default;
+};
+
+template<typename T>
+std::expected<std::span<T const>, std::string> gguf::get_array(std::string const &key) const {
+  /// Look up an array of strings, floats or integers by key
+  auto const *const found{find(key)};
+  if(!found) return std::unexpected{"missing " + key};
+  auto const *const values{std::get_if<array>(found)};
+  if(!values) return std::unexpected{key + " is not an array"};
+  auto const *const typed{std::get_if<std::vector<T>>(values)};
+  if(!typed) return std::unexpected{key + " has the wrong element type"};
+  return std::span<T const>{*typed};
+}
+
+}
@@ -0,0 +1,173 @@
+#include "image.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <optional>
+#ifdef __SSE__
+  #include <immintrin.h>
+#endif // __SSE__
+
+namespace chat {
+
+namespace {
+
+struct contributions {
+  /// Source pixels covered by each destination pixel along one axis, with the fraction of each that's covered
+  struct run {
+    unsigned int first{0};
+    unsigned int count{0};
+    size_t weights{0};                                                          // offset into the weights of the first source pixel
+  };
+  std::vector<run> runs;
+  std::vector<float> weights;                                                   // the weights for each destination pixel sum to one
+
+  contributions(unsigned int source_size, unsigned int destination_size);
+};
+
+contributions::contributions(unsigned int const source_size, unsigned int const destination_size) {
+  /// Compute box filter weights for shrinking an axis, so each destination pixel averages the area it covers
+  double const scale{static_cast<double>(source_size) / destination_size};
+  runs.reserve(destination_size);
+  weights.reserve(static_cast<size_t>(source_size) + destination_size);         // each source pixel is shared by at most two destination pixels
+  for(unsigned int i{0}; i != destination_size; ++i) {
+    double const start{i * scale};
+    double const end{std::min((i + 1) * scale, static_cast<double>(source_size))};
+    auto const first{static_cast<unsigned int>(start)};
+    auto const last{std::min(static_cast<unsigned int>(std::ceil(end)), source_size)};
+    runs.emplace_back(run{
+      .first{first},
+      .count{last - first},
+      .weights{weights.size()},
+    });
+    for(unsigned int j{first}; j != last; ++j) {
+      double const covered{std::min(end, j + 1.0) - std::max(start, static_cast<double>(j))};
+      weights.emplace_back(static_cast<float>(covered / scale));
+    }
+  }
+}
+
+void filter_row(uint8_t const *source, contributions const &horizontal, float *destination) {
+  /// Shrink one row of RGBA pixels horizontally, into four floats per pixel
+  for(auto const &run : horizontal.runs) {
+    float const *const weights{horizontal.weights.data() + run.weights};
+    uint8_t const *const pixels{source + run.first * 4};
+    #ifdef __SSE4_1__
+      __m128 sum{_mm_setzero_ps()};
+      for(unsigned int i{0}; i != run.count; ++i) {
+        int packed;
+        std::memcpy(&packed, pixels + i * 4, sizeof(packed));
+        __m128 const pixel{_mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(packed)))}; // all four channels at once
+        sum = _mm_add_ps(sum, _mm_mul_ps(pixel, _mm_set1_ps(weights[i])));
+      }
+      _mm_storeu_ps(destination, sum);
+    #else
+      std::fill_n(destination, 4, 0.0f);
+      for(unsigned int i{0}; i != run.count; ++i) {
+        for(unsigned int channel{0}; channel != 4; ++channel) {
+          destination[channel] += pixels[i * 4 + channel] * weights[i];
+        }
+      }
+    #endif // __SSE4_1__
+    destination += 4;
+  }
+}
+
+void accumulate_row(float const *source, float const weight, float *accumulator, size_t const count) {
+  /// Add a weighted row of floats to an accumulator; count is a multiple of four
+  #ifdef __SSE__
+    __m128 const weights{_mm_set1_ps(weight)};
+    for(size_t i{0}; i != count; i += 4) {
+      _mm_storeu_ps(accumulator + i, _mm_add_ps(_mm_loadu_ps(accumulator + i), _mm_mul_ps(_mm_loadu_ps(source + i), weights)));
+    }
+  #else
+    for(size_t i{0}; i != count; ++i) {
+      accumulator[i] += source[i] * weight;
+    }
+  #endif // __SSE__
+}
+
+void store_row(float const *source, uint8_t *destination, size_t const count) {
+  /// Round a row of floats to bytes; count is a multiple of four
+  #ifdef __SSE4_1__
+    for(size_t i{0}; i != count; i += 4) {
+      __m128i const words{_mm_packus_epi32(_mm_cvtps_epi32(_mm_loadu_ps(source + i)), _mm_setzero_si128())};
+      int const packed{_mm_cvtsi128_si32(_mm_packus_epi16(words, words))};      // saturated, so rounding can't overflow
+      std::memcpy(destination + i, &packed, sizeof(packed));
+    }
+  #else
+    for(size_t i{0}; i != count; ++i) {
+      destination[i] = static_cast<uint8_t>(std::clamp(std::lround(source[i]), 0l, 255l));
+    }
+  #endif // __SSE4_1__
+}
+
+} // anonymous namespace
+
+image::size image::fit_for_upload(size const original, details const detail) {
+  /// Return the largest size the model will make use of at the given detail, never enlarging
+  double const longest{static_cast<double>(std::max(original.width, original.height))};
+  double const shortest{static_cast<double>(std::min(original.width, original.height))};
+  double scale{1.0};
+  switch(detail) {
+  case details::low:
+    scale = std::min(scale, 512.0 / longest);
+    break;
+  case details::high:
+    scale = std::min(scale, 2048.0 / longest);                                  // the API fits images within 2048px square, then shrinks the shortest side to 768px
+    scale = std::min(scale, 768.0 / shortest);
+    break;
+  }
+  return {
+    .width{std::max(1u, static_cast<unsigned int>(std::lround(original.width * scale)))},
+    .height{std::max(1u, static_cast<unsigned int>(std::lround(original.height * scale)))},
+  };
+}
+
+void image::downscale(std::span<uint8_t const> source, size const source_size, std::span<uint8_t> destination, size const destination_size) {
+  /// Shrink an RGBA image with a box filter, averaging the area each destination pixel covers
+  assert(source.size() == static_cast<size_t>(source_size.width) * source_size.height * 4 && "image::downscale source size mismatch");
+  assert(destination.size() == static_cast<size_t>(destination_size.width) * destination_size.height * 4 && "image::downscale destination size mismatch");
+  assert(destination_size.width <= source_size.width && destination_size.height <= source_size.height && "image::downscale can't enlarge");
+  contributions const horizontal{source_size.width, destination_size.width};
+  contributions const vertical{source_size.height, destination_size.height};
+  size_t const row_floats{static_cast<size_t>(destination_size.width) * 4};
+  size_t const source_stride{static_cast<size_t>(source_size.width) * 4};
+  std::vector<float> filtered(row_floats);
+  std::vector<float> accumulator(row_floats);
+  std::optional<unsigned int> filtered_row;                                     // a source row straddling two destination rows is only filtered once
+  for(unsigned int y{0}; y != destination_size.height; ++y) {
+    auto const &run{vertical.runs[y]};
+    std::fill(accumulator.begin(), accumulator.end(), 0.0f);
+    for(unsigned int i{0}; i != run.count; ++i) {
+      unsigned int const row{run.first + i};
+      if(filtered_row != row) {
+        filter_row(source.data() + row * source_stride, horizontal, filtered.data());
+        filtered_row = row;
+      }
+      accumulate_row(filtered.data(), vertical.weights[run.weights + i], accumulator.data(), row_floats);
+    }
+    store_row(accumulator.data(), destination.data() + y * row_floats, row_floats);
+  }
+}
+
+bool image::is_opaque(std::span<uint8_t const> rgba) {
+  /// Whether every pixel of an RGBA image is fully opaque, so it can be encoded without alpha
+  for(size_t i{3}; i < rgba.size(); i += 4) {
+    if(rgba[i] != 255) return false;
+  }
+  return true;
+}
+
+unsigned int image::tokens() const {
+  /// Estimate the prompt tokens this image will cost, from the published tiling rules
+  switch(detail) {
+  case details::low:
+    return 85;
+  case details::high:
+    return 85 + 170 * ((dimensions.width + 511) / 512) * ((dimensions.height + 511) / 512);
+  }
+  return max_tokens;
+}
+
+}
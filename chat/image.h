@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace chat {
+
+struct image {
+  /// An image attached to a message, already downscaled and encoded for upload
+  enum class details {
+    low,                                                                        // a single 512px tile, at a fixed token cost
+    high,                                                                       // up to eight 512px tiles
+  };
+
+  struct size {
+    unsigned int width{0};
+    unsigned int height{0};
+  };
+
+  std::string media_type{};                                                     // e.g. "image/jpeg"
+  std::vector<std::byte> data{};                                                // the encoded file
+  size dimensions{};
+  details detail{details::high};
+
+  static unsigned int constexpr max_tokens{85 + 170 * 8};                       // the most a high detail image can cost
+
+  static size fit_for_upload(size original, details detail);
+  static void downscale(std::span<uint8_t const> source, size source_size, std::span<uint8_t> destination, size destination_size);
+  static bool is_opaque(std::span<uint8_t const> rgba);
+
+  unsigned int tokens() const;
+};
+
+}
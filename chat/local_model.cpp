@@ -0,0 +1,545 @@
+#include "local_model.h"
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#ifdef __SSE__
+  #include <immintrin.h>
+#endif // __SSE__
+
+namespace chat {
+
+namespace {
+
+unsigned int constexpr q8_0_block{32};                                          // values per Q8_0 block
+size_t constexpr q8_0_block_bytes{2 + q8_0_block};                              // an f16 scale then the values
+unsigned int constexpr rows_per_tile{16};                                       // Q8_0 rows multiplied by a batch of inputs together, small enough to stay in the L1 cache
+uint64_t constexpr max_cache_bytes{uint64_t{1} << 30};                          // keys and values together, leaving room for the weights in a 32-bit address space
+
+float half_to_float(uint16_t const half) {
+  /// Convert an IEEE half precision value to single precision
+  uint32_t const sign{static_cast<uint32_t>(half & 0x8000u) << 16};
+  uint32_t exponent{(half >> 10) & 0x1Fu};
+  uint32_t mantissa{half & 0x3FFu};
+  uint32_t bits;
+  if(exponent == 0) {
+    if(mantissa == 0) {
+      bits = sign;
+    } else {                                                                    // subnormal, which is normal in single precision
+      exponent = 113;
+      while((mantissa & 0x400u) == 0) {
+        mantissa <<= 1;
+        --exponent;
+      }
+      bits = sign | (exponent << 23) | ((mantissa & 0x3FFu) << 13);
+    }
+  } else if(exponent == 31) {
+    bits = sign | 0x7F80'0000u | (mantissa << 13);                              // infinity or NaN
+  } else {
+    bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  }
+  float result;
+  std::memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+float load_half(std::byte const *source) {
+  /// Read an unaligned half precision value
+  uint16_t half;
+  std::memcpy(&half, source, sizeof(half));
+  return half_to_float(half);
+}
+
+float dot(float const *lhs, float const *rhs, size_t const count) {
+  /// Dot product of two float arrays of any length
+  size_t i{0};
+  float sum{0.0f};
+  #ifdef __SSE__
+    __m128 sum0{_mm_setzero_ps()};
+    __m128 sum1{_mm_setzero_ps()};
+    for(; i + 8 <= count; i += 8) {
+      sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(lhs + i),     _mm_loadu_ps(rhs + i)));
+      sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(lhs + i + 4), _mm_loadu_ps(rhs + i + 4)));
+    }
+    __m128 quad{_mm_add_ps(sum0, sum1)};
+    quad = _mm_add_ps(quad, _mm_movehl_ps(quad, quad));                         // horizontal sum
+    quad = _mm_add_ss(quad, _mm_shuffle_ps(quad, quad, 0b01));
+    sum = _mm_cvtss_f32(quad);
+  #endif // __SSE__
+  for(; i != count; ++i) {
+    sum += lhs[i] * rhs[i];
+  }
+  return sum;
+}
+
+void add_scaled(float *target, float const *source, float const scale, size_t const count) {
+  /// target += source * scale
+  size_t i{0};
+  #ifdef __SSE__
+    __m128 const scales{_mm_set1_ps(scale)};
+    for(; i + 4 <= count; i += 4) {
+      _mm_storeu_ps(target + i, _mm_add_ps(_mm_loadu_ps(target + i), _mm_mul_ps(_mm_loadu_ps(source + i), scales)));
+    }
+  #endif // __SSE__
+  for(; i != count; ++i) {
+    target[i] += source[i] * scale;
+  }
+}
+
+template<unsigned int inputs>
+void dot_q8_0(std::byte const *blocks, int16_t const *input, float const *input_scales, unsigned int const block_count, float *output, size_t const output_stride) {
+  /// Dot products of a row of Q8_0 weights with several inputs quantised to Q8_0, in integer arithmetic within each block, widening each block of weights once for them all
+  size_t const input_stride{static_cast<size_t>(block_count) * q8_0_block};     // inputs follow one another, as do their scales
+  #ifdef __SSE4_1__
+    __m128 sums[inputs];
+    for(auto &sum : sums) sum = _mm_setzero_ps();
+    for(unsigned int i{0}; i != block_count; ++i) {
+      std::byte const *const block{blocks + i * q8_0_block_bytes};
+      __m128i const weights_low{_mm_loadu_si128(reinterpret_cast<__m128i const*>(block + 2))};
+      __m128i const weights_high{_mm_loadu_si128(reinterpret_cast<__m128i const*>(block + 18))};
+      __m128i const weights[4]{
+        _mm_cvtepi8_epi16(weights_low),
+        _mm_cvtepi8_epi16(_mm_srli_si128(weights_low, 8)),
+        _mm_cvtepi8_epi16(weights_high),
+        _mm_cvtepi8_epi16(_mm_srli_si128(weights_high, 8)),
+      };
+      float const weight_scale{load_half(block)};
+      for(unsigned int j{0}; j != inputs; ++j) {
+        __m128i const *const values{reinterpret_cast<__m128i const*>(input + j * input_stride + i * q8_0_block)};
+        __m128i products{_mm_madd_epi16(weights[0], _mm_loadu_si128(values))};  // widening multiply-add, which is a single wasm SIMD instruction
+        products = _mm_add_epi32(products, _mm_madd_epi16(weights[1], _mm_loadu_si128(values + 1)));
+        products = _mm_add_epi32(products, _mm_madd_epi16(weights[2], _mm_loadu_si128(values + 2)));
+        products = _mm_add_epi32(products, _mm_madd_epi16(weights[3], _mm_loadu_si128(values + 3)));
+        sums[j] = _mm_add_ps(sums[j], _mm_mul_ps(_mm_cvtepi32_ps(products), _mm_set1_ps(weight_scale * input_scales[j * block_count + i])));
+      }
+    }
+    for(unsigned int j{0}; j != inputs; ++j) {
+      __m128 sum{_mm_add_ps(sums[j], _mm_movehl_ps(sums[j], sums[j]))};
+      sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 0b01));
+      output[j * output_stride] = _mm_cvtss_f32(sum);
+    }
+  #else
+    float sums[inputs]{};
+    for(unsigned int i{0}; i != block_count; ++i) {
+      std::byte const *const block{blocks + i * q8_0_block_bytes};
+      float const weight_scale{load_half(block)};
+      for(unsigned int j{0}; j != inputs; ++j) {
+        int16_t const *const values{input + j * input_stride + i * q8_0_block};
+        int32_t products{0};
+        for(unsigned int k{0}; k != q8_0_block; ++k) {
+          products += static_cast<int8_t>(block[2 + k]) * values[k];
+        }
+        sums[j] += static_cast<float>(products) * weight_scale * input_scales[j * block_count + i];
+      }
+    }
+    for(unsigned int j{0}; j != inputs; ++j) {
+      output[j * output_stride] = sums[j];
+    }
+  #endif // __SSE4_1__
+}
+
+void quantise_q8_0(std::span<float const> input, std::vector<int16_t> &output, std::vector<float> &scales) {
+  /// Quantise a vector, or several one after another, whose length is a multiple of the block size to Q8_0, with a scale per block
+  output.resize(input.size());
+  scales.resize(input.size() / q8_0_block);
+  for(size_t block{0}; block != scales.size(); ++block) {
+    float const *const values{input.data() + block * q8_0_block};
+    float largest{0.0f};
+    for(unsigned int i{0}; i != q8_0_block; ++i) {
+      largest = std::max(largest, std::abs(values[i]));
+    }
+    float const scale{largest / 127.0f};
+    float const inverse{scale > 0.0f ? 1.0f / scale : 0.0f};
+    for(unsigned int i{0}; i != q8_0_block; ++i) {
+      output[block * q8_0_block + i] = static_cast<int16_t>(std::lround(values[i] * inverse));
+    }
+    scales[block] = scale;
+  }
+}
+
+void rms_norm(std::span<float const> input, std::span<float const> weights, float const epsilon, std::span<float> output) {
+  /// Scale a vector to unit root mean square, then by per-element weights
+  float const mean_square{dot(input.data(), input.data(), input.size()) / static_cast<float>(input.size())};
+  float const scale{1.0f / std::sqrt(mean_square + epsilon)};
+  for(size_t i{0}; i != input.size(); ++i) {
+    output[i] = input[i] * scale * weights[i];
+  }
+}
+
+void softmax(std::span<float> values) {
+  /// Normalise values in place to a probability distribution
+  float const largest{*std::ranges::max_element(values)};
+  float sum{0.0f};
+  for(float &value : values) {
+    value = std::exp(value - largest);
+    sum += value;
+  }
+  for(float &value : values) {
+    value /= sum;
+  }
+}
+
+} // anonymous namespace
+
+local_model::local_model(gguf &&this_file, chat::tokenizer &&this_vocabulary)
+  : file{std::move(this_file)},
+    vocabulary{std::move(this_vocabulary)} {
+  /// Take ownership of a parsed file and its vocabulary; load() fills in the rest
+}
+
+std::expected<local_model, std::string> local_model::load(std::vector<std::byte> &&contents, unsigned int const max_context) {
+  /// Parse a GGUF file holding a llama-architecture model, keeping the cache within a maximum context
+  auto parsed{gguf::load(std::move(contents))};
+  if(!parsed) return std::unexpected{parsed.error()};
+  return load(std::move(*parsed), max_context);
+}
+
+std::expected<local_model, std::string> local_model::load(gguf &&parsed, unsigned int const max_context) {
+  /// Set up a llama-architecture model from a parsed GGUF file, keeping the cache within a maximum context
+  if(auto const architecture{parsed.get_string("general.architecture")}; !architecture || *architecture != "llama") {
+    return std::unexpected{"only the llama architecture is supported"};
+  }
+  auto vocabulary{tokenizer::load(parsed)};
+  if(!vocabulary) return std::unexpected{vocabulary.error()};
+  local_model result{std::move(parsed), std::move(*vocabulary)};
+  auto const &source{result.file};
+
+  std::string error;
+  auto const get_uint{[&](std::string const &key, std::optional<uint64_t> fallback = std::nullopt) -> unsigned int {
+    auto const value{source.get_uint(key)};
+    if(value) return static_cast<unsigned int>(*value);
+    if(fallback) return static_cast<unsigned int>(*fallback);
+    if(error.empty()) error = value.error();
+    return 0;
+  }};
+  auto &parameters{result.parameters};
+  parameters.embedding = get_uint("llama.embedding_length");
+  parameters.layers = get_uint("llama.block_count");
+  parameters.heads = get_uint("llama.attention.head_count");
+  parameters.kv_heads = get_uint("llama.attention.head_count_kv", parameters.heads);
+  parameters.feed_forward = get_uint("llama.feed_forward_length");
+  parameters.context = std::min(get_uint("llama.context_length", 2048), max_context);
+  if(auto const epsilon{source.get_float("llama.attention.layer_norm_rms_epsilon")}) parameters.rms_epsilon = *epsilon;
+  if(auto const base{source.get_float("llama.rope.freq_base")}) parameters.rope_base = *base;
+  if(!error.empty()) return std::unexpected{error};
+  if(parameters.heads == 0 || parameters.kv_heads == 0 || parameters.heads % parameters.kv_heads != 0 || parameters.embedding % parameters.heads != 0) {
+    return std::unexpected{"inconsistent attention head counts"};
+  }
+  parameters.head_dimension = parameters.embedding / parameters.heads;
+  if(get_uint("llama.rope.dimension_count", parameters.head_dimension) != parameters.head_dimension) return std::unexpected{"partial rotary embeddings are not supported"};
+  if(parameters.embedding % q8_0_block != 0 || parameters.feed_forward % q8_0_block != 0) return std::unexpected{"dimensions must be multiples of 32"};
+
+  auto const get_matrix{[&](std::string const &tensor_name, unsigned int const columns, unsigned int const rows) -> matrix {
+    auto const *const tensor{source.find_tensor(tensor_name)};
+    if(!tensor) {
+      if(error.empty()) error = "missing tensor " + tensor_name;
+      return {};
+    }
+    if(tensor->dimensions.size() != 2 || tensor->dimensions[0] != columns || (rows != 0 && tensor->dimensions[1] != rows) || tensor->dimensions[1] > UINT_MAX) {
+      if(error.empty()) error = tensor_name + " has unexpected dimensions";
+      return {};
+    }
+    return {
+      .type{tensor->type},
+      .rows{static_cast<unsigned int>(tensor->dimensions[1])},
+      .columns{columns},
+      .data{tensor->data.data()},
+    };
+  }};
+  auto const get_vector{[&](std::string const &tensor_name, unsigned int const size) -> std::vector<float> {
+    auto const *const tensor{source.find_tensor(tensor_name)};                  // norms are one-dimensional, and copied out as floats
+    if(!tensor || tensor->dimensions.size() != 1 || tensor->dimensions[0] != size || tensor->type == gguf::tensor_types::q8_0) return {};
+    std::vector<float> values(size);
+    result.dequantise_row({.type{tensor->type}, .rows{1}, .columns{size}, .data{tensor->data.data()}}, 0, values);
+    return values;
+  }};
+
+  unsigned int const kv_dimension{parameters.kv_heads * parameters.head_dimension};
+  result.token_embedding = get_matrix("token_embd.weight", parameters.embedding, 0);
+  parameters.vocabulary = result.token_embedding.rows;
+  for(unsigned int i{0}; i != parameters.layers && error.empty(); ++i) {
+    std::string const prefix{"blk." + std::to_string(i) + "."};
+    result.layers.emplace_back(layer{
+      .attention_norm{get_vector(prefix + "attn_norm.weight", parameters.embedding)},
+      .query{get_matrix(prefix + "attn_q.weight", parameters.embedding, parameters.embedding)},
+      .key{get_matrix(prefix + "attn_k.weight", parameters.embedding, kv_dimension)},
+      .value{get_matrix(prefix + "attn_v.weight", parameters.embedding, kv_dimension)},
+      .attention_output{get_matrix(prefix + "attn_output.weight", parameters.embedding, parameters.embedding)},
+      .feed_forward_norm{get_vector(prefix + "ffn_norm.weight", parameters.embedding)},
+      .gate{get_matrix(prefix + "ffn_gate.weight", parameters.embedding, parameters.feed_forward)},
+      .up{get_matrix(prefix + "ffn_up.weight", parameters.embedding, parameters.feed_forward)},
+      .down{get_matrix(prefix + "ffn_down.weight", parameters.feed_forward, parameters.embedding)},
+    });
+    if(result.layers.back().attention_norm.empty() || result.layers.back().feed_forward_norm.empty()) {
+      if(error.empty()) error = prefix + " norms are missing or malformed";
+    }
+  }
+  result.output_norm = get_vector("output_norm.weight", parameters.embedding);
+  if(result.output_norm.empty() && error.empty()) error = "output norm is missing or malformed";
+  if(source.find_tensor("output.weight")) {
+    result.output_weights = get_matrix("output.weight", parameters.embedding, parameters.vocabulary);
+  } else {
+    result.output_weights = result.token_embedding;                             // tied embeddings
+  }
+  if(!error.empty()) return std::unexpected{error};
+  if(parameters.vocabulary != result.vocabulary.size()) return std::unexpected{"vocabulary size doesn't match the embeddings"};
+
+  if(auto const model_name{source.get_string("general.name")}) {
+    result.name = "local:" + std::string{*model_name};
+  } else {
+    result.name = "local";
+  }
+
+  uint64_t const cache_per_layer{uint64_t{parameters.context} * kv_dimension};
+  if(cache_per_layer != 0 && parameters.layers > max_cache_bytes / (2 * sizeof(float)) / cache_per_layer) { // keys and values, from sizes in the header
+    return std::unexpected{"the key and value cache would need more than " + std::to_string(max_cache_bytes >> 20) + "MB; try a shorter context"};
+  }
+  auto const cache_size{static_cast<size_t>(parameters.layers * cache_per_layer)};
+  result.key_cache.resize(cache_size);
+  result.value_cache.resize(cache_size);
+  result.cached_tokens.reserve(parameters.context);
+  auto &buffers{result.scratch};
+  buffers.residual.resize(batch_size * parameters.embedding);
+  buffers.normalised.resize(batch_size * parameters.embedding);
+  buffers.query.resize(batch_size * parameters.embedding);
+  buffers.attention.resize(batch_size * parameters.embedding);
+  buffers.attention_scores.resize(parameters.context);
+  buffers.gate.resize(batch_size * parameters.feed_forward);
+  buffers.up.resize(batch_size * parameters.feed_forward);
+  buffers.logits.resize(parameters.vocabulary);
+  buffers.row.resize(std::max(parameters.embedding, parameters.feed_forward));
+  buffers.rope_cos.resize(batch_size * parameters.head_dimension / 2);
+  buffers.rope_sin.resize(batch_size * parameters.head_dimension / 2);
+  for(unsigned int i{0}; i != parameters.head_dimension / 2; ++i) {
+    result.rope_frequencies.emplace_back(std::pow(parameters.rope_base, -2.0f * static_cast<float>(i) / static_cast<float>(parameters.head_dimension)));
+  }
+  return result;
+}
+
+size_t local_model::reuse_prefix(std::span<tokenizer::token const> tokens) {
+  /// Keep the cached positions shared with the start of a new sequence, returning how many; at least the last token is always left to evaluate, for its logits
+  size_t common{0};
+  size_t const limit{std::min(cached_tokens.size(), tokens.empty() ? 0 : tokens.size() - 1)};
+  while(common != limit && cached_tokens[common] == tokens[common]) ++common;
+  cached_tokens.resize(common);
+  return common;
+}
+
+std::span<float const> local_model::evaluate(tokenizer::token const token, bool const want_logits) {
+  /// Run one token through the model at the next position, caching its keys and values; returns the next token logits if wanted
+  return evaluate({&token, 1}, want_logits);
+}
+
+std::span<float const> local_model::evaluate(std::span<tokenizer::token const> tokens, bool const want_logits) {
+  /// Run tokens through the model at the next positions a batch at a time, caching their keys and values; returns the logits following the last token if wanted
+  assert(cached_tokens.size() + tokens.size() <= parameters.context && "local_model::evaluate context is full");
+  for(size_t start{0}; start < tokens.size(); start += batch_size) {
+    evaluate_batch(tokens.subspan(start, std::min(batch_size, tokens.size() - start)));
+  }
+  if(!want_logits || tokens.empty()) return {};                                 // skipping the largest matrix for prompt tokens
+
+  auto &buffers{scratch};
+  size_t const last{(tokens.size() - 1) % batch_size};                          // where the last token's output is in its batch
+  std::span<float> const normalised{buffers.normalised.data(), parameters.embedding};
+  rms_norm({buffers.residual.data() + last * parameters.embedding, parameters.embedding}, output_norm, parameters.rms_epsilon, normalised);
+  multiply(output_weights, normalised, buffers.logits);
+  return buffers.logits;
+}
+
+local_model::hyperparameters const &local_model::get_parameters() const {
+  /// Return the model's dimensions
+  return parameters;
+}
+
+tokenizer const &local_model::get_tokenizer() const {
+  /// Return the model's vocabulary
+  return vocabulary;
+}
+
+std::string const &local_model::get_name() const {
+  /// Return the model's name, as reported in responses
+  return name;
+}
+
+size_t local_model::get_position() const {
+  /// Number of positions evaluated and cached
+  return cached_tokens.size();
+}
+
+size_t local_model::get_file_size() const {
+  /// Size of the model file held in memory
+  return file.size();
+}
+
+void local_model::evaluate_batch(std::span<tokenizer::token const> tokens) {
+  /// Run up to a batch of tokens through the model at the next positions, caching their keys and values and leaving their outputs in the residual buffer
+  assert(tokens.size() <= batch_size && "local_model::evaluate_batch batch too large");
+  size_t const first{cached_tokens.size()};
+  size_t const count{tokens.size()};
+  for(auto const token : tokens) {
+    assert(token >= 0 && static_cast<unsigned int>(token) < parameters.vocabulary && "local_model::evaluate token out of range");
+    cached_tokens.emplace_back(token);
+  }
+
+  unsigned int const embedding{parameters.embedding};
+  unsigned int const head_dimension{parameters.head_dimension};
+  unsigned int const kv_dimension{parameters.kv_heads * head_dimension};
+  unsigned int const group{parameters.heads / parameters.kv_heads};             // query heads sharing each key and value head
+  float const attention_scale{1.0f / std::sqrt(static_cast<float>(head_dimension))};
+  size_t const pairs{rope_frequencies.size()};
+  auto &buffers{scratch};
+  std::span<float> const residual{buffers.residual.data(), count * embedding};  // each buffer holds a row per position
+  std::span<float> const normalised{buffers.normalised.data(), count * embedding};
+  std::span<float> const query{buffers.query.data(), count * embedding};
+  std::span<float> const attention{buffers.attention.data(), count * embedding};
+  std::span<float> const gate{buffers.gate.data(), count * parameters.feed_forward};
+  std::span<float> const up{buffers.up.data(), count * parameters.feed_forward};
+
+  for(size_t i{0}; i != count; ++i) {                                           // the same rotations apply to every head and layer
+    for(size_t j{0}; j != pairs; ++j) {
+      float const angle{static_cast<float>(first + i) * rope_frequencies[j]};
+      buffers.rope_cos[i * pairs + j] = std::cos(angle);
+      buffers.rope_sin[i * pairs + j] = std::sin(angle);
+    }
+  }
+  auto const rotate{[&](float *head, size_t const i){
+    float const *const cos{buffers.rope_cos.data() + i * pairs};
+    float const *const sin{buffers.rope_sin.data() + i * pairs};
+    for(size_t j{0}; j != pairs; ++j) {                                         // adjacent pairs, as GGUF conversion permutes the weights to suit
+      float const real{head[j * 2]};
+      float const imaginary{head[j * 2 + 1]};
+      head[j * 2]     = real * cos[j] - imaginary * sin[j];
+      head[j * 2 + 1] = real * sin[j] + imaginary * cos[j];
+    }
+  }};
+  auto const normalise_rows{[&](std::span<float const> weights){
+    for(size_t i{0}; i != count; ++i) {
+      rms_norm(residual.subspan(i * embedding, embedding), weights, parameters.rms_epsilon, normalised.subspan(i * embedding, embedding));
+    }
+  }};
+
+  for(size_t i{0}; i != count; ++i) {
+    dequantise_row(token_embedding, static_cast<unsigned int>(tokens[i]), residual.subspan(i * embedding, embedding));
+  }
+  for(unsigned int l{0}; l != parameters.layers; ++l) {
+    auto const &this_layer{layers[l]};
+    size_t const layer_offset{static_cast<size_t>(l) * parameters.context * kv_dimension};
+    std::span<float> const keys{key_cache.data() + layer_offset, static_cast<size_t>(parameters.context) * kv_dimension};
+    std::span<float> const values{value_cache.data() + layer_offset, static_cast<size_t>(parameters.context) * kv_dimension};
+
+    normalise_rows(this_layer.attention_norm);
+    multiply(this_layer.query, normalised, query);
+    multiply(this_layer.key, normalised, keys.subspan(first * kv_dimension, count * kv_dimension)); // consecutive positions are consecutive rows of the cache
+    multiply(this_layer.value, normalised, values.subspan(first * kv_dimension, count * kv_dimension));
+    for(size_t i{0}; i != count; ++i) {
+      for(unsigned int h{0}; h != parameters.heads; ++h) {
+        rotate(query.data() + i * embedding + h * head_dimension, i);
+      }
+      for(unsigned int h{0}; h != parameters.kv_heads; ++h) {
+        rotate(keys.data() + (first + i) * kv_dimension + h * head_dimension, i);
+      }
+    }
+
+    for(size_t i{0}; i != count; ++i) {
+      size_t const position{first + i};                                         // attending to itself and earlier positions only, not later ones in the batch
+      std::span<float> const scores{buffers.attention_scores.data(), position + 1};
+      for(unsigned int h{0}; h != parameters.heads; ++h) {
+        float const *const this_query{query.data() + i * embedding + h * head_dimension};
+        size_t const kv_offset{(h / group) * head_dimension};
+        for(size_t t{0}; t <= position; ++t) {
+          scores[t] = dot(this_query, keys.data() + t * kv_dimension + kv_offset, head_dimension) * attention_scale;
+        }
+        softmax(scores);
+        float *const output{attention.data() + i * embedding + h * head_dimension};
+        std::fill_n(output, head_dimension, 0.0f);
+        for(size_t t{0}; t <= position; ++t) {
+          add_scaled(output, values.data() + t * kv_dimension + kv_offset, scores[t], head_dimension);
+        }
+      }
+    }
+    multiply(this_layer.attention_output, attention, normalised);
+    add_scaled(residual.data(), normalised.data(), 1.0f, residual.size());
+
+    normalise_rows(this_layer.feed_forward_norm);
+    multiply(this_layer.gate, normalised, gate);
+    multiply(this_layer.up, normalised, up);
+    for(size_t i{0}; i != gate.size(); ++i) {                                   // SwiGLU
+      float const this_gate{gate[i]};
+      gate[i] = this_gate / (1.0f + std::exp(-this_gate)) * up[i];
+    }
+    multiply(this_layer.down, gate, normalised);
+    add_scaled(residual.data(), normalised.data(), 1.0f, residual.size());
+  }
+}
+
+void local_model::multiply(matrix const &weights, std::span<float const> input, std::span<float> output) {
+  /// Multiply a matrix by one or more vectors of its column count, one after another, writing a vector of its row count for each; each row of weights is read once for all of them
+  assert(weights.columns != 0 && input.size() % weights.columns == 0 && output.size() == input.size() / weights.columns * weights.rows && "local_model::multiply size mismatch");
+  size_t const count{input.size() / weights.columns};
+  switch(weights.type) {
+  case gguf::tensor_types::q8_0:
+    {
+      quantise_q8_0(input, scratch.quantised, scratch.quantised_scales);        // once for all rows, so the inner loop is integer only
+      unsigned int const block_count{weights.columns / q8_0_block};
+      size_t const row_bytes{block_count * q8_0_block_bytes};
+      for(unsigned int first_row{0}; first_row < weights.rows; first_row += rows_per_tile) { // a tile of rows stays in cache while every input passes over it
+        unsigned int const last_row{std::min(first_row + rows_per_tile, weights.rows)};
+        size_t i{0};
+        for(; i + 4 <= count; i += 4) {                                         // four inputs share each widened block of weights
+          for(unsigned int row{first_row}; row != last_row; ++row) {
+            dot_q8_0<4>(weights.data + row * row_bytes, scratch.quantised.data() + i * weights.columns, scratch.quantised_scales.data() + i * block_count, block_count, output.data() + i * weights.rows + row, weights.rows);
+          }
+        }
+        for(; i != count; ++i) {
+          for(unsigned int row{first_row}; row != last_row; ++row) {
+            dot_q8_0<1>(weights.data + row * row_bytes, scratch.quantised.data() + i * weights.columns, scratch.quantised_scales.data() + i * block_count, block_count, output.data() + i * weights.rows + row, weights.rows);
+          }
+        }
+      }
+      break;
+    }
+  case gguf::tensor_types::f32:
+    for(unsigned int row{0}; row != weights.rows; ++row) {
+      float const *const values{reinterpret_cast<float const*>(weights.data) + static_cast<size_t>(row) * weights.columns}; // the file's alignment keeps these aligned
+      for(size_t i{0}; i != count; ++i) {
+        output[i * weights.rows + row] = dot(values, input.data() + i * weights.columns, weights.columns);
+      }
+    }
+    break;
+  case gguf::tensor_types::f16:
+    for(unsigned int row{0}; row != weights.rows; ++row) {
+      std::span<float> const values{scratch.row.data(), weights.columns};
+      dequantise_row(weights, row, values);
+      for(size_t i{0}; i != count; ++i) {
+        output[i * weights.rows + row] = dot(values.data(), input.data() + i * weights.columns, weights.columns);
+      }
+    }
+    break;
+  }
+}
+
+void local_model::dequantise_row(matrix const &weights, unsigned int const row, std::span<float> output) const {
+  /// Expand one row of a matrix to floats
+  switch(weights.type) {
+  case gguf::tensor_types::f32:
+    std::memcpy(output.data(), weights.data + static_cast<size_t>(row) * weights.columns * sizeof(float), weights.columns * sizeof(float));
+    break;
+  case gguf::tensor_types::f16:
+    for(unsigned int i{0}; i != weights.columns; ++i) {
+      output[i] = load_half(weights.data + (static_cast<size_t>(row) * weights.columns + i) * 2);
+    }
+    break;
+  case gguf::tensor_types::q8_0:
+    {
+      std::byte const *const blocks{weights.data + static_cast<size_t>(row) * (weights.columns / q8_0_block) * q8_0_block_bytes};
+      for(unsigned int i{0}; i != weights.columns; ++i) {
+        std::byte const *const block{blocks + (i / q8_0_block) * q8_0_block_bytes};
+        output[i] = load_half(block) * static_cast<float>(static_cast<int8_t>(block[2 + i % q8_0_block]));
+      }
+      break;
+    }
+  }
+}
+
+}
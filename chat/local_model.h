@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstdint>
+#include <expected>
+#include <span>
+#include <string>
+#include <vector>
+#include "chat/gguf.h"
+#include "chat/tokenizer.h"
+
+namespace chat {
+
+class local_model {
+  /// A llama-architecture transformer evaluated on the CPU, a batch of positions at a time, from a GGUF file.
+  ///
+  /// Weights stay in the file's memory as F32, F16 or Q8_0; Q8_0 matrices
+  /// are multiplied by activations quantised to Q8_0 with integer SIMD dot
+  /// products.  A prompt's positions are evaluated together in batches, so
+  /// each row of weights is read once per batch rather than once per token.
+  /// Keys and values of evaluated positions are kept in a cache, so a
+  /// prompt that extends the previous one only evaluates the new part.
+public:
+  struct hyperparameters {
+    unsigned int embedding{0};
+    unsigned int layers{0};
+    unsigned int heads{0};
+    unsigned int kv_heads{0};                                                   // fewer than heads with grouped-query attention
+    unsigned int head_dimension{0};
+    unsigned int feed_forward{0};
+    unsigned int vocabulary{0};
+    unsigned int context{0};                                                    // positions the cache holds, which may be fewer than trained
+    float rms_epsilon{1e-5f};
+    float rope_base{10'000.0f};
+  };
+
+  static size_t constexpr batch_size{16};                                       // positions evaluated together; longer prompts take several batches
+
+  struct matrix {
+    gguf::tensor_types type{gguf::tensor_types::f32};
+    unsigned int rows{0};
+    unsigned int columns{0};
+    std::byte const *data{nullptr};
+  };
+
+private:
+  struct layer {
+    std::vector<float> attention_norm;
+    matrix query;
+    matrix key;
+    matrix value;
+    matrix attention_output;
+    std::vector<float> feed_forward_norm;
+    matrix gate;
+    matrix up;
+    matrix down;
+  };
+
+  gguf file;
+  chat::tokenizer vocabulary;
+  std::string name;
+  hyperparameters parameters;
+  matrix token_embedding;
+  std::vector<layer> layers;
+  std::vector<float> output_norm;
+  matrix output_weights;                                                        // often the token embedding, when tied
+
+  std::vector<float> key_cache;                                                 // layers x context x kv_heads x head_dimension
+  std::vector<float> value_cache;
+  std::vector<tokenizer::token> cached_tokens;                                  // the tokens whose keys and values are in the cache, by position
+
+  struct scratch_buffers {                                                      // reused between batches, to avoid allocations, with a row per position in the batch
+    std::vector<float> residual;
+    std::vector<float> normalised;
+    std::vector<float> query;
+    std::vector<float> attention;
+    std::vector<float> attention_scores;
+    std::vector<float> gate;
+    std::vector<float> up;
+    std::vector<float> logits;
+    std::vector<float> row;                                                     // a dequantised matrix row
+    std::vector<float> rope_cos;                                                // rotations for each position in the batch
+    std::vector<float> rope_sin;
+    std::vector<int16_t> quantised;                                             // the current matrix inputs as Q8_0, already widened for the multiply-adds
+    std::vector<float> quantised_scales;
+  } scratch;
+  std::vector<float> rope_frequencies;                                          // one per pair of dimensions in a head
+
+public:
+  local_model(local_model const&) = delete;
+  local_model(local_model&&) = default;
+  local_model &operator=(local_model const&) = delete;
+  local_model &operator=(local_model&&) = default;
+
+  static std::expected<local_model, std::string> load(std::vector<std::byte> &&contents, unsigned int max_context = 2048);
+  static std::expected<local_model, std::string> load(gguf &&parsed, unsigned int max_context = 2048);
+
+  size_t reuse_prefix(std::span<tokenizer::token const> tokens);
+  std::span<float const> evaluate(tokenizer::token token, bool want_logits);
+  std::span<float const> evaluate(std::span<tokenizer::token const> tokens, bool want_logits);
+
+  hyperparameters const &get_parameters() const;
+  tokenizer const &get_tokenizer() const;
+  std::string const &get_name() const;
+  size_t get_position() const;
+  size_t get_file_size() const;
+
+private:
+  local_model(gguf &&this_file, chat::tokenizer &&this_vocabulary);
+
+  void evaluate_batch(std::span<tokenizer::token const> tokens);
+  void multiply(matrix const &weights, std::span<float const> input, std::span<float> output);
+  void dequantise_row(matrix const &weights, unsigned int row, std::span<float> output) const;
+};
+
+}
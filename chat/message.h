@@ -0,0 +1,17 @@
+#pragma once
+
+#include <string>
+
+namespace chat {
+
+struct message {
+  /// A single turn of a conversation
+  enum class roles {
+    system,
+    user,
+    assistant,
+  } role{roles::user};
+  std::string text{};
+};
+
+}
@@ -0,0 +1,271 @@
+#include "message_store.h"
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include "lz4_block.h"
+
+namespace chat {
+
+message_store::message_store(uint32_t const this_cold_after, size_t const this_block_size, size_t const this_cache_capacity)
+  : cold_after{this_cold_after},
+    block_size{this_block_size},
+    cache_capacity{std::max<size_t>(this_cache_capacity, 1)} {
+  /// Construct an empty store; texts are frozen once unused for cold_after calls to maintain()
+}
+
+message_store::handle message_store::add(std::string &&text) {
+  /// Store a new text, returning its handle
+  handle const id{allocate()};
+  auto &this_entry{entries[id]};
+  stats.hot_count++;
+  stats.hot_bytes += text.size();
+  this_entry.text = std::move(text);
+  this_entry.state = states::hot;
+  this_entry.last_used = generation;
+  link_newest(id);
+  return id;
+}
+
+std::string_view message_store::get(handle const id) {
+  /// Return a text, decompressing its block if it is cold; the view is valid until the next call into the store
+  auto &this_entry{entries[id]};
+  assert(this_entry.state != states::free && "message_store::get on a released handle");
+  if(this_entry.state == states::hot) {
+    this_entry.last_used = generation;
+    if(newest != id) {
+      unlink(id);
+      link_newest(id);
+    }
+    return this_entry.text;
+  }
+  std::span<std::byte const> const data{load_block(this_entry.block)};
+  return {reinterpret_cast<char const*>(data.data()) + this_entry.offset, this_entry.length};
+}
+
+void message_store::set(handle const id, std::string &&text) {
+  /// Replace a text; an edited text is always hot
+  auto &this_entry{entries[id]};
+  assert(this_entry.state != states::free && "message_store::set on a released handle");
+  if(this_entry.state == states::cold) {
+    release_cold(id);
+    this_entry.state = states::hot;
+    stats.hot_count++;
+    link_newest(id);
+  } else {
+    stats.hot_bytes -= this_entry.text.size();
+    if(newest != id) {
+      unlink(id);
+      link_newest(id);
+    }
+  }
+  stats.hot_bytes += text.size();
+  this_entry.text = std::move(text);
+  this_entry.last_used = generation;
+}
+
+void message_store::remove(handle const id) {
+  /// Release a text and its handle
+  auto &this_entry{entries[id]};
+  assert(this_entry.state != states::free && "message_store::remove on a released handle");
+  if(this_entry.state == states::hot) {
+    unlink(id);
+    stats.hot_count--;
+    stats.hot_bytes -= this_entry.text.size();
+  } else {
+    release_cold(id);
+  }
+  this_entry = entry{};
+  this_entry.newer = first_free;
+  first_free = id;
+}
+
+void message_store::maintain() {
+  /// Advance the usage clock and freeze up to one block of the least recently used texts, if enough have gone cold
+  ++generation;
+  std::vector<handle> batch;
+  size_t raw_size{0};
+  for(handle id{oldest}; id != none && raw_size < block_size; id = entries[id].newer) {
+    auto const &this_entry{entries[id]};
+    if(generation - this_entry.last_used < cold_after) break;                   // everything newer is warmer still
+    batch.emplace_back(id);
+    raw_size += this_entry.text.size();
+  }
+  if(raw_size < block_size / 2) return;                                         // wait for more, as small blocks compress poorly
+  freeze(batch, raw_size);
+}
+
+message_store::statistics message_store::get_statistics() const {
+  /// Return counts and sizes of each tier
+  statistics result{stats};
+  result.cached_blocks = static_cast<size_t>(std::count_if(cache.begin(), cache.end(), [](cached_block const &this_cached){return this_cached.block != none;}));
+  return result;
+}
+
+message_store::handle message_store::allocate() {
+  /// Take an entry from the free list, or add one
+  if(first_free == none) {
+    entries.emplace_back();
+    return static_cast<handle>(entries.size() - 1);
+  }
+  handle const id{first_free};
+  first_free = entries[id].newer;
+  entries[id].newer = none;
+  return id;
+}
+
+void message_store::link_newest(handle const id) {
+  /// Insert a hot entry at the recent end of the LRU list
+  auto &this_entry{entries[id]};
+  this_entry.newer = none;
+  this_entry.older = newest;
+  if(newest == none) {
+    oldest = id;
+  } else {
+    entries[newest].newer = id;
+  }
+  newest = id;
+}
+
+void message_store::unlink(handle const id) {
+  /// Remove a hot entry from the LRU list
+  auto &this_entry{entries[id]};
+  if(this_entry.newer == none) {
+    newest = this_entry.older;
+  } else {
+    entries[this_entry.newer].older = this_entry.older;
+  }
+  if(this_entry.older == none) {
+    oldest = this_entry.newer;
+  } else {
+    entries[this_entry.older].newer = this_entry.newer;
+  }
+  this_entry.newer = none;
+  this_entry.older = none;
+}
+
+void message_store::freeze(std::vector<handle> const &batch, size_t const raw_size) {
+  /// Compress a batch of hot texts together into a new cold block
+  if(dictionary.empty()) {                                                      // sample the first batch to seed the shared dictionary
+    for(handle const id : batch) {
+      std::string_view const sample{std::string_view{entries[id].text}.substr(0, std::min(dictionary_sample_size, dictionary_size - dictionary.size()))};
+      auto const *const sample_bytes{reinterpret_cast<std::byte const*>(sample.data())};
+      dictionary.insert(dictionary.end(), sample_bytes, sample_bytes + sample.size());
+      if(dictionary.size() == dictionary_size) break;
+    }
+  }
+
+  uint32_t index;
+  if(free_blocks.empty()) {
+    index = static_cast<uint32_t>(blocks.size());
+    blocks.emplace_back();
+  } else {
+    index = free_blocks.back();
+    free_blocks.pop_back();
+  }
+
+  std::vector<std::byte> raw;
+  raw.reserve(raw_size);
+  for(handle const id : batch) {
+    auto &this_entry{entries[id]};
+    auto const *const text_bytes{reinterpret_cast<std::byte const*>(this_entry.text.data())};
+    this_entry.block = index;
+    this_entry.offset = static_cast<uint32_t>(raw.size());
+    this_entry.length = static_cast<uint32_t>(this_entry.text.size());
+    raw.insert(raw.end(), text_bytes, text_bytes + this_entry.text.size());
+    unlink(id);
+    std::string{}.swap(this_entry.text);                                        // release the capacity, not just the contents
+    this_entry.state = states::cold;
+  }
+
+  auto &this_block{blocks[index]};
+  lz4_block::compress(raw, this_block.compressed, dictionary);
+  this_block.compressed.shrink_to_fit();
+  this_block.members = batch;
+  this_block.raw_size = static_cast<uint32_t>(raw.size());
+  this_block.live_bytes = this_block.raw_size;
+  this_block.live_count = static_cast<uint32_t>(batch.size());
+
+  stats.hot_count -= batch.size();
+  stats.hot_bytes -= raw.size();
+  stats.cold_count += batch.size();
+  stats.cold_bytes += raw.size();
+  stats.compressed_bytes += this_block.compressed.size();
+}
+
+void message_store::release_cold(handle const id) {
+  /// Remove a cold entry from its block, freeing the block once empty or thawing its survivors once it's mostly dead
+  auto &this_entry{entries[id]};
+  this_entry.state = states::free;                                              // the caller sets the final state
+  auto &this_block{blocks[this_entry.block]};
+  this_block.live_bytes -= this_entry.length;
+  this_block.live_count--;
+  stats.cold_count--;
+  stats.cold_bytes -= this_entry.length;
+
+  if(this_block.live_count != 0 && this_block.live_bytes >= this_block.raw_size / 4) return;
+  if(this_block.live_count != 0) {
+    thaw_block(this_entry.block);                                               // survivors get refrozen with other cold texts, reclaiming the dead space
+    return;
+  }
+  stats.compressed_bytes -= this_block.compressed.size();
+  for(auto &this_cached : cache) {
+    if(this_cached.block == this_entry.block) this_cached.block = none;
+  }
+  this_block = block{};
+  free_blocks.emplace_back(this_entry.block);
+}
+
+void message_store::thaw_block(uint32_t const index) {
+  /// Decompress every live text in a block back to the hot tier as the least recently used, and free the block
+  std::span<std::byte const> const data{load_block(index)};
+  auto &this_block{blocks[index]};
+  for(auto it{this_block.members.rbegin()}; it != this_block.members.rend(); ++it) { // most recently frozen first, so they end up oldest first
+    handle const id{*it};
+    auto &this_entry{entries[id]};
+    if(this_entry.state != states::cold || this_entry.block != index) continue; // released, or reused for another text since
+    this_entry.text.assign(reinterpret_cast<char const*>(data.data()) + this_entry.offset, this_entry.length);
+    this_entry.state = states::hot;
+    this_entry.newer = oldest;                                                  // link at the old end of the list
+    this_entry.older = none;
+    if(oldest == none) {
+      newest = id;
+    } else {
+      entries[oldest].older = id;
+    }
+    oldest = id;
+    stats.cold_count--;
+    stats.cold_bytes -= this_entry.length;
+    stats.hot_count++;
+    stats.hot_bytes += this_entry.length;
+  }
+  stats.compressed_bytes -= this_block.compressed.size();
+  for(auto &this_cached : cache) {
+    if(this_cached.block == index) this_cached.block = none;
+  }
+  this_block = block{};
+  free_blocks.emplace_back(index);
+}
+
+std::span<std::byte const> message_store::load_block(uint32_t const index) {
+  /// Return the uncompressed contents of a cold block, from the cache or by decompressing it over the least recently used cache entry
+  auto const &this_block{blocks[index]};
+  ++cache_clock;
+  for(auto &this_cached : cache) {
+    if(this_cached.block != index) continue;
+    this_cached.last_used = cache_clock;
+    return {this_cached.data.data(), this_block.raw_size};
+  }
+
+  if(cache.size() < cache_capacity) cache.emplace_back();
+  auto &target{*std::min_element(cache.begin(), cache.end(), [](cached_block const &lhs, cached_block const &rhs){return lhs.last_used < rhs.last_used;})};
+  target.block = index;
+  target.last_used = cache_clock;
+  target.data.resize(this_block.raw_size);
+  if(!lz4_block::decompress(this_block.compressed, target.data, dictionary)) {
+    std::cerr << "ERROR: message_store block " << index << " failed to decompress" << std::endl;
+    std::fill(target.data.begin(), target.data.end(), std::byte{0});
+  }
+  return {target.data.data(), this_block.raw_size};
+}
+
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace chat {
+
+class message_store {
+  /// Tiered storage for message texts, compressing those not used recently.
+  ///
+  /// Texts start hot, as individual strings on an LRU list.  Texts not read or
+  /// written for a number of maintain() calls are frozen together into blocks
+  /// compressed with LZ4 against a shared dictionary, which is sampled from the
+  /// first texts frozen.  Reading a cold text decompresses its whole block into
+  /// a small LRU cache, so scrolling through old history costs one decompression
+  /// per block rather than per message.
+  ///
+  /// Views returned by get() are only valid until the next call into the store.
+public:
+  using handle = uint32_t;
+
+  struct statistics {
+    size_t hot_count{0};
+    size_t hot_bytes{0};
+    size_t cold_count{0};
+    size_t cold_bytes{0};                                                       // uncompressed size of live cold texts
+    size_t compressed_bytes{0};                                                 // size of all cold blocks, including dead texts not yet purged
+    size_t cached_blocks{0};
+  };
+
+private:
+  static uint32_t constexpr none{UINT32_MAX};
+
+  enum class states : uint8_t {
+    free,
+    hot,
+    cold,
+  };
+
+  struct entry {
+    std::string text;                                                           // only while hot
+    handle newer{none};                                                         // hot LRU list links; next free entry while free
+    handle older{none};
+    uint32_t last_used{0};                                                      // generation of the last read or write
+    uint32_t block{0};                                                          // location while cold
+    uint32_t offset{0};
+    uint32_t length{0};
+    states state{states::free};
+  };
+
+  struct block {
+    std::vector<std::byte> compressed;
+    std::vector<handle> members;                                                // entries frozen into this block, some possibly dead since
+    uint32_t raw_size{0};
+    uint32_t live_bytes{0};                                                     // uncompressed size of members still cold here
+    uint32_t live_count{0};
+  };
+
+  struct cached_block {
+    uint32_t block{none};
+    uint64_t last_used{0};
+    std::vector<std::byte> data;                                                // reused between blocks to avoid reallocating
+  };
+
+  std::vector<entry> entries;
+  handle first_free{none};
+  handle newest{none};                                                          // hot LRU list, most recently used first
+  handle oldest{none};
+  std::vector<block> blocks;
+  std::vector<uint32_t> free_blocks;
+  std::vector<std::byte> dictionary;                                            // fixed once the first block is frozen, as every block depends on it
+  std::vector<cached_block> cache;
+  uint64_t cache_clock{0};
+  uint32_t generation{0};
+  statistics stats;
+
+  uint32_t cold_after;                                                          // maintain() calls without use before a text may be frozen
+  size_t block_size;                                                            // target uncompressed size of each block
+  size_t cache_capacity;                                                        // decompressed blocks kept
+
+  static size_t constexpr dictionary_size{32 * 1024};
+  static size_t constexpr dictionary_sample_size{256};                          // taken from the start of each text, where boilerplate is most common
+
+public:
+  explicit message_store(uint32_t cold_after = 600, size_t block_size = 64 * 1024, size_t cache_capacity = 32);
+
+  handle add(std::string &&text);
+  std::string_view get(handle id);
+  void set(handle id, std::string &&text);
+  void remove(handle id);
+
+  void maintain();
+  statistics get_statistics() const;
+
+private:
+  handle allocate();
+  void link_newest(handle id);
+  void unlink(handle id);
+  void freeze(std::vector<handle> const &batch, size_t raw_size);
+  void release_cold(handle id);
+  void thaw_block(uint32_t index);
+  std::span<std::byte const> load_block(uint32_t index);
+};
+
+}
@@ -0,0 +1,467 @@
+#include "provider.h"
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <iostream>
+#include <memory>
+#include "chat/image.h"
+
+namespace chat {
+
+namespace {
+
+std::string const completions_url{"https://api.openai.com/v1/chat/completions"};
+std::string const models_url{"https://api.openai.com/v1/models"};
+uint32_t constexpr max_completion_tokens{2048};
+
+using clock = std::chrono::steady_clock;
+
+float milliseconds_between(clock::time_point const from, clock::time_point const to) {
+  /// Duration between two times in milliseconds
+  return std::chrono::duration<float, std::milli>(to - from).count();
+}
+
+std::optional<std::string> get_message_text(nlohmann::json const &message) {
+  /// The text of a message, whether its content is a string or a list of text parts; nothing if it has any other kind of part
+  auto const content{message.find("content")};
+  if(content == message.end() || content->is_null()) return std::string{};
+  if(content->is_string()) return content->get<std::string>();
+  if(!content->is_array()) return std::nullopt;
+  std::string text;
+  for(auto const &part : *content) {
+    if(part.value("type", "") != "text") return std::nullopt;
+    text += part.value("text", "");
+  }
+  return text;
+}
+
+} // anonymous namespace
+
+provider::~provider() = default;
+
+void provider::warm_up() {
+  /// Prepare for a request that's likely to follow soon; nothing to do for most backends
+}
+
+openai_provider::openai_provider(rate_limiter &this_limiter, emscripten_fetch_manager &this_fetcher, std::string const &this_api_key)
+  : limiter{this_limiter},
+    fetcher{this_fetcher},
+    api_key{this_api_key} {
+  /// Send requests through a rate limiter, authorised with a key that may change later
+}
+
+bool openai_provider::can_serve(nlohmann::json const &/*request*/) const {
+  /// The API accepts every request the interface builds
+  return true;
+}
+
+void openai_provider::complete(nlohmann::json const &/*request*/, std::string &&body, success_callback &&on_success, error_callback &&on_error) {
+  /// Post a request body to the chat completions endpoint
+  auto const estimated_tokens{estimate_tokens(body)};
+  auto const timing{std::make_shared<emscripten_fetch_manager::timings>()};
+  limiter.fetch({
+    .method{"POST"},
+    .url{completions_url},
+    .headers{
+      "Content-Type", "application/json",
+      "Authorization", "Bearer " + api_key,
+    },
+    .body{std::move(body)},
+    .on_success{[on_success = std::move(on_success), timing](unsigned short /*status*/, std::span<std::byte const> data){
+      on_success({
+        .response{reinterpret_cast<char const*>(data.data()), data.size()},
+        .timing{*timing},
+        .local{false},
+      });
+    }},
+    .on_error{[on_error = std::move(on_error)](unsigned short status, std::string_view status_text, std::span<std::byte const> data){
+      on_error(status, std::string{status_text} + ", " + std::string{reinterpret_cast<char const*>(data.data()), data.size()});
+    }},
+    .attributes{EMSCRIPTEN_FETCH_LOAD_TO_MEMORY | EMSCRIPTEN_FETCH_REPLACE},
+    .on_timings{[timing](emscripten_fetch_manager::timings const &this_timing){
+      *timing = this_timing;
+    }},
+  }, estimated_tokens);
+}
+
+void openai_provider::warm_up() {
+  /// Open a connection to the API with a cheap request, once for each key, so the next completion doesn't pay for it
+  if(api_key.empty() || api_key == warmed_key) return;
+  warmed_key = api_key;
+  limiter.fetch({                                                               // admitted like any other request, as it counts against the same limits
+    .method{"GET"},
+    .url{models_url},
+    .headers{
+      "Authorization", "Bearer " + api_key,
+    },
+    .on_success{[](unsigned short /*status*/, std::span<std::byte const> /*data*/){}},
+    .on_error{[](unsigned short /*status*/, std::string_view /*status_text*/, std::span<std::byte const> /*data*/){}}, // a bad key is reported by the real request
+    .attributes{EMSCRIPTEN_FETCH_LOAD_TO_MEMORY | EMSCRIPTEN_FETCH_REPLACE},
+    .on_timings{[this](emscripten_fetch_manager::timings const &timing){
+      fetcher.record_warm_up(timing);
+    }},
+  }, 0);
+}
+
+uint32_t openai_provider::estimate_tokens(std::string_view body) {
+  /// Rough upper bound on the tokens a completion request will use, for rate limiting: about four bytes of JSON per token, plus the reply, with images costed by tiles rather than size
+  size_t text_size{body.size()};
+  uint32_t image_tokens{0};
+  for(size_t position{body.find(";base64,")}; position != std::string_view::npos; position = body.find(";base64,", position)) {
+    size_t const end{std::min(body.find('"', position), body.size())};
+    text_size -= end - position;
+    image_tokens += image::max_tokens;
+    position = end;
+  }
+  return static_cast<uint32_t>(text_size / 4) + image_tokens + max_completion_tokens;
+}
+
+void local_provider::load(emscripten_fetch_manager &fetcher, std::string const &model_url, unsigned int const max_context) {
+  /// Download and parse a GGUF model file, replacing any model already loaded
+  for(auto &pending : jobs) {
+    pending.on_error(503, "the local model is being replaced");
+  }
+  jobs.clear();
+  model.reset();
+  state = states::loading;
+  status = "Loading " + model_url + "...";
+  url = model_url;
+  fetcher.fetch({
+    .url{url},
+    .on_success{},                                                              // on_success_owned instead
+    .on_error{[this](unsigned short error_status, std::string_view status_text, std::span<std::byte const> /*data*/){
+      state = states::failed;
+      status = "Failed to download " + url + ": " + std::to_string(error_status) + " " + std::string{status_text};
+      std::cerr << "ERROR: " << status << std::endl;
+    }},
+    .attributes{EMSCRIPTEN_FETCH_LOAD_TO_MEMORY | EMSCRIPTEN_FETCH_PERSIST_FILE}, // keep the model in IndexedDB, as it's large and rarely changes
+    .on_success_owned{[this, max_context](unsigned short /*status*/, emscripten_fetch_manager::response &&data, size_t const size){
+      auto const start_time{clock::now()};
+      auto parsed{gguf::load(std::move(data), size)};                           // the model keeps the downloaded buffer, rather than a copy of it
+      auto loaded{parsed ? local_model::load(std::move(*parsed), max_context) : std::unexpected{parsed.error()}};
+      if(!loaded) {
+        state = states::failed;
+        status = "Failed to load " + url + ": " + loaded.error();
+        std::cerr << "ERROR: " << status << std::endl;
+        return;
+      }
+      model.emplace(std::move(*loaded));
+      auto const &vocabulary{model->get_tokenizer()};
+      auto const im_end{vocabulary.find("<|im_end|>")};
+      chat_markup = vocabulary.find("<|im_start|>") && im_end;
+      stop_tokens = {vocabulary.get_eos()};
+      if(chat_markup) stop_tokens.emplace_back(*im_end);
+      auto const &parameters{model->get_parameters()};
+      state = states::ready;
+      status = model->get_name() + ": " + std::to_string(parameters.layers) + " layers, " + std::to_string(parameters.embedding) + " wide, "
+             + std::to_string(model->get_file_size() >> 20) + "MB, " + std::to_string(parameters.context) + " token context, parsed in "
+             + std::to_string(static_cast<int>(milliseconds_between(start_time, clock::now()))) + "ms";
+    }},
+  });
+}
+
+void local_provider::update() {
+  /// Evaluate queued requests until this frame's time budget is spent, always making some progress
+  if(!model || jobs.empty()) return;
+  auto const deadline{clock::now() + std::chrono::duration_cast<clock::duration>(std::chrono::duration<float, std::milli>{frame_budget_ms})};
+  do {
+    if(step(jobs.front())) jobs.pop_front();
+  } while(!jobs.empty() && clock::now() < deadline);
+  stats.queued = jobs.size();
+}
+
+bool local_provider::can_serve(nlohmann::json const &request) const {
+  /// Whether the model is loaded, the request needs nothing beyond plain text generation, and its prompt fits the context
+  return make_prompt(request).has_value();
+}
+
+void local_provider::complete(nlohmann::json const &request, std::string &&/*body*/, success_callback &&on_success, error_callback &&on_error) {
+  /// Queue a request for generation in update()
+  enqueue(request, make_prompt(request), std::move(on_success), std::move(on_error));
+}
+
+bool local_provider::accepts(nlohmann::json const &request) const {
+  /// Whether the model is loaded and the request needs nothing beyond plain text generation, checked without tokenising it
+  if(!model) return false;
+  if(auto const tools{request.find("tools")}; tools != request.end() && !tools->empty()) return false;
+  if(request.value("n", 1) != 1) return false;
+  if(auto const format{request.find("response_format")}; format != request.end() && format->value("type", "text") != "text") return false;
+  return true;
+}
+
+void local_provider::enqueue(nlohmann::json const &request, std::optional<std::vector<tokenizer::token>> &&prompt, success_callback &&on_success, error_callback &&on_error) {
+  /// Queue a request with the prompt make_prompt() built for it, failing it if there was none
+  if(!model || !prompt) {
+    on_error(400, "the local model can't serve this request");
+    return;
+  }
+  jobs.emplace_back(job{
+    .prompt{std::move(*prompt)},
+    .evaluated{0},
+    .reused{0},
+    .generated{},
+    .max_tokens{request.value("max_tokens", max_completion_tokens)},
+    .temperature{request.value("temperature", 1.0f)},
+    .top_p{request.value("top_p", 1.0f)},
+    .on_success{std::move(on_success)},
+    .on_error{std::move(on_error)},
+    .submitted{clock::now()},
+  });
+  stats.queued = jobs.size();
+}
+
+local_provider::states local_provider::get_state() const {
+  /// Whether a model is loaded
+  return state;
+}
+
+std::string const &local_provider::get_status() const {
+  /// Description of the loaded model, or why it couldn't be loaded
+  return status;
+}
+
+std::optional<std::string_view> local_provider::get_model_name() const {
+  /// Name of the loaded model, as reported in responses
+  if(!model) return std::nullopt;
+  return model->get_name();
+}
+
+float local_provider::get_frame_budget_ms() const {
+  /// Time spent generating each frame
+  return frame_budget_ms;
+}
+
+void local_provider::set_frame_budget_ms(float const new_budget) {
+  /// Set the time spent generating each frame
+  frame_budget_ms = new_budget;
+}
+
+local_provider::statistics const &local_provider::get_statistics() const {
+  /// Queue length, token counts and recent speeds
+  return stats;
+}
+
+std::optional<std::vector<tokenizer::token>> local_provider::make_prompt(nlohmann::json const &request) const {
+  /// Format a request's messages with the model's chat markup and tokenize them, ending with the assistant's turn, if the model can serve it
+  if(!accepts(request)) return std::nullopt;
+  auto const messages{request.find("messages")};
+  if(messages == request.end() || !messages->is_array()) return std::nullopt;
+  std::string text;
+  for(auto const &message : *messages) {
+    std::string const role{message.value("role", "")};
+    if(role != "system" && role != "user" && role != "assistant") return std::nullopt;
+    auto const content{get_message_text(message)};
+    if(!content) return std::nullopt;
+    if(chat_markup) {
+      text += "<|im_start|>" + role + '\n' + *content + "<|im_end|>\n";
+    } else {
+      text += "<|" + role + "|>\n" + *content + "</s>\n";
+    }
+  }
+  text += chat_markup ? "<|im_start|>assistant\n" : "<|assistant|>\n";
+  auto const &vocabulary{model->get_tokenizer()};
+  std::vector<tokenizer::token> tokens{vocabulary.get_bos()};
+  vocabulary.encode(text, tokens);
+  if(tokens.size() >= model->get_parameters().context) return std::nullopt;
+  return tokens;
+}
+
+bool local_provider::step(job &current) {
+  /// Evaluate a batch of a job's prompt or one generated token, returning whether the job is finished
+  auto &this_model{*model};
+  if(!current.started) {
+    current.started = clock::now();
+    current.reused = this_model.reuse_prefix(current.prompt);                   // the previous request's cache usually covers the earlier turns
+    current.evaluated = current.reused;
+  }
+  std::span<float const> logits;
+  if(current.evaluated != current.prompt.size()) {
+    size_t const count{std::min(local_model::batch_size, current.prompt.size() - current.evaluated)};
+    bool const last{current.evaluated + count == current.prompt.size()};
+    logits = this_model.evaluate(std::span{current.prompt}.subspan(current.evaluated, count), last); // only the last prompt position's predictions are wanted
+    current.evaluated += count;
+    if(!last) return false;
+    current.prompt_done = clock::now();
+  } else {
+    if(this_model.get_position() == this_model.get_parameters().context) {
+      finish(current, "length");
+      return true;
+    }
+    logits = this_model.evaluate(current.generated.back(), true);
+  }
+  tokenizer::token const next{sample(logits, current.temperature, current.top_p)};
+  if(std::ranges::find(stop_tokens, next) != stop_tokens.end()) {
+    finish(current, "stop");
+    return true;
+  }
+  current.generated.emplace_back(next);
+  if(current.generated.size() >= current.max_tokens) {
+    finish(current, "length");
+    return true;
+  }
+  return false;
+}
+
+tokenizer::token local_provider::sample(std::span<float const> logits, float const temperature, float const top_p) {
+  /// Choose the next token: the most likely at zero temperature, otherwise at random from the smallest set whose probability reaches top_p
+  auto const most_likely{std::ranges::max_element(logits)};
+  if(temperature <= 0.0f) return static_cast<tokenizer::token>(most_likely - logits.begin());
+  candidates.clear();
+  float total{0.0f};
+  for(size_t i{0}; i != logits.size(); ++i) {
+    float const weight{std::exp((logits[i] - *most_likely) / temperature)};
+    candidates.emplace_back(weight, static_cast<tokenizer::token>(i));
+    total += weight;
+  }
+  if(top_p < 1.0f) {
+    std::ranges::sort(candidates, std::greater{});
+    float kept{0.0f};
+    size_t count{0};
+    while(count != candidates.size() && kept < top_p * total) {
+      kept += candidates[count++].first;
+    }
+    candidates.resize(count);
+    total = kept;
+  }
+  float remaining{std::uniform_real_distribution<float>{0.0f, total}(random)};
+  for(auto const &[weight, id] : candidates) {
+    remaining -= weight;
+    if(remaining <= 0.0f) return id;
+  }
+  return candidates.back().second;                                              // rounding left a little over
+}
+
+void local_provider::finish(job &current, std::string_view finish_reason) {
+  /// Report a finished job's reply as a chat completion response
+  auto const now{clock::now()};
+  auto const &vocabulary{model->get_tokenizer()};
+  std::string text;
+  for(tokenizer::token const id : current.generated) {
+    vocabulary.decode(id, text);
+  }
+  size_t const prompt_tokens{current.prompt.size()};
+  size_t const completion_tokens{current.generated.size()};
+  nlohmann::json const response = {
+    {"id", "local-" + std::to_string(next_response_id++)},
+    {"object", "chat.completion"},
+    {"created", std::time(nullptr)},
+    {"model", model->get_name()},
+    {"choices", {{
+      {"index", 0},
+      {"message", {
+        {"role", "assistant"},
+        {"content", std::move(text)},
+      }},
+      {"finish_reason", finish_reason},
+    }}},
+    {"usage", {
+      {"prompt_tokens", prompt_tokens},
+      {"completion_tokens", completion_tokens},
+      {"total_tokens", prompt_tokens + completion_tokens},
+      {"prompt_tokens_details", {
+        {"cached_tokens", current.reused},
+      }},
+    }},
+  };
+  response_buffer = response.dump();
+
+  clock::time_point const prompt_done{current.prompt_done.value_or(now)};
+  float const prompt_ms{milliseconds_between(*current.started, prompt_done)};
+  float const generation_ms{milliseconds_between(prompt_done, now)};
+  ++stats.completed;
+  stats.prompt_tokens += prompt_tokens;
+  stats.reused_tokens += current.reused;
+  stats.generated_tokens += completion_tokens;
+  stats.prompt_tokens_per_second = prompt_ms > 0.0f ? static_cast<float>(prompt_tokens - current.reused) * 1000.0f / prompt_ms : 0.0f;
+  stats.generated_tokens_per_second = generation_ms > 0.0f ? static_cast<float>(completion_tokens) * 1000.0f / generation_ms : 0.0f;
+
+  auto const on_success{std::move(current.on_success)};                         // the callback may queue another job
+  on_success({
+    .response{response_buffer},
+    .timing{
+      .time_to_first_byte_ms{milliseconds_between(current.submitted, prompt_done)}, // until the first token, as a stream would deliver it
+      .total_ms{milliseconds_between(current.submitted, now)},
+    },
+    .local{true},
+  });
+}
+
+router::router(provider &this_remote, local_provider &this_local)
+  : remote{this_remote},
+    local{this_local} {
+  /// Route between the API and a local model, remotely until told otherwise
+}
+
+bool router::can_serve(nlohmann::json const &request) const {
+  /// Whether the chosen backend for a request could serve it
+  if(mode == modes::local) return local.can_serve(request);
+  return true;
+}
+
+void router::complete(nlohmann::json const &request, std::string &&body, success_callback &&on_success, error_callback &&on_error) {
+  /// Send a request to the backend the mode chooses, retrying locally if the API was unreachable
+  bool const local_capable{local.accepts(request)};                             // cheap, so requests that stay remote aren't tokenised
+  std::optional<std::vector<tokenizer::token>> prompt;
+  if(local_capable && mode != modes::remote) prompt = local.make_prompt(request); // tokenised once, and handed over if the local model serves it
+  bool const use_local{
+    mode == modes::local ||
+    (mode == modes::automatic && prompt && prompt->size() <= max_local_prompt_tokens)
+  };
+  if(use_local) {
+    ++stats.local;
+    local.enqueue(request, std::move(prompt), std::move(on_success), std::move(on_error));
+    return;
+  }
+  ++stats.remote;
+  if(!local_capable) {
+    remote.complete(request, std::move(body), std::move(on_success), std::move(on_error));
+    return;
+  }
+  remote.complete(request, std::move(body), success_callback{on_success}, [this, request, on_success, on_error = std::move(on_error)](unsigned short error_status, std::string_view message) mutable {
+    if(error_status != 0) {                                                     // only when offline, as other errors would recur on retry
+      on_error(error_status, message);
+      return;
+    }
+    auto fallback_prompt{local.make_prompt(request)};                           // tokenised only on this rare path, with whichever model is loaded by now
+    if(!fallback_prompt) {
+      on_error(error_status, message);
+      return;
+    }
+    std::cerr << "ERROR calling API, falling back to the local model: " << message << std::endl;
+    ++stats.fallbacks;
+    ++stats.local;
+    local.enqueue(request, std::move(fallback_prompt), std::move(on_success), std::move(on_error));
+  });
+}
+
+void router::warm_up() {
+  /// Warm up the API unless every request is going to the local model
+  if(mode != modes::local) remote.warm_up();
+}
+
+router::modes router::get_mode() const {
+  /// How requests are routed
+  return mode;
+}
+
+void router::set_mode(modes const new_mode) {
+  /// Choose how requests are routed
+  mode = new_mode;
+}
+
+unsigned int router::get_max_local_prompt_tokens() const {
+  /// Longest prompt sent to the local model in automatic mode
+  return max_local_prompt_tokens;
+}
+
+void router::set_max_local_prompt_tokens(unsigned int const new_max) {
+  /// Set the longest prompt sent to the local model in automatic mode
+  max_local_prompt_tokens = new_max;
+}
+
+router::statistics const &router::get_statistics() const {
+  /// Requests sent each way
+  return stats;
+}
+
+}
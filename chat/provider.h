@@ -0,0 +1,171 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "chat/local_model.h"
+#include "chat/rate_limiter.h"
+#include "emscripten_fetch_manager.h"
+
+namespace chat {
+
+class provider {
+  /// A backend that answers chat completion requests, taking and returning the OpenAI format whatever it runs on
+public:
+  struct result {
+    std::string_view response;                                                  // a chat completion response body
+    emscripten_fetch_manager::timings timing;
+    bool local{false};                                                          // generated in the browser, so not worth caching
+  };
+
+  using success_callback = std::function<void(result const &completion)>;
+  using error_callback = std::function<void(unsigned short status, std::string_view message)>; // status 0 when the server couldn't be reached
+
+  virtual ~provider();
+
+  virtual bool can_serve(nlohmann::json const &request) const = 0;
+  virtual void complete(nlohmann::json const &request, std::string &&body, success_callback &&on_success, error_callback &&on_error) = 0;
+  virtual void warm_up();
+};
+
+class openai_provider final : public provider {
+  /// The OpenAI chat completions API, admitted through the shared rate limiter
+  rate_limiter &limiter;
+  emscripten_fetch_manager &fetcher;                                            // for warm-up statistics
+  std::string const &api_key;
+  std::string warmed_key;                                                       // the key the connection was last warmed up with
+
+public:
+  openai_provider(rate_limiter &limiter, emscripten_fetch_manager &fetcher, std::string const &api_key);
+
+  virtual bool can_serve(nlohmann::json const &request) const override final;
+  virtual void complete(nlohmann::json const &request, std::string &&body, success_callback &&on_success, error_callback &&on_error) override final;
+  virtual void warm_up() override final;
+
+  static uint32_t estimate_tokens(std::string_view body);
+};
+
+class local_provider final : public provider {
+  /// A small llama-family model run in the browser, for short text-only requests and for working offline.
+  ///
+  /// Requests are queued, and update() evaluates tokens until its per-frame
+  /// time budget is spent, so generation never stalls the interface; a
+  /// prompt is evaluated a batch of positions at a time.  The key and value
+  /// cache is kept between requests, so a conversation that grows by a turn
+  /// only evaluates the new messages.
+public:
+  enum class states {
+    empty,
+    loading,
+    ready,
+    failed,
+  };
+
+  struct statistics {
+    size_t queued{0};
+    uint64_t completed{0};
+    uint64_t prompt_tokens{0};
+    uint64_t reused_tokens{0};                                                  // prompt tokens whose keys and values were already cached
+    uint64_t generated_tokens{0};
+    float prompt_tokens_per_second{0.0f};                                       // of the most recent request
+    float generated_tokens_per_second{0.0f};
+  };
+
+private:
+  struct job {
+    std::vector<tokenizer::token> prompt;
+    size_t evaluated{0};                                                        // prompt tokens in the cache so far
+    size_t reused{0};
+    std::vector<tokenizer::token> generated;
+    unsigned int max_tokens;
+    float temperature;
+    float top_p;
+    success_callback on_success;
+    error_callback on_error;
+    std::chrono::steady_clock::time_point submitted;
+    std::optional<std::chrono::steady_clock::time_point> started{};             // when the first token was evaluated
+    std::optional<std::chrono::steady_clock::time_point> prompt_done{};         // when the first generated token was sampled
+  };
+
+  std::optional<local_model> model;
+  states state{states::empty};
+  std::string status;                                                           // why loading failed, or what was loaded
+  std::string url;                                                              // kept for the fetch, which refers to it
+  bool chat_markup{false};                                                      // ChatML rather than Zephyr-style prompts
+  std::vector<tokenizer::token> stop_tokens;
+  std::deque<job> jobs;
+  std::mt19937 random{std::random_device{}()};
+  std::vector<std::pair<float, tokenizer::token>> candidates;                   // scratch for nucleus sampling
+  std::string response_buffer;                                                  // the last response, which callbacks view
+  uint64_t next_response_id{0};
+  float frame_budget_ms{8.0f};
+  statistics stats;
+
+public:
+  void load(emscripten_fetch_manager &fetcher, std::string const &model_url, unsigned int max_context = 2048);
+  void update();
+
+  virtual bool can_serve(nlohmann::json const &request) const override final;
+  virtual void complete(nlohmann::json const &request, std::string &&body, success_callback &&on_success, error_callback &&on_error) override final;
+
+  bool accepts(nlohmann::json const &request) const;
+  std::optional<std::vector<tokenizer::token>> make_prompt(nlohmann::json const &request) const;
+  void enqueue(nlohmann::json const &request, std::optional<std::vector<tokenizer::token>> &&prompt, success_callback &&on_success, error_callback &&on_error);
+
+  states get_state() const;
+  std::string const &get_status() const;
+  std::optional<std::string_view> get_model_name() const;
+  float get_frame_budget_ms() const;
+  void set_frame_budget_ms(float new_budget);
+  statistics const &get_statistics() const;
+
+private:
+  bool step(job &current);
+  tokenizer::token sample(std::span<float const> logits, float temperature, float top_p);
+  void finish(job &current, std::string_view finish_reason);
+};
+
+class router final : public provider {
+  /// Chooses between the API and the local model for each request, falling back to the local model when the API can't be reached
+public:
+  enum class modes {
+    remote,
+    local,
+    automatic,                                                                  // local for short requests it can serve, remote otherwise
+  };
+
+  struct statistics {
+    uint64_t remote{0};
+    uint64_t local{0};
+    uint64_t fallbacks{0};                                                      // of the local requests, those sent remotely first
+  };
+
+private:
+  provider &remote;
+  local_provider &local;
+  modes mode{modes::remote};
+  unsigned int max_local_prompt_tokens{256};
+  statistics stats;
+
+public:
+  router(provider &remote, local_provider &local);
+
+  virtual bool can_serve(nlohmann::json const &request) const override final;
+  virtual void complete(nlohmann::json const &request, std::string &&body, success_callback &&on_success, error_callback &&on_error) override final;
+  virtual void warm_up() override final;
+
+  modes get_mode() const;
+  void set_mode(modes new_mode);
+  unsigned int get_max_local_prompt_tokens() const;
+  void set_max_local_prompt_tokens(unsigned int new_max);
+  statistics const &get_statistics() const;
+};
+
+}
@@ -0,0 +1,122 @@
+#include "rate_limiter.h"
+#include <algorithm>
+#include <iostream>
+
+namespace chat {
+
+rate_limiter::rate_limiter(emscripten_fetch_manager &this_fetcher)
+  : rate_limiter{this_fetcher, limits{}} {
+  /// Construct with default limits
+}
+
+rate_limiter::rate_limiter(emscripten_fetch_manager &this_fetcher, limits const &this_config)
+  : fetcher{this_fetcher},
+    config{this_config},
+    request_budget{this_config.requests_per_minute},
+    token_budget{this_config.tokens_per_minute} {
+  /// Construct with the given limits, starting with full buckets
+}
+
+void rate_limiter::fetch(emscripten_fetch_manager::request_params &&params, uint32_t const estimated_tokens) {
+  /// Queue a request, starting it now if the limits allow
+  queue.emplace_back(std::make_shared<pending>(pending{
+    .method{std::move(params.method)},
+    .url{params.url},                                                           // the params only hold a reference, which won't outlive the call
+    .headers{std::move(params.headers)},
+    .body{params.shared_body ? std::move(params.shared_body) : std::make_shared<std::string const>(std::move(params.body))},
+    .on_success{std::move(params.on_success)},
+    .on_error{std::move(params.on_error)},
+    .on_timings{std::move(params.on_timings)},
+    .attributes{params.attributes},
+    .tokens{estimated_tokens},
+    .attempts{0},
+    .submitted{clock::now()},
+  }));
+  update();
+}
+
+void rate_limiter::update() {
+  /// Start queued requests in order while the limits allow; call once a frame
+  auto const now{clock::now()};
+  refill(now);
+  stats.queued = queue.size();
+  if(now < paused_until) return;
+  while(!queue.empty() && stats.in_flight < config.max_in_flight && request_budget >= 1.0f) {
+    auto const &next{queue.front()};
+    float const tokens{std::min(static_cast<float>(next->tokens), config.tokens_per_minute)}; // a request larger than the whole bucket waits for a full one
+    if(token_budget < tokens) break;                                            // strictly in order, so big requests aren't starved by small ones
+    request_budget -= 1.0f;
+    token_budget -= tokens;
+    auto const request{next};
+    queue.pop_front();
+    start(request, now);
+  }
+  stats.queued = queue.size();
+}
+
+rate_limiter::limits const &rate_limiter::get_limits() const {
+  /// Return the current limits
+  return config;
+}
+
+void rate_limiter::set_limits(limits const &new_config) {
+  /// Change the limits, keeping the buckets within their new capacity
+  config = new_config;
+  request_budget = std::min(request_budget, config.requests_per_minute);
+  token_budget = std::min(token_budget, config.tokens_per_minute);
+}
+
+rate_limiter::statistics const &rate_limiter::get_statistics() const {
+  /// Return queue and throughput counters
+  return stats;
+}
+
+void rate_limiter::refill(clock::time_point const now) {
+  /// Top up the buckets in proportion to the time since the last refill
+  float const minutes{std::chrono::duration<float, std::ratio<60>>{now - last_refill}.count()};
+  last_refill = now;
+  request_budget = std::min(request_budget + minutes * config.requests_per_minute, config.requests_per_minute);
+  token_budget = std::min(token_budget + minutes * config.tokens_per_minute, config.tokens_per_minute);
+}
+
+void rate_limiter::start(std::shared_ptr<pending> const &request, clock::time_point const now) {
+  /// Send a request, retrying it later if the server asks us to slow down
+  ++stats.in_flight;
+  ++stats.started;
+  stats.last_wait_ms = std::chrono::duration<float, std::milli>{now - request->submitted}.count();
+  fetcher.fetch({
+    .method{request->method},
+    .url{request->url},
+    .headers{request->headers},
+    .shared_body{request->body},                                                // shared rather than copied, as a retry needs it again
+    .on_success{[this, request](unsigned short status, std::span<std::byte const> data){
+      --stats.in_flight;
+      backoff = {};
+      request->on_success(status, data);
+    }},
+    .on_error{[this, request](unsigned short status, std::string_view status_text, std::span<std::byte const> data){
+      --stats.in_flight;
+      if((status == 429 || status >= 500) && request->attempts + 1 < max_attempts) {
+        std::cerr << "ERROR: Request to " << request->url << " failed with " << status << ", retrying" << std::endl;
+        retry_later(request);
+        return;
+      }
+      request->on_error(status, status_text, data);
+    }},
+    .attributes{request->attributes},
+    .on_timings{request->on_timings},                                           // of each attempt, so the last one seen is the one that succeeded
+  });
+}
+
+void rate_limiter::retry_later(std::shared_ptr<pending> const &request) {
+  /// Requeue a request at the front, pausing all admission for the current backoff
+  ++request->attempts;
+  ++stats.retried;
+  backoff = backoff == clock::duration{} ? initial_backoff : std::min(backoff * 2, max_backoff);
+  paused_until = clock::now() + backoff;
+  request->submitted = clock::now();
+  queue.emplace_front(request);
+  stats.queued = queue.size();
+}
+
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include "emscripten_fetch_manager.h"
+
+namespace chat {
+
+class rate_limiter {
+  /// Shared admission control for API requests, keeping every session within the account's rate limits.
+  ///
+  /// Requests are started while token buckets for requests and tokens per
+  /// minute have room and fewer than max_in_flight are outstanding; the rest
+  /// wait in submission order until update() finds room.  Rate limiting (429)
+  /// and server error responses are retried with exponential backoff, which
+  /// pauses admission for everyone, as the limits are per account rather than
+  /// per session.
+public:
+  using clock = std::chrono::steady_clock;
+
+  struct limits {
+    float requests_per_minute{500.0f};
+    float tokens_per_minute{30'000.0f};
+    unsigned int max_in_flight{32};
+  };
+
+  struct statistics {
+    size_t queued{0};
+    unsigned int in_flight{0};
+    uint64_t started{0};
+    uint64_t retried{0};
+    float last_wait_ms{0.0f};                                                   // queueing delay of the most recently started request
+  };
+
+private:
+  struct pending {                                                              // a copy of the request parameters, kept for retries
+    std::string method;
+    std::string url;
+    std::vector<std::string> headers;
+    std::shared_ptr<std::string const> body;                                    // shared with each attempt in flight
+    std::function<void(unsigned short status, std::span<std::byte const> data)> on_success;
+    std::function<void(unsigned short status, std::string_view status_text, std::span<std::byte const> data)> on_error;
+    std::function<void(emscripten_fetch_manager::timings const &timing)> on_timings;
+    uint32_t attributes;
+    uint32_t tokens;
+    unsigned int attempts{0};
+    clock::time_point submitted;
+  };
+
+  emscripten_fetch_manager &fetcher;
+  limits config;
+  std::deque<std::shared_ptr<pending>> queue;
+  float request_budget;
+  float token_budget;
+  clock::time_point last_refill{clock::now()};
+  clock::time_point paused_until{};
+  clock::duration backoff{};
+  statistics stats;
+
+  static unsigned int constexpr max_attempts{5};
+  static clock::duration constexpr initial_backoff{std::chrono::seconds{1}};
+  static clock::duration constexpr max_backoff{std::chrono::seconds{32}};
+
+public:
+  explicit rate_limiter(emscripten_fetch_manager &fetcher);
+  rate_limiter(emscripten_fetch_manager &fetcher, limits const &config);
+
+  void fetch(emscripten_fetch_manager::request_params &&params, uint32_t estimated_tokens);
+  void update();
+
+  limits const &get_limits() const;
+  void set_limits(limits const &new_config);
+  statistics const &get_statistics() const;
+
+private:
+  void refill(clock::time_point now);
+  void start(std::shared_ptr<pending> const &request, clock::time_point now);
+  void retry_later(std::shared_ptr<pending> const &request);
+};
+
+}
@@ -0,0 +1,692 @@
+#include "search_index.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <optional>
+
+namespace chat {
+
+namespace {
+
+float constexpr bm25_k1{1.2f};
+float constexpr bm25_b{0.75f};
+
+struct occurrence {
+  uint32_t position{0};                                                         // token index within the document
+  uint32_t offset{0};                                                           // byte offset within the document text
+};
+
+struct scored_hit {
+  uint32_t doc{0};
+  float score{0.0f};
+  uint32_t offset{0};
+};
+
+struct query_clause {
+  std::vector<std::string> terms;                                               // more than one term makes this a phrase
+  bool prefix{false};                                                           // single-term clauses only: match any term starting with this
+};
+
+inline bool is_term_char(char const c) {
+  /// Whether a byte forms part of a term - any non-ASCII byte is treated as a word character so UTF-8 text is kept intact
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || static_cast<unsigned char>(c) >= 0x80;
+}
+
+inline char to_lower_ascii(char const c) {
+  /// Lowercase ASCII letters only, leaving UTF-8 sequences untouched
+  return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+template<typename F>
+uint32_t tokenise(std::string_view text, size_t max_length, F &&callback) {
+  /// Split text into lowercased terms, calling back with each term, its token position and byte offset, and return the token count
+  std::string term;
+  uint32_t position{0};
+  for(size_t i{0}; i != text.size();) {
+    if(!is_term_char(text[i])) {
+      ++i;
+      continue;
+    }
+    size_t const start{i};
+    term.clear();
+    for(; i != text.size() && is_term_char(text[i]); ++i) {
+      if(term.size() != max_length) term += to_lower_ascii(text[i]);
+    }
+    callback(std::string_view{term}, position, static_cast<uint32_t>(start));
+    ++position;
+  }
+  return position;
+}
+
+inline void write_varint(std::vector<uint8_t> &out, uint32_t value) {
+  /// Append an unsigned LEB128 varint
+  while(value >= 0x80u) {
+    out.emplace_back(static_cast<uint8_t>(value | 0x80u));
+    value >>= 7;
+  }
+  out.emplace_back(static_cast<uint8_t>(value));
+}
+
+inline uint32_t read_varint(uint8_t const *&ptr) {
+  /// Decode an unsigned LEB128 varint and advance the read pointer
+  uint32_t value{0};
+  for(unsigned int shift{0};; shift += 7) {
+    uint8_t const byte{*ptr++};
+    value |= static_cast<uint32_t>(byte & 0x7Fu) << shift;
+    if(!(byte & 0x80u)) return value;
+  }
+}
+
+template<typename F>
+void for_each_posting(std::vector<uint8_t> const &data, F &&callback) {
+  /// Walk a posting list, calling back with each document, its occurrence count and a pointer to its encoded occurrences
+  /// The callback must consume exactly the occurrences it is given, via the pointer reference
+  uint8_t const *ptr{data.data()};
+  uint8_t const *const end{ptr + data.size()};
+  uint32_t doc{0};
+  while(ptr != end) {
+    doc += read_varint(ptr);
+    uint32_t const count{read_varint(ptr)};
+    callback(doc, count, ptr);
+  }
+}
+
+std::vector<query_clause> parse_query(std::string_view query, size_t max_term_length) {
+  /// Split a query into term, prefix and phrase clauses
+  std::vector<query_clause> clauses;
+  auto add_segment{[&](std::string_view segment, bool const phrase, bool const prefix){
+    query_clause clause;
+    tokenise(segment, max_term_length, [&](std::string_view term, uint32_t /*position*/, uint32_t /*offset*/){
+      clause.terms.emplace_back(term);
+    });
+    if(clause.terms.empty()) return;
+    clause.prefix = !phrase && prefix && clause.terms.size() == 1;
+    clauses.emplace_back(std::move(clause));
+  }};
+
+  for(size_t i{0}; i != query.size();) {
+    if(query[i] == ' ' || query[i] == '\t' || query[i] == '\n') {
+      ++i;
+      continue;
+    }
+    if(query[i] == '"') {                                                       // quoted phrase, running to the closing quote or the end of the query
+      size_t const close{query.find('"', i + 1)};
+      size_t const end{close == std::string_view::npos ? query.size() : close};
+      add_segment(query.substr(i + 1, end - i - 1), true, false);
+      i = (close == std::string_view::npos ? query.size() : close + 1);
+      continue;
+    }
+    size_t end{i};
+    while(end != query.size() && query[end] != ' ' && query[end] != '\t' && query[end] != '\n' && query[end] != '"') ++end;
+    std::string_view const segment{query.substr(i, end - i)};
+    bool const explicit_prefix{segment.back() == '*'};
+    bool const still_typing{end == query.size()};                               // the final word of the query is treated as a prefix while it's being typed
+    add_segment(segment, false, explicit_prefix || still_typing);
+    i = end;
+  }
+  return clauses;
+}
+
+} // anonymous namespace
+
+class search_index::cursor {
+  /// Walks a posting list in document order, jumping a block at a time when seeking far ahead
+  posting_list const *list;
+  uint8_t const *ptr;                                                           // the next posting's document delta
+  uint8_t const *occurrences{nullptr};                                          // the current posting's encoded occurrences
+  size_t block{0};                                                              // the block holding the current posting
+  size_t bound_block{0};                                                        // the block last asked about by block_covering, never behind the current one
+  bool ended{false};
+
+public:
+  doc_id doc{0};                                                                // the current posting, or the largest document id once past the end
+  uint32_t count{0};                                                            // its number of occurrences
+
+  explicit cursor(posting_list const &this_list);
+
+  bool at_end() const;
+  bool next();
+  bool seek(doc_id target);
+
+  posting_skip const &block_covering(doc_id target);
+  doc_id next_block_start() const;
+
+  occurrence first_occurrence() const;
+  void read_occurrences(std::vector<occurrence> &destination) const;
+};
+
+search_index::cursor::cursor(posting_list const &this_list)
+  : list{&this_list},
+    ptr{this_list.data.data()} {
+  /// Start on the first posting of the list
+  next();
+}
+
+bool search_index::cursor::at_end() const {
+  /// Whether the cursor has passed the last posting
+  return ended;
+}
+
+bool search_index::cursor::next() {
+  /// Move to the next posting, returning false once past the end of the list
+  if(occurrences) {                                                             // step over the current posting's occurrences, counting the last byte of each varint
+    ptr = occurrences;
+    for(uint32_t varints{count * 2}; varints != 0; ++ptr) {
+      varints -= *ptr < 0x80u;
+    }
+  }
+  if(ptr == list->data.data() + list->data.size()) {
+    ended = true;
+    doc = std::numeric_limits<doc_id>::max();
+    return false;
+  }
+  doc += read_varint(ptr);
+  count = read_varint(ptr);
+  occurrences = ptr;
+  if(block + 1 != list->skips.size() && list->skips[block + 1].doc <= doc) ++block;
+  return true;
+}
+
+bool search_index::cursor::seek(doc_id const target) {
+  /// Move forward to the first posting for the target document or a later one, returning false if there is none
+  if(ended) return false;
+  if(doc >= target) return true;
+  auto const &skips{list->skips};
+  if(block + 1 != skips.size() && skips[block + 1].doc <= target) {             // the target is at least a block ahead, so jump to the last block starting at or before it
+    auto const found{std::prev(std::upper_bound(skips.begin() + static_cast<ptrdiff_t>(block + 1), skips.end(), target, [](doc_id const this_target, posting_skip const &skip){
+      return this_target < skip.doc;
+    }))};
+    block = static_cast<size_t>(found - skips.begin());
+    doc = found->doc;
+    ptr = list->data.data() + found->offset;
+    count = read_varint(ptr);
+    occurrences = ptr;
+    if(doc == target) return true;
+  }
+  while(next()) {
+    if(doc >= target) return true;
+  }
+  return false;
+}
+
+search_index::posting_skip const &search_index::cursor::block_covering(doc_id const target) {
+  /// Find the skip entry of the block a document would be in, without moving the cursor - targets must not go backwards
+  auto const &skips{list->skips};
+  bound_block = std::max(bound_block, block);
+  if(bound_block + 1 != skips.size() && skips[bound_block + 1].doc <= target) {
+    bound_block = static_cast<size_t>(std::upper_bound(skips.begin() + static_cast<ptrdiff_t>(bound_block + 1), skips.end(), target, [](doc_id const this_target, posting_skip const &skip){
+      return this_target < skip.doc;
+    }) - skips.begin()) - 1;
+  }
+  return skips[bound_block];
+}
+
+search_index::doc_id search_index::cursor::next_block_start() const {
+  /// The first document of the block after the one last found by block_covering, or the largest document id if there isn't one
+  auto const &skips{list->skips};
+  return bound_block + 1 != skips.size() ? skips[bound_block + 1].doc : std::numeric_limits<doc_id>::max();
+}
+
+occurrence search_index::cursor::first_occurrence() const {
+  /// Decode only the first occurrence in the current posting
+  uint8_t const *this_ptr{occurrences};
+  return {
+    .position{read_varint(this_ptr)},
+    .offset{read_varint(this_ptr)},
+  };
+}
+
+void search_index::cursor::read_occurrences(std::vector<occurrence> &destination) const {
+  /// Decode every occurrence in the current posting
+  destination.clear();
+  uint8_t const *this_ptr{occurrences};
+  occurrence current;
+  for(uint32_t i{0}; i != count; ++i) {
+    current.position += read_varint(this_ptr);
+    current.offset += read_varint(this_ptr);
+    destination.emplace_back(current);
+  }
+}
+
+void search_index::begin_posting(posting_list &list, doc_id const doc, uint32_t const count, uint32_t const length, float const average_length) {
+  /// Append a document to a posting list, up to its occurrences, starting a new block where one is due and noting its score bound
+  write_varint(list.data, list.doc_count == 0 ? doc : doc - list.last_doc);
+  if(list.doc_count % skip_interval == 0) {
+    list.skips.emplace_back(posting_skip{
+      .doc{doc},
+      .offset{static_cast<uint32_t>(list.data.size())},
+      .min_average{average_length},
+    });
+  }
+  float const tf{static_cast<float>(count)};
+  float const weight{tf / (tf + bm25_k1 * (1.0f - bm25_b + bm25_b * static_cast<float>(length) / average_length))};
+  auto &skip{list.skips.back()};
+  skip.max_weight = std::max(skip.max_weight, weight);
+  skip.min_average = std::min(skip.min_average, average_length);
+  list.max_weight = std::max(list.max_weight, weight);
+  list.min_average = list.doc_count == 0 ? average_length : std::min(list.min_average, average_length);
+  write_varint(list.data, count);
+  list.last_doc = doc;
+  ++list.doc_count;
+}
+
+void search_index::update(message_id const id, std::string_view text) {
+  /// Index a new message, or replace the indexed content of an existing message
+  remove(id);
+
+  doc_id const doc{static_cast<doc_id>(documents.size())};
+  std::unordered_map<std::string, std::vector<occurrence>> grouped;             // occurrences of each term, in document order
+  uint32_t const length{tokenise(text, max_term_length, [&](std::string_view term, uint32_t const position, uint32_t const offset){
+    grouped[std::string{term}].emplace_back(occurrence{
+      .position{position},
+      .offset{offset},
+    });
+  })};
+  float const average_length{std::max(1.0f, static_cast<float>(live_tokens + length) / static_cast<float>(live_count + 1))}; // as searches will see it, once this document is counted
+
+  for(auto &[term, occurrences] : grouped) {
+    auto &list{terms.try_emplace(term).first->second};
+    begin_posting(list, doc, static_cast<uint32_t>(occurrences.size()), length, average_length);
+    occurrence previous;
+    for(auto const &this_occurrence : occurrences) {
+      write_varint(list.data, this_occurrence.position - previous.position);
+      write_varint(list.data, this_occurrence.offset - previous.offset);
+      previous = this_occurrence;
+    }
+  }
+
+  documents.emplace_back(document{
+    .id{id},
+    .length{length},
+  });
+  current_documents[id] = doc;
+  live_tokens += length;
+  ++live_count;
+}
+
+void search_index::remove(message_id const id) {
+  /// Remove a message from the index - its postings are tombstoned and purged by later compaction
+  auto const it{current_documents.find(id)};
+  if(it == current_documents.end()) return;
+  auto &this_document{documents[it->second]};
+  this_document.live = false;
+  live_tokens -= this_document.length;
+  --live_count;
+  ++dead_count;
+  current_documents.erase(it);
+
+  if(dead_count > 1024 && dead_count > live_count) compact();                   // amortised: only when most of the index is garbage
+}
+
+void search_index::clear() {
+  /// Remove everything from the index
+  terms.clear();
+  documents.clear();
+  current_documents.clear();
+  live_tokens = 0;
+  live_count = 0;
+  dead_count = 0;
+}
+
+std::vector<search_index::result> search_index::search(std::string_view query, size_t const max_results) const {
+  /// Return the best matching messages for a query, most relevant first
+  std::vector<query_clause> const clauses{parse_query(query, max_term_length)};
+  if(clauses.empty() || live_count == 0 || max_results == 0) return {};
+
+  float const document_count{static_cast<float>(live_count)};
+  float const average_length{std::max(1.0f, static_cast<float>(live_tokens) / document_count)};
+  auto idf{[&](uint32_t const frequency){
+    float const df{std::min(static_cast<float>(frequency), document_count)};
+    return std::log(1.0f + (document_count - df + 0.5f) / (df + 0.5f));
+  }};
+  auto bm25{[&](float const term_idf, uint32_t const term_frequency, doc_id const doc){
+    float const tf{static_cast<float>(term_frequency)};
+    float const length_ratio{static_cast<float>(documents[doc].length) / average_length};
+    return term_idf * tf * (bm25_k1 + 1.0f) / (tf + bm25_k1 * (1.0f - bm25_b + bm25_b * length_ratio));
+  }};
+
+  // resolve each clause to its posting lists, and start from the one that can match fewest documents
+  struct resolved_clause {
+    std::vector<posting_list const*> lists;                                     // a phrase's terms in order, or a term's prefix expansions
+    bool phrase{false};
+    uint32_t estimate{0};                                                       // most documents the clause can match
+    std::vector<cursor> cursors;                                                // one per list
+    std::vector<float> idfs;                                                    // one per list - a phrase's are all its rarest term's
+    float max_score{0.0f};                                                      // the most the clause can add to any document's score
+  };
+  std::vector<resolved_clause> resolved;
+  resolved.reserve(clauses.size());
+  for(auto const &clause : clauses) {
+    auto &this_clause{resolved.emplace_back()};
+    this_clause.phrase = clause.terms.size() > 1;
+    auto &lists{this_clause.lists};
+    if(clause.prefix) {
+      for(auto it{terms.lower_bound(clause.terms.front())}; it != terms.end() && it->first.starts_with(clause.terms.front()); ++it) {
+        lists.emplace_back(&it->second);
+      }
+      if(lists.size() > max_prefix_expansions) {                                // keep only the most frequent expansions
+        std::partial_sort(lists.begin(), lists.begin() + static_cast<ptrdiff_t>(max_prefix_expansions), lists.end(), [](posting_list const *lhs, posting_list const *rhs){
+          return lhs->doc_count > rhs->doc_count;
+        });
+        lists.resize(max_prefix_expansions);
+      }
+    } else {
+      for(auto const &term : clause.terms) {
+        auto const it{terms.find(term)};
+        if(it == terms.end()) return {};                                        // all clauses must match, and this one can't
+        lists.emplace_back(&it->second);
+      }
+    }
+    if(lists.empty()) return {};
+    uint64_t estimate{this_clause.phrase ? std::numeric_limits<uint64_t>::max() : 0};
+    for(auto const *list : lists) {
+      estimate = this_clause.phrase ? std::min<uint64_t>(estimate, list->doc_count) : estimate + list->doc_count;
+    }
+    this_clause.estimate = static_cast<uint32_t>(std::min<uint64_t>(estimate, std::numeric_limits<uint32_t>::max()));
+  }
+  std::sort(resolved.begin(), resolved.end(), [](resolved_clause const &lhs, resolved_clause const &rhs){
+    return lhs.estimate < rhs.estimate;
+  });
+
+  std::vector<std::vector<occurrence>> phrase_occurrences;                      // scratch space for each term of a phrase
+  auto match_phrase{[&](std::vector<cursor> const &cursors, uint32_t &offset){
+    /// Count the places a phrase occurs in the document every cursor is on, noting the offset of the first
+    phrase_occurrences.resize(cursors.size());
+    for(size_t i{0}; i != cursors.size(); ++i) {
+      cursors[i].read_occurrences(phrase_occurrences[i]);
+    }
+    uint32_t count{0};
+    for(auto const &start : phrase_occurrences.front()) {
+      bool consecutive{true};
+      for(size_t i{1}; i != phrase_occurrences.size() && consecutive; ++i) {
+        auto const &this_occurrences{phrase_occurrences[i]};
+        uint32_t const position{start.position + static_cast<uint32_t>(i)};
+        auto const found{std::lower_bound(this_occurrences.begin(), this_occurrences.end(), position, [](occurrence const &lhs, uint32_t const this_position){
+          return lhs.position < this_position;
+        })};
+        consecutive = found != this_occurrences.end() && found->position == position;
+      }
+      if(!consecutive) continue;
+      if(count == 0) offset = std::min(offset, start.offset);
+      ++count;
+    }
+    return count;
+  }};
+
+  // a phrase's document frequency isn't known without matching it everywhere,
+  // so its idf is taken from its rarest term, which is never less frequent
+  for(auto &clause : resolved) {
+    clause.cursors.reserve(clause.lists.size());
+    clause.idfs.reserve(clause.lists.size());
+    for(auto const *list : clause.lists) {
+      clause.cursors.emplace_back(*list);
+      clause.idfs.emplace_back(clause.phrase ? idf(clause.estimate) : idf(list->doc_count));
+    }
+  }
+
+  // upper bounds on scores, from the weights noted as postings were added - a
+  // weight falls as the average document length falls, and rises no more than
+  // in proportion as it grows
+  auto weight_bound{[&](float const max_weight, float const min_average){
+    /// The most a weight noted with at least this average length can be now, widened so float rounding never undercuts a score
+    return max_weight * std::max(1.0f, average_length / min_average) * 1.0001f;
+  }};
+  auto list_bound{[&](resolved_clause const &clause, size_t const i, float const weight){
+    /// The most one of a clause's lists can add to a score, given a bound on its weight
+    return clause.idfs[i] * (bm25_k1 + 1.0f) * weight * (clause.phrase ? static_cast<float>(clause.lists.size()) : 1.0f);
+  }};
+  auto clause_bound_at{[&](resolved_clause &clause, doc_id const doc, doc_id &block_end){
+    /// The most a clause can score for documents from this one until block_end, bringing block_end in to the end of the blocks used - a phrase never occurs more often than its rarest term
+    float bound{clause.phrase ? std::numeric_limits<float>::max() : 0.0f};
+    for(size_t i{0}; i != clause.cursors.size(); ++i) {
+      auto &this_cursor{clause.cursors[i]};
+      auto const &skip{this_cursor.block_covering(doc)};
+      float const this_bound{list_bound(clause, i, weight_bound(skip.max_weight, skip.min_average))};
+      bound = clause.phrase ? std::min(bound, this_bound) : std::max(bound, this_bound);
+      block_end = std::min(block_end, this_cursor.next_block_start());
+    }
+    return bound;
+  }};
+  for(auto &clause : resolved) {
+    clause.max_score = clause.phrase ? std::numeric_limits<float>::max() : 0.0f;
+    for(size_t i{0}; i != clause.lists.size(); ++i) {
+      float const this_bound{list_bound(clause, i, weight_bound(clause.lists[i]->max_weight, clause.lists[i]->min_average))};
+      clause.max_score = clause.phrase ? std::min(clause.max_score, this_bound) : std::max(clause.max_score, this_bound);
+    }
+  }
+
+  auto probe{[&](resolved_clause &clause, doc_id const doc, float const at_least, uint32_t &offset) -> std::optional<float> {
+    /// Score a clause for one document, seeking its cursors forward to it, or return nothing if it doesn't match there or is a phrase that can't score more than at_least
+    if(clause.phrase) {
+      uint32_t fewest{std::numeric_limits<uint32_t>::max()};
+      for(auto &this_cursor : clause.cursors) {
+        if(!this_cursor.seek(doc) || this_cursor.doc != doc) return std::nullopt;
+        fewest = std::min(fewest, this_cursor.count);
+      }
+      float const scale{static_cast<float>(clause.cursors.size())};             // phrases are worth more than their terms scattered
+      if(bm25(clause.idfs.front(), fewest, doc) * scale <= at_least) return std::nullopt; // it can't occur more often than its rarest term, so don't match positions needlessly
+      uint32_t const count{match_phrase(clause.cursors, offset)};
+      if(count == 0) return std::nullopt;
+      return bm25(clause.idfs.front(), count, doc) * scale;
+    }
+    std::optional<float> score;
+    uint32_t best_offset{0};
+    for(size_t i{0}; i != clause.cursors.size(); ++i) {
+      auto &this_cursor{clause.cursors[i]};
+      if(!this_cursor.seek(doc) || this_cursor.doc != doc) continue;
+      if(float const this_score{bm25(clause.idfs[i], this_cursor.count, doc)}; !score || this_score > *score) {
+        score = this_score;
+        best_offset = this_cursor.first_occurrence().offset;
+      }
+    }
+    if(score) offset = std::min(offset, best_offset);
+    return score;
+  }};
+
+  // candidates come from the most selective clause, and are probed in the others, rarest first; once there are
+  // max_results hits, documents and whole blocks are passed over where their bounds can't beat the worst of them
+  auto &driver{resolved.front()};
+  float rest_bound{0.0f};                                                       // the most the other clauses can add
+  for(size_t i{1}; i != resolved.size(); ++i) {
+    rest_bound += resolved[i].max_score;
+  }
+  std::vector<scored_hit> best;                                                 // a heap with the worst hit at the front
+  best.reserve(std::min<size_t>(max_results, driver.estimate));
+  auto const worse{[](scored_hit const &lhs, scored_hit const &rhs){
+    return lhs.score > rhs.score;
+  }};
+  float threshold{0.0f};                                                        // the score to beat, once there are max_results hits
+
+  // a term or prefix driver scores each document by its best expansion there, so each of its lists can be
+  // passed over on its own: a block that can't beat the threshold is skipped, and a list that can't is dropped
+  std::vector<float> list_max;                                                  // the most each of the driver's lists can score
+  std::vector<size_t> by_doc;                                                   // the driver's lists still in play, in order of their current documents
+  auto const restore_order{[&](size_t const moved){
+    /// Put the first few lists of by_doc back in order after moving their cursors, dropping any that are exhausted
+    for(size_t k{moved}; k-- != 0;) {
+      auto const first{by_doc.begin() + static_cast<ptrdiff_t>(k)};
+      auto const position{std::upper_bound(first + 1, by_doc.end(), driver.cursors[*first].doc, [&](doc_id const doc, size_t const i){
+        return doc < driver.cursors[i].doc;
+      })};
+      std::rotate(first, first + 1, position);
+    }
+    while(!by_doc.empty() && driver.cursors[by_doc.back()].at_end()) by_doc.pop_back();
+  }};
+  if(!driver.phrase) {
+    for(size_t i{0}; i != driver.lists.size(); ++i) {
+      list_max.emplace_back(list_bound(driver, i, weight_bound(driver.lists[i]->max_weight, driver.lists[i]->min_average)));
+      by_doc.emplace_back(i);
+    }
+    std::sort(by_doc.begin(), by_doc.end(), [&](size_t const lhs, size_t const rhs){
+      return driver.cursors[lhs].doc < driver.cursors[rhs].doc;
+    });
+  }
+
+  std::vector<float> remaining_bound(resolved.size());                          // the most the clauses after each can add around the current candidate
+  float shared_bound{0.0f};                                                     // the most all the other clauses, and a phrase driver, can add there
+  doc_id shared_bound_end{0};                                                   // the first document those bounds don't cover
+  for(doc_id target{0};;) {
+    bool const full{best.size() == max_results};
+    doc_id candidate{0};
+    size_t at_candidate{0};                                                     // how many of by_doc are on the candidate
+    if(driver.phrase) {                                                         // every term must occur at consecutive positions, so leapfrog the terms' cursors to the documents they share
+      bool aligned{false};
+      bool exhausted{false};
+      while(!aligned && !exhausted) {
+        aligned = true;
+        for(auto &this_cursor : driver.cursors) {
+          if(!this_cursor.seek(target)) {
+            exhausted = true;
+            break;
+          }
+          if(this_cursor.doc != target) {
+            target = this_cursor.doc;
+            aligned = false;
+            break;
+          }
+        }
+      }
+      if(exhausted) break;
+      candidate = target;
+    } else {
+      if(by_doc.empty()) break;
+      candidate = driver.cursors[by_doc.front()].doc;
+      for(at_candidate = 1; at_candidate != by_doc.size() && driver.cursors[by_doc[at_candidate]].doc == candidate; ++at_candidate) {}
+    }
+
+    if(full && candidate >= shared_bound_end) {                                 // bound the other clauses, and a phrase driver, to the end of their blocks around the candidate
+      shared_bound_end = std::numeric_limits<doc_id>::max();
+      remaining_bound.back() = 0.0f;
+      for(size_t i{resolved.size() - 1}; i != 0; --i) {
+        remaining_bound[i - 1] = remaining_bound[i] + clause_bound_at(resolved[i], candidate, shared_bound_end);
+      }
+      shared_bound = remaining_bound.front() + (driver.phrase ? clause_bound_at(driver, candidate, shared_bound_end) : 0.0f);
+    }
+
+    uint32_t offset{std::numeric_limits<uint32_t>::max()};
+    std::optional<float> score;
+    if(driver.phrase) {
+      if(full && shared_bound <= threshold) {                                   // nothing in these blocks can beat the threshold
+        if(shared_bound_end == std::numeric_limits<doc_id>::max()) break;
+        target = shared_bound_end;
+        continue;
+      }
+      target = candidate + 1;
+      if(documents[candidate].live) score = probe(driver, candidate, full ? threshold - remaining_bound.front() : std::numeric_limits<float>::lowest(), offset);
+    } else {
+      for(size_t k{0}; k != at_candidate; ++k) {
+        auto &this_cursor{driver.cursors[by_doc[k]]};
+        if(full) {                                                              // skip the rest of this list's block if nothing in it can beat the threshold
+          auto const &skip{this_cursor.block_covering(candidate)};
+          if(list_bound(driver, by_doc[k], weight_bound(skip.max_weight, skip.min_average)) + shared_bound <= threshold) {
+            this_cursor.seek(std::min(this_cursor.next_block_start(), shared_bound_end));
+            continue;
+          }
+        }
+        if(documents[candidate].live) {
+          if(float const this_score{bm25(driver.idfs[by_doc[k]], this_cursor.count, candidate)}; !score || this_score > *score) {
+            score = this_score;
+            offset = this_cursor.first_occurrence().offset;
+          }
+        }
+        this_cursor.next();
+      }
+      restore_order(at_candidate);
+    }
+    for(size_t i{1}; i != resolved.size() && score; ++i) {
+      if(full && *score + remaining_bound[i - 1] <= threshold) {
+        score.reset();
+        break;
+      }
+      auto const this_score{probe(resolved[i], candidate, full ? threshold - *score - remaining_bound[i] : std::numeric_limits<float>::lowest(), offset)};
+      score = this_score ? std::optional<float>{*score + *this_score} : std::nullopt;
+    }
+    if(!score) continue;
+
+    if(!full) {
+      best.emplace_back(scored_hit{
+        .doc{candidate},
+        .score{*score},
+        .offset{offset},
+      });
+      std::push_heap(best.begin(), best.end(), worse);
+    } else if(*score > threshold) {
+      std::pop_heap(best.begin(), best.end(), worse);
+      best.back() = scored_hit{
+        .doc{candidate},
+        .score{*score},
+        .offset{offset},
+      };
+      std::push_heap(best.begin(), best.end(), worse);
+    } else {
+      continue;
+    }
+    if(best.size() != max_results) continue;
+    threshold = best.front().score;
+    std::erase_if(by_doc, [&](size_t const i){                                  // drop the driver's lists that can no longer beat it
+      return list_max[i] + rest_bound <= threshold;
+    });
+  }
+
+  std::sort_heap(best.begin(), best.end(), worse);                              // most relevant first
+  std::vector<result> results;
+  results.reserve(best.size());
+  for(auto const &hit : best) {
+    results.emplace_back(result{
+      .id{documents[hit.doc].id},
+      .score{hit.score},
+      .offset{hit.offset},
+    });
+  }
+  return results;
+}
+
+size_t search_index::size() const {
+  /// Return the number of messages indexed
+  return live_count;
+}
+
+void search_index::compact() {
+  /// Rebuild all posting lists without tombstoned documents, renumbering the remaining documents
+  std::vector<doc_id> remap(documents.size());
+  std::vector<document> live_documents;
+  live_documents.reserve(live_count);
+  for(doc_id doc{0}; doc != documents.size(); ++doc) {
+    if(!documents[doc].live) continue;
+    remap[doc] = static_cast<doc_id>(live_documents.size());
+    live_documents.emplace_back(documents[doc]);
+  }
+  float const average_length{std::max(1.0f, static_cast<float>(live_tokens) / static_cast<float>(std::max(live_count, 1u)))};
+
+  for(auto it{terms.begin()}; it != terms.end();) {
+    auto &list{it->second};
+    posting_list rebuilt;
+    for_each_posting(list.data, [&](doc_id const doc, uint32_t const count, uint8_t const *&ptr){
+      uint8_t const *const begin{ptr};
+      for(uint32_t i{0}; i != count; ++i) {
+        read_varint(ptr);
+        read_varint(ptr);
+      }
+      if(!documents[doc].live) return;
+      begin_posting(rebuilt, remap[doc], count, documents[doc].length, average_length);
+      rebuilt.data.insert(rebuilt.data.end(), begin, ptr);                      // occurrences are delta-encoded within the document, so can be copied verbatim
+    });
+    if(rebuilt.doc_count == 0) {
+      it = terms.erase(it);
+      continue;
+    }
+    rebuilt.data.shrink_to_fit();
+    rebuilt.skips.shrink_to_fit();
+    list = std::move(rebuilt);
+    ++it;
+  }
+
+  for(auto &[id, doc] : current_documents) {
+    doc = remap[doc];
+  }
+  documents = std::move(live_documents);
+  dead_count = 0;
+}
+
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace chat {
+
+class search_index {
+  /// Incremental full-text inverted index over conversation messages.
+  ///
+  /// Terms map to delta + varint compressed posting lists of (document,
+  /// token position, byte offset), with a skip entry every block of
+  /// documents so intersections can jump over the parts of a long list
+  /// that can't match.  Skip entries also note the most any document in
+  /// their block can score for the term, so a search for the best few
+  /// results passes over whole blocks that can't make it into them, and
+  /// stops early once no remaining document can.  Messages are indexed as
+  /// documents; updating a message appends a new document and tombstones
+  /// the old one, and tombstoned documents are purged by periodic compaction.
+  ///
+  /// Query syntax:
+  ///   foo bar       - documents containing both terms (ranked by BM25)
+  ///   foo*          - prefix match, scored by the best matching term (the last term is also a prefix while typing)
+  ///   "foo bar"     - phrase match
+public:
+  using message_id = uint32_t;
+
+  struct result {
+    message_id id{0};                                                           // the message this result refers to
+    float score{0.0f};                                                          // BM25 relevance score, higher is better
+    uint32_t offset{0};                                                         // byte offset of the first match within the message text
+  };
+
+private:
+  using doc_id = uint32_t;
+
+  struct document {
+    message_id id{0};                                                           // the message this document indexes
+    uint32_t length{0};                                                         // number of tokens in the document
+    bool live{true};                                                            // false once the message has been updated or removed
+  };
+
+  struct posting_skip {
+    doc_id doc{0};                                                              // first document of the block
+    uint32_t offset{0};                                                         // where that document's occurrence count starts in the data
+    float max_weight{0.0f};                                                     // largest BM25 term frequency weight tf / (tf + k1 (1 - b + b length / average)) in the block
+    float min_average{0.0f};                                                    // smallest average document length those weights were taken with
+  };
+
+  struct posting_list {
+    std::vector<uint8_t> data;                                                  // varint-encoded: doc delta, occurrence count, then (position delta, offset delta) per occurrence
+    std::vector<posting_skip> skips;                                            // one per block of skip_interval documents
+    doc_id last_doc{0};                                                         // last document appended, for delta encoding
+    uint32_t doc_count{0};                                                      // number of documents in this list, including tombstoned ones
+    float max_weight{0.0f};                                                     // largest weight of any block
+    float min_average{0.0f};                                                    // smallest average of any block
+  };
+
+  std::map<std::string, posting_list, std::less<>> terms;                       // ordered, so prefix queries are a contiguous range
+  std::vector<document> documents;                                              // indexed by doc_id
+  std::unordered_map<message_id, doc_id> current_documents;                     // live document for each message
+  uint64_t live_tokens{0};                                                      // total length of all live documents, for average document length
+  uint32_t live_count{0};
+  uint32_t dead_count{0};
+
+  static size_t constexpr max_term_length{64};                                  // longer tokens are truncated
+  static size_t constexpr max_prefix_expansions{64};                            // most frequent terms considered for a prefix query
+  static uint32_t constexpr skip_interval{64};                                  // documents per posting list block
+
+  class cursor;
+
+public:
+  void update(message_id id, std::string_view text);
+  void remove(message_id id);
+  void clear();
+
+  std::vector<result> search(std::string_view query, size_t max_results) const;
+
+  size_t size() const;
+
+private:
+  static void begin_posting(posting_list &list, doc_id doc, uint32_t count, uint32_t length, float average_length);
+  void compact();
+};
+
+}
@@ -0,0 +1,244 @@
+#include "semantic_search.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <iostream>
+#include <nlohmann/json.hpp>
+#include "emscripten_fetch_manager.h"
+
+namespace chat {
+
+namespace {
+
+std::vector<float> decode_base64_floats(std::string_view encoded) {
+  /// Decode a base64 string of little-endian float32 values, as returned by the embeddings API with encoding_format "base64"
+  static auto constexpr decode_table{[]{
+    std::array<uint8_t, 256> table{};
+    table.fill(0xFF);
+    std::string_view constexpr alphabet{"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"};
+    for(size_t i{0}; i != alphabet.size(); ++i) {
+      table[static_cast<unsigned char>(alphabet[i])] = static_cast<uint8_t>(i);
+    }
+    return table;
+  }()};
+
+  std::vector<std::byte> bytes;
+  bytes.reserve(encoded.size() / 4 * 3);
+  uint32_t accumulator{0};
+  unsigned int bits{0};
+  for(char const c : encoded) {
+    uint8_t const value{decode_table[static_cast<unsigned char>(c)]};
+    if(value == 0xFF) continue;                                                 // padding or whitespace
+    accumulator = (accumulator << 6) | value;
+    bits += 6;
+    if(bits >= 8) {
+      bits -= 8;
+      bytes.emplace_back(static_cast<std::byte>(accumulator >> bits));
+    }
+  }
+
+  std::vector<float> result(bytes.size() / sizeof(float));
+  std::memcpy(result.data(), bytes.data(), result.size() * sizeof(float));      // wasm and all supported native targets are little-endian
+  return result;
+}
+
+} // anonymous namespace
+
+semantic_search::semantic_search(emscripten_fetch_manager &this_fetcher)
+  : fetcher{this_fetcher} {
+  /// Default constructor
+}
+
+void semantic_search::update(message_id const id, std::string_view text) {
+  /// Make sure the current text of a message is embedded and indexed
+  hash_128 const hash{hash_bytes_128(text)};
+  if(auto const it{message_hashes.find(id)}; it != message_hashes.end()) {
+    if(it->second == hash) return;                                              // unchanged
+    remove(id);
+  }
+  message_hashes[id] = hash;
+  if(text.empty()) return;                                                      // the API rejects empty inputs, and there's nothing to find anyway
+
+  if(auto const slot_it{slots_by_hash.find(hash)}; slot_it != slots_by_hash.end()) {
+    slot_messages[slot_it->second].emplace_back(id);                            // cache hit, no request needed
+    return;
+  }
+  waiting_messages[hash].emplace_back(id);
+  enqueue(hash, text);
+}
+
+void semantic_search::remove(message_id const id) {
+  /// Stop returning a message in results
+  auto const it{message_hashes.find(id)};
+  if(it == message_hashes.end()) return;
+  if(auto const slot_it{slots_by_hash.find(it->second)}; slot_it != slots_by_hash.end()) {
+    std::erase(slot_messages[slot_it->second], id);                             // the old text's vector stays in the graph, but no longer leads to this message
+  }
+  if(auto const waiting_it{waiting_messages.find(it->second)}; waiting_it != waiting_messages.end()) {
+    std::erase(waiting_it->second, id);
+  }
+  message_hashes.erase(it);
+}
+
+void semantic_search::query(std::string_view text, size_t const k, query_callback &&callback) {
+  /// Find the k messages most semantically similar to the given text; the callback is called once the query is embedded
+  pending_query this_query{
+    .hash{hash_bytes_128(text)},
+    .k{k},
+    .callback{std::move(callback)},
+  };
+  if(auto const it{query_cache.find(this_query.hash)}; it != query_cache.end()) {
+    run_query(this_query, it->second);
+    return;
+  }
+  enqueue(this_query.hash, text);
+  pending_queries.emplace_back(std::move(this_query));
+}
+
+void semantic_search::flush(std::string const &api_key) {
+  /// Send all queued texts to the embeddings API, in as few requests as possible
+  while(!queue.empty()) {
+    nlohmann::json request_json{
+      {"model", model},
+      {"encoding_format", "base64"},                                            // a third of the size of a JSON float array, and no float parsing
+    };
+    auto &input{request_json["input"] = nlohmann::json::array()};
+    std::vector<hash_128> batch_hashes;
+    size_t batch_chars{0};
+    auto it{queue.begin()};
+    for(; it != queue.end() && batch_hashes.size() != max_batch_inputs; ++it) {
+      if(!batch_hashes.empty() && batch_chars + it->second.size() > max_batch_chars) break;
+      batch_chars += it->second.size();
+      input.emplace_back(std::move(it->second));
+      batch_hashes.emplace_back(it->first);
+    }
+    queue.erase(queue.begin(), it);
+
+    ++requests_in_flight;
+    fetcher.fetch({
+      .method{"POST"},
+      .url{"https://api.openai.com/v1/embeddings"},
+      .headers{
+        "Content-Type", "application/json",
+        "Authorization", "Bearer " + api_key,
+      },
+      .body{request_json.dump()},
+      .on_success{[this, batch_hashes](unsigned short /*status*/, std::span<std::byte const> data){
+        --requests_in_flight;
+        try {
+          nlohmann::json const json = nlohmann::json::parse(data);
+          std::vector<bool> resolved(batch_hashes.size(), false);
+          for(auto const &item : json.at("data")) {
+            size_t const item_index{item.at("index").get<size_t>()};
+            if(item_index >= batch_hashes.size() || resolved[item_index]) continue;
+            std::vector<float> const vector{decode_base64_floats(item.at("embedding").get_ref<std::string const&>())};
+            if(vector.empty() || (index && vector.size() != index->get_dimensions())) {
+              std::cerr << "ERROR: embeddings response has " << vector.size() << " dimensions, expected " << (index ? index->get_dimensions() : 0) << std::endl;
+              continue;                                                         // left unresolved, so failed below
+            }
+            add_embedding(batch_hashes[item_index], vector);
+            resolved[item_index] = true;
+          }
+          std::vector<hash_128> unresolved;
+          for(size_t i{0}; i != batch_hashes.size(); ++i) {
+            if(!resolved[i]) unresolved.emplace_back(batch_hashes[i]);
+          }
+          if(!unresolved.empty()) fail_batch(unresolved);                       // missing or unusable, so don't leave anything waiting on them
+        } catch(std::exception const &e) {
+          std::cerr << "ERROR parsing embeddings response: " << e.what() << std::endl;
+          fail_batch(batch_hashes);
+        }
+      }},
+      .on_error{[this, batch_hashes](unsigned short status, std::string_view status_text, std::span<std::byte const> data){
+        --requests_in_flight;
+        std::cerr << "ERROR calling embeddings API: " << status << ": " << status_text << ", " << std::string_view{reinterpret_cast<char const*>(data.data()), data.size()} << std::endl;
+        fail_batch(batch_hashes);
+      }},
+    });
+  }
+}
+
+bool semantic_search::busy() const {
+  /// Whether any texts are queued or awaiting embedding
+  return !queue.empty() || requests_in_flight != 0;
+}
+
+size_t semantic_search::size() const {
+  /// Return the number of distinct texts indexed
+  return index ? index->size() : 0;
+}
+
+void semantic_search::enqueue(hash_128 const &hash, std::string_view text) {
+  /// Queue a text for embedding on the next flush, unless it's already queued or in flight
+  if(!outstanding.emplace(hash).second) return;
+  queue.emplace_back(hash, std::string{text.substr(0, max_input_chars)});       // truncate very long texts rather than have the whole batch rejected
+}
+
+void semantic_search::add_embedding(hash_128 const &hash, std::span<float const> vector) {
+  /// Handle a newly received embedding: index it for any waiting messages, and answer any waiting queries
+  outstanding.erase(hash);
+  if(auto const waiting_it{waiting_messages.find(hash)}; waiting_it != waiting_messages.end()) {
+    if(!index) index.emplace(static_cast<unsigned int>(vector.size()));
+    embedding_index::slot const slot{index->add(vector)};
+    slots_by_hash.emplace(hash, slot);
+    slot_messages.resize(index->size());
+    slot_messages[slot] = std::move(waiting_it->second);
+    waiting_messages.erase(waiting_it);
+  }
+
+  bool answered{false};
+  for(auto it{pending_queries.begin()}; it != pending_queries.end();) {
+    if(it->hash != hash) {
+      ++it;
+      continue;
+    }
+    run_query(*it, vector);
+    it = pending_queries.erase(it);
+    answered = true;
+  }
+  if(answered) {
+    if(query_cache.size() == max_cached_queries) query_cache.clear();           // queries are cheap to re-embed, so don't bother with LRU here
+    query_cache.try_emplace(hash, vector.begin(), vector.end());
+  }
+}
+
+void semantic_search::run_query(pending_query &this_query, std::span<float const> vector) {
+  /// Search the index with an embedded query and hand the results to its callback
+  std::vector<result> results;
+  if(index && vector.size() == index->get_dimensions()) {
+    for(auto const &match : index->search(vector, this_query.k * 2)) {          // over-fetch, as some slots may no longer belong to any message
+      for(message_id const id : slot_messages[match.id]) {
+        results.emplace_back(result{
+          .id{id},
+          .similarity{match.similarity},
+        });
+      }
+      if(results.size() >= this_query.k) break;
+    }
+    if(results.size() > this_query.k) results.resize(this_query.k);
+  }
+  this_query.callback(std::move(results));
+}
+
+void semantic_search::fail_batch(std::vector<hash_128> const &hashes) {
+  /// Forget about texts whose embedding request failed, so a later update can retry them
+  for(auto const &hash : hashes) {
+    outstanding.erase(hash);
+    if(auto const waiting_it{waiting_messages.find(hash)}; waiting_it != waiting_messages.end()) {
+      for(message_id const id : waiting_it->second) {
+        message_hashes.erase(id);
+      }
+      waiting_messages.erase(waiting_it);
+    }
+    for(auto it{pending_queries.begin()}; it != pending_queries.end();) {
+      if(it->hash != hash) {
+        ++it;
+        continue;
+      }
+      it->callback({});
+      it = pending_queries.erase(it);
+    }
+  }
+}
+
+}
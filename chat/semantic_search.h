@@ -0,0 +1,79 @@
+#pragma once
+
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "chat/embedding_index.h"
+#include "hash_128.h"
+
+class emscripten_fetch_manager;
+
+namespace chat {
+
+class semantic_search {
+  /// Semantic search over messages using the embeddings API and an in-memory ANN index.
+  ///
+  /// Texts are embedded at most once: they are keyed by content hash, queued,
+  /// and sent in batches on flush().  Returned vectors are added to an HNSW
+  /// index, and queries are embedded the same way before searching it.
+public:
+  using message_id = uint32_t;
+
+  struct result {
+    message_id id{0};
+    float similarity{0.0f};                                                     // cosine similarity to the query
+  };
+
+  using query_callback = std::function<void(std::vector<result> &&results)>;
+
+private:
+  emscripten_fetch_manager &fetcher;
+
+  struct pending_query {
+    hash_128 hash;
+    size_t k{0};
+    query_callback callback;
+  };
+
+  std::string model{"text-embedding-3-small"};
+
+  std::optional<embedding_index> index;                                         // created once the embedding dimensionality is known
+  std::unordered_map<hash_128, embedding_index::slot> slots_by_hash;            // content cache: identical text is only embedded once
+  std::vector<std::vector<message_id>> slot_messages;                           // messages currently holding the text in each slot
+  std::unordered_map<message_id, hash_128> message_hashes;                      // current content hash of each message
+
+  std::vector<std::pair<hash_128, std::string>> queue;                          // texts awaiting embedding, sent in batches on flush
+  std::unordered_set<hash_128> outstanding;                                     // texts queued or in flight, so each is only requested once
+  std::unordered_map<hash_128, std::vector<message_id>> waiting_messages;       // messages waiting on each queued or in-flight text
+  std::vector<pending_query> pending_queries;
+  std::unordered_map<hash_128, std::vector<float>> query_cache;                 // embeddings of recent queries
+  unsigned int requests_in_flight{0};
+
+  static size_t constexpr max_batch_inputs{256};                                // texts per embeddings request
+  static size_t constexpr max_batch_chars{400'000};                             // keep each request comfortably under the per-request token limit
+  static size_t constexpr max_input_chars{24'000};                              // keep each input under the per-input token limit
+  static size_t constexpr max_cached_queries{256};
+
+public:
+  explicit semantic_search(emscripten_fetch_manager &fetcher);
+
+  void update(message_id id, std::string_view text);
+  void remove(message_id id);
+  void query(std::string_view text, size_t k, query_callback &&callback);
+  void flush(std::string const &api_key);
+
+  bool busy() const;
+  size_t size() const;
+
+private:
+  void enqueue(hash_128 const &hash, std::string_view text);
+  void add_embedding(hash_128 const &hash, std::span<float const> vector);
+  void run_query(pending_query &this_query, std::span<float const> vector);
+  void fail_batch(std::vector<hash_128> const &hashes);
+};
+
+}
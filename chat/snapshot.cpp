@@ -0,0 +1,425 @@
+#include "snapshot.h"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+#ifndef __EMSCRIPTEN__
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif // __EMSCRIPTEN__
+#include "chat/conversation_tree.h"
+#include "lz4_block.h"
+
+namespace chat {
+
+static_assert(std::endian::native == std::endian::little, "snapshot records are read in place, so require a little-endian host");
+
+namespace {
+
+std::array<char, 8> constexpr magic{'A', 'C', 'H', 'A', 'T', 'S', 'N', 'P'};
+uint32_t constexpr no_index{UINT32_MAX};
+
+enum class codecs : uint32_t {
+  none,
+  lz4,
+};
+
+size_t align_up(size_t const value) {
+  /// Round a file offset up so the records that follow it can be read in place
+  return (value + 7) & ~size_t{7};
+}
+
+std::optional<std::span<std::byte const>> read_blob(std::span<std::byte const> const block, size_t &offset) {
+  /// Read a length-prefixed blob from an uncompressed block and advance past it, or return nothing if it's out of range
+  if(offset > block.size() || block.size() - offset < sizeof(uint32_t)) return std::nullopt;
+  uint32_t length;
+  std::memcpy(&length, block.data() + offset, sizeof(length));
+  offset += sizeof(length);
+  if(length > block.size() - offset) return std::nullopt;
+  std::span<std::byte const> const result{block.subspan(offset, length)};
+  offset += length;
+  return result;
+}
+
+} // anonymous namespace
+
+struct snapshot::header {
+  std::array<char, 8> magic;
+  uint32_t version;
+  uint32_t node_count;
+  uint32_t branch_count;
+  uint32_t active_branch;                                                       // index into the branch table
+  uint32_t block_count;
+  uint32_t image_count;                                                         // from version 2, and reserved as 0 before
+  uint64_t node_table_offset;
+  uint64_t branch_table_offset;
+  uint64_t block_table_offset;
+  uint64_t file_size;                                                           // to detect truncation
+  uint64_t image_table_offset;                                                  // from version 2, where the header grew to include it
+};
+
+struct snapshot::node_record {
+  uint32_t parent;                                                              // no_index for the first message of a conversation
+  uint32_t role;
+  uint32_t block;
+  uint32_t offset;                                                              // of the blob's length prefix within the uncompressed block
+};
+
+struct snapshot::image_record {
+  uint32_t node;                                                                // index of the message it's attached to
+  uint32_t block;
+  uint32_t offset;                                                              // of the media type's length prefix within the uncompressed block, followed by the file's
+  uint32_t width;
+  uint32_t height;
+  uint32_t detail;
+};
+
+struct snapshot::block_record {
+  uint64_t offset;
+  uint32_t stored_size;
+  uint32_t raw_size;
+  codecs codec;
+  uint32_t reserved;
+};
+
+void snapshot::storage_deleter::operator()(std::byte const *data) const {
+  /// Release the memory holding a snapshot file
+  #ifdef __EMSCRIPTEN__
+    delete[] data;
+  #else
+    munmap(const_cast<std::byte*>(data), size);
+  #endif // __EMSCRIPTEN__
+}
+
+std::expected<snapshot, std::string> snapshot::open(std::string const &path) {
+  /// Open a snapshot file and validate its structure, without reading any message text
+  size_t constexpr header_size_v1{offsetof(header, image_table_offset)};        // the smallest header of any version
+  snapshot result;
+  #ifdef __EMSCRIPTEN__
+    std::ifstream file{path, std::ios::binary | std::ios::ate};
+    if(!file) return std::unexpected{"Unable to open snapshot " + path};
+    result.storage_size = static_cast<size_t>(file.tellg());
+    auto *const data{new std::byte[result.storage_size]};                       // one contiguous read into the heap; the file system is in memory anyway
+    result.storage = {data, storage_deleter{result.storage_size}};
+    file.seekg(0);
+    if(!file.read(reinterpret_cast<char*>(data), static_cast<std::streamsize>(result.storage_size))) return std::unexpected{"Unable to read snapshot " + path};
+  #else
+    int const fd{::open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+    if(fd == -1) return std::unexpected{"Unable to open snapshot " + path + ": " + std::strerror(errno)};
+    struct stat file_stat{};
+    if(fstat(fd, &file_stat) != 0 || file_stat.st_size < static_cast<off_t>(header_size_v1)) {
+      ::close(fd);
+      return std::unexpected{"Snapshot " + path + " is too small to be valid"};
+    }
+    result.storage_size = static_cast<size_t>(file_stat.st_size);
+    void *const mapping{mmap(nullptr, result.storage_size, PROT_READ, MAP_PRIVATE, fd, 0)};
+    ::close(fd);                                                                // the mapping holds its own reference to the file
+    if(mapping == MAP_FAILED) return std::unexpected{"Unable to map snapshot " + path + ": " + std::strerror(errno)};
+    result.storage = {static_cast<std::byte const*>(mapping), storage_deleter{result.storage_size}};
+  #endif // __EMSCRIPTEN__
+
+  auto const fail{[&](std::string_view reason){
+    return std::unexpected{"Snapshot " + path + " is invalid: " + std::string{reason}};
+  }};
+  std::byte const *const data{result.storage.get()};
+  if(result.storage_size < header_size_v1) return fail("too small");
+  auto const &file_header{*reinterpret_cast<header const*>(data)};              // fields past the version's header size are never read
+  if(file_header.magic != magic) return fail("not a snapshot");
+  if(file_header.version > current_version) return fail("written by a newer version, " + std::to_string(file_header.version));
+  bool const has_images{file_header.version >= 2};
+  if(has_images && result.storage_size < sizeof(header)) return fail("too small");
+  if(file_header.file_size != result.storage_size) return fail("truncated");
+
+  auto const table_fits{[&](uint64_t const offset, uint64_t const count, size_t const record_size){
+    return offset % 8 == 0 && offset <= result.storage_size && count <= (result.storage_size - offset) / record_size;
+  }};
+  if(!table_fits(file_header.node_table_offset,   file_header.node_count,   sizeof(node_record)))  return fail("node table out of range");
+  if(!table_fits(file_header.branch_table_offset, file_header.branch_count, sizeof(uint32_t)))     return fail("branch table out of range");
+  if(!table_fits(file_header.block_table_offset,  file_header.block_count,  sizeof(block_record))) return fail("block table out of range");
+  result.file_header = &file_header;
+  result.nodes = {reinterpret_cast<node_record const*>(data + file_header.node_table_offset), file_header.node_count};
+  result.branch_leaves = {reinterpret_cast<uint32_t const*>(data + file_header.branch_table_offset), file_header.branch_count};
+  result.blocks = {reinterpret_cast<block_record const*>(data + file_header.block_table_offset), file_header.block_count};
+  if(has_images) {
+    if(!table_fits(file_header.image_table_offset, file_header.image_count, sizeof(image_record))) return fail("image table out of range");
+    result.images = {reinterpret_cast<image_record const*>(data + file_header.image_table_offset), file_header.image_count};
+  }
+
+  for(auto const &block : result.blocks) {
+    if(block.offset > result.storage_size || block.stored_size > result.storage_size - block.offset) return fail("block out of range");
+    if(block.codec == codecs::none ? block.stored_size != block.raw_size : block.codec != codecs::lz4) return fail("unknown block codec");
+  }
+  auto const blob_fits{[&](uint32_t const block, uint32_t const offset){        // blob lengths are checked on access, so the blobs themselves are never touched here
+    return block < file_header.block_count && offset <= result.blocks[block].raw_size - std::min<uint32_t>(result.blocks[block].raw_size, sizeof(uint32_t));
+  }};
+  for(uint32_t i{0}; i != file_header.node_count; ++i) {
+    auto const &node{result.nodes[i]};
+    if(node.parent != no_index && node.parent >= i) return fail("node parent out of order");
+    if(node.role > static_cast<uint32_t>(message::roles::assistant)) return fail("unknown message role");
+    if(!blob_fits(node.block, node.offset)) return fail("node text out of range");
+  }
+  for(size_t i{0}; i != result.images.size(); ++i) {
+    auto const &this_image{result.images[i]};
+    if(this_image.node >= file_header.node_count || (i != 0 && this_image.node < result.images[i - 1].node)) return fail("image node out of order");
+    if(this_image.detail > static_cast<uint32_t>(image::details::high)) return fail("unknown image detail");
+    if(!blob_fits(this_image.block, this_image.offset)) return fail("image out of range");
+  }
+  for(uint32_t const leaf : result.branch_leaves) {
+    if(leaf != no_index && leaf >= file_header.node_count) return fail("branch leaf out of range");
+  }
+  result.decompressed.resize(file_header.block_count);
+  return result;
+}
+
+std::expected<void, std::string> snapshot::save(conversation_tree const &conversation, std::string const &path) {
+  /// Save a conversation with the default options
+  return save(conversation, path, options{});
+}
+
+std::expected<void, std::string> snapshot::save(conversation_tree const &conversation, std::string const &path, options const &save_options) {
+  /// Write every branch of a conversation to a snapshot file, replacing it atomically
+  std::vector<conversation_tree::node const*> tree_nodes;
+  tree_nodes.reserve(conversation.size());
+  conversation.for_each_node([&](conversation_tree::node const &node){
+    tree_nodes.emplace_back(&node);
+  });
+  std::sort(tree_nodes.begin(), tree_nodes.end(), [](auto const *lhs, auto const *rhs){return lhs->id < rhs->id;}); // a parent is always created before its children
+  std::unordered_map<conversation_tree::node_id, uint32_t> node_indices;
+  node_indices.reserve(tree_nodes.size());
+  for(size_t i{0}; i != tree_nodes.size(); ++i) {
+    node_indices.emplace(tree_nodes[i]->id, static_cast<uint32_t>(i));
+  }
+  auto const branches{conversation.get_branches()};
+  size_t image_count{0};
+  for(auto const *node : tree_nodes) {
+    image_count += conversation.get_images(*node).size();
+  }
+
+  header file_header{
+    .magic{magic},
+    .version{current_version},
+    .node_count{static_cast<uint32_t>(tree_nodes.size())},
+    .branch_count{static_cast<uint32_t>(branches.size())},
+    .active_branch{0},
+    .block_count{0},
+    .image_count{static_cast<uint32_t>(image_count)},
+    .node_table_offset{align_up(sizeof(header))},
+    .branch_table_offset{0},
+    .block_table_offset{0},
+    .file_size{0},
+    .image_table_offset{0},
+  };
+  file_header.branch_table_offset = align_up(file_header.node_table_offset + tree_nodes.size() * sizeof(node_record));
+  file_header.image_table_offset = align_up(file_header.branch_table_offset + branches.size() * sizeof(uint32_t));
+  size_t const blocks_offset{align_up(file_header.image_table_offset + image_count * sizeof(image_record))};
+
+  std::vector<std::byte> output(blocks_offset);                                 // tables are filled in once the blocks are written
+  std::vector<node_record> node_table;
+  node_table.reserve(tree_nodes.size());
+  std::vector<block_record> block_table;
+  std::vector<image_record> image_table;
+  image_table.reserve(image_count);
+  std::vector<std::byte> block;                                                 // uncompressed contents of the block being built
+  block.reserve(save_options.block_size + sizeof(uint32_t));
+
+  auto const flush_block{[&]{
+    if(block.empty()) return;
+    block_record record{
+      .offset{output.size()},
+      .stored_size{static_cast<uint32_t>(block.size())},
+      .raw_size{static_cast<uint32_t>(block.size())},
+      .codec{codecs::none},
+      .reserved{0},
+    };
+    if(save_options.compress) {
+      size_t const compressed_size{lz4_block::compress(block, output)};
+      if(compressed_size < block.size() - block.size() / 16) {                  // only worth decompressing on load if it saves a useful amount
+        record.stored_size = static_cast<uint32_t>(compressed_size);
+        record.codec = codecs::lz4;
+      } else {
+        output.resize(record.offset);
+      }
+    }
+    if(record.codec == codecs::none) output.insert(output.end(), block.begin(), block.end());
+    block_table.emplace_back(record);
+    block.clear();
+  }};
+
+  auto const append_blob{[&](std::span<std::byte const> const blob){
+    auto const length{static_cast<uint32_t>(blob.size())};
+    auto const *const length_bytes{reinterpret_cast<std::byte const*>(&length)};
+    block.insert(block.end(), length_bytes, length_bytes + sizeof(length));
+    block.insert(block.end(), blob.begin(), blob.end());
+  }};
+  auto const make_room{[&](size_t const size){                                  // start a new block if this wouldn't fit, returning false if it can never fit
+    if(!block.empty() && block.size() + size > save_options.block_size) flush_block();
+    return block.size() + size <= UINT32_MAX;
+  }};
+
+  for(auto const *node : tree_nodes) {
+    std::string_view const text{conversation.get_text(*node)};
+    if(!make_room(sizeof(uint32_t) + text.size())) return std::unexpected{"Message too large to save in a snapshot"};
+    node_table.emplace_back(node_record{
+      .parent{node->parent ? node_indices.at(node->parent->id) : no_index},
+      .role{static_cast<uint32_t>(node->role)},
+      .block{static_cast<uint32_t>(block_table.size())},
+      .offset{static_cast<uint32_t>(block.size())},
+    });
+    append_blob(std::as_bytes(std::span{text}));
+  }
+  flush_block();                                                                // images go in blocks of their own, as they rarely compress and would spoil the texts' ratio
+
+  for(uint32_t i{0}; i != tree_nodes.size(); ++i) {
+    for(auto const &this_image : conversation.get_images(*tree_nodes[i])) {
+      if(!make_room(2 * sizeof(uint32_t) + this_image.media_type.size() + this_image.data.size())) return std::unexpected{"Image too large to save in a snapshot"};
+      image_table.emplace_back(image_record{
+        .node{i},
+        .block{static_cast<uint32_t>(block_table.size())},
+        .offset{static_cast<uint32_t>(block.size())},
+        .width{this_image.dimensions.width},
+        .height{this_image.dimensions.height},
+        .detail{static_cast<uint32_t>(this_image.detail)},
+      });
+      append_blob(std::as_bytes(std::span{this_image.media_type}));
+      append_blob(this_image.data);
+    }
+  }
+  flush_block();
+
+  file_header.block_count = static_cast<uint32_t>(block_table.size());
+  file_header.block_table_offset = align_up(output.size());
+  file_header.file_size = file_header.block_table_offset + block_table.size() * sizeof(block_record);
+  output.resize(file_header.file_size);
+
+  std::vector<uint32_t> branch_table;
+  branch_table.reserve(branches.size());
+  for(size_t i{0}; i != branches.size(); ++i) {
+    branch_table.emplace_back(branches[i].leaf ? node_indices.at(branches[i].leaf->id) : no_index);
+    if(branches[i].id == conversation.get_active_branch()) file_header.active_branch = static_cast<uint32_t>(i);
+  }
+  auto const write_table{[&](uint64_t const offset, auto const &table){
+    if(table.empty()) return;                                                   // an empty vector's data may be null
+    std::memcpy(output.data() + offset, table.data(), table.size() * sizeof(table.front()));
+  }};
+  std::memcpy(output.data(), &file_header, sizeof(file_header));
+  write_table(file_header.node_table_offset, node_table);
+  write_table(file_header.branch_table_offset, branch_table);
+  write_table(file_header.image_table_offset, image_table);
+  write_table(file_header.block_table_offset, block_table);
+
+  std::string const temporary_path{path + ".tmp"};
+  {
+    std::ofstream file{temporary_path, std::ios::binary | std::ios::trunc};
+    if(!file) return std::unexpected{"Unable to create snapshot " + temporary_path};
+    if(!file.write(reinterpret_cast<char const*>(output.data()), static_cast<std::streamsize>(output.size()))) return std::unexpected{"Unable to write snapshot " + temporary_path};
+  }
+  std::error_code error;
+  std::filesystem::rename(temporary_path, path, error);                         // never leave a half-written snapshot in place of a good one
+  if(error) return std::unexpected{"Unable to replace snapshot " + path + ": " + error.message()};
+  return {};
+}
+
+size_t snapshot::size() const {
+  /// Return the number of messages in the snapshot
+  return nodes.size();
+}
+
+snapshot::entry snapshot::get(size_t const index) const {
+  /// Return a message by index; the text is empty if its blob is corrupt
+  auto const &node{nodes[index]};
+  entry result{
+    .parent{node.parent == no_index ? std::nullopt : std::optional{node.parent}},
+    .role{static_cast<message::roles>(node.role)},
+    .text{},
+  };
+  size_t offset{node.offset};
+  if(auto const blob{read_blob(block_data(node.block), offset)}) {
+    result.text = {reinterpret_cast<char const*>(blob->data()), blob->size()};
+  }
+  return result;
+}
+
+std::vector<image> snapshot::get_images(size_t const index) const {
+  /// Return copies of the images attached to a message, leaving out any whose blobs are corrupt
+  std::vector<image> result;
+  auto it{std::lower_bound(images.begin(), images.end(), index, [](image_record const &record, size_t const this_index){
+    return record.node < this_index;
+  })};
+  for(; it != images.end() && it->node == index; ++it) {
+    std::span<std::byte const> const block{block_data(it->block)};
+    size_t offset{it->offset};
+    auto const media_type{read_blob(block, offset)};
+    auto const data{read_blob(block, offset)};
+    if(!media_type || !data) continue;
+    result.emplace_back(image{
+      .media_type{reinterpret_cast<char const*>(media_type->data()), media_type->size()},
+      .data{data->begin(), data->end()},
+      .dimensions{
+        .width{it->width},
+        .height{it->height},
+      },
+      .detail{static_cast<image::details>(it->detail)},
+    });
+  }
+  return result;
+}
+
+std::span<uint32_t const> snapshot::get_branch_leaves() const {
+  /// Return the leaf node index of each branch, or UINT32_MAX for an empty branch
+  return branch_leaves;
+}
+
+size_t snapshot::get_active_branch() const {
+  /// Return the index of the branch that was active when the snapshot was saved
+  return file_header->active_branch;
+}
+
+std::expected<void, std::string> snapshot::restore(conversation_tree &conversation) const {
+  /// Replace a conversation with the contents of this snapshot, copying every text and image into it; the conversation is left alone if it has an empty branch
+  if(branch_leaves.empty()) return std::unexpected{"Snapshot has no branches"};
+  std::vector<std::optional<size_t>> leaves;
+  leaves.reserve(branch_leaves.size());
+  for(uint32_t const leaf : branch_leaves) {
+    if(leaf == no_index) return std::unexpected{"Snapshot has an empty branch"}; // a conversation always has at least its first message
+    leaves.emplace_back(leaf);
+  }
+  conversation.restore(nodes.size(), [&](size_t const index){
+    entry const this_entry{get(index)};
+    std::vector<image> this_images{get_images(index)};
+    return conversation_tree::restored_node{
+      .parent{this_entry.parent},
+      .content{
+        .role{this_entry.role},
+        .text{std::string{this_entry.text}},
+      },
+      .images{this_images.empty() ? nullptr : std::make_shared<std::vector<image> const>(std::move(this_images))},
+    };
+  }, leaves, get_active_branch());
+  return {};
+}
+
+std::span<std::byte const> snapshot::block_data(uint32_t const index) const {
+  /// Return the uncompressed contents of a block, decompressing it the first time it's needed
+  auto const &block{blocks[index]};
+  std::span<std::byte const> const stored{storage.get() + block.offset, block.stored_size};
+  if(block.codec == codecs::none) return stored;
+  auto &buffer{decompressed[index]};
+  if(!buffer) {
+    buffer = std::make_unique_for_overwrite<std::byte[]>(block.raw_size);
+    if(!lz4_block::decompress(stored, {buffer.get(), block.raw_size})) {
+      std::cerr << "ERROR: Snapshot block " << index << " failed to decompress" << std::endl;
+      std::fill_n(buffer.get(), block.raw_size, std::byte{0});                  // reads as empty texts rather than garbage lengths
+    }
+  }
+  return {buffer.get(), block.raw_size};
+}
+
+}
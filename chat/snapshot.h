@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <expected>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "chat/image.h"
+#include "chat/message.h"
+
+namespace chat {
+
+class conversation_tree;
+
+class snapshot {
+  /// Versioned binary snapshot of a conversation tree, for fast persistence.
+  ///
+  /// Layout, all integers little-endian:
+  ///   header                                    magic, version, counts and table offsets
+  ///   node table    node_count   x node_record  parent, role, and location of the text blob
+  ///   branch table  branch_count x uint32_t     leaf node index of each branch
+  ///   image table   image_count  x image_record node, size and detail of each attachment, and location of its blobs (version 2 onwards)
+  ///   blocks                                    length-prefixed blobs, each block optionally LZ4 compressed: UTF-8 texts, then
+  ///                                             each image's media type followed by its encoded file
+  ///   block table   block_count  x block_record offset, sizes and codec of each block
+  ///
+  /// Opening a snapshot maps the file on native builds, or reads it into the
+  /// heap in one go on the web, and only validates the tables; get() returns
+  /// texts in uncompressed blocks as views straight into that memory, and
+  /// compressed blocks are decompressed the first time one of their texts is
+  /// read.  Restoring a conversation is not zero-copy: every text and image
+  /// is copied into the tree, and the caller reindexes it.
+public:
+  static uint32_t constexpr current_version{2};
+
+  struct options {
+    bool compress{true};                                                        // compress blocks where that saves space
+    size_t block_size{256 * 1024};                                              // target uncompressed size of each block
+  };
+
+  struct entry {
+    std::optional<uint32_t> parent;                                             // index of the parent node, always less than this node's
+    message::roles role{message::roles::user};
+    std::string_view text;                                                      // valid for the lifetime of the snapshot
+  };
+
+private:
+  struct storage_deleter {
+    size_t size;                                                                // no initialiser, so unique_ptr sees this as default constructible inside the class
+    void operator()(std::byte const *data) const;
+  };
+
+  struct header;
+  struct node_record;
+  struct block_record;
+  struct image_record;
+
+  std::unique_ptr<std::byte const, storage_deleter> storage;                    // the whole file, mapped or read
+  size_t storage_size{0};
+  header const *file_header{nullptr};
+  std::span<node_record const> nodes;
+  std::span<uint32_t const> branch_leaves;
+  std::span<block_record const> blocks;
+  std::span<image_record const> images;                                         // in node order
+  mutable std::vector<std::unique_ptr<std::byte[]>> decompressed;               // decompressed contents of compressed blocks, filled on demand
+
+  snapshot() = default;
+
+public:
+  static std::expected<snapshot, std::string> open(std::string const &path);
+  static std::expected<void, std::string> save(conversation_tree const &conversation, std::string const &path, options const &save_options);
+  static std::expected<void, std::string> save(conversation_tree const &conversation, std::string const &path);
+
+  size_t size() const;
+  entry get(size_t index) const;
+  std::vector<image> get_images(size_t index) const;
+  std::span<uint32_t const> get_branch_leaves() const;
+  size_t get_active_branch() const;
+
+  std::expected<void, std::string> restore(conversation_tree &conversation) const;
+
+private:
+  std::span<std::byte const> block_data(uint32_t block) const;
+};
+
+}
@@ -0,0 +1,213 @@
+#include "telemetry.h"
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include <nlohmann/json.hpp>
+
+namespace chat {
+
+namespace {
+
+uint64_t get_count(nlohmann::json const &object, char const *key) {
+  /// Read a token count that may be missing, as older models omit some details
+  auto const it{object.find(key)};
+  if(it == object.end() || !it->is_number_unsigned()) return 0;
+  return it->get<uint64_t>();
+}
+
+nlohmann::json aggregate_to_json(telemetry::aggregate const &source) {
+  /// Describe an aggregate, with full histograms so the distributions can be reanalysed
+  return {
+    {"requests", source.requests},
+    {"prompt_tokens", source.tokens.prompt_tokens},
+    {"completion_tokens", source.tokens.completion_tokens},
+    {"reasoning_tokens", source.tokens.reasoning_tokens},
+    {"cached_tokens", source.tokens.cached_tokens},
+    {"tokens_per_second", source.tokens_per_second.to_json()},
+    {"time_to_first_byte_ms", source.time_to_first_byte_ms.to_json()},
+    {"latency_ms", source.latency_ms.to_json()},
+  };
+}
+
+void write_csv_row(std::ostream &stream, std::string_view scope, std::string_view name, telemetry::aggregate const &source) {
+  /// Write one aggregate as a row of CSV, quoting the name in case it contains commas
+  stream << scope << ",\"";
+  for(char const c : name) {
+    if(c == '"') stream << '"';
+    stream << c;
+  }
+  stream << "\"," << source.requests
+         << ',' << source.tokens.prompt_tokens
+         << ',' << source.tokens.completion_tokens
+         << ',' << source.tokens.reasoning_tokens
+         << ',' << source.tokens.cached_tokens
+         << ',' << source.tokens_per_second.mean()
+         << ',' << source.tokens_per_second.quantile(0.5)
+         << ',' << source.tokens_per_second.quantile(0.1)                       // the slow tail of throughput is the low end
+         << ',' << source.time_to_first_byte_ms.quantile(0.5)
+         << ',' << source.time_to_first_byte_ms.quantile(0.9)
+         << ',' << source.latency_ms.quantile(0.5)
+         << ',' << source.latency_ms.quantile(0.9)
+         << ',' << source.latency_ms.quantile(0.99)
+         << '\n';
+}
+
+} // anonymous namespace
+
+telemetry::usage telemetry::usage::from_response(nlohmann::json const &response) {
+  /// Read the usage block of a chat completion response, treating anything missing as zero
+  auto const it{response.find("usage")};
+  if(it == response.end() || !it->is_object()) return {};
+  auto const &block{*it};
+  usage result{
+    .prompt_tokens{get_count(block, "prompt_tokens")},
+    .completion_tokens{get_count(block, "completion_tokens")},
+    .reasoning_tokens{0},
+    .cached_tokens{0},
+  };
+  if(auto const details{block.find("prompt_tokens_details")}; details != block.end() && details->is_object()) {
+    result.cached_tokens = get_count(*details, "cached_tokens");
+  }
+  if(auto const details{block.find("completion_tokens_details")}; details != block.end() && details->is_object()) {
+    result.reasoning_tokens = get_count(*details, "reasoning_tokens");
+  }
+  return result;
+}
+
+void telemetry::histogram::record(double const value) {
+  /// Add a non-negative value to the distribution
+  ++counts[bucket_index(value)];
+  min = count == 0 ? value : std::min(min, value);
+  max = count == 0 ? value : std::max(max, value);
+  ++count;
+  sum += value;
+}
+
+uint64_t telemetry::histogram::get_count() const {
+  /// Number of values recorded
+  return count;
+}
+
+double telemetry::histogram::mean() const {
+  /// Exact mean of the values recorded, or zero if there are none
+  return count == 0 ? 0.0 : sum / static_cast<double>(count);
+}
+
+double telemetry::histogram::quantile(double const fraction) const {
+  /// Estimate the value below which the given fraction of values fall, from the middle of its bucket
+  if(count == 0) return 0.0;
+  auto const rank{static_cast<uint64_t>(std::ceil(std::clamp(fraction, 0.0, 1.0) * static_cast<double>(count)))};
+  uint64_t seen{0};
+  for(unsigned int i{0}; i != bucket_count; ++i) {
+    seen += counts[i];
+    if(seen < std::max(rank, uint64_t{1})) continue;
+    double const middle{(bucket_lower_bound(i) + bucket_lower_bound(i + 1)) * 0.5};
+    return std::clamp(middle, min, max);                                        // the exact extremes are known, so never report beyond them
+  }
+  return max;
+}
+
+nlohmann::json telemetry::histogram::to_json() const {
+  /// Describe the distribution, listing only occupied buckets by their lower bound
+  nlohmann::json buckets = nlohmann::json::array();
+  for(unsigned int i{0}; i != bucket_count; ++i) {
+    if(counts[i] != 0) buckets.emplace_back(nlohmann::json::array({bucket_lower_bound(i), counts[i]}));
+  }
+  return {
+    {"count", count},
+    {"mean", mean()},
+    {"min", min},
+    {"max", max},
+    {"p50", quantile(0.5)},
+    {"p90", quantile(0.9)},
+    {"p99", quantile(0.99)},
+    {"buckets", std::move(buckets)},
+  };
+}
+
+unsigned int telemetry::histogram::bucket_index(double const value) {
+  /// Which bucket a value falls in: a fixed number of linear buckets per power of two
+  if(!(value >= std::ldexp(1.0, min_exponent))) return 0;                       // also catches NaN
+  int exponent;
+  double const mantissa{std::frexp(value, &exponent)};                          // in [0.5, 1)
+  int const octave{exponent - 1 - min_exponent};
+  if(octave >= static_cast<int>(octaves)) return bucket_count - 1;
+  auto const step{static_cast<unsigned int>((mantissa * 2.0 - 1.0) * buckets_per_octave)};
+  return static_cast<unsigned int>(octave) * buckets_per_octave + std::min(step, buckets_per_octave - 1);
+}
+
+double telemetry::histogram::bucket_lower_bound(unsigned int const index) {
+  /// Smallest value that falls in a bucket
+  unsigned int const octave{index / buckets_per_octave};
+  unsigned int const step{index % buckets_per_octave};
+  return std::ldexp(1.0 + static_cast<double>(step) / buckets_per_octave, static_cast<int>(octave) + min_exponent);
+}
+
+void telemetry::record(std::string_view model, unsigned int const session, usage const &tokens, float const time_to_first_byte_ms, float const latency_ms) {
+  /// Add a completed request to the aggregates for its model and session
+  auto model_it{models.find(model)};
+  if(model_it == models.end()) model_it = models.emplace(std::string{model}, aggregate{}).first;
+  for(aggregate *const target : {&model_it->second, &sessions[session]}) {
+    ++target->requests;
+    target->tokens.prompt_tokens += tokens.prompt_tokens;
+    target->tokens.completion_tokens += tokens.completion_tokens;
+    target->tokens.reasoning_tokens += tokens.reasoning_tokens;
+    target->tokens.cached_tokens += tokens.cached_tokens;
+    if(latency_ms > 0.0f) {
+      target->tokens_per_second.record(static_cast<double>(tokens.completion_tokens) * 1000.0 / static_cast<double>(latency_ms));
+    }
+    target->time_to_first_byte_ms.record(static_cast<double>(time_to_first_byte_ms));
+    target->latency_ms.record(static_cast<double>(latency_ms));
+  }
+}
+
+void telemetry::clear() {
+  /// Forget everything recorded so far
+  models.clear();
+  sessions.clear();
+}
+
+std::map<std::string, telemetry::aggregate, std::less<>> const &telemetry::get_models() const {
+  /// Return the aggregates for each model, as named in responses
+  return models;
+}
+
+std::map<unsigned int, telemetry::aggregate> const &telemetry::get_sessions() const {
+  /// Return the aggregates for each session, by session id
+  return sessions;
+}
+
+std::string telemetry::to_csv() const {
+  /// Export a summary of every aggregate as CSV, one row each
+  std::ostringstream stream;
+  stream << std::fixed << std::setprecision(2);
+  stream << "scope,name,requests,prompt_tokens,completion_tokens,reasoning_tokens,cached_tokens,"
+            "tokens_per_second_mean,tokens_per_second_p50,tokens_per_second_p10,"
+            "time_to_first_byte_ms_p50,time_to_first_byte_ms_p90,"
+            "latency_ms_p50,latency_ms_p90,latency_ms_p99\n";
+  for(auto const &[model, model_aggregate] : models) {
+    write_csv_row(stream, "model", model, model_aggregate);
+  }
+  for(auto const &[session, session_aggregate] : sessions) {
+    write_csv_row(stream, "session", std::to_string(session), session_aggregate);
+  }
+  return stream.str();
+}
+
+nlohmann::json telemetry::to_json() const {
+  /// Export every aggregate as JSON, including full histograms
+  nlohmann::json result = {
+    {"models", nlohmann::json::object()},
+    {"sessions", nlohmann::json::object()},
+  };
+  for(auto const &[model, model_aggregate] : models) {
+    result["models"][model] = aggregate_to_json(model_aggregate);
+  }
+  for(auto const &[session, session_aggregate] : sessions) {
+    result["sessions"][std::to_string(session)] = aggregate_to_json(session_aggregate);
+  }
+  return result;
+}
+
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <nlohmann/json_fwd.hpp>
+
+namespace chat {
+
+class telemetry {
+  /// Token usage and latency of completion requests, aggregated per model and per session.
+  ///
+  /// Counters are exact; distributions are kept in fixed-size log-scale
+  /// histograms, so memory stays constant however many requests are made.
+  /// Quantiles are reported at bucket midpoints, so are within about 6%.
+public:
+  struct usage {
+    uint64_t prompt_tokens{0};
+    uint64_t completion_tokens{0};
+    uint64_t reasoning_tokens{0};                                               // part of the completion tokens
+    uint64_t cached_tokens{0};                                                  // part of the prompt tokens
+
+    static usage from_response(nlohmann::json const &response);
+  };
+
+  class histogram {
+    static int constexpr min_exponent{-8};                                      // values below 2^-8 share the first bucket
+    static unsigned int constexpr octaves{32};                                  // values above 2^24 share the last bucket
+    static unsigned int constexpr buckets_per_octave{8};
+    static unsigned int constexpr bucket_count{octaves * buckets_per_octave};
+
+    std::array<uint32_t, bucket_count> counts{};
+    uint64_t count{0};
+    double sum{0.0};
+    double min{0.0};
+    double max{0.0};
+
+  public:
+    void record(double value);
+
+    uint64_t get_count() const;
+    double mean() const;
+    double quantile(double fraction) const;
+    nlohmann::json to_json() const;
+
+  private:
+    static unsigned int bucket_index(double value);
+    static double bucket_lower_bound(unsigned int index);
+  };
+
+  struct aggregate {
+    uint64_t requests{0};
+    usage tokens{};
+    histogram tokens_per_second{};                                              // completion tokens over total latency
+    histogram time_to_first_byte_ms{};
+    histogram latency_ms{};
+  };
+
+private:
+  std::map<std::string, aggregate, std::less<>> models;
+  std::map<unsigned int, aggregate> sessions;
+
+public:
+  void record(std::string_view model, unsigned int session, usage const &tokens, float time_to_first_byte_ms, float latency_ms);
+  void clear();
+
+  std::map<std::string, aggregate, std::less<>> const &get_models() const;
+  std::map<unsigned int, aggregate> const &get_sessions() const;
+
+  std::string to_csv() const;
+  nlohmann::json to_json() const;
+};
+
+}
@@ -0,0 +1,236 @@
+#include "tokenizer.h"
+#include <algorithm>
+#include <queue>
+#include "chat/gguf.h"
+
+namespace chat {
+
+namespace {
+
+std::string_view constexpr space_marker{"▁"};                                   // SentencePiece's stand-in for a space
+
+enum class token_types : int64_t {                                              // from llama_token_type
+  normal = 1,
+  unknown = 2,
+  control = 3,
+  user_defined = 4,
+  unused = 5,
+  byte = 6,
+};
+
+size_t utf8_length(char const first) {
+  /// Length of a UTF-8 sequence from its first byte, treating invalid bytes as single characters
+  auto const byte{static_cast<unsigned char>(first)};
+  if(byte < 0xC0) return 1;
+  if(byte < 0xE0) return 2;
+  if(byte < 0xF0) return 3;
+  return 4;
+}
+
+std::optional<uint8_t> parse_byte_piece(std::string_view piece) {
+  /// Value of a byte fallback piece, written as <0xAB>
+  if(piece.size() != 6 || !piece.starts_with("<0x") || piece.back() != '>') return std::nullopt;
+  unsigned int value{0};
+  for(char const c : piece.substr(3, 2)) {
+    value <<= 4;
+    if(c >= '0' && c <= '9') {
+      value |= static_cast<unsigned int>(c - '0');
+    } else if(c >= 'A' && c <= 'F') {
+      value |= static_cast<unsigned int>(c - 'A' + 10);
+    } else {
+      return std::nullopt;
+    }
+  }
+  return static_cast<uint8_t>(value);
+}
+
+} // anonymous namespace
+
+std::expected<tokenizer, std::string> tokenizer::load(gguf const &model) {
+  /// Read the vocabulary from a model's metadata
+  if(auto const type{model.get_string("tokenizer.ggml.model")}; !type || *type != "llama") {
+    return std::unexpected{"only SentencePiece (llama) vocabularies are supported"};
+  }
+  auto const pieces{model.get_array<std::string>("tokenizer.ggml.tokens")};
+  if(!pieces) return std::unexpected{pieces.error()};
+  auto const scores{model.get_array<float>("tokenizer.ggml.scores")};
+  auto const types{model.get_array<int64_t>("tokenizer.ggml.token_type")};
+
+  tokenizer result;
+  result.pieces.assign(pieces->begin(), pieces->end());
+  if(scores && scores->size() == pieces->size()) {
+    result.scores.assign(scores->begin(), scores->end());
+  } else {
+    result.scores.assign(pieces->size(), 0.0f);
+  }
+  result.hidden.assign(pieces->size(), false);
+  for(size_t i{0}; i != result.pieces.size(); ++i) {
+    auto const id{static_cast<token>(i)};
+    std::string_view const piece{result.pieces[i]};
+    result.lookup.try_emplace(piece, id);
+    auto const type{types && types->size() == pieces->size() ? static_cast<token_types>((*types)[i]) : token_types::normal};
+    if(type == token_types::byte) {
+      if(auto const value{parse_byte_piece(piece)}) result.byte_tokens[*value] = id;
+    } else if(type == token_types::control || type == token_types::user_defined) {
+      if(!piece.empty()) result.specials.emplace_back(id);
+      result.hidden[i] = type == token_types::control;
+    }
+  }
+  std::ranges::sort(result.specials, std::greater{}, [&](token const id){return result.pieces[static_cast<size_t>(id)].size();});
+  if(auto const bos{model.get_uint("tokenizer.ggml.bos_token_id")}) result.bos = static_cast<token>(*bos);
+  if(auto const eos{model.get_uint("tokenizer.ggml.eos_token_id")}) result.eos = static_cast<token>(*eos);
+  if(auto const *const prefix{model.find("tokenizer.ggml.add_space_prefix")}) {
+    if(auto const *const flag{std::get_if<bool>(prefix)}) result.add_space_prefix = *flag;
+  }
+  if(static_cast<size_t>(result.bos) >= result.pieces.size() || static_cast<size_t>(result.eos) >= result.pieces.size()) {
+    return std::unexpected{"special token ids are outside the vocabulary"};
+  }
+  return result;
+}
+
+void tokenizer::encode(std::string_view text, std::vector<token> &output) const {
+  /// Append the tokens of some text, recognising control tokens written out in it
+  bool at_start{true};
+  while(!text.empty()) {
+    size_t next_position{text.size()};
+    std::optional<token> next_special;
+    for(token const id : specials) {                                            // longest first, so the first match at a position is the longest
+      size_t const position{text.find(pieces[static_cast<size_t>(id)])};
+      if(position < next_position) {
+        next_position = position;
+        next_special = id;
+      }
+    }
+    if(next_position != 0) encode_text(text.substr(0, next_position), at_start, output);
+    if(!next_special) break;
+    output.emplace_back(*next_special);
+    text.remove_prefix(next_position + pieces[static_cast<size_t>(*next_special)].size());
+    at_start = false;
+  }
+}
+
+void tokenizer::decode(token const id, std::string &output) const {
+  /// Append the text of a token, restoring spaces and raw bytes
+  if(id < 0 || static_cast<size_t>(id) >= pieces.size() || hidden[static_cast<size_t>(id)]) return;
+  std::string_view piece{pieces[static_cast<size_t>(id)]};
+  if(auto const value{parse_byte_piece(piece)}; value && byte_tokens[*value] == id) {
+    output += static_cast<char>(*value);
+    return;
+  }
+  for(size_t position{piece.find(space_marker)}; position != std::string_view::npos; position = piece.find(space_marker)) {
+    output.append(piece.substr(0, position));
+    output += ' ';
+    piece.remove_prefix(position + space_marker.size());
+  }
+  output.append(piece);
+}
+
+std::optional<tokenizer::token> tokenizer::find(std::string_view piece) const {
+  /// Look up the token for an exact piece of text
+  auto const it{lookup.find(piece)};
+  if(it == lookup.end()) return std::nullopt;
+  return it->second;
+}
+
+tokenizer::token tokenizer::get_bos() const {
+  /// Beginning of sequence token
+  return bos;
+}
+
+tokenizer::token tokenizer::get_eos() const {
+  /// End of sequence token
+  return eos;
+}
+
+size_t tokenizer::size() const {
+  /// Number of tokens in the vocabulary
+  return pieces.size();
+}
+
+void tokenizer::encode_text(std::string_view text, bool const at_start, std::vector<token> &output) const {
+  /// Append the tokens of text without control tokens, merging adjacent pieces by score
+  std::string normalised;
+  normalised.reserve(text.size() + space_marker.size() * 8);
+  if(at_start && add_space_prefix) normalised += space_marker;
+  for(char const c : text) {
+    if(c == ' ') {
+      normalised += space_marker;
+    } else {
+      normalised += c;
+    }
+  }
+
+  struct symbol {
+    int previous;
+    int next;
+    size_t begin;                                                               // into the normalised text
+    size_t length;                                                              // zero once merged into the previous symbol
+  };
+  std::vector<symbol> symbols;
+  for(size_t position{0}; position < normalised.size();) {
+    size_t const length{std::min(utf8_length(normalised[position]), normalised.size() - position)};
+    symbols.emplace_back(symbol{
+      .previous{static_cast<int>(symbols.size()) - 1},
+      .next{static_cast<int>(symbols.size()) + 1},
+      .begin{position},
+      .length{length},
+    });
+    position += length;
+  }
+  if(symbols.empty()) return;
+  symbols.back().next = -1;
+
+  struct bigram {
+    int left;
+    int right;
+    float score;
+    size_t length;                                                              // to detect pairs invalidated by earlier merges
+
+    bool operator<(bigram const &other) const {
+      return std::pair{score, -left} < std::pair{other.score, -other.left};     // best score first, then leftmost
+    }
+  };
+  std::priority_queue<bigram> queue;
+  auto const try_pair{[&](int const left, int const right){
+    if(left < 0 || right < 0) return;
+    size_t const length{symbols[static_cast<size_t>(left)].length + symbols[static_cast<size_t>(right)].length};
+    auto const it{lookup.find(std::string_view{normalised}.substr(symbols[static_cast<size_t>(left)].begin, length))};
+    if(it == lookup.end()) return;
+    queue.emplace(bigram{
+      .left{left},
+      .right{right},
+      .score{scores[static_cast<size_t>(it->second)]},
+      .length{length},
+    });
+  }};
+  for(size_t i{1}; i != symbols.size(); ++i) {
+    try_pair(static_cast<int>(i) - 1, static_cast<int>(i));
+  }
+  while(!queue.empty()) {
+    bigram const best{queue.top()};
+    queue.pop();
+    auto &left{symbols[static_cast<size_t>(best.left)]};
+    auto &right{symbols[static_cast<size_t>(best.right)]};
+    if(left.length == 0 || right.length == 0 || left.length + right.length != best.length) continue; // stale
+    left.length += right.length;
+    right.length = 0;
+    left.next = right.next;
+    if(right.next >= 0) symbols[static_cast<size_t>(right.next)].previous = best.left;
+    try_pair(left.previous, best.left);
+    try_pair(best.left, left.next);
+  }
+
+  for(int i{0}; i >= 0; i = symbols[static_cast<size_t>(i)].next) {
+    auto const &this_symbol{symbols[static_cast<size_t>(i)]};
+    std::string_view const piece{std::string_view{normalised}.substr(this_symbol.begin, this_symbol.length)};
+    if(auto const it{lookup.find(piece)}; it != lookup.end()) {
+      output.emplace_back(it->second);
+      continue;
+    }
+    for(char const c : piece) {                                                 // only single characters can be missing, as merges must be in the vocabulary
+      if(auto const byte_token{byte_tokens[static_cast<unsigned char>(c)]}) output.emplace_back(*byte_token);
+    }
+  }
+}
+
+}
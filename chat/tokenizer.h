@@ -0,0 +1,58 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <expected>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace chat {
+
+class gguf;
+
+class tokenizer {
+  /// SentencePiece-style tokenizer for llama-family vocabularies, as stored in GGUF files.
+  ///
+  /// Text is split into characters, and adjacent pieces are merged highest
+  /// score first while the merged piece is in the vocabulary; characters
+  /// left without a token fall back to byte tokens.  Control tokens such as
+  /// end-of-sequence markers are matched verbatim in the text.
+public:
+  using token = int32_t;
+
+private:
+  std::vector<std::string> pieces;
+  std::vector<float> scores;
+  std::unordered_map<std::string_view, token> lookup;                           // views into pieces, which never change after loading
+  std::array<std::optional<token>, 256> byte_tokens{};
+  std::vector<token> specials;                                                  // control tokens matched in text, longest first
+  std::vector<bool> hidden;                                                     // control tokens, which decode to nothing
+  token bos{1};
+  token eos{2};
+  bool add_space_prefix{true};
+
+public:
+  tokenizer(tokenizer const&) = delete;
+  tokenizer(tokenizer&&) = default;
+  tokenizer &operator=(tokenizer const&) = delete;
+  tokenizer &operator=(tokenizer&&) = default;
+
+  static std::expected<tokenizer, std::string> load(gguf const &model);
+
+  void encode(std::string_view text, std::vector<token> &output) const;
+  void decode(token id, std::string &output) const;
+  std::optional<token> find(std::string_view piece) const;
+
+  token get_bos() const;
+  token get_eos() const;
+  size_t size() const;
+
+private:
+  tokenizer() = default;
+  void encode_text(std::string_view text, bool at_start, std::vector<token> &output) const;
+};
+
+}
@@ -0,0 +1,123 @@
+#include "tool_registry.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+
+namespace chat {
+
+namespace {
+
+std::string error_result(std::string_view message) {
+  /// Format an error as a tool result, so the model can see what went wrong and carry on
+  return nlohmann::json{{"error", message}}.dump();
+}
+
+} // anonymous namespace
+
+void tool_registry::add(tool &&this_tool) {
+  /// Register a tool, replacing any existing tool of the same name
+  auto const it{std::find_if(tools.begin(), tools.end(), [&](tool const &existing){return existing.name == this_tool.name;})};
+  if(it == tools.end()) {
+    tools.emplace_back(std::move(this_tool));
+  } else {
+    *it = std::move(this_tool);
+  }
+}
+
+bool tool_registry::empty() const {
+  /// Whether any tools are registered
+  return tools.empty();
+}
+
+nlohmann::json tool_registry::get_definitions() const {
+  /// Return the definitions of every tool, in the form of a chat completion request's "tools" array
+  nlohmann::json result = nlohmann::json::array();
+  for(auto const &this_tool : tools) {
+    result.emplace_back(nlohmann::json{
+      {"type", "function"},
+      {"function", {
+        {"name", this_tool.name},
+        {"description", this_tool.description},
+        {"parameters", this_tool.parameters},
+      }},
+    });
+  }
+  return result;
+}
+
+tool_registry::statistics const &tool_registry::get_statistics() const {
+  /// Return timings of the most recent batch of calls
+  return stats;
+}
+
+void tool_registry::dispatch(nlohmann::json const &tool_calls, batch_callback &&on_complete) {
+  /// Start every call in a response's "tool_calls" array at once, calling back with the tool messages once all have finished
+  using clock = std::chrono::steady_clock;
+  struct batch {
+    nlohmann::json messages;
+    std::vector<bool> finished;                                                 // guards against handlers completing more than once
+    size_t remaining;
+    clock::time_point time_start;
+    float total_ms{0.0f};
+    batch_callback on_complete;
+  };
+  auto const state{std::make_shared<batch>(batch{
+    .messages = nlohmann::json::array(),                                        // not braced, which would nest it in another array
+    .finished{std::vector<bool>(tool_calls.size(), false)},
+    .remaining{tool_calls.size()},
+    .time_start{clock::now()},
+    .total_ms{0.0f},
+    .on_complete{std::move(on_complete)},
+  })};
+  for(auto const &call : tool_calls) {
+    state->messages.emplace_back(nlohmann::json{
+      {"role", "tool"},
+      {"tool_call_id", call.value("id", "")},
+      {"content", ""},
+    });
+  }
+  if(tool_calls.empty()) {
+    state->on_complete(std::move(state->messages));
+    return;
+  }
+
+  for(size_t i{0}; i != tool_calls.size(); ++i) {
+    auto done{[this, state, i, call_start = clock::now()](std::string &&result){
+      if(state->finished[i]) return;
+      state->finished[i] = true;
+      state->messages[i]["content"] = std::move(result);
+      state->total_ms += std::chrono::duration<float, std::milli>{clock::now() - call_start}.count();
+      if(--state->remaining != 0) return;
+      stats = {
+        .last_batch_calls{state->finished.size()},
+        .last_batch_wall_ms{std::chrono::duration<float, std::milli>{clock::now() - state->time_start}.count()},
+        .last_batch_total_ms{state->total_ms},
+      };
+      state->on_complete(std::move(state->messages));
+    }};
+
+    auto const &call{tool_calls[i]};
+    std::string const name{call.value("/function/name"_json_pointer, "")};
+    auto const *const this_tool{find(name)};
+    if(!this_tool) {
+      done(error_result("Unknown tool \"" + name + "\""));
+      continue;
+    }
+    std::string const arguments{call.value("/function/arguments"_json_pointer, "{}")}; // arguments arrive as JSON text, which handlers decode themselves
+    try {
+      this_tool->invoke(arguments, completion{done});
+    } catch(std::exception const &e) {
+      std::cerr << "ERROR: Tool " << name << " failed: " << e.what() << std::endl;
+      done(error_result(e.what()));                                             // ignored if the handler already completed
+    }
+  }
+}
+
+tool_registry::tool const *tool_registry::find(std::string_view name) const {
+  /// Find a tool by name
+  auto const it{std::find_if(tools.begin(), tools.end(), [&](tool const &this_tool){return this_tool.name == name;})};
+  return it == tools.end() ? nullptr : &*it;
+}
+
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "json_reflect.h"
+
+namespace chat {
+
+class tool_registry {
+  /// Named tools the model may call, and concurrent dispatch of the calls in a response.
+  ///
+  /// Handlers are asynchronous: each receives a completion function to call
+  /// with its result, now or later.  Every call in a response is started
+  /// before any is waited on, so when handlers wait on fetches the turn takes
+  /// as long as the slowest tool rather than the sum of them all.  Once every
+  /// result is in, the tool messages are handed back in call order, ready to
+  /// append to the follow-up request.
+public:
+  using completion = std::function<void(std::string &&result)>;
+  using handler = std::function<void(std::string_view arguments, completion &&done)>; // arguments are the JSON text the model wrote
+  using batch_callback = std::function<void(nlohmann::json &&tool_messages)>;
+
+  struct tool {
+    std::string name{};
+    std::string description{};
+    nlohmann::json parameters{};                                                // JSON schema of the arguments object
+    handler invoke{};
+  };
+
+  struct statistics {
+    size_t last_batch_calls{0};
+    float last_batch_wall_ms{0.0f};                                             // from dispatch until the last result arrived
+    float last_batch_total_ms{0.0f};                                            // sum of each call's own duration, what running them in sequence would have cost
+  };
+
+private:
+  std::vector<tool> tools;
+  statistics stats;
+
+public:
+  void add(tool &&this_tool);
+  template<typename T>
+  void add(std::string name, std::string description, std::function<void(T &&arguments, completion &&done)> &&invoke);
+
+  bool empty() const;
+  nlohmann::json get_definitions() const;
+  statistics const &get_statistics() const;
+
+  void dispatch(nlohmann::json const &tool_calls, batch_callback &&on_complete);
+
+private:
+  tool const *find(std::string_view name) const;
+};
+
+template<typename T>
+void tool_registry::add(std::string name, std::string description, std::function<void(T &&arguments, completion &&done)> &&invoke) {
+  /// Register a tool whose handler takes its arguments as an aggregate, with the schema and decoder reflected from it
+  add({
+    .name{std::move(name)},
+    .description{std::move(description)},
+    .parameters = json_reflect::schema<T>(),                                    // not braced, which would nest it in an array
+    .invoke{[invoke = std::move(invoke)](std::string_view arguments, completion &&done){
+      auto decoded{json_reflect::decode<T>(arguments)};
+      if(!decoded) {
+        done(nlohmann::json{{"error", "Invalid arguments: " + decoded.error()}}.dump());
+        return;
+      }
+      invoke(std::move(*decoded), std::move(done));
+    }},
+  });
+}
+
+}
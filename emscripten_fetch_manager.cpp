@@ -1,11 +1,52 @@
 #include "emscripten_fetch_manager.h"
+#include <algorithm>
+#include <cstdlib>
 
-emscripten_fetch_manager::request::request(std::unique_ptr<std::string const> &&this_data,
+namespace {
+
+std::string_view origin_of(std::string_view const url) {
+  /// The scheme and host of a URL, which requests sharing a connection have in common
+  size_t const host{url.find("://")};
+  if(host == std::string_view::npos) return url;
+  return url.substr(0, url.find('/', host + 3));
+}
+
+} // anonymous namespace
+
+std::deque<emscripten_fetch_manager::completion> emscripten_fetch_manager::completions;
+emscripten_fetch_manager::dispatch_statistics emscripten_fetch_manager::dispatch_stats;
+
+emscripten_fetch_manager::request::request(std::shared_ptr<std::string const> &&this_data,
                                            std::function<void(unsigned short status, std::span<std::byte const> data)> &&this_callback_success,
-                                           std::function<void(unsigned short status, std::string_view status_text, std::span<std::byte const> data)> &&this_callback_error)
+                                           std::function<void(unsigned short status, std::string_view status_text, std::span<std::byte const> data)> &&this_callback_error,
+                                           std::function<void(timings const &timing)> &&this_callback_timings,
+                                           std::function<void(unsigned short status, response &&data, size_t size)> &&this_callback_success_owned)
   : data(std::move(this_data)),
     callback_success(std::move(this_callback_success)),
-    callback_error(std::move(this_callback_error)) {
+    callback_error(std::move(this_callback_error)),
+    callback_timings(std::move(this_callback_timings)),
+    callback_success_owned(std::move(this_callback_success_owned)) {
+}
+
+void emscripten_fetch_manager::response_deleter::operator()(std::byte *data) const {
+  /// Free a response body taken over from its fetch
+  std::free(data);
+}
+
+void emscripten_fetch_manager::request::update_state(emscripten_fetch_t const &fetch, std::chrono::steady_clock::time_point const now) {
+  /// Track the state and status of the request, noting when the response starts to arrive
+  state = static_cast<ready_state>(fetch.readyState);
+  status = fetch.status;
+  if(!headers_received && state >= ready_state::headers_received) headers_received = now;
+}
+
+emscripten_fetch_manager::timings emscripten_fetch_manager::request::get_timings(std::chrono::steady_clock::time_point const finished) const {
+  /// Time taken until the request finished, and until the response started to arrive
+  return {
+    .time_to_first_byte_ms{std::chrono::duration<float, std::milli>{headers_received.value_or(finished) - started}.count()},
+    .total_ms{std::chrono::duration<float, std::milli>{finished - started}.count()},
+    .cold{cold},
+  };
 }
 
 emscripten_fetch_manager::request_id emscripten_fetch_manager::fetch(request_params &&params) {
@@ -17,7 +58,7 @@ emscripten_fetch_manager::request_id emscripten_fetch_manager::fetch(request_par
   }
   c_headers.emplace_back(nullptr);                                              // terminating null
 
-  auto request_data{std::make_unique<std::string>(std::move(params.body))};
+  std::shared_ptr<std::string const> request_data{params.shared_body ? std::move(params.shared_body) : std::make_shared<std::string const>(std::move(params.body))};
 
   emscripten_fetch_attr_t attr;
   emscripten_fetch_attr_init(&attr);
@@ -28,37 +69,31 @@ emscripten_fetch_manager::request_id emscripten_fetch_manager::fetch(request_par
   attr.requestDataSize = request_data->size();
   attr.userData = this;
   attr.onsuccess = [](emscripten_fetch_t *fetch){
-    /// Success callback
-    auto &manager{*static_cast<emscripten_fetch_manager*>(fetch->userData)};
-    auto &request{manager.requests.at(fetch->id)};
-    request.state = static_cast<request::ready_state>(fetch->readyState);
-    request.status = fetch->status;
-
-    request.callback_success(fetch->status, std::as_bytes(std::span{fetch->data, static_cast<size_t>(fetch->numBytes)}));
-
-    manager.requests.erase(fetch->id);
-    emscripten_fetch_close(fetch);                                              // free data associated with the fetch
+    /// Success callback, deferred to the next dispatch rather than run inside the browser's event handler
+    completions.emplace_back(completion{
+      .manager{static_cast<emscripten_fetch_manager*>(fetch->userData)},
+      .fetch{fetch},
+      .success{true},
+      .finished{std::chrono::steady_clock::now()},
+    });
+    dispatch_stats.max_queued = std::max(dispatch_stats.max_queued, completions.size());
   };
   attr.onerror = [](emscripten_fetch_t *fetch){
-    /// Error callback
-    auto &manager{*static_cast<emscripten_fetch_manager*>(fetch->userData)};
-    auto &request{manager.requests.at(fetch->id)};
-
-    request.state = static_cast<request::ready_state>(fetch->readyState);
-    request.status = fetch->status;
-
-    request.callback_error(fetch->status, fetch->statusText, std::as_bytes(std::span{fetch->data, static_cast<size_t>(fetch->numBytes)}));
-
-    manager.requests.erase(fetch->id);
-    emscripten_fetch_close(fetch);                                              // also free data on error
+    /// Error callback, also deferred
+    completions.emplace_back(completion{
+      .manager{static_cast<emscripten_fetch_manager*>(fetch->userData)},
+      .fetch{fetch},
+      .success{false},
+      .finished{std::chrono::steady_clock::now()},
+    });
+    dispatch_stats.max_queued = std::max(dispatch_stats.max_queued, completions.size());
   };
   attr.onprogress = [](emscripten_fetch_t *fetch){
     /// Progress updated callback
     // note: enable EMSCRIPTEN_FETCH_STREAM_DATA to populate fetch->data progressively
     auto &manager{*static_cast<emscripten_fetch_manager*>(fetch->userData)};
     auto &request{manager.requests.at(fetch->id)};
-    request.state = static_cast<request::ready_state>(fetch->readyState);
-    request.status = fetch->status;
+    request.update_state(*fetch, std::chrono::steady_clock::now());
 
     if(fetch->totalBytes == 0) {
       request.bytes_done = fetch->dataOffset + fetch->numBytes;
@@ -71,9 +106,7 @@ emscripten_fetch_manager::request_id emscripten_fetch_manager::fetch(request_par
   attr.onreadystatechange = [](emscripten_fetch_t *fetch){
     /// Download state updated callback
     auto &manager{*static_cast<emscripten_fetch_manager*>(fetch->userData)};
-    auto &request{manager.requests.at(fetch->id)};
-    request.state = static_cast<request::ready_state>(fetch->readyState);
-    request.status = fetch->status;
+    manager.requests.at(fetch->id).update_state(*fetch, std::chrono::steady_clock::now());
   };
 
   auto id{emscripten_fetch(&attr, params.url.c_str())->id};
@@ -84,8 +117,93 @@ emscripten_fetch_manager::request_id emscripten_fetch_manager::fetch(request_par
     std::forward_as_tuple(
       std::move(request_data),
       std::move(params.on_success),
-      std::move(params.on_error)
+      std::move(params.on_error),
+      std::move(params.on_timings),
+      std::move(params.on_success_owned)
     )
   );
+  requests.at(id).cold = !is_warm(params.url);
   return id;
 }
+
+bool emscripten_fetch_manager::is_warm(std::string const &url) const {
+  /// Whether a response arrived from this URL's origin recently enough that its connection is likely still open
+  auto const it{last_contact.find(std::string{origin_of(url)})};
+  return it != last_contact.end() && std::chrono::steady_clock::now() - it->second < warm_interval;
+}
+
+void emscripten_fetch_manager::record_warm_up(timings const &timing) {
+  /// Count a request sent only to open a connection, and how long it took
+  ++warm_stats.warmups;
+  warm_stats.last_warmup_ms = timing.total_ms;
+}
+
+std::chrono::steady_clock::duration emscripten_fetch_manager::get_warm_interval() const {
+  /// Return how long an origin is considered warm after a response from it
+  return warm_interval;
+}
+
+void emscripten_fetch_manager::set_warm_interval(std::chrono::steady_clock::duration const new_interval) {
+  /// Set how long an origin is considered warm after a response from it
+  warm_interval = new_interval;
+}
+
+emscripten_fetch_manager::warm_statistics const &emscripten_fetch_manager::get_warm_statistics() const {
+  /// Return warm-up counters and first byte times
+  return warm_stats;
+}
+
+emscripten_fetch_manager::dispatch_statistics const &emscripten_fetch_manager::dispatch_completions(std::chrono::steady_clock::duration const budget) {
+  /// Run the callbacks of finished fetches in the order they finished, until the budget is spent, leaving the rest for the next call; always runs at least one
+  auto const start_time{std::chrono::steady_clock::now()};
+  size_t dispatched{0};
+  while(!completions.empty()) {
+    auto const next{completions.front()};
+    completions.pop_front();
+    next.manager->complete(*next.fetch, next.success, next.finished);
+    ++dispatched;
+    if(std::chrono::steady_clock::now() - start_time >= budget) break;
+  }
+  dispatch_stats.dispatched = dispatched;
+  dispatch_stats.carried_over = completions.size();
+  dispatch_stats.total_dispatched += dispatched;
+  dispatch_stats.last_dispatch_ms = std::chrono::duration<float, std::milli>{std::chrono::steady_clock::now() - start_time}.count();
+  return dispatch_stats;
+}
+
+emscripten_fetch_manager::dispatch_statistics const &emscripten_fetch_manager::get_dispatch_statistics() {
+  /// Return counters from the last dispatch
+  return dispatch_stats;
+}
+
+void emscripten_fetch_manager::complete(emscripten_fetch_t &fetch, bool const success, std::chrono::steady_clock::time_point const finished) {
+  /// Call a finished request's callbacks, then release it; times are measured to when it finished, not to this dispatch
+  auto &request{requests.at(fetch.id)};
+  request.update_state(fetch, finished);
+
+  auto const timing{request.get_timings(finished)};
+  std::string const url{fetch.url};
+  if(timing.cold) {
+    ++warm_stats.cold_requests;
+    warm_stats.cold_first_byte_ms += (timing.time_to_first_byte_ms - warm_stats.cold_first_byte_ms) / static_cast<float>(warm_stats.cold_requests);
+  } else {
+    ++warm_stats.warm_requests;
+    warm_stats.warm_first_byte_ms += (timing.time_to_first_byte_ms - warm_stats.warm_first_byte_ms) / static_cast<float>(warm_stats.warm_requests);
+  }
+  if(fetch.status != 0) last_contact[std::string{origin_of(url)}] = finished;   // status 0 means the server was never reached
+
+  if(request.callback_timings) request.callback_timings(timing);
+  auto const data{std::as_bytes(std::span{fetch.data, static_cast<size_t>(fetch.numBytes)})};
+  if(success && request.callback_success_owned) {
+    response owned{reinterpret_cast<std::byte*>(const_cast<char*>(fetch.data))};
+    fetch.data = nullptr;                                                       // so closing the fetch leaves it alone
+    request.callback_success_owned(fetch.status, std::move(owned), data.size());
+  } else if(success) {
+    request.callback_success(fetch.status, data);
+  } else {
+    request.callback_error(fetch.status, fetch.statusText, data);
+  }
+
+  requests.erase(fetch.id);
+  emscripten_fetch_close(&fetch);                                               // free data associated with the fetch
+}
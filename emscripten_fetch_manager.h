@@ -1,32 +1,56 @@
 #pragma once
 
+#include <chrono>
+#include <deque>
 #include <functional>
+#include <memory>
 #include <span>
 #include <string>
 #include <string_view>
+#include <unordered_map>
 #include <vector>
 #include <emscripten/fetch.h>
 
 class emscripten_fetch_manager {
 public:
+  struct timings {
+    /// How long a request took, from when it was sent
+    float time_to_first_byte_ms{0.0f};                                          // until the response headers arrived
+    float total_ms{0.0f};                                                       // until the whole response arrived
+    bool cold{false};                                                           // nothing reached the same origin recently, so this may have paid for a connection
+  };
+
+  struct response_deleter {
+    void operator()(std::byte *data) const;                                     // the fetch allocated it with malloc
+  };
+  using response = std::unique_ptr<std::byte, response_deleter>;                // a response body taken over from its fetch
+
   struct request_params {
     /// Parameters for a fetch request
     std::string method{"GET"};
     std::string const &url{};
     std::vector<std::string> headers{};
     std::string body{};
+    std::shared_ptr<std::string const> shared_body{};                           // sent instead of body when set, for a body that's sent more than once
     std::function<void(unsigned short status, std::span<std::byte const> data)> on_success; // on_success callback is usually expected
     std::function<void(unsigned short status, std::string_view status_text, std::span<std::byte const> data)> on_error{};
     uint32_t attributes{EMSCRIPTEN_FETCH_LOAD_TO_MEMORY | EMSCRIPTEN_FETCH_REPLACE}; // using REPLACE without PERSIST_FILE skips querying IndexedDB
+    std::function<void(timings const &timing)> on_timings{};                    // optional, called just before on_success or on_error
+    std::function<void(unsigned short status, response &&data, size_t size)> on_success_owned{}; // optional, called instead of on_success with ownership of the body, so a large one needn't be copied
   };
 
   using request_id = uint32_t;
 
   struct request {
     /// Status of an ongoing request
-    std::unique_ptr<std::string const> const data;                              // the body of the request we sent (must be preserved until fetch completes)
+    std::shared_ptr<std::string const> const data;                              // the body of the request we sent (must be preserved until fetch completes)
     std::function<void(unsigned short status, std::span<std::byte const> data)> callback_success;
     std::function<void(unsigned short status, std::string_view status_text, std::span<std::byte const> data)> callback_error;
+    std::function<void(timings const &timing)> callback_timings;
+    std::function<void(unsigned short status, response &&data, size_t size)> callback_success_owned;
+    std::chrono::steady_clock::time_point const started{std::chrono::steady_clock::now()};
+    std::optional<std::chrono::steady_clock::time_point> headers_received{};
+    bool cold{false};
 
   public:
     enum class ready_state : unsigned short {                                   // from include/emscripten/fetch.h
@@ -40,12 +64,62 @@ public:
     uint64_t bytes_done{0};
     std::optional<uint64_t> bytes_total{};
 
-    request(std::unique_ptr<std::string const> &&data,
+    request(std::shared_ptr<std::string const> &&data,
             std::function<void(unsigned short status, std::span<std::byte const> data)> &&callback_success,
-            std::function<void(unsigned short status, std::string_view status_text, std::span<std::byte const> data)> &&callback_error);
+            std::function<void(unsigned short status, std::string_view status_text, std::span<std::byte const> data)> &&callback_error,
+            std::function<void(timings const &timing)> &&callback_timings,
+            std::function<void(unsigned short status, response &&data, size_t size)> &&callback_success_owned);
+
+    void update_state(emscripten_fetch_t const &fetch, std::chrono::steady_clock::time_point now);
+    timings get_timings(std::chrono::steady_clock::time_point finished) const;
   };
   std::unordered_map<request_id, request> requests;
 
+  struct dispatch_statistics {
+    /// Completion callbacks run at the start of each frame
+    size_t dispatched{0};                                                       // in the last dispatch
+    size_t carried_over{0};                                                     // left for the next frame when the budget ran out
+    size_t max_queued{0};                                                       // deepest the queue has been
+    uint64_t total_dispatched{0};
+    float last_dispatch_ms{0.0f};
+  };
+
+  struct warm_statistics {
+    /// Connection warm-ups, and how long the first byte took to arrive for cold and warm requests, warm-ups included
+    uint64_t warmups{0};
+    float last_warmup_ms{0.0f};                                                 // including any preflight and connection setup
+    uint64_t cold_requests{0};
+    uint64_t warm_requests{0};
+    float cold_first_byte_ms{0.0f};                                             // mean over cold requests
+    float warm_first_byte_ms{0.0f};                                             // mean over warm requests
+  };
+
+private:
+  struct completion {
+    emscripten_fetch_manager *manager;
+    emscripten_fetch_t *fetch;                                                  // kept open, with its data, until dispatched
+    bool success;
+    std::chrono::steady_clock::time_point finished;                             // when the browser reported it, rather than when it's dispatched
+  };
+  static std::deque<completion> completions;                                    // finished fetches of every manager, in the order the browser reported them
+  static dispatch_statistics dispatch_stats;
+
+  std::unordered_map<std::string, std::chrono::steady_clock::time_point> last_contact; // when a response last arrived from each origin, whose connection later requests share
+  std::chrono::steady_clock::duration warm_interval{std::chrono::seconds{30}};  // how long a connection is assumed to stay open
+  warm_statistics warm_stats;
+
 public:
   request_id fetch(request_params &&params);
+  bool is_warm(std::string const &url) const;
+  void record_warm_up(timings const &timing);
+
+  std::chrono::steady_clock::duration get_warm_interval() const;
+  void set_warm_interval(std::chrono::steady_clock::duration new_interval);
+  warm_statistics const &get_warm_statistics() const;
+
+  static dispatch_statistics const &dispatch_completions(std::chrono::steady_clock::duration budget);
+  static dispatch_statistics const &get_dispatch_statistics();
+
+private:
+  void complete(emscripten_fetch_t &fetch, bool success, std::chrono::steady_clock::time_point finished);
 };
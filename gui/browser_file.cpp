@@ -0,0 +1,140 @@
+#include "browser_file.h"
+#include <memory>
+#include <emscripten.h>
+
+namespace gui::browser_file {
+
+namespace {
+
+struct read_request {                                                           // owned by the browser until it calls back
+  std::function<void(bool success)> done;
+};
+
+} // anonymous namespace
+
+EM_JS(void, browser_file_pick_js, (void *request), {
+  /// Show the file dialog, and keep the chosen file for reading parts of it
+  Module.browserFiles = Module.browserFiles || {next: 1, handles: new Map()};
+  const input = document.createElement('input');
+  input.type = 'file';
+  input.addEventListener('cancel', () => {
+    Module["ccall"]('gui_browser_file_picked', null, ['number', 'number', 'string', 'number', 'string'], [request, 0, '', 0, 'No file chosen']);
+  });
+  input.addEventListener('change', () => {
+    const file = input.files[0];
+    const handle = Module.browserFiles.next++;
+    Module.browserFiles.handles.set(handle, file);
+    Module["ccall"]('gui_browser_file_picked', null, ['number', 'number', 'string', 'number', 'string'], [request, handle, file.name, file.size, '']);
+  });
+  input.click();
+});
+
+EM_JS(void, browser_file_read_js, (int handle, double offset, std::byte *destination, size_t size, void *request), {
+  /// Read a byte range of a picked file into wasm memory, which the caller keeps allocated until it's told the read is done
+  const file = Module.browserFiles.handles.get(handle);
+  file.slice(offset, offset + size).arrayBuffer().then((buffer) => {
+    if(buffer.byteLength !== size) throw new Error('short read');
+    HEAPU8.set(new Uint8Array(buffer), destination);                            // HEAPU8 as it is now, in case memory grew meanwhile
+    Module["ccall"]('gui_browser_file_read', null, ['number', 'number'], [request, 1]);
+  }).catch(() => {
+    Module["ccall"]('gui_browser_file_read', null, ['number', 'number'], [request, 0]);
+  });
+});
+
+EM_JS(int, browser_file_create_js, (char const *filename), {
+  /// Start a file to be saved, returning its handle
+  Module.browserFiles = Module.browserFiles || {next: 1, handles: new Map()};
+  const handle = Module.browserFiles.next++;
+  Module.browserFiles.handles.set(handle, {name: UTF8ToString(filename), parts: []});
+  return handle;
+});
+
+EM_JS(void, browser_file_append_js, (int handle, std::byte const *data, size_t size), {
+  /// Copy the next part of a file to be saved out of wasm memory
+  Module.browserFiles.handles.get(handle).parts.push(new Blob([HEAPU8.slice(data, data + size)]));
+});
+
+EM_JS(void, browser_file_save_js, (int handle), {
+  /// Offer a complete file to the user to save, then let it go
+  const target = Module.browserFiles.handles.get(handle);
+  Module.browserFiles.handles.delete(handle);
+  const url = URL.createObjectURL(new Blob(target.parts));
+  const link = document.createElement('a');
+  link.href = url;
+  link.download = target.name;
+  link.click();
+  setTimeout(() => URL.revokeObjectURL(url), 60000);                            // long enough for the browser to start saving it
+});
+
+EM_JS(void, browser_file_release_js, (int handle), {
+  /// Let go of a picked file, or discard a file that won't be saved
+  Module.browserFiles.handles.delete(handle);
+});
+
+void pick(pick_callback &&callback) {
+  /// Let the user choose a file, without reading any of it yet
+  browser_file_pick_js(new pick_callback{std::move(callback)});
+}
+
+save_target save(std::string const &filename) {
+  /// Start a file to be saved as a download arrives, a part at a time
+  auto const handle{std::shared_ptr<int>{new int{browser_file_create_js(filename.c_str())}, [](int *released){
+    if(*released != 0) browser_file_release_js(*released);                      // not saved, so discard what was kept
+    delete released;
+  }}};
+  return {
+    .write{[handle](std::span<std::byte const> data){
+      if(*handle == 0) return false;
+      browser_file_append_js(*handle, data.data(), data.size());
+      return true;
+    }},
+    .finish{[handle](bool const success){
+      if(*handle == 0) return;
+      if(success) {
+        browser_file_save_js(*handle);                                          // which releases it
+      } else {
+        browser_file_release_js(*handle);
+      }
+      *handle = 0;
+    }},
+  };
+}
+
+extern "C" {
+
+EMSCRIPTEN_KEEPALIVE void gui_browser_file_picked(void *request, int handle, char const *name, double size, char const *error);
+EMSCRIPTEN_KEEPALIVE void gui_browser_file_read(void *request, int success);
+
+EMSCRIPTEN_KEEPALIVE void gui_browser_file_picked(void *request, int const handle, char const *name, double const size, char const *error) {
+  /// Hand the chosen file or an error to the callback, releasing the request - called from javascript
+  std::unique_ptr<pick_callback> const owned{static_cast<pick_callback*>(request)};
+  if(*error != '\0') {
+    (*owned)(std::unexpected{std::string{error}});
+    return;
+  }
+  auto const file{std::shared_ptr<int const>{new int{handle}, [](int const *released){
+    browser_file_release_js(*released);
+    delete released;
+  }}};
+  (*owned)(picked{
+    .name{name},
+    .size{static_cast<uint64_t>(size)},
+    .read{[file](uint64_t const offset, std::span<std::byte> destination, std::function<void(bool success)> &&done){
+      browser_file_read_js(*file, static_cast<double>(offset), destination.data(), destination.size(), new read_request{
+        .done{[file, done = std::move(done)](bool const success){               // holding the file until the read completes
+          done(success);
+        }},
+      });
+    }},
+  });
+}
+
+EMSCRIPTEN_KEEPALIVE void gui_browser_file_read(void *request, int const success) {
+  /// Tell the reader a part has been read, releasing the request - called from javascript
+  std::unique_ptr<read_request> const owned{static_cast<read_request*>(request)};
+  owned->done(success != 0);
+}
+
+}
+
+} // namespace gui::browser_file
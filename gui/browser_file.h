@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <expected>
+#include <functional>
+#include <string>
+#include "chat/file_transfer.h"
+
+namespace gui::browser_file {
+  /// Files the user picks or saves through the browser, streamed a part at a time for file transfers.
+  ///
+  /// The virtual filesystem keeps a whole file in wasm memory, which breaks
+  /// file_transfer's bound of part_size x parallelism for large files.  A
+  /// picked file instead stays a browser File, and each part is read from a
+  /// slice of it when it's needed.  A download is kept part by part as
+  /// browser Blobs, which the browser may hold on disk, and offered to the
+  /// user to save once it's complete.  Reads complete asynchronously,
+  /// calling back on the main thread.
+
+struct picked {
+  std::string name;
+  uint64_t size{0};
+  chat::file_transfer::reader read;                                             // reads byte ranges of the file, holding it until the last copy is destroyed
+};
+
+struct save_target {
+  chat::file_transfer::sink write;                                              // copies each part out of wasm memory as it arrives
+  std::function<void(bool success)> finish;                                     // offers the file to save, or discards what was kept
+};
+
+using pick_callback = std::function<void(std::expected<picked, std::string> &&result)>;
+
+void pick(pick_callback &&callback);
+save_target save(std::string const &filename);
+
+} // namespace gui::browser_file
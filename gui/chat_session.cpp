@@ -0,0 +1,728 @@
+#include "chat_session.h"
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <iostream>
+#include <imgui/imgui.h>
+#include <imgui/imgui_stdlib.h>
+#include <emscripten.h>
+#include <nlohmann/json.hpp>
+#include <magic_enum/magic_enum.hpp>
+#include "chat/snapshot.h"
+#include "base64.h"
+#include "emscripten_fetch_manager.h"
+#include "image_loader.h"
+#include "json_reflect.h"
+
+namespace gui {
+
+namespace {
+
+struct search_arguments {                                                       // tool arguments, with schema and decoder reflected by json_reflect
+  std::string query{};
+  std::optional<uint32_t> max_results{};                                        // up to 50, defaulting to 10
+};
+
+struct suggested_replies {                                                      // structured output of a reply suggestion request
+  std::vector<std::string> replies{};
+};
+
+std::string_view constexpr image_placeholder_marker{"\"\\u0001"};              // how an image placeholder's leading control character is escaped in a dump
+
+std::string make_image_placeholder(chat::conversation_tree::node_id const id, size_t const index) {
+  /// A short stand-in for an image's data URL, replaced as the request is serialised
+  return "\x01" + std::to_string(id) + ':' + std::to_string(index);
+}
+
+} // anonymous namespace
+
+chat_session::chat_session(unsigned int const this_id, services const &this_shared)
+  : session_id{this_id},
+    name{"Chat " + std::to_string(this_id)},
+    shared{this_shared},
+    semantic_search{this_shared.fetcher} {
+  /// Start a new conversation
+  conversation.append({
+    .role{chat::message::roles::system},
+    .text{"You are a helpful assistant..."},
+  });
+  conversation.append({
+    .role{chat::message::roles::user},
+  });
+  sync_indexes();
+  register_tools();
+}
+
+void chat_session::draw() {
+  /// Draw the conversation and its controls
+  draw_search();
+
+  draw_branches();
+
+  std::span<chat::conversation_tree::node* const> path{conversation.path()};
+  std::optional<size_t> fork_index;
+  std::optional<std::pair<size_t, size_t>> detach;                              // path index and image index
+  ImGuiListClipper clipper;                                                     // messages are all the same height, so only those on screen are drawn, letting the rest go cold
+  clipper.Begin(static_cast<int>(path.size()));
+  if(scroll_to_message) {
+    auto const it{std::find_if(path.begin(), path.end(), [&](auto const *node){return node->id == *scroll_to_message;})};
+    if(it != path.end()) clipper.IncludeItemByIndex(static_cast<int>(it - path.begin()));
+  }
+  while(clipper.Step()) {
+    for(auto i{static_cast<size_t>(clipper.DisplayStart)}; i != static_cast<size_t>(clipper.DisplayEnd); ++i) {
+      chat::conversation_tree::node_id const node_id{path[i]->id};
+      ImGui::PushID(static_cast<int>(node_id));
+      ImGui::Separator();
+      if(scroll_to_message == node_id) {
+        ImGui::SetScrollHereY(0.0f);
+        scroll_to_message.reset();
+      }
+      if(ImGui::BeginCombo("Role", std::string{magic_enum::enum_name(path[i]->role)}.c_str())) {
+        for(auto const &[this_role, role_name] : magic_enum::enum_entries<chat::message::roles>()) {
+          bool const is_selected{this_role == path[i]->role};
+          if(ImGui::Selectable(std::string{role_name}.c_str(), is_selected) && !is_selected) {
+            conversation.set_role(i, this_role);
+            path = conversation.path();                                         // editing a shared message copies the rest of the path
+          }
+          if(is_selected) ImGui::SetItemDefaultFocus();
+        }
+        ImGui::EndCombo();
+      }
+      ImGui::SameLine();
+      if(ImGui::Button("Fork here")) fork_index = i;
+      if(path[i]->role == chat::message::roles::user) {                         // the API only accepts images from the user
+        ImGui::SameLine();
+        if(ImGui::Button("Attach image")) attach_image(node_id);
+        auto const images{conversation.get_images(*path[i])};
+        for(size_t j{0}; j != images.size(); ++j) {                             // on the same line, so messages stay the same height for the clipper
+          ImGui::SameLine();
+          ImGui::PushID(static_cast<int>(j));
+          std::string const label{std::to_string(images[j].dimensions.width) + "x" + std::to_string(images[j].dimensions.height) + ", " + std::to_string(images[j].data.size() / 1024) + "KB X"};
+          if(ImGui::SmallButton(label.c_str())) detach = std::pair{i, j};
+          ImGui::SetItemTooltip("Remove this image");
+          ImGui::PopID();
+        }
+      }
+      edit_buffer = conversation.get_text(*path[i]);
+      if(ImGui::InputTextMultiline("Message", &edit_buffer)) {
+        conversation.set_text(i, std::string{edit_buffer});
+        path = conversation.path();
+        shared.provider.warm_up();                                              // a request is likely soon, so get the connection ready while typing; once per key
+      }
+      if(ImGui::IsItemDeactivatedAfterEdit()) {                                 // reindex once editing finishes, rather than on every keystroke
+        sync_indexes();
+        run_search();
+      }
+      ImGui::PopID();
+    }
+  }
+  if(detach) {                                                                  // after drawing, as editing may copy the path
+    conversation.detach_image(detach->first, detach->second);
+    sync_indexes();
+  }
+  if(fork_index) {                                                              // after drawing, as forking changes the path
+    conversation.fork(*fork_index);
+    if(conversation.path().back()->role != chat::message::roles::user) {
+      conversation.append({.role{chat::message::roles::user}});                 // leave room for an alternative reply
+    }
+    sync_indexes();
+  }
+  ImGui::SetNextItemWidth(ImGui::GetFontSize() * 10.0f);
+  ImGui::SliderFloat("Temperature", &temperature, 0.0f, 2.0f, "%.2f");
+  ImGui::SameLine();
+  ImGui::Checkbox("Tools", &tools_enabled);
+  ImGui::SameLine();
+  ImGui::SetNextItemWidth(ImGui::GetFontSize() * 5.0f);
+  if(ImGui::BeginCombo("Image detail", std::string{magic_enum::enum_name(image_detail)}.c_str())) {
+    for(auto const &[this_detail, detail_name] : magic_enum::enum_entries<chat::image::details>()) {
+      if(ImGui::Selectable(std::string{detail_name}.c_str(), this_detail == image_detail)) image_detail = this_detail;
+    }
+    ImGui::EndCombo();
+  }
+  ImGui::SetItemTooltip("Resolution of newly attached images: low is a single 512px tile, high is up to 768px on the shortest side");
+  if(images_loading != 0) {
+    ImGui::SameLine();
+    ImGui::TextUnformatted("Loading image...");
+  } else if(!image_status.empty()) {
+    ImGui::SameLine();
+    ImGui::TextUnformatted(image_status.c_str());
+  }
+  if(last_request_size != 0) {
+    ImGui::SameLine();
+    ImGui::Text("Last request: %zuKB built in %.2fms", last_request_size / 1024, static_cast<double>(last_request_build_ms));
+  }
+  if(auto const &tool_stats{tools.get_statistics()}; tool_stats.last_batch_calls != 0) {
+    ImGui::SameLine();
+    ImGui::Text("Last tool turn: %zu calls in %.1fms (%.1fms if run in sequence)",
+      tool_stats.last_batch_calls,
+      static_cast<double>(tool_stats.last_batch_wall_ms),
+      static_cast<double>(tool_stats.last_batch_total_ms)
+    );
+  }
+
+  ImGui::BeginDisabled(!can_call());
+  if(ImGui::Button("Call")) call();
+  ImGui::EndDisabled();
+  ImGui::SameLine();
+  if(ImGui::Button("Suggest replies")) request_suggestions();
+  if(requests_in_flight != 0) {
+    ImGui::SameLine();
+    ImGui::Text("%u requests in progress", requests_in_flight);
+  }
+  draw_suggestions();
+}
+
+void chat_session::update() {
+  /// Per-frame housekeeping, whether or not the session is visible
+  if(semantic_enabled) semantic_search.flush(shared.api_key);                   // send anything queued this frame as one batch
+  conversation.maintain();
+}
+
+void chat_session::call() {
+  /// Request the assistant's reply to the active branch
+  nlohmann::json request_json = make_request();                                 // not braced, which would nest it in an array
+  if(tools_enabled && !tools.empty()) {
+    request_json["tools"] = tools.get_definitions();
+    request_json["parallel_tool_calls"] = true;
+  }
+  ++requests_in_flight;                                                         // until the final reply, however many tool rounds it takes
+  request_completion(conversation.get_active_branch(), request_json, 0);
+}
+
+bool chat_session::can_call() {
+  /// Whether the active branch ends with a user message to reply to
+  auto const *const last{conversation.path().back()};
+  return last->role == chat::message::roles::user && (!conversation.get_text(*last).empty() || !conversation.get_images(*last).empty());
+}
+
+bool chat_session::idle() const {
+  /// Whether no requests are outstanding, so the session can be destroyed safely
+  return requests_in_flight == 0 && images_loading == 0 && !semantic_search.busy();
+}
+
+unsigned int chat_session::get_id() const {
+  /// Return the session's unique id
+  return session_id;
+}
+
+std::string const &chat_session::get_name() const {
+  /// Return the session's display name
+  return name;
+}
+
+std::string chat_session::snapshot_path() const {
+  /// Location of this session's snapshot, in the IndexedDB-backed file system
+  return "/persistent/conversation_" + std::to_string(session_id) + ".snapshot";
+}
+
+void chat_session::draw_search() {
+  /// Draw the message search box and any results
+  if(ImGui::InputTextWithHint("Search", "Search messages: words, prefix*, \"exact phrase\"", &search_query)) {
+    run_search();
+  }
+  if(ImGui::Checkbox("Semantic search", &semantic_enabled) && semantic_enabled) {
+    conversation.for_each_node([&](chat::conversation_tree::node const &node){ // backfill embeddings for the existing conversation
+      semantic_search.update(node.id, conversation.get_text(node));
+    });
+  }
+  if(semantic_enabled) {
+    ImGui::SameLine();
+    ImGui::BeginDisabled(search_query.empty());
+    if(ImGui::Button("Find related")) {
+      semantic_search.query(search_query, 20, [&](std::vector<chat::semantic_search::result> &&results){
+        semantic_results = std::move(results);
+      });
+    }
+    ImGui::EndDisabled();
+    ImGui::SameLine();
+    ImGui::Text("%zu indexed%s", semantic_search.size(), semantic_search.busy() ? ", embedding..." : "");
+  }
+
+  if(semantic_enabled && !semantic_results.empty()) {
+    ImGui::TextUnformatted("Related messages:");
+    if(ImGui::BeginListBox("##semantic_results", {-FLT_MIN, ImGui::GetTextLineHeightWithSpacing() * static_cast<float>(std::min<size_t>(semantic_results.size(), 6) + 1)})) {
+      for(auto const &result : semantic_results) {
+        char annotation[16];
+        std::snprintf(annotation, sizeof(annotation), "%.3f", static_cast<double>(result.similarity));
+        draw_message_link(result.id, 0, annotation);
+      }
+      ImGui::EndListBox();
+    }
+  }
+
+  if(search_query.empty()) return;
+  ImGui::Text("%zu results in %.3fms", search_results.size(), static_cast<double>(search_time_ms));
+  if(search_results.empty()) return;
+  if(!ImGui::BeginListBox("##search_results", {-FLT_MIN, ImGui::GetTextLineHeightWithSpacing() * static_cast<float>(std::min<size_t>(search_results.size(), 6) + 1)})) return;
+  for(auto const &result : search_results) {
+    draw_message_link(result.id, result.offset, {});
+  }
+  ImGui::EndListBox();
+}
+
+void chat_session::draw_branches() {
+  /// Draw the branch selector for the conversation
+  auto const branch_label{[&](chat::conversation_tree::branch const &branch){
+    return "Branch " + std::to_string(branch.id) + " (" + std::to_string(branch.leaf ? branch.leaf->depth + 1 : 0) + " messages)";
+  }};
+  auto const branches{conversation.get_branches()};
+  auto const active{conversation.get_active_branch()};
+  auto const active_it{std::find_if(branches.begin(), branches.end(), [&](auto const &branch){return branch.id == active;})};
+  if(ImGui::BeginCombo("Branch", branch_label(*active_it).c_str())) {
+    std::optional<chat::conversation_tree::branch_id> selected;
+    for(auto const &branch : branches) {
+      bool const is_selected{branch.id == active};
+      if(ImGui::Selectable((branch_label(branch) + "##" + std::to_string(branch.id)).c_str(), is_selected)) {
+        selected = branch.id;
+      }
+      if(is_selected) ImGui::SetItemDefaultFocus();
+    }
+    ImGui::EndCombo();
+    if(selected) conversation.switch_branch(*selected);                         // switch after iterating, as the branch list is a view
+  }
+  ImGui::SameLine();
+  ImGui::BeginDisabled(branches.size() == 1);
+  if(ImGui::Button("Delete branch")) {
+    conversation.remove_branch(active);
+    sync_indexes();
+    run_search();
+  }
+  ImGui::EndDisabled();
+  ImGui::SameLine();
+  auto const storage{conversation.get_storage_statistics()};
+  ImGui::Text("%zu messages across all branches: %zu hot (%zuKiB), %zu cold (%zuKiB compressed to %zuKiB)",
+    conversation.size(),
+    storage.hot_count,
+    storage.hot_bytes / 1024,
+    storage.cold_count,
+    storage.cold_bytes / 1024,
+    storage.compressed_bytes / 1024
+  );
+
+  if(ImGui::Button("Save")) {
+    auto const time_start{std::chrono::steady_clock::now()};
+    if(auto const result{chat::snapshot::save(conversation, snapshot_path())}; !result) {
+      snapshot_status = result.error();
+    } else {
+      snapshot_status = "Saved in " + std::to_string(std::chrono::duration<float, std::milli>{std::chrono::steady_clock::now() - time_start}.count()) + "ms";
+      EM_ASM(
+        FS.syncfs(false, function(error) {                                      // write back to IndexedDB
+          if(error) console.error('ERROR saving persistent storage: ' + error);
+        });
+      );
+    }
+  }
+  ImGui::SameLine();
+  if(ImGui::Button("Load")) {
+    auto const time_start{std::chrono::steady_clock::now()};
+    if(auto const loaded{chat::snapshot::open(snapshot_path())}; !loaded) {
+      snapshot_status = loaded.error();
+    } else if(auto const restored{loaded->restore(conversation)}; !restored) {
+      snapshot_status = restored.error();
+    } else {
+      sync_indexes();
+      run_search();
+      snapshot_status = "Loaded " + std::to_string(loaded->size()) + " messages in " + std::to_string(std::chrono::duration<float, std::milli>{std::chrono::steady_clock::now() - time_start}.count()) + "ms";
+    }
+  }
+  if(!snapshot_status.empty()) {
+    ImGui::SameLine();
+    ImGui::TextUnformatted(snapshot_status.c_str());
+  }
+}
+
+void chat_session::draw_message_link(chat::conversation_tree::node_id const id, size_t const offset, std::string_view annotation) {
+  /// Draw a selectable one-line summary of a message around the given offset, which switches to its branch and scrolls to it when clicked
+  auto const *const node{conversation.find(id)};
+  if(!node) return;                                                             // released since the results were produced
+  std::string_view const text{conversation.get_text(*node)};
+  size_t const line_start{text.rfind('\n', offset)};
+  size_t const snippet_start{line_start == std::string_view::npos ? 0 : line_start + 1}; // show the line containing the match
+  size_t const snippet_end{std::min(text.find('\n', offset), text.size())};
+  std::string label{"#" + std::to_string(node->depth) + " "};
+  if(!annotation.empty()) {
+    label += '(';
+    label += annotation;
+    label += ") ";
+  }
+  label += magic_enum::enum_name(node->role);
+  label += ": ";
+  label += text.substr(snippet_start, std::min<size_t>(snippet_end - snippet_start, 160));
+  label += "##" + std::to_string(id);
+  if(ImGui::Selectable(label.c_str())) {
+    if(auto const branch{conversation.find_branch_containing(id)}) conversation.switch_branch(*branch);
+    scroll_to_message = id;
+  }
+}
+
+void chat_session::run_search() {
+  /// Query the search index for the current search string
+  if(search_query.empty()) {
+    search_results.clear();
+    return;
+  }
+  auto const time_start{std::chrono::steady_clock::now()};
+  search_results = search_index.search(search_query, 100);
+  search_time_ms = std::chrono::duration<float, std::milli>{std::chrono::steady_clock::now() - time_start}.count();
+}
+
+void chat_session::register_tools() {
+  /// Register the tools the model may call when tools are enabled
+  tools.add<search_arguments>(
+    "search_messages",
+    "Full-text search of every message in this conversation, on all branches. Supports prefix* and \"exact phrase\" terms. Returns up to max_results messages, at most 50, or 10 if null.",
+    [this](search_arguments &&arguments, chat::tool_registry::completion &&done){
+      nlohmann::json result = nlohmann::json::array();
+      for(auto const &match : search_index.search(arguments.query, std::min<size_t>(arguments.max_results.value_or(10), 50))) {
+        result.emplace_back(describe_message(match.id));
+      }
+      done(result.dump());
+    }
+  );
+  tools.add<search_arguments>(
+    "find_related_messages",
+    "Semantic search for messages in this conversation related in meaning to the query. Returns up to max_results messages, at most 50, or 10 if null.",
+    [this](search_arguments &&arguments, chat::tool_registry::completion &&done){
+      if(!semantic_enabled) {                                                   // queries are only flushed while enabled, so this would never complete
+        done(R"({"error": "Semantic search is disabled"})");
+        return;
+      }
+      semantic_search.query(arguments.query, std::min<size_t>(arguments.max_results.value_or(10), 50), [this, done = std::move(done)](std::vector<chat::semantic_search::result> &&results){
+        nlohmann::json result = nlohmann::json::array();
+        for(auto const &match : results) {
+          result.emplace_back(describe_message(match.id));
+        }
+        done(result.dump());
+      });
+    }
+  );
+  tools.add({
+    .name{"get_current_time"},
+    .description{"Get the current date and time in UTC."},
+    .parameters{
+      {"type", "object"},
+      {"properties", nlohmann::json::object()},
+    },
+    .invoke{[](std::string_view /*arguments*/, chat::tool_registry::completion &&done){
+      std::time_t const time{std::time(nullptr)};
+      std::array<char, 32> buffer{};
+      done(std::string{buffer.data(), std::strftime(buffer.data(), buffer.size(), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&time))}); // single threaded, so gmtime's shared result is safe
+    }},
+  });
+}
+
+nlohmann::json chat_session::make_request() {
+  /// Build a chat completion request for the active branch with the current settings
+  nlohmann::json request_json = {                                               // not ordered_json, so keys are sorted and the dump is canonical
+    {"model", "gpt-4o"},
+    {"response_format", {
+      {"type", "text"}
+    }},
+    {"temperature", std::round(static_cast<double>(temperature) * 100.0) / 100.0}, // to the precision shown, so equal settings hash equally
+    {"max_tokens", 2048},
+    {"top_p", 1},
+    {"frequency_penalty", 0},
+    {"presence_penalty", 0},
+  };
+  for(auto const *node : conversation.path()) {
+    nlohmann::json content = {
+      {
+        {"type", "text"},
+        {"text", conversation.get_text(*node)}
+      }
+    };
+    if(node->role == chat::message::roles::user) {
+      auto const images{conversation.get_images(*node)};
+      for(size_t i{0}; i != images.size(); ++i) {
+        content.emplace_back(nlohmann::json{
+          {"type", "image_url"},
+          {"image_url", {
+            {"url", make_image_placeholder(node->id, i)},                       // encoded into the body by serialise_request, rather than copied through the DOM
+            {"detail", magic_enum::enum_name(images[i].detail)}
+          }}
+        });
+      }
+    }
+    request_json["messages"].emplace_back(
+      nlohmann::json{
+        {"role", magic_enum::enum_name(node->role)},
+        {"content", std::move(content)}
+      }
+    );
+  }
+  return request_json;
+}
+
+std::string chat_session::serialise_request(nlohmann::json const &request) {
+  /// Dump a request as JSON, base64 encoding attached images straight into the body in place of their placeholders
+  auto const start_time{std::chrono::steady_clock::now()};
+  std::string const dump{request.dump()};                                       // not ordered_json, so keys are sorted and the dump is canonical
+  struct splice {
+    size_t begin;                                                               // the placeholder string's contents, within the quotes
+    size_t end;
+    chat::image const *source;
+  };
+  std::vector<splice> splices;
+  size_t body_size{dump.size()};
+  for(size_t position{dump.find(image_placeholder_marker)}; position != std::string::npos; position = dump.find(image_placeholder_marker, position)) {
+    size_t const begin{position + 1};
+    size_t const end{dump.find('"', begin)};
+    position = end;
+    std::string_view const placeholder{std::string_view{dump}.substr(begin + image_placeholder_marker.size() - 1, end - begin - (image_placeholder_marker.size() - 1))};
+    chat::conversation_tree::node_id id{0};
+    size_t index{0};
+    auto const [id_end, id_error]{std::from_chars(placeholder.data(), placeholder.data() + placeholder.size(), id)};
+    if(id_error != std::errc{} || id_end == placeholder.data() + placeholder.size() || *id_end != ':') continue; // a control character the user typed, which isn't ours
+    auto const [index_end, index_error]{std::from_chars(id_end + 1, placeholder.data() + placeholder.size(), index)};
+    if(index_error != std::errc{} || index_end != placeholder.data() + placeholder.size()) continue;
+    auto const *const node{conversation.find(id)};
+    if(!node) continue;
+    auto const images{conversation.get_images(*node)};
+    if(index >= images.size()) continue;
+    splices.emplace_back(splice{
+      .begin{begin},
+      .end{end},
+      .source{&images[index]},
+    });
+    body_size += std::string_view{"data:;base64,"}.size() + images[index].media_type.size() + base64::encoded_size(images[index].data.size()) - (end - begin);
+  }
+  if(splices.empty()) return dump;
+
+  std::string body;
+  body.reserve(body_size);                                                      // a single allocation, as images dominate the size
+  size_t copied{0};
+  for(auto const &this_splice : splices) {
+    body.append(dump, copied, this_splice.begin - copied);
+    body += "data:";
+    body += this_splice.source->media_type;
+    body += ";base64,";
+    base64::encode_append(this_splice.source->data, body);
+    copied = this_splice.end;
+  }
+  body.append(dump, copied);
+  last_request_size = body.size();
+  last_request_build_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+  return body;
+}
+
+void chat_session::attach_image(chat::conversation_tree::node_id const id) {
+  /// Let the user choose an image to attach to a message, once it's been shrunk and encoded
+  ++images_loading;
+  image_status.clear();
+  image_loader::load_for_upload(image_detail, [this, id](std::expected<chat::image, std::string> &&result){
+    --images_loading;
+    if(!result) {
+      image_status = "Image not attached: " + result.error();
+      return;
+    }
+    auto const path{conversation.path()};
+    auto const it{std::find_if(path.begin(), path.end(), [&](auto const *node){return node->id == id;})};
+    if(it == path.end()) {
+      image_status = "Image not attached, as its message is no longer on this branch";
+      return;
+    }
+    conversation.attach_image(static_cast<size_t>(it - path.begin()), std::move(*result));
+    sync_indexes();
+  });
+}
+
+void chat_session::request_suggestions() {
+  /// Ask for some replies the user might send next, as structured output
+  nlohmann::json request_json = make_request();                                 // not braced, which would nest it in an array
+  request_json["response_format"] = json_reflect::response_format<suggested_replies>("suggested_replies");
+  request_json["messages"].emplace_back(nlohmann::json{
+    {"role", "system"},
+    {"content", "Suggest three short, distinct replies the user might send next, written as the user."},
+  });
+  reply_suggestions.clear();
+  ++requests_in_flight;
+  shared.provider.complete(request_json, serialise_request(request_json), [this, branch = conversation.get_active_branch()](chat::provider::result const &completion){
+    --requests_in_flight;
+    try {
+      nlohmann::json const json = nlohmann::json::parse(completion.response);
+      record_usage(json, completion.timing);                                    // tokens were spent whether or not the suggestions are still wanted
+      if(branch != conversation.get_active_branch()) return;                    // the suggestions would be for another branch
+      auto const &content{json.at("choices").at(0).at("message").at("content")};
+      if(!content.is_string()) {                                                // null when the model refuses
+        std::cerr << "ERROR: No reply suggestions in response" << std::endl;
+        return;
+      }
+      suggested_replies decoded;
+      if(auto const result{json_reflect::decode_into(content.get_ref<std::string const&>(), decoded)}; !result) {
+        std::cerr << "ERROR: Invalid reply suggestions: " << result.error() << std::endl;
+        return;
+      }
+      reply_suggestions = std::move(decoded.replies);
+    } catch(std::exception const &e) {
+      std::cerr << "ERROR: Invalid reply suggestions response: " << e.what() << std::endl;
+    }
+  }, [this](unsigned short status, std::string_view message){
+    --requests_in_flight;
+    std::cerr << "ERROR requesting reply suggestions: " << status << ": " << message << std::endl;
+  });
+}
+
+void chat_session::draw_suggestions() {
+  /// Draw any suggested replies, each of which replaces the final user message when clicked
+  std::optional<size_t> selected;
+  for(size_t i{0}; i != reply_suggestions.size(); ++i) {
+    ImGui::PushID(static_cast<int>(i));
+    if(ImGui::Selectable(reply_suggestions[i].c_str())) selected = i;
+    ImGui::PopID();
+  }
+  if(!selected) return;
+  if(conversation.path().back()->role != chat::message::roles::user) {
+    conversation.append({.role{chat::message::roles::user}});
+  }
+  conversation.set_text(conversation.path().size() - 1, std::move(reply_suggestions[*selected]));
+  reply_suggestions.clear();
+  sync_indexes();
+}
+
+nlohmann::json chat_session::describe_message(chat::conversation_tree::node_id const id) {
+  /// Summarise a message as a tool result
+  auto const *const node{conversation.find(id)};
+  if(!node) return nullptr;
+  return {
+    {"id", id},
+    {"role", magic_enum::enum_name(node->role)},
+    {"text", conversation.get_text(*node).substr(0, 2000)},                     // keep results from long messages within reason
+  };
+}
+
+void chat_session::request_completion(chat::conversation_tree::branch_id const branch, nlohmann::json const &request, unsigned int const tool_round) {
+  /// Request a chat completion for a branch, from the cache if the request is reproducible and was seen before
+  std::string body{serialise_request(request)};
+  if(!chat::completion_cache::is_reproducible(request)) {
+    send_completion(branch, request, std::nullopt, std::move(body), tool_round);
+    return;
+  }
+  hash_128 const key{chat::completion_cache::make_key(body)};
+  shared.completion_cache.get(key, [this, branch, request, key, body = std::move(body), tool_round](std::optional<std::string_view> response) mutable {
+    if(response) {
+      handle_completion(branch, body, *response, tool_round, std::nullopt);     // served locally, so not counted in telemetry
+    } else {
+      send_completion(branch, request, key, std::move(body), tool_round);
+    }
+  });
+}
+
+void chat_session::send_completion(chat::conversation_tree::branch_id const branch, nlohmann::json const &request, std::optional<hash_128> const cache_key, std::string &&body, unsigned int const tool_round) {
+  /// Send a chat completion request for a branch to whichever provider serves it, caching the response under the given key if any
+  std::string body_copy{body};                                                  // keep the request, to extend if the reply calls tools
+  shared.provider.complete(request, std::move(body), [this, branch, cache_key, body = std::move(body_copy), tool_round](chat::provider::result const &completion){
+    if(cache_key && !completion.local) shared.completion_cache.put(*cache_key, completion.response); // a local model's replies are cheap to regenerate, and not what the key promises
+    handle_completion(branch, body, completion.response, tool_round, completion.timing);
+  }, [this](unsigned short status, std::string_view message){
+    --requests_in_flight;                                                       // the turn ends here
+    std::cerr << "ERROR calling API: " << status << ": " << message << std::endl;
+    // TODO: error message box in gui
+  });
+}
+
+void chat_session::handle_completion(chat::conversation_tree::branch_id const branch, std::string_view request, std::string_view response, unsigned int const tool_round, std::optional<emscripten_fetch_manager::timings> const &timing) {
+  /// Append a chat completion response to the branch that asked for it, or run the tools it calls and send the results back
+  try {
+    nlohmann::json const json = nlohmann::ordered_json::parse(response);
+    if(timing) record_usage(json, *timing);
+    auto const &reply{json.at("choices").front().at("message")};
+    if(auto const tool_calls{reply.find("tool_calls")}; tool_calls != reply.end() && !tool_calls->empty()) {
+      if(tool_round == max_tool_rounds) {
+        std::cerr << "ERROR: Giving up after " << max_tool_rounds << " rounds of tool calls" << std::endl;
+        --requests_in_flight;
+        return;
+      }
+      tools.dispatch(*tool_calls, [this, branch, request = nlohmann::json::parse(request), reply, tool_round](nlohmann::json &&tool_messages) mutable {
+        auto &messages{request.at("messages")};
+        messages.emplace_back(std::move(reply));                                // the tool results must follow the assistant message that called them
+        for(auto &tool_message : tool_messages) {
+          messages.emplace_back(std::move(tool_message));
+        }
+        request_completion(branch, request, tool_round + 1);
+      });
+      return;                                                                   // the turn continues with the follow-up
+    }
+    if(conversation.append(branch, {                                            // reply to the branch that asked, even if another is now active
+      .role{chat::message::roles::assistant},
+      .text{reply.at("content")},
+    })) {                                                                       // unless the branch was deleted while waiting
+      conversation.append(branch, {
+        .role{chat::message::roles::user},
+      });
+      sync_indexes();
+      run_search();
+    }
+  } catch(std::exception const &e) {
+    std::cerr << "ERROR: Invalid chat completion response: " << e.what() << std::endl;
+  }
+  --requests_in_flight;
+}
+
+void chat_session::record_usage(nlohmann::json const &response, emscripten_fetch_manager::timings const &timing) {
+  /// Add a response's token usage and timing to the shared telemetry, under the model that actually served it
+  auto const model{response.find("model")};
+  shared.telemetry.record(
+    model != response.end() && model->is_string() ? model->get_ref<std::string const&>() : std::string_view{"unknown"},
+    session_id,
+    chat::telemetry::usage::from_response(response),
+    timing.time_to_first_byte_ms,
+    timing.total_ms
+  );
+}
+
+void chat_session::sync_indexes() {
+  /// Bring the search indexes up to date with messages created, edited and released since the last call
+  auto const changes{conversation.take_changes()};
+  for(auto const id : changes.released) {
+    search_index.remove(id);
+    semantic_search.remove(id);
+  }
+  for(auto const id : changes.updated) {
+    std::string_view const text{conversation.get_text(*conversation.find(id))};
+    search_index.update(id, text);
+    if(semantic_enabled) semantic_search.update(id, text);
+  }
+}
+
+}
+
+/**
+sample response:
+
+{
+  "id": "chatcmpl-AcZ8FxqQeZTY1oMIHmq39u5gJWl40",
+  "object": "chat.completion",
+  "created": 1733754875,
+  "model": "gpt-4o-2024-08-06",
+  "choices": [
+    {
+      "index": 0,
+      "message": {
+        "role": "assistant",
+        "content": "four",
+        "refusal": null
+      },
+      "logprobs": null,
+      "finish_reason": "stop"
+    }
+  ],
+  "usage": {
+    "prompt_tokens": 23,
+    "completion_tokens": 1,
+    "total_tokens": 24,
+    "prompt_tokens_details": {
+      "cached_tokens": 0,
+      "audio_tokens": 0
+    },
+    "completion_tokens_details": {
+      "reasoning_tokens": 0,
+      "audio_tokens": 0,
+      "accepted_prediction_tokens": 0,
+      "rejected_prediction_tokens": 0
+    }
+  },
+  "system_fingerprint": "fp_9d50cd990b"
+}
+**/
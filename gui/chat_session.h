@@ -0,0 +1,96 @@
+#pragma once
+#include <optional>
+#include <string>
+#include <vector>
+#include "chat/completion_cache.h"
+#include "chat/conversation_tree.h"
+#include "chat/provider.h"
+#include "chat/search_index.h"
+#include "chat/semantic_search.h"
+#include "chat/telemetry.h"
+#include "chat/tool_registry.h"
+#include "emscripten_fetch_manager.h"
+
+namespace gui {
+
+class chat_session {
+  /// One independent conversation with its own indexes and requests, drawn as a tab
+public:
+  struct services {                                                             // shared between all sessions
+    emscripten_fetch_manager &fetcher;
+    chat::provider &provider;                                                   // the API, a local model, or a router between them
+    chat::completion_cache &completion_cache;
+    chat::telemetry &telemetry;
+    std::string const &api_key;
+  };
+
+private:
+  unsigned int session_id;
+  std::string name;
+  services shared;
+  unsigned int requests_in_flight{0};                                           // completion turns and suggestion requests not yet finished
+
+  chat::conversation_tree conversation;
+  std::string edit_buffer;                                                      // scratch copy of each message's text for the input widget, reused to avoid allocations
+  std::string snapshot_status;                                                  // result of the last save or load
+
+  chat::search_index search_index;                                              // full-text index over messages on all branches, keyed by node id
+  std::string search_query;
+  std::vector<chat::search_index::result> search_results;
+  float search_time_ms{0.0f};                                                   // how long the last search took
+  std::optional<chat::conversation_tree::node_id> scroll_to_message;            // message to bring into view on the next frame
+
+  chat::semantic_search semantic_search;                                        // embeddings-backed search, only used when enabled as it costs API calls
+  bool semantic_enabled{false};
+  std::vector<chat::semantic_search::result> semantic_results;
+
+  float temperature{1.0f};
+
+  chat::tool_registry tools;
+  bool tools_enabled{false};
+  static unsigned int constexpr max_tool_rounds{8};                             // follow-up requests per call, in case the model keeps calling tools
+
+  std::vector<std::string> reply_suggestions;
+
+  chat::image::details image_detail{chat::image::details::high};
+  unsigned int images_loading{0};                                               // being picked, decoded and encoded by the browser
+  std::string image_status;                                                     // why the last image wasn't attached, if it wasn't
+  size_t last_request_size{0};                                                  // of the last request with images, in bytes
+  float last_request_build_ms{0.0f};                                            // and how long it took to serialise
+
+public:
+  chat_session(unsigned int id, services const &shared);
+  chat_session(chat_session const&) = delete;                                   // callbacks in flight refer to the session
+  chat_session &operator=(chat_session const&) = delete;
+
+  void draw();
+  void update();
+
+  void call();
+  bool can_call();
+  bool idle() const;
+
+  unsigned int get_id() const;
+  std::string const &get_name() const;
+
+private:
+  std::string snapshot_path() const;
+  void draw_search();
+  void draw_branches();
+  void draw_message_link(chat::conversation_tree::node_id id, size_t offset, std::string_view annotation);
+  void draw_suggestions();
+  void run_search();
+  void register_tools();
+  nlohmann::json make_request();
+  std::string serialise_request(nlohmann::json const &request);
+  void attach_image(chat::conversation_tree::node_id id);
+  void request_suggestions();
+  nlohmann::json describe_message(chat::conversation_tree::node_id id);
+  void request_completion(chat::conversation_tree::branch_id branch, nlohmann::json const &request, unsigned int tool_round);
+  void send_completion(chat::conversation_tree::branch_id branch, nlohmann::json const &request, std::optional<hash_128> cache_key, std::string &&body, unsigned int tool_round);
+  void handle_completion(chat::conversation_tree::branch_id branch, std::string_view request, std::string_view response, unsigned int tool_round, std::optional<emscripten_fetch_manager::timings> const &timing);
+  void record_usage(nlohmann::json const &response, emscripten_fetch_manager::timings const &timing);
+  void sync_indexes();
+};
+
+}
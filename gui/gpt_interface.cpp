@@ -1,17 +1,46 @@
-#include <iostream>
 #include "gpt_interface.h"
+#include <algorithm>
+#include <cinttypes>
 #include <imgui/imgui.h>
 #include <imgui/imgui_stdlib.h>
+#include <emscripten.h>
 #include <nlohmann/json.hpp>
 #include <magic_enum/magic_enum.hpp>
+#include "emscripten_browser_clipboard.h"
+#include "browser_file.h"
 
 using namespace std::string_literals;
 
 namespace gui {
 
+gpt_interface::gpt_interface() {
+  /// Default constructor
+  add_session();
+
+  EM_ASM(
+    FS.mkdir('/persistent');
+    FS.mount(IDBFS, {}, '/persistent');
+    FS.syncfs(true, function(error) {                                           // populate from IndexedDB
+      if(error) console.error('ERROR loading persistent storage: ' + error);
+    });
+  );
+}
+
 void gpt_interface::draw() {
   /// Draw the interface window
-  if(!ImGui::Begin("Chat", nullptr, ImGuiWindowFlags_NoTitleBar | ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoMove)) {
+  // services run every frame, whether or not the window is visible
+  for(auto &session : sessions) {
+    session->update();
+  }
+  for(auto &session : closed_sessions) {
+    session->update();
+  }
+  std::erase_if(closed_sessions, [](auto const &session){return session->idle();});
+  rate_limiter.update();                                                        // start any requests that were waiting for the limits
+  local_provider.update();                                                      // generate within this frame's budget
+  file_transfer.update();                                                       // retry parts whose backoff has passed
+
+  if(!ImGui::Begin("Chat", nullptr, ImGuiWindowFlags_NoTitleBar | ImGuiWindowFlags_NoResize | ImGuiWindowFlags_NoMove | ImGuiWindowFlags_NoBringToFrontOnFocus)) { // the background, beneath other windows
     ImGui::End();
     return;
   }
@@ -63,74 +92,9 @@ void gpt_interface::draw() {
       }
 
       if(model_selected != model_list.end()) {
-        int imgui_id{0};
-        for(auto &message : messages) {
-          ImGui::PushID(++imgui_id);
-          ImGui::Separator();
-          if(ImGui::BeginCombo("Role", std::string{magic_enum::enum_name(message.role)}.c_str())) {
-            for(auto const &[this_role, role_name] : magic_enum::enum_entries<message_type::roles>()) {
-              bool const is_selected{this_role == message.role};
-              if(ImGui::Selectable(std::string{role_name}.c_str(), is_selected)) {
-                message.role = this_role;
-              }
-              if(is_selected) ImGui::SetItemDefaultFocus();
-            }
-            ImGui::EndCombo();
-          }
-          ImGui::InputTextMultiline("Message", &message.text);
-          ImGui::PopID();
-        }
-        if(ImGui::Button("Call")) {
-          nlohmann::json request_json = {
-            {"model", "gpt-4o"},
-            {"response_format", {
-              {"type", "text"}
-            }},
-            {"temperature", 1},
-            {"max_tokens", 2048},
-            {"top_p", 1},
-            {"frequency_penalty", 0},
-            {"presence_penalty", 0},
-          };
-          for(auto const &message : messages) {
-            request_json["messages"].emplace_back(
-              nlohmann::json{
-                {"role", magic_enum::enum_name(message.role)},
-                {"content", {
-                  {
-                    {"type", "text"},
-                    {"text", message.text}
-                  }
-                }}
-              }
-            );
-          }
-
-          fetcher.fetch({
-            .method{"POST"},
-            .url{"https://api.openai.com/v1/chat/completions"},
-            .headers{
-              "Content-Type", "application/json",
-              "Authorization", "Bearer " + api_key,
-            },
-            .body{request_json.dump()},
-            .on_success{[&](unsigned short /*status*/, std::span<std::byte const> data){
-              nlohmann::json const json = nlohmann::ordered_json::parse(data);
-              messages.emplace_back(message_type{
-                .role{message_type::roles::assistant},
-                .text{json.at("choices").front().at("message").at("content")},
-              });
-              messages.emplace_back(message_type{
-                .role{message_type::roles::user},
-              });
-            }},
-            .on_error{[](unsigned short status, std::string_view status_text, std::span<std::byte const> data){
-              std::cerr << "ERROR calling API: " << status << ": " << status_text << ", " << std::string_view{reinterpret_cast<char const*>(data.data()), data.size()} << std::endl;
-              // TODO: error message box in gui
-            }},
-            .attributes{EMSCRIPTEN_FETCH_LOAD_TO_MEMORY | EMSCRIPTEN_FETCH_REPLACE},
-          });
-        }
+        draw_shared_settings();
+        draw_telemetry();
+        draw_sessions();
       }
     }
   } catch(std::bad_expected_access<std::string> const &e) {
@@ -147,43 +111,286 @@ void gpt_interface::draw() {
   ImGui::End();
 }
 
+void gpt_interface::draw_shared_settings() {
+  /// Draw settings and statistics for the services shared between sessions
+  if(bool persistent_cache{completion_cache.get_persistent()}; ImGui::Checkbox("Persistent cache", &persistent_cache)) {
+    completion_cache.set_persistent(persistent_cache);
+  }
+  ImGui::SameLine();
+  auto const &cache_stats{completion_cache.get_statistics()};
+  ImGui::Text("Cache: %" PRIu64 " memory hits (last in %.1fus), %" PRIu64 " persistent hits, %" PRIu64 " misses",
+    cache_stats.memory_hits,
+    static_cast<double>(cache_stats.last_hit_us),
+    cache_stats.persistent_hits,
+    cache_stats.misses
+  );
+
+  auto limits{rate_limiter.get_limits()};
+  ImGui::SetNextItemWidth(ImGui::GetFontSize() * 6.0f);
+  bool limits_changed{ImGui::DragFloat("Requests/min", &limits.requests_per_minute, 10.0f, 1.0f, 100'000.0f, "%.0f")};
+  ImGui::SameLine();
+  ImGui::SetNextItemWidth(ImGui::GetFontSize() * 8.0f);
+  limits_changed |= ImGui::DragFloat("Tokens/min", &limits.tokens_per_minute, 1'000.0f, 1'000.0f, 100'000'000.0f, "%.0f");
+  ImGui::SameLine();
+  ImGui::SetNextItemWidth(ImGui::GetFontSize() * 4.0f);
+  limits_changed |= ImGui::DragScalar("Max in flight", ImGuiDataType_U32, &limits.max_in_flight, 1.0f);
+  if(limits_changed) rate_limiter.set_limits(limits);
+  ImGui::SameLine();
+  auto const &limiter_stats{rate_limiter.get_statistics()};
+  ImGui::Text("%u in flight, %zu queued (last waited %.0fms), %" PRIu64 " sent, %" PRIu64 " retried",
+    limiter_stats.in_flight,
+    limiter_stats.queued,
+    static_cast<double>(limiter_stats.last_wait_ms),
+    limiter_stats.started,
+    limiter_stats.retried
+  );
+  ImGui::SameLine();
+  auto const &dispatch_stats{emscripten_fetch_manager::get_dispatch_statistics()};
+  ImGui::Text("Responses: %zu handled last frame in %.2fms, %zu carried over, at most %zu queued",
+    dispatch_stats.dispatched,
+    static_cast<double>(dispatch_stats.last_dispatch_ms),
+    dispatch_stats.carried_over,
+    dispatch_stats.max_queued
+  );
+  auto const &warm_stats{fetcher.get_warm_statistics()};
+  ImGui::Text("Connections: %" PRIu64 " warm-ups (last %.0fms), first byte in %.0fms cold (%" PRIu64 "), %.0fms warm (%" PRIu64 ")",
+    warm_stats.warmups,
+    static_cast<double>(warm_stats.last_warmup_ms),
+    static_cast<double>(warm_stats.cold_first_byte_ms),
+    warm_stats.cold_requests,
+    static_cast<double>(warm_stats.warm_first_byte_ms),
+    warm_stats.warm_requests
+  );
+  draw_local_model();
+  draw_files();
 }
 
-/**
-sample response:
-
-{
-  "id": "chatcmpl-AcZ8FxqQeZTY1oMIHmq39u5gJWl40",
-  "object": "chat.completion",
-  "created": 1733754875,
-  "model": "gpt-4o-2024-08-06",
-  "choices": [
-    {
-      "index": 0,
-      "message": {
-        "role": "assistant",
-        "content": "four",
-        "refusal": null
-      },
-      "logprobs": null,
-      "finish_reason": "stop"
+void gpt_interface::draw_local_model() {
+  /// Draw settings for the local model and for routing requests to it
+  if(!ImGui::CollapsingHeader("Local model")) return;
+  ImGui::BeginDisabled(local_provider.get_state() == chat::local_provider::states::loading);
+  ImGui::SetNextItemWidth(ImGui::GetFontSize() * 16.0f);
+  ImGui::InputTextWithHint("##local_model_url", "URL of a GGUF model file", &local_model_url);
+  ImGui::SameLine();
+  if(ImGui::Button("Load")) local_provider.load(fetcher, local_model_url);
+  ImGui::EndDisabled();
+  ImGui::SetItemTooltip("Llama-architecture models with F32, F16 or Q8_0 weights and a SentencePiece vocabulary, such as TinyLlama chat in Q8_0");
+  ImGui::SameLine();
+  ImGui::TextUnformatted(local_provider.get_status().c_str());
+
+  auto mode{router.get_mode()};
+  ImGui::SetNextItemWidth(ImGui::GetFontSize() * 8.0f);
+  if(ImGui::BeginCombo("Route requests", std::string{magic_enum::enum_name(mode)}.c_str())) {
+    for(auto const &[this_mode, mode_name] : magic_enum::enum_entries<chat::router::modes>()) {
+      if(ImGui::Selectable(std::string{mode_name}.c_str(), this_mode == mode)) router.set_mode(this_mode);
+    }
+    ImGui::EndCombo();
+  }
+  ImGui::SetItemTooltip("remote: always the API, falling back to the local model when offline\nlocal: only the local model\nautomatic: the local model for short text-only requests");
+  ImGui::SameLine();
+  ImGui::BeginDisabled(mode != chat::router::modes::automatic);
+  unsigned int max_tokens{router.get_max_local_prompt_tokens()};
+  ImGui::SetNextItemWidth(ImGui::GetFontSize() * 5.0f);
+  if(ImGui::DragScalar("Max local prompt tokens", ImGuiDataType_U32, &max_tokens, 8.0f)) router.set_max_local_prompt_tokens(max_tokens);
+  ImGui::EndDisabled();
+  ImGui::SameLine();
+  float budget{local_provider.get_frame_budget_ms()};
+  ImGui::SetNextItemWidth(ImGui::GetFontSize() * 4.0f);
+  if(ImGui::DragFloat("Frame budget", &budget, 0.5f, 1.0f, 100.0f, "%.1fms")) local_provider.set_frame_budget_ms(budget);
+  ImGui::SetItemTooltip("Time spent generating each frame; more is faster but less smooth");
+
+  auto const &local_stats{local_provider.get_statistics()};
+  auto const &router_stats{router.get_statistics()};
+  ImGui::Text("%" PRIu64 " remote, %" PRIu64 " local (%" PRIu64 " fell back), %zu queued, %" PRIu64 " prompt tokens (%" PRIu64 " reused), %" PRIu64 " generated, last at %.0f prompt and %.1f generated tokens/s",
+    router_stats.remote,
+    router_stats.local,
+    router_stats.fallbacks,
+    local_stats.queued,
+    local_stats.prompt_tokens,
+    local_stats.reused_tokens,
+    local_stats.generated_tokens,
+    static_cast<double>(local_stats.prompt_tokens_per_second),
+    static_cast<double>(local_stats.generated_tokens_per_second)
+  );
+}
+
+void gpt_interface::draw_files() {
+  /// Draw controls to upload files the user picks for batch and fine-tuning jobs, and to download them back, streaming each a part at a time
+  if(!ImGui::CollapsingHeader("Files")) return;
+  auto transfer_settings{file_transfer.get_settings()};
+  unsigned int part_size_mb{static_cast<unsigned int>(transfer_settings.part_size >> 20)};
+  ImGui::SetNextItemWidth(ImGui::GetFontSize() * 4.0f);
+  bool settings_changed{ImGui::DragScalar("Part MB", ImGuiDataType_U32, &part_size_mb, 1.0f)};
+  ImGui::SameLine();
+  ImGui::SetNextItemWidth(ImGui::GetFontSize() * 4.0f);
+  settings_changed |= ImGui::DragScalar("Parallel parts", ImGuiDataType_U32, &transfer_settings.parallelism, 0.1f);
+  if(settings_changed) {
+    transfer_settings.part_size = static_cast<size_t>(part_size_mb) << 20;
+    file_transfer.set_settings(transfer_settings);
+  }
+  ImGui::SameLine();
+  auto const &transfer_stats{file_transfer.get_statistics()};
+  ImGui::Text("Buffered %zuKB (peak %zuKB), %" PRIu64 " parts sent, %" PRIu64 " retried",
+    transfer_stats.buffered_bytes >> 10,
+    transfer_stats.peak_buffered_bytes >> 10,
+    transfer_stats.parts_sent,
+    transfer_stats.parts_retried
+  );
+
+  ImGui::SetNextItemWidth(ImGui::GetFontSize() * 6.0f);
+  if(ImGui::BeginCombo("Purpose", upload_purpose.c_str())) {
+    for(std::string const purpose : {"batch", "fine-tune", "assistants", "user_data"}) {
+      if(ImGui::Selectable(purpose.c_str(), purpose == upload_purpose)) upload_purpose = purpose;
+    }
+    ImGui::EndCombo();
+  }
+  ImGui::SameLine();
+  if(ImGui::Button("Upload a file...")) {
+    browser_file::pick([this, purpose = upload_purpose](std::expected<browser_file::picked, std::string> &&picked){
+      if(!picked) {
+        transfer_status = "Nothing uploaded: " + picked.error();
+        return;
+      }
+      std::string const name{picked->name};
+      file_transfer.upload({
+        .filename{name},
+        .purpose{purpose},
+        .mime_type{name.ends_with(".jsonl") ? "text/jsonl" : "application/octet-stream"},
+        .size{picked->size},
+        .read{std::move(picked->read)},
+        .on_done{[this, name](std::expected<std::string, std::string> const &file_id){
+          transfer_status = file_id ? "Uploaded " + name + " as " + *file_id : "Upload of " + name + " failed: " + file_id.error();
+          if(file_id) download_file_id = *file_id;
+        }},
+      });
+    });
+  }
+
+  ImGui::SetNextItemWidth(ImGui::GetFontSize() * 10.0f);
+  ImGui::InputTextWithHint("##download_file_id", "File id", &download_file_id);
+  ImGui::SameLine();
+  ImGui::SetNextItemWidth(ImGui::GetFontSize() * 16.0f);
+  ImGui::InputTextWithHint("##download_name", "Name to save it as", &download_name);
+  ImGui::SameLine();
+  ImGui::BeginDisabled(download_file_id.empty() || download_name.empty());
+  if(ImGui::Button("Download")) {
+    auto target{browser_file::save(download_name)};
+    file_transfer.download({
+      .file_id{download_file_id},
+      .write{std::move(target.write)},
+      .on_done{[this, name = download_name, finish = std::move(target.finish)](std::expected<uint64_t, std::string> const &size){
+        finish(size.has_value());
+        transfer_status = size ? "Downloaded " + std::to_string(*size >> 10) + "KB as " + name : "Download of " + name + " failed: " + size.error();
+      }},
+    });
+  }
+  ImGui::EndDisabled();
+  if(!transfer_status.empty()) ImGui::TextUnformatted(transfer_status.c_str());
+
+  for(auto const &transfer : file_transfer.get_progress()) {
+    ImGui::PushID(static_cast<int>(transfer.id));
+    float const fraction{transfer.bytes_total == 0 ? 0.0f : static_cast<float>(static_cast<double>(transfer.bytes_done) / static_cast<double>(transfer.bytes_total))};
+    std::string const label{(transfer.upload ? "Uploading " : "Downloading ") + transfer.name + ": " + std::to_string(transfer.bytes_done >> 20) + "/" + std::to_string(transfer.bytes_total >> 20) + "MB, "
+                           + std::to_string(transfer.parts_in_flight) + " parts in flight, " + std::to_string(transfer.retries) + " retries"};
+    ImGui::ProgressBar(fraction, {ImGui::GetFontSize() * 30.0f, 0.0f}, label.c_str());
+    ImGui::SameLine();
+    if(ImGui::Button("Cancel")) file_transfer.cancel(transfer.id);
+    ImGui::PopID();
+  }
+}
+
+void gpt_interface::draw_telemetry() {
+  /// Draw token usage and latency per model and per session, with export to the clipboard
+  if(!ImGui::CollapsingHeader("Usage")) return;
+  if(ImGui::Button("Copy CSV")) emscripten_browser_clipboard::copy(telemetry.to_csv());
+  ImGui::SameLine();
+  if(ImGui::Button("Copy JSON")) emscripten_browser_clipboard::copy(telemetry.to_json().dump(2));
+  ImGui::SameLine();
+  if(ImGui::Button("Clear")) telemetry.clear();
+
+  auto const draw_table{[](char const *table_id, char const *name_heading, auto const &aggregates, auto const &get_name){
+    if(aggregates.empty()) return;
+    if(!ImGui::BeginTable(table_id, 9, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit)) return;
+    ImGui::TableSetupColumn(name_heading);
+    ImGui::TableSetupColumn("Requests");
+    ImGui::TableSetupColumn("Prompt tokens");
+    ImGui::TableSetupColumn("Cached");
+    ImGui::TableSetupColumn("Completion tokens");
+    ImGui::TableSetupColumn("Reasoning");
+    ImGui::TableSetupColumn("Tokens/s p50 (p10)");
+    ImGui::TableSetupColumn("First byte p50 (p90)");
+    ImGui::TableSetupColumn("Latency p50 (p90)");
+    ImGui::TableHeadersRow();
+    for(auto const &[key, aggregate] : aggregates) {
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      ImGui::TextUnformatted(get_name(key).c_str());
+      ImGui::TableNextColumn();
+      ImGui::Text("%" PRIu64, aggregate.requests);
+      ImGui::TableNextColumn();
+      ImGui::Text("%" PRIu64, aggregate.tokens.prompt_tokens);
+      ImGui::TableNextColumn();
+      ImGui::Text("%" PRIu64, aggregate.tokens.cached_tokens);
+      ImGui::TableNextColumn();
+      ImGui::Text("%" PRIu64, aggregate.tokens.completion_tokens);
+      ImGui::TableNextColumn();
+      ImGui::Text("%" PRIu64, aggregate.tokens.reasoning_tokens);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.1f (%.1f)", aggregate.tokens_per_second.quantile(0.5), aggregate.tokens_per_second.quantile(0.1));
+      ImGui::TableNextColumn();
+      ImGui::Text("%.0fms (%.0fms)", aggregate.time_to_first_byte_ms.quantile(0.5), aggregate.time_to_first_byte_ms.quantile(0.9));
+      ImGui::TableNextColumn();
+      ImGui::Text("%.0fms (%.0fms)", aggregate.latency_ms.quantile(0.5), aggregate.latency_ms.quantile(0.9));
+    }
+    ImGui::EndTable();
+  }};
+  draw_table("Models", "Model", telemetry.get_models(), [](std::string const &model){return model;});
+  draw_table("Sessions", "Session", telemetry.get_sessions(), [&](unsigned int const id){
+    auto const it{std::find_if(sessions.begin(), sessions.end(), [&](auto const &session){return session->get_id() == id;})};
+    return it == sessions.end() ? "Closed session " + std::to_string(id) : (*it)->get_name();
+  });
+}
+
+void gpt_interface::draw_sessions() {
+  /// Draw a tab for each session, with controls to add sessions and call all of them at once
+  if(ImGui::Button("New session")) add_session();
+  ImGui::SameLine();
+  if(ImGui::Button("Call all")) {
+    for(auto &session : sessions) {
+      if(session->can_call()) session->call();
     }
-  ],
-  "usage": {
-    "prompt_tokens": 23,
-    "completion_tokens": 1,
-    "total_tokens": 24,
-    "prompt_tokens_details": {
-      "cached_tokens": 0,
-      "audio_tokens": 0
-    },
-    "completion_tokens_details": {
-      "reasoning_tokens": 0,
-      "audio_tokens": 0,
-      "accepted_prediction_tokens": 0,
-      "rejected_prediction_tokens": 0
+  }
+
+  if(!ImGui::BeginTabBar("Sessions", ImGuiTabBarFlags_Reorderable | ImGuiTabBarFlags_FittingPolicyScroll)) return;
+  std::optional<size_t> close_index;
+  for(size_t i{0}; i != sessions.size(); ++i) {
+    auto &session{*sessions[i]};
+    bool open{true};
+    std::string const label{session.get_name() + (session.idle() ? "" : " ...") + "###session" + std::to_string(session.get_id())}; // stable id while the label changes
+    if(ImGui::BeginTabItem(label.c_str(), sessions.size() == 1 ? nullptr : &open)) {
+      ImGui::PushID(static_cast<int>(session.get_id()));
+      session.draw();
+      ImGui::PopID();
+      ImGui::EndTabItem();
     }
-  },
-  "system_fingerprint": "fp_9d50cd990b"
+    if(!open) close_index = i;
+  }
+  ImGui::EndTabBar();
+  if(close_index) {                                                             // after drawing, as closing changes the list
+    closed_sessions.emplace_back(std::move(sessions[*close_index]));
+    sessions.erase(sessions.begin() + static_cast<std::ptrdiff_t>(*close_index));
+  }
+}
+
+void gpt_interface::add_session() {
+  /// Open a new session with an empty conversation
+  sessions.emplace_back(std::make_unique<chat_session>(next_session_id++, chat_session::services{
+    .fetcher{fetcher},
+    .provider{router},
+    .completion_cache{completion_cache},
+    .telemetry{telemetry},
+    .api_key{api_key},
+  }));
+}
+
 }
-**/
@@ -1,40 +1,54 @@
 #pragma once
 #include <expected>
+#include <memory>
 #include <string>
 #include <vector>
+#include "chat/completion_cache.h"
+#include "chat/file_transfer.h"
+#include "chat/provider.h"
+#include "chat/rate_limiter.h"
+#include "chat/telemetry.h"
+#include "chat_session.h"
 #include "emscripten_fetch_manager.h"
 
 namespace gui {
 
 class gpt_interface {
-  struct message_type {
-    enum class roles {
-      system,
-      user,
-      assistant,
-    } role{roles::user};
-    std::string text{};
-  };
-
   std::string api_key;
 
   emscripten_fetch_manager fetcher;
+  chat::rate_limiter rate_limiter{fetcher};                                     // shared by every session, as the limits are per account
+  chat::completion_cache completion_cache{"completion_cache"};                  // only consulted for reproducible requests, i.e. at zero temperature
+  chat::telemetry telemetry;
+  chat::openai_provider remote_provider{rate_limiter, fetcher, api_key};
+  chat::local_provider local_provider;
+  chat::router router{remote_provider, local_provider};                         // what sessions send requests to
+  std::string local_model_url{"models/local.gguf"};
+  chat::file_transfer file_transfer{fetcher, api_key};
+  std::string upload_purpose{"batch"};
+  std::string download_file_id;
+  std::string download_name;                                                    // offered to the browser when saving
+  std::string transfer_status;                                                  // result of the last finished transfer
 
   std::expected<std::vector<std::string>, std::string> model_list_result;
   std::vector<std::string>::const_iterator model_selected{model_list_result->end()};
 
-  std::vector<message_type> messages{
-    {
-      .role{message_type::roles::system},
-      .text{"You are a helpful assistant..."},
-    },
-    {
-      .role{message_type::roles::user},
-    },
-  };
+  std::vector<std::unique_ptr<chat_session>> sessions;
+  std::vector<std::unique_ptr<chat_session>> closed_sessions;                   // kept until their requests finish, as callbacks refer to them
+  unsigned int next_session_id{1};
 
 public:
+  gpt_interface();
+
   void draw();
+
+private:
+  void draw_sessions();
+  void draw_shared_settings();
+  void draw_local_model();
+  void draw_files();
+  void draw_telemetry();
+  void add_session();
 };
 
 }
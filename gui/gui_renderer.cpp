@@ -6,8 +6,9 @@
 
 namespace gui {
 
-gui_renderer::gui_renderer(logstorm::manager &this_logger)
-  :logger{this_logger} {
+gui_renderer::gui_renderer(logstorm::manager &this_logger, std::shared_ptr<logstorm::sink::circular_buffer> log_history)
+  :logger{this_logger},
+   log{std::move(log_history)} {
   /// Construct the top level GUI and initialise ImGUI
   logger << "GUI: Initialising";
   #ifndef NDEBUG
@@ -35,6 +36,7 @@ void gui_renderer::draw() {
   ImGui::NewFrame();
 
   gpt.draw();
+  log.draw();
 
   //ImGui::ShowDemoWindow();
 
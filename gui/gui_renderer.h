@@ -1,7 +1,9 @@
 #pragma once
+#include <memory>
 #include "logstorm/logstorm_forward.h"
 #include "clipboard.h"
 #include "gpt_interface.h"
+#include "log_viewer.h"
 
 class ImGui_ImplWGPU_InitInfo;
 
@@ -14,8 +16,10 @@ class gui_renderer {
 
   gpt_interface gpt;
 
+  log_viewer log;
+
 public:
-  gui_renderer(logstorm::manager &logger);
+  gui_renderer(logstorm::manager &logger, std::shared_ptr<logstorm::sink::circular_buffer> log_history);
 
   void init(ImGui_ImplWGPU_InitInfo &wgpu_info);
 
@@ -0,0 +1,167 @@
+#include "image_loader.h"
+#include <memory>
+#include <emscripten.h>
+
+namespace gui::image_loader {
+
+namespace {
+
+struct decode_request {                                                         // owned by the browser until it calls back
+  decode_callback callback;
+  std::vector<uint8_t> rgba;
+};
+
+struct encode_request {
+  encode_callback callback;
+  std::vector<std::byte> data;
+};
+
+float constexpr jpeg_quality{0.85f};                                            // well past the point where the model can tell the difference
+
+} // anonymous namespace
+
+EM_JS(void, image_loader_pick_js, (void *request), {
+  /// Show the file dialog and decode the chosen image to RGBA pixels
+  const input = document.createElement('input');
+  input.type = 'file';
+  input.accept = 'image/*';
+  input.addEventListener('cancel', () => {
+    Module["ccall"]('gui_image_loader_decoded', null, ['number', 'number', 'number', 'string'], [request, 0, 0, 'No image chosen']);
+  });
+  input.addEventListener('change', async () => {
+    try {
+      const bitmap = await createImageBitmap(input.files[0]);
+      const canvas = new OffscreenCanvas(bitmap.width, bitmap.height);
+      const context = canvas.getContext('2d');
+      context.drawImage(bitmap, 0, 0);
+      bitmap.close();
+      const pixels = context.getImageData(0, 0, canvas.width, canvas.height).data;
+      const pointer = Module["ccall"]('gui_image_loader_decode_buffer', 'number', ['number', 'number'], [request, pixels.length]);
+      HEAPU8.set(pixels, pointer);
+      Module["ccall"]('gui_image_loader_decoded', null, ['number', 'number', 'number', 'string'], [request, canvas.width, canvas.height, '']);
+    } catch(error) {
+      Module["ccall"]('gui_image_loader_decoded', null, ['number', 'number', 'number', 'string'], [request, 0, 0, String(error)]);
+    }
+  });
+  input.click();
+});
+
+EM_JS(void, image_loader_encode_js, (void *request, uint8_t const *rgba, unsigned int width, unsigned int height, char const *media_type, float quality), {
+  /// Encode RGBA pixels to the given format; the pixels are copied before returning
+  const pixels = new Uint8ClampedArray(HEAPU8.subarray(rgba, rgba + width * height * 4));
+  const canvas = new OffscreenCanvas(width, height);
+  canvas.getContext('2d').putImageData(new ImageData(pixels, width, height), 0, 0);
+  canvas.convertToBlob({type: UTF8ToString(media_type), quality: quality}).then((blob) => blob.arrayBuffer()).then((buffer) => {
+    const bytes = new Uint8Array(buffer);
+    const pointer = Module["ccall"]('gui_image_loader_encode_buffer', 'number', ['number', 'number'], [request, bytes.length]);
+    HEAPU8.set(bytes, pointer);
+    Module["ccall"]('gui_image_loader_encoded', null, ['number', 'string'], [request, '']);
+  }).catch((error) => {
+    Module["ccall"]('gui_image_loader_encoded', null, ['number', 'string'], [request, String(error)]);
+  });
+});
+
+void pick(decode_callback &&callback) {
+  /// Let the user choose an image file, and decode it
+  image_loader_pick_js(new decode_request{
+    .callback{std::move(callback)},
+    .rgba{},
+  });
+}
+
+void encode(std::span<uint8_t const> rgba, chat::image::size const dimensions, std::string const &media_type, float const quality, encode_callback &&callback) {
+  /// Encode pixels as an image file of the given media type, with quality from 0 to 1 where the format is lossy
+  image_loader_encode_js(
+    new encode_request{
+      .callback{std::move(callback)},
+      .data{},
+    },
+    rgba.data(),
+    dimensions.width,
+    dimensions.height,
+    media_type.c_str(),
+    quality
+  );
+}
+
+void load_for_upload(chat::image::details const detail, std::function<void(std::expected<chat::image, std::string> &&result)> &&callback) {
+  /// Let the user choose an image, shrink it to the size the model will use, and encode it compactly
+  pick([detail, callback = std::move(callback)](std::expected<pixels, std::string> &&decoded) mutable {
+    if(!decoded) {
+      callback(std::unexpected{std::move(decoded.error())});
+      return;
+    }
+    chat::image::size const dimensions{chat::image::fit_for_upload(decoded->dimensions, detail)};
+    std::vector<uint8_t> downscaled;
+    if(dimensions.width != decoded->dimensions.width || dimensions.height != decoded->dimensions.height) {
+      downscaled.resize(static_cast<size_t>(dimensions.width) * dimensions.height * 4);
+      chat::image::downscale(decoded->rgba, decoded->dimensions, downscaled, dimensions);
+    } else {
+      downscaled = std::move(decoded->rgba);
+    }
+    std::string media_type{chat::image::is_opaque(downscaled) ? "image/jpeg" : "image/png"}; // keep transparency where there is any
+    encode(downscaled, dimensions, media_type, jpeg_quality, [detail, dimensions, media_type, callback = std::move(callback)](std::expected<std::vector<std::byte>, std::string> &&encoded) mutable {
+      if(!encoded) {
+        callback(std::unexpected{std::move(encoded.error())});
+        return;
+      }
+      callback(chat::image{
+        .media_type{std::move(media_type)},
+        .data{std::move(*encoded)},
+        .dimensions{dimensions},
+        .detail{detail},
+      });
+    });
+  });
+}
+
+extern "C" {
+
+EMSCRIPTEN_KEEPALIVE uint8_t *gui_image_loader_decode_buffer(void *request, size_t size);
+EMSCRIPTEN_KEEPALIVE void gui_image_loader_decoded(void *request, unsigned int width, unsigned int height, char const *error);
+EMSCRIPTEN_KEEPALIVE std::byte *gui_image_loader_encode_buffer(void *request, size_t size);
+EMSCRIPTEN_KEEPALIVE void gui_image_loader_encoded(void *request, char const *error);
+
+EMSCRIPTEN_KEEPALIVE uint8_t *gui_image_loader_decode_buffer(void *request, size_t const size) {
+  /// Make room for decoded pixels - called from javascript
+  auto &target{static_cast<decode_request*>(request)->rgba};
+  target.resize(size);
+  return target.data();
+}
+
+EMSCRIPTEN_KEEPALIVE void gui_image_loader_decoded(void *request, unsigned int const width, unsigned int const height, char const *error) {
+  /// Hand decoded pixels or an error to the callback, releasing the request - called from javascript
+  std::unique_ptr<decode_request> const owned{static_cast<decode_request*>(request)};
+  if(*error != '\0') {
+    owned->callback(std::unexpected{std::string{error}});
+    return;
+  }
+  owned->callback(pixels{
+    .rgba{std::move(owned->rgba)},
+    .dimensions{
+      .width{width},
+      .height{height},
+    },
+  });
+}
+
+EMSCRIPTEN_KEEPALIVE std::byte *gui_image_loader_encode_buffer(void *request, size_t const size) {
+  /// Make room for an encoded file - called from javascript
+  auto &target{static_cast<encode_request*>(request)->data};
+  target.resize(size);
+  return target.data();
+}
+
+EMSCRIPTEN_KEEPALIVE void gui_image_loader_encoded(void *request, char const *error) {
+  /// Hand an encoded file or an error to the callback, releasing the request - called from javascript
+  std::unique_ptr<encode_request> const owned{static_cast<encode_request*>(request)};
+  if(*error != '\0') {
+    owned->callback(std::unexpected{std::string{error}});
+    return;
+  }
+  owned->callback(std::move(owned->data));
+}
+
+}
+
+} // namespace gui::image_loader
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <expected>
+#include <functional>
+#include <span>
+#include <string>
+#include <vector>
+#include "chat/image.h"
+
+namespace gui::image_loader {
+  /// Image decoding and encoding by the browser's own codecs, for image attachments.
+  ///
+  /// Files are picked with the browser's file dialog and decoded to RGBA
+  /// pixels; pixels are encoded with OffscreenCanvas.  Both complete
+  /// asynchronously, calling back on the main thread.
+
+struct pixels {
+  std::vector<uint8_t> rgba;
+  chat::image::size dimensions;
+};
+
+using decode_callback = std::function<void(std::expected<pixels, std::string> &&result)>;
+using encode_callback = std::function<void(std::expected<std::vector<std::byte>, std::string> &&result)>;
+
+void pick(decode_callback &&callback);
+void encode(std::span<uint8_t const> rgba, chat::image::size dimensions, std::string const &media_type, float quality, encode_callback &&callback);
+void load_for_upload(chat::image::details detail, std::function<void(std::expected<chat::image, std::string> &&result)> &&callback);
+
+} // namespace gui::image_loader
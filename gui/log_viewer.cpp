@@ -0,0 +1,82 @@
+#include "log_viewer.h"
+#include <algorithm>
+#include "logstorm/sink/circular_buffer.h"
+
+namespace gui {
+
+log_viewer::log_viewer(std::shared_ptr<logstorm::sink::circular_buffer> this_buffer)
+  : buffer{std::move(this_buffer)} {
+  /// Default constructor
+  line.reserve(1024);
+}
+
+void log_viewer::draw() {
+  /// Draw the log window
+  ImGui::SetNextWindowPos({0.0f, ImGui::GetIO().DisplaySize.y * 0.6f}, ImGuiCond_FirstUseEver);
+  ImGui::SetNextWindowSize({ImGui::GetIO().DisplaySize.x, ImGui::GetIO().DisplaySize.y * 0.4f}, ImGuiCond_FirstUseEver);
+  ImGui::SetNextWindowCollapsed(true, ImGuiCond_FirstUseEver);
+  if(!ImGui::Begin("Log")) {
+    ImGui::End();
+    return;
+  }
+
+  auto const [first, end]{buffer->get_snapshot()};
+  if(filter.Draw("Filter", ImGui::GetFontSize() * 20.0f)) {
+    matches.clear();                                                            // a changed filter starts over from the oldest line
+    scanned = first;
+  }
+  ImGui::SameLine();
+  ImGui::Checkbox("Follow", &follow);
+  ImGui::SameLine();
+  auto const stats{buffer->get_statistics()};
+  ImGui::TextDisabled("%llu lines, %.1f of %.1fMB, %llu evicted",
+    static_cast<unsigned long long>(stats.lines),
+    static_cast<double>(stats.used_bytes) / (1u << 20),
+    static_cast<double>(stats.capacity_bytes) / (1u << 20),
+    static_cast<unsigned long long>(stats.evicted)
+  );
+  bool const filtering{filter.IsActive()};
+  if(filtering) {
+    update_matches(first, end);
+    if(scanned != end) {
+      ImGui::SameLine();
+      ImGui::TextDisabled("(filtering, %.0f%%)", 100.0 * static_cast<double>(scanned - first) / static_cast<double>(end - first));
+    }
+  }
+
+  if(ImGui::BeginChild("Lines", {0.0f, 0.0f}, ImGuiChildFlags_Borders, ImGuiWindowFlags_HorizontalScrollbar)) {
+    ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, {0.0f, 0.0f});
+    ImGuiListClipper clipper;                                                   // lines are all the same height, so only those on screen are read from the buffer
+    clipper.Begin(static_cast<int>(filtering ? matches.size() : end - first));
+    while(clipper.Step()) {
+      for(auto i{static_cast<size_t>(clipper.DisplayStart)}; i != static_cast<size_t>(clipper.DisplayEnd); ++i) {
+        if(buffer->read(filtering ? matches[i] : first + i, line)) {
+          ImGui::TextUnformatted(line.data(), line.data() + line.size());
+        } else {
+          ImGui::TextDisabled("(evicted)");                                     // overwritten since the frame started
+        }
+      }
+    }
+    ImGui::PopStyleVar();
+    if(follow && ImGui::GetScrollY() >= ImGui::GetScrollMaxY()) ImGui::SetScrollHereY(1.0f);
+  }
+  ImGui::EndChild();
+
+  ImGui::End();
+}
+
+void log_viewer::update_matches(uint64_t const first, uint64_t const end) {
+  /// Drop matches that have been evicted, and check lines not yet checked against the filter, until the frame's budget runs out
+  while(!matches.empty() && matches.front() < first) matches.pop_front();
+  scanned = std::max(scanned, first);
+  auto const deadline{std::chrono::steady_clock::now() + scan_budget};
+  while(scanned != end) {
+    if(buffer->read(scanned, line) && filter.PassFilter(line.data(), line.data() + line.size())) {
+      matches.emplace_back(scanned);
+    }
+    ++scanned;
+    if(scanned % 1024 == 0 && std::chrono::steady_clock::now() > deadline) break; // checking the clock costs more than checking a line
+  }
+}
+
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <imgui/imgui.h>
+#include "logstorm/logstorm_forward.h"
+
+namespace gui {
+
+class log_viewer {
+  /// A window showing the lines held by a circular buffer sink, optionally filtered.
+  ///
+  /// Only the lines on screen are copied out of the buffer each frame.  When
+  /// filtering, lines are checked against the filter a time budget's worth
+  /// per frame, picking up where the last frame left off, so new lines cost
+  /// only themselves and a changed filter never stalls a frame.
+  std::shared_ptr<logstorm::sink::circular_buffer> buffer;
+
+  ImGuiTextFilter filter;                                                       // comma separated terms, "-" to exclude
+  std::deque<uint64_t> matches;                                                 // line numbers passing the filter, oldest first
+  uint64_t scanned{0};                                                          // lines before this have been checked against the filter
+  std::chrono::microseconds scan_budget{2'000};                                 // per frame
+  std::string line;                                                             // reused for each line read
+  bool follow{true};                                                            // keep the newest line in view
+
+public:
+  explicit log_viewer(std::shared_ptr<logstorm::sink::circular_buffer> buffer);
+
+  void draw();
+
+private:
+  void update_matches(uint64_t first, uint64_t end);
+};
+
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <span>
+#include <string_view>
+
+struct hash_128 {
+  /// 128-bit non-cryptographic content hash (MurmurHash3 x64 128), for cache keys and content deduplication
+  uint64_t low{0};
+  uint64_t high{0};
+
+  bool operator==(hash_128 const &other) const = default;
+};
+
+inline hash_128 hash_bytes_128(std::span<std::byte const> data, uint64_t seed = 0);
+inline hash_128 hash_bytes_128(std::string_view data, uint64_t seed = 0);
+
+namespace hash_128_impl {
+
+inline uint64_t fmix64(uint64_t k) {
+  /// Final avalanche mix
+  k ^= k >> 33;
+  k *= 0xFF'51'AF'D7'ED'55'8C'CDull;
+  k ^= k >> 33;
+  k *= 0xC4'CE'B9'FE'1A'85'EC'53ull;
+  k ^= k >> 33;
+  return k;
+}
+
+inline uint64_t load64(std::byte const *ptr) {
+  /// Unaligned little-endian load
+  uint64_t value;
+  std::memcpy(&value, ptr, sizeof(value));
+  if constexpr(std::endian::native == std::endian::big) value = std::byteswap(value);
+  return value;
+}
+
+} // namespace hash_128_impl
+
+inline hash_128 hash_bytes_128(std::span<std::byte const> data, uint64_t const seed) {
+  /// Hash a block of memory
+  using namespace hash_128_impl;
+  uint64_t constexpr c1{0x87'C3'7B'91'11'42'53'D5ull};
+  uint64_t constexpr c2{0x4C'F5'AD'43'27'45'93'7Full};
+
+  uint64_t h1{seed};
+  uint64_t h2{seed};
+  size_t const block_count{data.size() / 16};
+  std::byte const *ptr{data.data()};
+  for(size_t i{0}; i != block_count; ++i, ptr += 16) {
+    uint64_t k1{load64(ptr)};
+    uint64_t k2{load64(ptr + 8)};
+    k1 *= c1; k1 = std::rotl(k1, 31); k1 *= c2; h1 ^= k1;
+    h1 = std::rotl(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52'DC'E7'29u;
+    k2 *= c2; k2 = std::rotl(k2, 33); k2 *= c1; h2 ^= k2;
+    h2 = std::rotl(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38'49'5A'B5u;
+  }
+
+  // tail: up to 15 remaining bytes, zero-padded
+  std::byte tail[16]{};
+  size_t const tail_size{data.size() & 15u};
+  if(tail_size != 0) {
+    std::memcpy(tail, ptr, tail_size);
+    uint64_t k1{load64(tail)};
+    uint64_t k2{load64(tail + 8)};
+    if(tail_size > 8) {
+      k2 *= c2; k2 = std::rotl(k2, 33); k2 *= c1; h2 ^= k2;
+    }
+    k1 *= c1; k1 = std::rotl(k1, 31); k1 *= c2; h1 ^= k1;
+  }
+
+  h1 ^= data.size();
+  h2 ^= data.size();
+  h1 += h2;
+  h2 += h1;
+  h1 = fmix64(h1);
+  h2 = fmix64(h2);
+  h1 += h2;
+  h2 += h1;
+  return {
+    .low{h1},
+    .high{h2},
+  };
+}
+
+inline hash_128 hash_bytes_128(std::string_view const data, uint64_t const seed) {
+  /// Hash the contents of a string
+  return hash_bytes_128(std::as_bytes(std::span{data.data(), data.size()}), seed);
+}
+
+template<>
+struct std::hash<hash_128> {
+  size_t operator()(hash_128 const &value) const noexcept {
+    return static_cast<size_t>(value.low);                                      // already well mixed
+  }
+};
@@ -0,0 +1,224 @@
+#include "json_reflect.h"
+#include <algorithm>
+
+namespace json_reflect::detail {
+
+namespace {
+
+bool is_number_char(char const c) {
+  /// Whether a character may appear in a JSON number
+  return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+}
+
+int hex_value(char const c) {
+  /// Value of a hex digit, or -1
+  if(c >= '0' && c <= '9') return c - '0';
+  if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+void append_utf8(std::string &value, uint32_t const code_point) {
+  /// Append a code point encoded as UTF-8
+  if(code_point < 0x80) {
+    value += static_cast<char>(code_point);
+  } else if(code_point < 0x800) {
+    value += static_cast<char>(0xC0 | (code_point >> 6));
+    value += static_cast<char>(0x80 | (code_point & 0x3F));
+  } else if(code_point < 0x10000) {
+    value += static_cast<char>(0xE0 | (code_point >> 12));
+    value += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+    value += static_cast<char>(0x80 | (code_point & 0x3F));
+  } else {
+    value += static_cast<char>(0xF0 | (code_point >> 18));
+    value += static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+    value += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+    value += static_cast<char>(0x80 | (code_point & 0x3F));
+  }
+}
+
+} // anonymous namespace
+
+decoder::decoder(std::string_view input)
+  : begin{input.data()},
+    cursor{input.data()},
+    end{input.data() + input.size()} {
+  /// Construct a decoder at the start of some JSON text
+}
+
+bool decoder::finish() {
+  /// Check that nothing but whitespace follows the decoded value
+  skip_whitespace();
+  if(cursor != end) return fail("unexpected trailing characters");
+  return true;
+}
+
+std::string const &decoder::get_error() const {
+  /// Return a description of the first error
+  return error;
+}
+
+bool decoder::fail(std::string_view message) {
+  /// Record an error at the current position, keeping only the first
+  if(error.empty()) {
+    error = "JSON decode error at offset " + std::to_string(cursor - begin) + ": " + std::string{message};
+  }
+  return false;
+}
+
+void decoder::skip_whitespace() {
+  /// Advance past any whitespace
+  while(cursor != end && (*cursor == ' ' || *cursor == '\n' || *cursor == '\r' || *cursor == '\t')) ++cursor;
+}
+
+bool decoder::consume(char const expected) {
+  /// Advance past a character if it's next, after any whitespace
+  skip_whitespace();
+  if(cursor == end || *cursor != expected) return false;
+  ++cursor;
+  return true;
+}
+
+bool decoder::read_literal(std::string_view literal) {
+  /// Advance past a keyword
+  if(static_cast<size_t>(end - cursor) < literal.size() || std::string_view{cursor, literal.size()} != literal) {
+    return fail("expected " + std::string{literal});
+  }
+  cursor += literal.size();
+  return true;
+}
+
+bool decoder::read_string(std::string &value) {
+  /// Read a string, copying unescaped runs in bulk
+  if(cursor == end || *cursor != '"') return fail("expected a string");
+  ++cursor;
+  value.clear();
+  for(;;) {
+    char const *const run_end{std::find_if(cursor, end, [](char const c){return c == '"' || c == '\\' || static_cast<unsigned char>(c) < 0x20;})};
+    value.append(cursor, run_end);
+    cursor = run_end;
+    if(cursor == end) return fail("unterminated string");
+    if(*cursor == '"') {
+      ++cursor;
+      return true;
+    }
+    if(*cursor != '\\') return fail("control character in string");
+    if(!read_escape(value)) return false;
+  }
+}
+
+bool decoder::read_key(std::string_view &key) {
+  /// Read a string without copying it, unless it contains escapes
+  if(cursor == end || *cursor != '"') return fail("expected a string");
+  char const *const start{cursor + 1};
+  char const *const run_end{std::find_if(start, end, [](char const c){return c == '"' || c == '\\';})};
+  if(run_end != end && *run_end == '"') {
+    key = {start, static_cast<size_t>(run_end - start)};
+    cursor = run_end + 1;
+    return true;
+  }
+  if(!read_string(key_buffer)) return false;
+  key = key_buffer;
+  return true;
+}
+
+bool decoder::read_escape(std::string &value) {
+  /// Decode the escape sequence at the cursor, including surrogate pairs
+  ++cursor;                                                                     // the backslash
+  if(cursor == end) return fail("unterminated string");
+  switch(*cursor++) {
+  case '"':  value += '"';  return true;
+  case '\\': value += '\\'; return true;
+  case '/':  value += '/';  return true;
+  case 'b':  value += '\b'; return true;
+  case 'f':  value += '\f'; return true;
+  case 'n':  value += '\n'; return true;
+  case 'r':  value += '\r'; return true;
+  case 't':  value += '\t'; return true;
+  case 'u':
+    break;
+  default:
+    return fail("invalid escape");
+  }
+  auto const read_hex4{[&](uint32_t &code_unit){
+    if(end - cursor < 4) return false;
+    code_unit = 0;
+    for(unsigned int i{0}; i != 4; ++i) {
+      int const digit{hex_value(*cursor++)};
+      if(digit < 0) return false;
+      code_unit = (code_unit << 4) | static_cast<uint32_t>(digit);
+    }
+    return true;
+  }};
+  uint32_t code_point;
+  if(!read_hex4(code_point)) return fail("invalid unicode escape");
+  if(code_point >= 0xD800 && code_point < 0xDC00) {                             // high surrogate, which must be followed by a low one
+    uint32_t low;
+    if(end - cursor < 2 || cursor[0] != '\\' || cursor[1] != 'u') return fail("unpaired surrogate");
+    cursor += 2;
+    if(!read_hex4(low) || low < 0xDC00 || low >= 0xE000) return fail("unpaired surrogate");
+    code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+  } else if(code_point >= 0xDC00 && code_point < 0xE000) {
+    return fail("unpaired surrogate");
+  }
+  append_utf8(value, code_point);
+  return true;
+}
+
+bool decoder::skip_value() {
+  /// Advance past a value of any type without decoding it
+  skip_whitespace();
+  if(cursor == end) return fail("expected a value");
+  switch(*cursor) {
+  case '"':
+    {
+      std::string_view ignored;
+      return read_key(ignored);
+    }
+  case 't':
+    return read_literal("true");
+  case 'f':
+    return read_literal("false");
+  case 'n':
+    return read_literal("null");
+  case '[':
+  case '{':
+    {
+      if(depth == max_depth) return fail("nested too deeply");
+      bool const is_object{*cursor == '{'};
+      char const close{is_object ? '}' : ']'};
+      ++cursor;
+      ++depth;
+      skip_whitespace();
+      if(!consume(close)) {
+        for(;;) {
+          if(is_object) {
+            std::string_view ignored;
+            skip_whitespace();
+            if(!read_key(ignored)) return false;
+            if(!consume(':')) return fail("expected ':'");
+          }
+          if(!skip_value()) return false;
+          if(consume(',')) continue;
+          if(consume(close)) break;
+          return fail(is_object ? "expected ',' or '}'" : "expected ',' or ']'");
+        }
+      }
+      --depth;
+      return true;
+    }
+  default:
+    if(read_number_token().empty()) return fail("expected a value");
+    return true;
+  }
+}
+
+std::string_view decoder::read_number_token() {
+  /// Advance past the characters of a number, returning them
+  skip_whitespace();
+  char const *const start{cursor};
+  cursor = std::find_if_not(cursor, end, is_number_char);
+  return {start, static_cast<size_t>(cursor - start)};
+}
+
+}
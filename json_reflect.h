@@ -0,0 +1,251 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <expected>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#include <magic_enum/magic_enum.hpp>
+#include <nlohmann/json.hpp>
+#include "reflect.h"
+
+// JSON schemas and DOM-free decoding for reflected aggregates, for structured outputs and tool arguments.
+//
+// Supported types are bool, arithmetic types, std::string, enums (by name, via
+// magic_enum), std::vector, std::optional, and aggregates of these.  Schemas
+// follow the subset accepted by strict structured outputs: every property is
+// required, optional ones are nullable, and no other properties are allowed.
+// The decoder writes straight into the destination, reusing its existing
+// allocations; it only allocates for the strings and vectors being filled.
+
+namespace json_reflect {
+
+namespace detail {
+
+template<typename T>
+struct is_vector : std::false_type {};
+template<typename T, typename A>
+struct is_vector<std::vector<T, A>> : std::true_type {};
+
+template<typename T>
+struct is_optional : std::false_type {};
+template<typename T>
+struct is_optional<std::optional<T>> : std::true_type {};
+
+template<typename T>
+inline uint64_t constexpr required_fields{[]<size_t... I>(std::index_sequence<I...>){
+  return (uint64_t{0} | ... | (is_optional<reflect::field_type<T, I>>::value ? uint64_t{0} : uint64_t{1} << I));
+}(std::make_index_sequence<reflect::field_count<T>>{})};
+
+class decoder {
+  /// Single pass reader over JSON text, stopping at the first error
+  char const *const begin;
+  char const *cursor;
+  char const *const end;
+  std::string error;
+  std::string key_buffer;                                                       // only used for keys containing escapes
+  unsigned int depth{0};
+
+  static unsigned int constexpr max_depth{64};                                  // of skipped values, which aren't bounded by the destination type
+
+public:
+  explicit decoder(std::string_view input);
+
+  template<typename T>
+  bool read(T &value);
+  bool finish();
+  std::string const &get_error() const;
+
+private:
+  bool fail(std::string_view message);
+  void skip_whitespace();
+  bool consume(char expected);
+  bool read_literal(std::string_view literal);
+  bool read_string(std::string &value);
+  bool read_key(std::string_view &key);
+  bool read_escape(std::string &value);
+  bool skip_value();
+  std::string_view read_number_token();
+
+  template<typename T>
+  bool read_number(T &value);
+  template<typename T>
+  bool read_object(T &value);
+  template<typename T>
+  bool read_field(T &value, std::string_view key, uint64_t &seen);
+};
+
+template<typename T>
+bool decoder::read(T &value) {
+  /// Read a value of any supported type
+  skip_whitespace();
+  if constexpr(std::is_same_v<T, bool>) {
+    if(cursor != end && *cursor == 't') {
+      value = true;
+      return read_literal("true");
+    }
+    value = false;
+    return read_literal("false");
+  } else if constexpr(std::is_arithmetic_v<T>) {
+    return read_number(value);
+  } else if constexpr(std::is_same_v<T, std::string>) {
+    return read_string(value);
+  } else if constexpr(std::is_enum_v<T>) {
+    std::string_view name;
+    if(!read_key(name)) return false;                                           // enumerator names never need escaping, so this avoids allocating
+    auto const parsed{magic_enum::enum_cast<T>(name)};
+    if(!parsed) return fail("unknown enumerator");
+    value = *parsed;
+    return true;
+  } else if constexpr(is_optional<T>::value) {
+    if(cursor != end && *cursor == 'n') {
+      value.reset();
+      return read_literal("null");
+    }
+    if(!value) value.emplace();
+    return read(*value);
+  } else if constexpr(is_vector<T>::value) {
+    if(!consume('[')) return fail("expected an array");
+    size_t count{0};
+    skip_whitespace();
+    if(!consume(']')) {
+      for(;;) {
+        if(count == value.size()) value.emplace_back();                         // reuse existing elements, and their allocations
+        if(!read(value[count])) return false;
+        ++count;
+        if(consume(',')) continue;
+        if(consume(']')) break;
+        return fail("expected ',' or ']'");
+      }
+    }
+    value.resize(count);
+    return true;
+  } else {
+    static_assert(reflect::reflectable<T>, "json_reflect: unsupported type");
+    return read_object(value);
+  }
+}
+
+template<typename T>
+bool decoder::read_number(T &value) {
+  /// Read a number into an arithmetic type, failing if it doesn't fit
+  std::string_view const token{read_number_token()};
+  if(token.empty()) return fail("expected a number");
+  auto const [end_parsed, result]{std::from_chars(token.data(), token.data() + token.size(), value)};
+  if(result == std::errc::result_out_of_range) return fail("number out of range");
+  if(result != std::errc{} || end_parsed != token.data() + token.size()) {
+    return fail(std::is_integral_v<T> ? "expected an integer" : "invalid number");
+  }
+  return true;
+}
+
+template<typename T>
+bool decoder::read_object(T &value) {
+  /// Read an object into an aggregate, skipping unknown keys and requiring every non-optional field
+  if(!consume('{')) return fail("expected an object");
+  uint64_t seen{0};
+  skip_whitespace();
+  if(!consume('}')) {
+    for(;;) {
+      std::string_view key;
+      skip_whitespace();
+      if(!read_key(key)) return false;
+      if(!consume(':')) return fail("expected ':'");
+      if(!read_field(value, key, seen)) return false;
+      if(consume(',')) continue;
+      if(consume('}')) break;
+      return fail("expected ',' or '}'");
+    }
+  }
+  if((seen & required_fields<T>) == required_fields<T>) return true;
+  std::string_view missing;
+  [&]<size_t... I>(std::index_sequence<I...>){
+    static_cast<void>(((!(seen & (uint64_t{1} << I)) && (required_fields<T> & (uint64_t{1} << I)) && (missing = reflect::field_name<T, I>, true)) || ...));
+  }(std::make_index_sequence<reflect::field_count<T>>{});
+  return fail("missing field \"" + std::string{missing} + "\"");
+}
+
+template<typename T>
+bool decoder::read_field(T &value, std::string_view key, uint64_t &seen) {
+  /// Read the value of a key into the field of that name, or skip it if there's no such field
+  auto fields{reflect::tie(value)};
+  return [&]<size_t... I>(std::index_sequence<I...>){
+    bool result{true};
+    bool const found{((key == reflect::field_name<T, I> && (seen |= uint64_t{1} << I, result = read(std::get<I>(fields)), true)) || ...)}; // the key is compared before reading, as reading may reuse its buffer
+    return found ? result : skip_value();
+  }(std::make_index_sequence<reflect::field_count<T>>{});
+}
+
+} // namespace detail
+
+template<typename T>
+nlohmann::json schema() {
+  /// Generate the JSON schema of a type
+  using namespace detail;
+  if constexpr(std::is_same_v<T, bool>) {
+    return {{"type", "boolean"}};
+  } else if constexpr(std::is_integral_v<T>) {
+    return {{"type", "integer"}};
+  } else if constexpr(std::is_floating_point_v<T>) {
+    return {{"type", "number"}};
+  } else if constexpr(std::is_same_v<T, std::string>) {
+    return {{"type", "string"}};
+  } else if constexpr(std::is_enum_v<T>) {
+    nlohmann::json names = nlohmann::json::array();
+    for(auto const name : magic_enum::enum_names<T>()) {
+      names.emplace_back(name);
+    }
+    return {{"type", "string"}, {"enum", std::move(names)}};
+  } else if constexpr(is_optional<T>::value) {
+    return {{"anyOf", nlohmann::json::array({schema<typename T::value_type>(), {{"type", "null"}}})}};
+  } else if constexpr(is_vector<T>::value) {
+    return {{"type", "array"}, {"items", schema<typename T::value_type>()}};
+  } else {
+    static_assert(reflect::reflectable<T>, "json_reflect: unsupported type");
+    nlohmann::json properties = nlohmann::json::object();
+    nlohmann::json required = nlohmann::json::array();
+    [&]<size_t... I>(std::index_sequence<I...>){
+      ((properties[std::string{reflect::field_name<T, I>}] = schema<reflect::field_type<T, I>>(), required.emplace_back(reflect::field_name<T, I>)), ...);
+    }(std::make_index_sequence<reflect::field_count<T>>{});
+    return {
+      {"type", "object"},
+      {"properties", std::move(properties)},
+      {"required", std::move(required)},
+      {"additionalProperties", false},
+    };
+  }
+}
+
+template<typename T>
+nlohmann::json response_format(std::string_view name) {
+  /// Generate the response_format of a chat completion request for structured output of a type
+  return {
+    {"type", "json_schema"},
+    {"json_schema", {
+      {"name", name},
+      {"strict", true},
+      {"schema", schema<T>()},
+    }},
+  };
+}
+
+template<typename T>
+std::expected<void, std::string> decode_into(std::string_view json, T &value) {
+  /// Decode JSON text into an existing value, reusing its allocations where possible
+  detail::decoder this_decoder{json};
+  if(!this_decoder.read(value) || !this_decoder.finish()) return std::unexpected{this_decoder.get_error()};
+  return {};
+}
+
+template<typename T>
+std::expected<T, std::string> decode(std::string_view json) {
+  /// Decode JSON text into a new value
+  T value{};
+  if(auto const result{decode_into(json, value)}; !result) return std::unexpected{result.error()};
+  return value;
+}
+
+} // namespace json_reflect
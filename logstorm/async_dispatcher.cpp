@@ -0,0 +1,177 @@
+#include "async_dispatcher.h"
+#include <algorithm>
+#include "sink/base.h"
+
+namespace logstorm {
+
+async_dispatcher::async_dispatcher(std::vector<std::shared_ptr<sink::base>> const &this_sinks, settings const &this_config)
+  : config{this_config},
+    queue{this_config.capacity, this_config.record_reserve},
+    sinks{this_sinks} {
+  /// Allocate the ring, and start the consumer thread if there is to be one
+  #ifdef LOGSTORM_CONSUMER_THREAD
+    if(config.consumer_thread) {
+      consumer = std::thread{[this]{
+        while(!stopping.load(std::memory_order_acquire)) {
+          if(drain() != 0) continue;
+          if(flush_requested.exchange(false, std::memory_order_acq_rel)) {
+            drain();                                                            // the line that asked may have been queued after the drain above
+            flush_sinks();
+            continue;
+          }
+          std::unique_lock lock{wake_mutex};
+          wake.wait_for(lock, config.poll_interval);                            // producers don't notify, to keep logging cheap, so poll
+        }
+      }};
+    }
+  #endif // LOGSTORM_CONSUMER_THREAD
+}
+
+async_dispatcher::~async_dispatcher() {
+  /// Stop the consumer, then write out anything still queued
+  #ifdef LOGSTORM_CONSUMER_THREAD
+    if(consumer.joinable()) {
+      stopping.store(true, std::memory_order_release);
+      wake.notify_one();
+      consumer.join();
+    }
+  #endif // LOGSTORM_CONSUMER_THREAD
+  drain();
+}
+
+void async_dispatcher::push(std::string_view const line) {
+  /// Queue a line for the sinks, applying the overflow policy if the ring is full
+  ring::clock::time_point const pushed{config.measure_latency ? ring::clock::now() : ring::clock::time_point{}};
+  if(queue.try_push(line, pushed)) return;
+  switch(config.overflow) {
+  case overflow_policies::block:
+    blocked.fetch_add(1, std::memory_order_relaxed);
+    do {
+      if(has_consumer_thread()) {
+        #ifdef LOGSTORM_CONSUMER_THREAD
+          wake.notify_one();
+          std::this_thread::yield();
+        #endif // LOGSTORM_CONSUMER_THREAD
+      } else {
+        drain();                                                                // nobody else will make room
+      }
+    } while(!queue.try_push(line, pushed));
+    return;
+  case overflow_policies::drop:
+    dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  case overflow_policies::overwrite:
+    do {
+      if(queue.try_pop([](std::string_view, ring::clock::time_point){})) overwritten.fetch_add(1, std::memory_order_relaxed);
+    } while(!queue.try_push(line, pushed));
+    return;
+  }
+}
+
+size_t async_dispatcher::flush() {
+  /// Write out every line queued so far, on this thread or by waiting for the consumer, and return how many this thread wrote
+  if(!has_consumer_thread()) return drain();
+  #ifdef LOGSTORM_CONSUMER_THREAD
+    size_t const target{queue.get_pushed()};
+    while(queue.get_completed() < target) {
+      wake.notify_one();
+      std::this_thread::yield();
+    }
+  #endif // LOGSTORM_CONSUMER_THREAD
+  return 0;
+}
+
+void async_dispatcher::request_flush() {
+  /// Have everything queued so far written out and the sinks flushed, without waiting for it where there's a consumer to do it
+  if(!has_consumer_thread()) {
+    drain();                                                                    // nobody else will
+    flush_sinks();
+    return;
+  }
+  #ifdef LOGSTORM_CONSUMER_THREAD
+    flush_requested.store(true, std::memory_order_release);
+    wake.notify_one();
+  #endif // LOGSTORM_CONSUMER_THREAD
+}
+
+void async_dispatcher::set_sinks(std::vector<std::shared_ptr<sink::base>> const &new_sinks) {
+  /// Replace the sinks lines are written to, between batches
+  #ifndef LOGSTORM_SINGLE_THREADED
+    std::scoped_lock lock{sinks_mutex};
+  #endif // LOGSTORM_SINGLE_THREADED
+  sinks = new_sinks;
+}
+
+async_dispatcher::settings const &async_dispatcher::get_settings() const {
+  /// Return the settings the dispatcher was created with
+  return config;
+}
+
+async_dispatcher::statistics async_dispatcher::get_statistics() const {
+  /// Return queue counters, approximately while lines are being logged
+  return {
+    .queued{queue.get_pushed()},
+    .written{written.load(std::memory_order_relaxed)},
+    .dropped{dropped.load(std::memory_order_relaxed)},
+    .overwritten{overwritten.load(std::memory_order_relaxed)},
+    .blocked{blocked.load(std::memory_order_relaxed)},
+    .depth{queue.get_depth()},
+    .capacity{queue.get_capacity()},
+    .total_latency{std::chrono::nanoseconds{total_latency_ns.load(std::memory_order_relaxed)}},
+    .max_latency{std::chrono::nanoseconds{max_latency_ns.load(std::memory_order_relaxed)}},
+    .sink_time{std::chrono::nanoseconds{sink_time_ns.load(std::memory_order_relaxed)}},
+  };
+}
+
+bool async_dispatcher::has_consumer_thread() const {
+  /// Whether a consumer thread is writing lines out
+  #ifdef LOGSTORM_CONSUMER_THREAD
+    return consumer.joinable();
+  #else
+    return false;
+  #endif // LOGSTORM_CONSUMER_THREAD
+}
+
+size_t async_dispatcher::drain() {
+  /// Pass every queued line to every sink, returning how many lines were written
+  #ifndef LOGSTORM_SINGLE_THREADED
+    std::scoped_lock lock{sinks_mutex};
+  #endif // LOGSTORM_SINGLE_THREADED
+  size_t count{0};
+  ring::clock::duration latency_sum{0};
+  ring::clock::duration latency_max{max_latency_ns.load(std::memory_order_relaxed)};
+  ring::clock::duration sink_sum{0};
+  while(queue.try_pop([&](std::string_view const line, ring::clock::time_point const pushed){
+    ring::clock::time_point const started{config.measure_latency ? ring::clock::now() : ring::clock::time_point{}};
+    for(auto const &thissink : sinks) {
+      thissink->log(line);
+    }
+    if(config.measure_latency) {
+      ring::clock::time_point const finished{ring::clock::now()};
+      latency_sum += finished - pushed;
+      latency_max = std::max(latency_max, finished - pushed);
+      sink_sum += finished - started;
+    }
+  })) {
+    ++count;
+  }
+  written.fetch_add(count, std::memory_order_relaxed);
+  if(config.measure_latency && count != 0) {
+    total_latency_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(latency_sum).count(), std::memory_order_relaxed);
+    max_latency_ns.store(std::chrono::duration_cast<std::chrono::nanoseconds>(latency_max).count(), std::memory_order_relaxed);
+    sink_time_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(sink_sum).count(), std::memory_order_relaxed);
+  }
+  return count;
+}
+
+void async_dispatcher::flush_sinks() {
+  /// Write out anything the sinks have buffered, leaving queued sinks to do it on their own workers
+  #ifndef LOGSTORM_SINGLE_THREADED
+    std::scoped_lock lock{sinks_mutex};
+  #endif // LOGSTORM_SINGLE_THREADED
+  for(auto const &thissink : sinks) {
+    thissink->request_flush();
+  }
+}
+
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+#include "async_settings.h"
+#include "ring.h"
+#include "threading.h"
+
+#ifndef LOGSTORM_SINGLE_THREADED
+  #include <mutex>
+#endif // LOGSTORM_SINGLE_THREADED
+#ifdef LOGSTORM_CONSUMER_THREAD
+  #include <condition_variable>
+  #include <thread>
+#endif // LOGSTORM_CONSUMER_THREAD
+
+namespace logstorm {
+
+namespace sink {
+class base;
+}
+
+class async_dispatcher {
+  /// Takes log lines off the logging thread: callers only copy each line into
+  /// a lock-free ring, and a consumer thread passes them on to the sinks.
+  /// Without threads, or with consumer_thread off, lines wait in the ring
+  /// until flush() is called, for example once per frame.  flush() waits
+  /// for everything queued to be written; request_flush() only wakes the
+  /// consumer to write it and flush the sinks, so logging needn't wait.
+public:
+  using overflow_policies = async_overflow_policies;                            // defined in async_settings.h, so users needn't include this header
+  using settings = async_settings;
+  using statistics = async_statistics;
+
+private:
+  settings const config;
+  ring queue;
+  std::vector<std::shared_ptr<sink::base>> sinks;                               // a copy of the manager's, so the manager can move
+  std::atomic<uint64_t> written{0};
+  std::atomic<uint64_t> dropped{0};
+  std::atomic<uint64_t> overwritten{0};
+  std::atomic<uint64_t> blocked{0};
+  std::atomic<int64_t> total_latency_ns{0};
+  std::atomic<int64_t> max_latency_ns{0};                                       // only raised by drain(), which holds sinks_mutex
+  std::atomic<int64_t> sink_time_ns{0};
+  #ifndef LOGSTORM_SINGLE_THREADED
+    std::mutex sinks_mutex;                                                     // held while writing, so sinks can't change underneath
+  #endif // LOGSTORM_SINGLE_THREADED
+  #ifdef LOGSTORM_CONSUMER_THREAD
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> flush_requested{false};                                   // set by request_flush(), for the consumer to flush the sinks
+    std::thread consumer;
+  #endif // LOGSTORM_CONSUMER_THREAD
+
+public:
+  async_dispatcher(std::vector<std::shared_ptr<sink::base>> const &sinks, settings const &config);
+  ~async_dispatcher();
+
+  void push(std::string_view line);
+  size_t flush();
+  void request_flush();
+
+  void set_sinks(std::vector<std::shared_ptr<sink::base>> const &new_sinks);
+  settings const &get_settings() const;
+  statistics get_statistics() const;
+
+private:
+  bool has_consumer_thread() const;
+  size_t drain();
+  void flush_sinks();
+};
+
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace logstorm {
+
+enum class async_overflow_policies {                                            // what async_dispatcher::push() does when the queue is full
+  block,                                                                        // wait for the consumer to make room
+  drop,                                                                         // discard the new line
+  overwrite,                                                                    // discard the oldest line
+};
+
+struct async_settings {
+  size_t capacity{1024};                                                        // lines, rounded up to a power of two
+  size_t record_reserve{256};                                                   // characters preallocated per line; longer lines allocate
+  async_overflow_policies overflow{async_overflow_policies::block};
+  bool consumer_thread{true};                                                   // ignored where threads are unavailable
+  std::chrono::milliseconds poll_interval{1};                                   // how often an idle consumer looks for new lines
+  bool measure_latency{true};                                                   // stamp each line as it's queued, to time it to the sinks
+};
+
+struct async_statistics {
+  uint64_t queued{0};
+  uint64_t written{0};                                                          // passed to the sinks
+  uint64_t dropped{0};
+  uint64_t overwritten{0};
+  uint64_t blocked{0};                                                          // lines whose caller had to wait for room
+  size_t depth{0};                                                              // lines waiting right now
+  size_t capacity{0};
+  std::chrono::nanoseconds total_latency{0};                                    // from being queued until every sink had written it, summed over lines written
+  std::chrono::nanoseconds max_latency{0};
+  std::chrono::nanoseconds sink_time{0};                                        // spent inside the sinks, summed
+};
+
+}
@@ -0,0 +1,234 @@
+#include "binary_decoder.h"
+#include <array>
+#include <charconv>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <iterator>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "binary_log.h"
+
+namespace logstorm::binary {
+
+namespace {
+
+struct site_definition {
+  levels level;
+  uint32_t line;
+  std::string file;
+  std::string format;
+  std::vector<arg_types> args;
+};
+
+class reader {
+  /// Reads values from a decoded file's bytes, failing softly at the end of the data
+  std::span<std::byte const> data;
+  size_t position{0};
+
+public:
+  explicit reader(std::span<std::byte const> this_data)
+    : data{this_data} {
+    /// Read from the start of the data
+  }
+
+  bool at_end() const {
+    /// Whether every byte has been read
+    return position == data.size();
+  }
+
+  template<typename T>
+  std::optional<T> fixed() {
+    /// Read a fixed-size value
+    if(data.size() - position < sizeof(T)) return std::nullopt;
+    T value;
+    std::memcpy(&value, data.data() + position, sizeof(T));
+    position += sizeof(T);
+    return value;
+  }
+
+  std::optional<uint64_t> varint() {
+    /// Read a variable-length unsigned integer
+    uint64_t value{0};
+    for(unsigned int shift{0}; shift < 64; shift += 7) {
+      if(position == data.size()) return std::nullopt;
+      auto const byte{static_cast<uint8_t>(data[position++])};
+      value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if(!(byte & 0x80)) return value;
+    }
+    return std::nullopt;
+  }
+
+  std::optional<int64_t> zigzag() {
+    /// Read a variable-length signed integer
+    auto const value{varint()};
+    if(!value) return std::nullopt;
+    return static_cast<int64_t>(*value >> 1) ^ -static_cast<int64_t>(*value & 1);
+  }
+
+  std::optional<std::string_view> text() {
+    /// Read length-prefixed text
+    auto const length{varint()};
+    if(!length || data.size() - position < *length) return std::nullopt;
+    std::string_view const result{reinterpret_cast<char const*>(data.data() + position), static_cast<size_t>(*length)};
+    position += static_cast<size_t>(*length);
+    return result;
+  }
+};
+
+std::string_view level_name(levels const level) {
+  /// Short name of a severity level
+  switch(level) {
+  case levels::trace:   return "TRACE";
+  case levels::debug:   return "DEBUG";
+  case levels::info:    return "INFO";
+  case levels::warning: return "WARNING";
+  case levels::error:   return "ERROR";
+  case levels::none:    return "NONE";
+  }
+  return "UNKNOWN";
+}
+
+template<typename T>
+void append_number(std::string &destination, T const value) {
+  /// Append a number in its shortest exact form
+  std::array<char, 32> digits;
+  auto const result{std::to_chars(digits.data(), digits.data() + digits.size(), value)};
+  destination.append(digits.data(), result.ptr);
+}
+
+std::optional<std::string> read_argument(reader &source, arg_types const type) {
+  /// Read one argument and render it as text
+  std::string result;
+  switch(type) {
+  case arg_types::i8:
+  case arg_types::i16:
+  case arg_types::i32:
+  case arg_types::i64:
+    if(auto const value{source.zigzag()}) append_number(result, *value); else return std::nullopt;
+    return result;
+  case arg_types::u8:
+  case arg_types::u16:
+  case arg_types::u32:
+  case arg_types::u64:
+    if(auto const value{source.varint()}) append_number(result, *value); else return std::nullopt;
+    return result;
+  case arg_types::f32:
+    if(auto const value{source.fixed<float>()}) append_number(result, *value); else return std::nullopt;
+    return result;
+  case arg_types::f64:
+    if(auto const value{source.fixed<double>()}) append_number(result, *value); else return std::nullopt;
+    return result;
+  case arg_types::boolean:
+    if(auto const value{source.fixed<uint8_t>()}) return std::string{*value ? "1" : "0"}; // as a text log prints it
+    return std::nullopt;
+  case arg_types::character:
+    if(auto const value{source.fixed<char>()}) return std::string(1, *value);
+    return std::nullopt;
+  case arg_types::string:
+    if(auto const value{source.text()}) return std::string{*value};
+    return std::nullopt;
+  }
+  return std::nullopt;
+}
+
+std::string format_line(std::string_view const format, std::span<std::string const> const args) {
+  /// Substitute arguments for each {} in order, with {{ and }} for literal braces; spare arguments go on the end
+  std::string result;
+  size_t next_arg{0};
+  for(size_t i{0}; i != format.size(); ++i) {
+    if(format.substr(i, 2) == "{}") {
+      result += next_arg < args.size() ? args[next_arg++] : "{?}";
+      ++i;
+    } else if(format.substr(i, 2) == "{{" || format.substr(i, 2) == "}}") {
+      result += format[i];
+      ++i;
+    } else {
+      result += format[i];
+    }
+  }
+  for(; next_arg != args.size(); ++next_arg) {
+    result += ' ';
+    result += args[next_arg];
+  }
+  return result;
+}
+
+void write_timestamp(std::ostream &output, uint64_t const unix_ns) {
+  /// Write a local date and time with microseconds
+  std::time_t const seconds{static_cast<std::time_t>(unix_ns / 1'000'000'000)};
+  std::tm const time_info{*std::localtime(&seconds)};
+  output << std::put_time(&time_info, "%Y-%m-%d %H:%M:%S") << '.' << std::setw(6) << std::setfill('0') << (unix_ns / 1'000) % 1'000'000;
+}
+
+} // anonymous namespace
+
+std::expected<uint64_t, std::string> decode(std::istream &input, std::ostream &output, decode_options const &options) {
+  /// Turn a binary log back into text, one line per record, returning the number of lines
+  std::vector<char> const bytes{std::istreambuf_iterator<char>{input}, std::istreambuf_iterator<char>{}};
+  reader source{std::as_bytes(std::span{bytes})};
+
+  auto const header{source.fixed<std::array<char, magic.size()>>()};
+  if(!header || *header != magic) return std::unexpected{"Not a LogStorm binary log"};
+  auto const file_version{source.fixed<uint8_t>()};
+  if(!file_version || *file_version != version) return std::unexpected{"Unsupported binary log version " + std::to_string(file_version.value_or(0))};
+  auto const start_unix_ns{source.fixed<uint64_t>()};
+  if(!start_unix_ns) return std::unexpected{"Truncated header"};
+
+  std::unordered_map<uint64_t, site_definition> sites;
+  uint64_t timestamp{0};
+  uint64_t lines{0};
+  std::vector<std::string> args;
+  while(!source.at_end()) {
+    auto const id{source.varint()};
+    if(!id) return std::unexpected{"Truncated after " + std::to_string(lines) + " lines"};
+    if(*id == definition_tag) {
+      auto const defined_id{source.varint()};
+      auto const level{source.fixed<uint8_t>()};
+      auto const line{source.varint()};
+      auto const file{source.text()};
+      auto const format{source.text()};
+      auto const count{source.fixed<uint8_t>()};
+      if(!defined_id || !level || !line || !file || !format || !count) return std::unexpected{"Truncated site definition after " + std::to_string(lines) + " lines"};
+      site_definition definition{
+        .level{static_cast<levels>(*level)},
+        .line{static_cast<uint32_t>(*line)},
+        .file{std::string{*file}},
+        .format{std::string{*format}},
+        .args{},
+      };
+      for(unsigned int i{0}; i != *count; ++i) {
+        auto const type{source.fixed<uint8_t>()};
+        if(!type || *type > static_cast<uint8_t>(arg_types::string)) return std::unexpected{"Bad argument type in site " + std::to_string(*defined_id)};
+        definition.args.emplace_back(static_cast<arg_types>(*type));
+      }
+      sites.insert_or_assign(*defined_id, std::move(definition));
+      continue;
+    }
+
+    auto const site_it{sites.find(*id)};
+    if(site_it == sites.end()) return std::unexpected{"Record for undefined site " + std::to_string(*id) + " after " + std::to_string(lines) + " lines"};
+    auto const &site{site_it->second};
+    auto const delta{source.varint()};
+    if(!delta) return std::unexpected{"Truncated after " + std::to_string(lines) + " lines"};
+    timestamp += *delta;
+    args.clear();
+    for(auto const type : site.args) {
+      auto arg{read_argument(source, type)};
+      if(!arg) return std::unexpected{"Truncated after " + std::to_string(lines) + " lines"};
+      args.emplace_back(std::move(*arg));
+    }
+
+    write_timestamp(output, *start_unix_ns + timestamp);
+    output << ' ' << level_name(site.level) << ' ';
+    if(options.show_sites) output << site.file << ':' << site.line << ' ';
+    output << format_line(site.format, args) << '\n';
+    ++lines;
+  }
+  return lines;
+}
+
+}
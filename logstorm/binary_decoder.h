@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+#include <expected>
+#include <istream>
+#include <ostream>
+#include <string>
+
+namespace logstorm::binary {
+
+struct decode_options {
+  bool show_sites{false};                                                       // prefix each line with the file and line that logged it
+};
+
+std::expected<uint64_t, std::string> decode(std::istream &input, std::ostream &output, decode_options const &options = {});
+
+}
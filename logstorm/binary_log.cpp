@@ -0,0 +1,197 @@
+#include "binary_log.h"
+#include <atomic>
+#include <iostream>
+
+namespace logstorm {
+
+namespace binary {
+
+namespace {
+
+std::atomic<uint32_t> next_site_id{1};                                          // 0 is the definition tag
+
+template<typename T>
+T get_raw(std::byte const *&source) {
+  /// Read a fixed-size value from the staging buffer and advance past it
+  T value;
+  std::memcpy(&value, source, sizeof(T));
+  source += sizeof(T);
+  return value;
+}
+
+void put_varint(std::vector<std::byte> &destination, uint64_t value) {
+  /// Append an unsigned integer seven bits at a time, low bits first, with the top bit set on all but the last byte
+  while(value >= 0x80) {
+    destination.emplace_back(static_cast<std::byte>(value | 0x80));
+    value >>= 7;
+  }
+  destination.emplace_back(static_cast<std::byte>(value));
+}
+
+void put_zigzag(std::vector<std::byte> &destination, int64_t value) {
+  /// Append a signed integer as a varint, interleaving negative and positive values so small magnitudes stay short
+  put_varint(destination, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+}
+
+void put_bytes(std::vector<std::byte> &destination, std::byte const *source, size_t size) {
+  /// Append raw bytes
+  destination.insert(destination.end(), source, source + size);
+}
+
+void put_text(std::vector<std::byte> &destination, std::string_view text) {
+  /// Append text preceded by its length
+  put_varint(destination, text.size());
+  put_bytes(destination, reinterpret_cast<std::byte const*>(text.data()), text.size());
+}
+
+} // anonymous namespace
+
+site::site(char const *this_file, uint32_t this_line, levels this_level, char const *this_format)
+  : id{next_site_id.fetch_add(1, std::memory_order_relaxed)},
+    file{this_file},
+    line{this_line},
+    level{this_level},
+    format{this_format} {
+  /// Take the next site id; constructed once per log statement, on its first use
+}
+
+}
+
+binary_log::binary_log(std::string const &filename, size_t staging_bytes)
+  : stream(filename, std::ios_base::binary | std::ios_base::trunc),
+    staging(staging_bytes) {
+  /// Open the file and write its header: magic, version, and the wall clock time the log started in nanoseconds since the Unix epoch
+  if(!stream.good()) {
+    std::cout << "LogStorm: WARNING: Couldn't open binary logfile " << filename << std::endl;
+    return;
+  }
+  output.reserve(staging_bytes);
+  uint64_t const start_unix_ns{static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count())};
+  stream.write(binary::magic.data(), binary::magic.size());
+  stream.put(static_cast<char>(binary::version));
+  stream.write(reinterpret_cast<char const*>(&start_unix_ns), sizeof(start_unix_ns));
+}
+
+binary_log::~binary_log() {
+  /// Write out anything staged
+  flush();
+}
+
+void binary_log::flush() {
+  /// Compact staged records into the file
+  #ifndef LOGSTORM_SINGLE_THREADED
+    std::scoped_lock lock{staging_mutex};
+  #endif // LOGSTORM_SINGLE_THREADED
+  flush_locked();
+}
+
+bool binary_log::good() const {
+  /// Whether the file is open and writable
+  return stream.good();
+}
+
+levels binary_log::get_level() const {
+  /// Return the least severe level recorded
+  return level;
+}
+
+void binary_log::set_level(levels const new_level) {
+  /// Set the least severe level recorded
+  level = new_level;
+}
+
+binary_log::statistics binary_log::get_statistics() {
+  /// Return counters, including bytes still staged
+  #ifndef LOGSTORM_SINGLE_THREADED
+    std::scoped_lock lock{staging_mutex};
+  #endif // LOGSTORM_SINGLE_THREADED
+  return stats;
+}
+
+std::byte *binary_log::reserve(size_t const bytes) {
+  /// Make room for a record in the staging buffer, flushing it first if full
+  if(used + bytes > staging.size()) {
+    flush_locked();
+    if(bytes > staging.size()) staging.resize(bytes);                           // a record larger than the whole buffer
+  }
+  std::byte *destination{staging.data() + used};
+  used += bytes;
+  stats.raw_bytes += bytes;
+  return destination;
+}
+
+void binary_log::define(binary::site const &site, std::span<binary::arg_types const> const types) {
+  /// Note a site's argument types, and stage a marker so its definition is written ahead of its first record
+  if(site.id >= sites.size()) {
+    sites.resize(site.id + 1);
+    site_args.resize(site.id + 1);
+  }
+  sites[site.id] = &site;
+  site_args[site.id].assign(types.begin(), types.end());
+  std::byte *destination{reserve(sizeof(binary::definition_tag) + sizeof(site.id))};
+  destination = binary::put_raw(destination, binary::definition_tag);
+  binary::put_raw(destination, site.id);
+  ++stats.sites;
+}
+
+void binary_log::flush_locked() {
+  /// Re-encode staged records compactly and write them out: varint ids and time deltas, zigzag varint integers, raw floats, length-prefixed text
+  if(used == 0) return;
+  output.clear();
+  std::byte const *source{staging.data()};
+  std::byte const *const end{staging.data() + used};
+  while(source != end) {
+    auto const id{binary::get_raw<uint32_t>(source)};
+    if(id == binary::definition_tag) {
+      auto const defined_id{binary::get_raw<uint32_t>(source)};
+      auto const &site{*sites[defined_id]};
+      auto const &types{site_args[defined_id]};
+      binary::put_varint(output, binary::definition_tag);
+      binary::put_varint(output, defined_id);
+      output.emplace_back(static_cast<std::byte>(site.level));
+      binary::put_varint(output, site.line);
+      binary::put_text(output, site.file);
+      binary::put_text(output, site.format);
+      output.emplace_back(static_cast<std::byte>(types.size()));
+      for(auto const type : types) output.emplace_back(static_cast<std::byte>(type));
+      continue;
+    }
+    auto const timestamp{binary::get_raw<uint64_t>(source)};
+    binary::put_varint(output, id);
+    binary::put_varint(output, timestamp - previous_ns);
+    previous_ns = timestamp;
+    for(auto const type : site_args[id]) {
+      switch(type) {
+      case binary::arg_types::i8:        binary::put_zigzag(output, binary::get_raw<int8_t>(source));   break;
+      case binary::arg_types::u8:        binary::put_varint(output, binary::get_raw<uint8_t>(source));  break;
+      case binary::arg_types::i16:       binary::put_zigzag(output, binary::get_raw<int16_t>(source));  break;
+      case binary::arg_types::u16:       binary::put_varint(output, binary::get_raw<uint16_t>(source)); break;
+      case binary::arg_types::i32:       binary::put_zigzag(output, binary::get_raw<int32_t>(source));  break;
+      case binary::arg_types::u32:       binary::put_varint(output, binary::get_raw<uint32_t>(source)); break;
+      case binary::arg_types::i64:       binary::put_zigzag(output, binary::get_raw<int64_t>(source));  break;
+      case binary::arg_types::u64:       binary::put_varint(output, binary::get_raw<uint64_t>(source)); break;
+      case binary::arg_types::f32:       binary::put_bytes(output, source, sizeof(float));  source += sizeof(float);  break;
+      case binary::arg_types::f64:       binary::put_bytes(output, source, sizeof(double)); source += sizeof(double); break;
+      case binary::arg_types::boolean:
+      case binary::arg_types::character: binary::put_bytes(output, source, 1); ++source; break;
+      case binary::arg_types::string:
+        {
+          auto const length{binary::get_raw<uint32_t>(source)};
+          binary::put_varint(output, length);
+          binary::put_bytes(output, source, length);
+          source += length;
+        }
+        break;
+      }
+    }
+  }
+  used = 0;
+  if(stream.good()) {
+    stream.write(reinterpret_cast<char const*>(output.data()), static_cast<std::streamsize>(output.size()));
+    stream.flush();
+  }
+  stats.written_bytes += output.size();
+  ++stats.flushes;
+}
+
+}
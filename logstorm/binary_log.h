@@ -0,0 +1,203 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#ifndef LOGSTORM_SINGLE_THREADED
+  #include <mutex>
+#endif // LOGSTORM_SINGLE_THREADED
+#include "level.h"
+
+/// Record a line in a binary log, formatting it only when the log is decoded:
+///   LOGSTORM_BINARY(trace_log, debug, "frame {} took {}us", frame, microseconds);
+/// The format must be a string literal, with {} for each argument.
+#define LOGSTORM_BINARY(binary_log, level, format, ...) \
+  if(!(logstorm::compiled_in(logstorm::levels::level) && (binary_log).is_enabled(logstorm::levels::level))) {} else \
+    (binary_log).write([]() -> logstorm::binary::site const& { \
+      static logstorm::binary::site const site{__FILE__, __LINE__, logstorm::levels::level, format}; \
+      return site; \
+    }() __VA_OPT__(,) __VA_ARGS__)
+
+namespace logstorm {
+
+namespace binary {
+
+enum class arg_types : uint8_t {
+  i8,
+  u8,
+  i16,
+  u16,
+  i32,
+  u32,
+  i64,
+  u64,
+  f32,
+  f64,
+  boolean,
+  character,
+  string,
+};
+
+struct site {
+  /// A log statement's static parts, written to a log once rather than with every line
+  uint32_t const id;                                                            // unique in the process, from 1
+  char const *file;
+  uint32_t line;
+  levels level;
+  char const *format;
+
+  site(char const *file, uint32_t line, levels level, char const *format);
+};
+
+std::array<char, 8> constexpr magic{'L', 'O', 'G', 'S', 'T', 'B', 'I', 'N'};
+uint8_t constexpr version{1};
+uint32_t constexpr definition_tag{0};                                           // in place of a site id, introduces a site's definition
+
+template<typename T>
+inline auto stored(T const &value) {
+  /// The form an argument is recorded in: text as a view, enums as their underlying integers
+  if constexpr(std::is_convertible_v<T const&, char const*>) {
+    char const *text{value};
+    return text ? std::string_view{text} : std::string_view{};
+  } else if constexpr(std::is_convertible_v<T const&, std::string_view>) {
+    return std::string_view{value};
+  } else if constexpr(std::is_enum_v<T>) {
+    return static_cast<std::underlying_type_t<T>>(value);
+  } else if constexpr(std::is_same_v<T, long double>) {
+    return static_cast<double>(value);
+  } else {
+    static_assert(std::is_arithmetic_v<T>, "LogStorm: binary logs record numbers, characters and text");
+    return value;
+  }
+}
+
+template<typename T>
+consteval arg_types type_of() {
+  /// The type code of a stored argument
+  if constexpr(std::is_same_v<T, std::string_view>) return arg_types::string;
+  else if constexpr(std::is_same_v<T, bool>) return arg_types::boolean;
+  else if constexpr(std::is_same_v<T, char>) return arg_types::character;
+  else if constexpr(std::is_same_v<T, float>) return arg_types::f32;
+  else if constexpr(std::is_same_v<T, double>) return arg_types::f64;
+  else if constexpr(std::is_signed_v<T> && sizeof(T) == 1) return arg_types::i8;
+  else if constexpr(std::is_signed_v<T> && sizeof(T) == 2) return arg_types::i16;
+  else if constexpr(std::is_signed_v<T> && sizeof(T) == 4) return arg_types::i32;
+  else if constexpr(std::is_signed_v<T> && sizeof(T) == 8) return arg_types::i64;
+  else if constexpr(sizeof(T) == 1) return arg_types::u8;
+  else if constexpr(sizeof(T) == 2) return arg_types::u16;
+  else if constexpr(sizeof(T) == 4) return arg_types::u32;
+  else return arg_types::u64;
+}
+
+template<typename T>
+inline size_t raw_size(T const &value) {
+  /// Bytes a stored argument takes in the staging buffer
+  if constexpr(std::is_same_v<T, std::string_view>) {
+    return sizeof(uint32_t) + value.size();
+  } else {
+    return sizeof(T);
+  }
+}
+
+template<typename T>
+inline std::byte *put_raw(std::byte *destination, T const &value) {
+  /// Copy a stored argument into the staging buffer, returning the end of what was written
+  if constexpr(std::is_same_v<T, std::string_view>) {
+    destination = put_raw(destination, static_cast<uint32_t>(value.size()));
+    std::memcpy(destination, value.data(), value.size());
+    return destination + value.size();
+  } else {
+    std::memcpy(destination, &value, sizeof(T));
+    return destination + sizeof(T);
+  }
+}
+
+}
+
+class binary_log {
+  /// Records log lines as a site id, a timestamp and the arguments' raw bytes, leaving formatting to an offline decoder.
+  ///
+  /// Logging copies the record into a staging buffer and nothing else.
+  /// When the buffer fills, or on flush(), records are compacted into the
+  /// file, with variable-length integers and time deltas, along with each
+  /// site's file, line and format the first time it appears.  The file is
+  /// self-describing, so tools/logstorm_decode can turn it back into text.
+public:
+  struct statistics {
+    uint64_t records{0};
+    uint64_t sites{0};                                                          // defined in this file
+    uint64_t flushes{0};
+    uint64_t raw_bytes{0};                                                      // staged
+    uint64_t written_bytes{0};                                                  // to the file, after compaction
+  };
+
+private:
+  std::ofstream stream;
+  std::vector<std::byte> staging;                                               // raw records since the last flush
+  size_t used{0};
+  std::vector<std::byte> output;                                                // compacted records, reused between flushes
+  std::vector<binary::site const*> sites;                                       // by id, for sites defined in this file
+  std::vector<std::vector<binary::arg_types>> site_args;                        // by id
+  std::chrono::steady_clock::time_point const start{std::chrono::steady_clock::now()};
+  uint64_t previous_ns{0};                                                      // timestamp of the last compacted record
+  levels level{levels::trace};
+  statistics stats;
+  #ifndef LOGSTORM_SINGLE_THREADED
+    std::mutex staging_mutex;
+  #endif // LOGSTORM_SINGLE_THREADED
+
+public:
+  explicit binary_log(std::string const &filename, size_t staging_bytes = 1u << 20);
+  ~binary_log();
+
+  template<typename... Args> void write(binary::site const &site, Args const &...args);
+  void flush();
+
+  bool good() const;
+  inline bool is_enabled(levels line_level) const;
+  levels get_level() const;
+  void set_level(levels new_level);
+  statistics get_statistics();
+
+private:
+  template<typename... Args> void write_stored(binary::site const &site, std::span<binary::arg_types const> types, Args const &...args);
+  std::byte *reserve(size_t bytes);
+  void define(binary::site const &site, std::span<binary::arg_types const> types);
+  void flush_locked();
+};
+
+template<typename... Args>
+void binary_log::write(binary::site const &site, Args const &...args) {
+  /// Record a line's site and arguments, to be formatted when the log is decoded
+  static std::array<binary::arg_types, sizeof...(Args)> constexpr types{binary::type_of<decltype(binary::stored(args))>()...};
+  write_stored(site, types, binary::stored(args)...);
+}
+
+template<typename... Args>
+void binary_log::write_stored(binary::site const &site, std::span<binary::arg_types const> types, Args const &...args) {
+  /// Copy a record into the staging buffer: site id, nanoseconds since the log started, then each argument's bytes
+  #ifndef LOGSTORM_SINGLE_THREADED
+    std::scoped_lock lock{staging_mutex};
+  #endif // LOGSTORM_SINGLE_THREADED
+  if(site.id >= sites.size() || !sites[site.id]) define(site, types);
+  uint64_t const timestamp{static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count())};
+  std::byte *destination{reserve(sizeof(site.id) + sizeof(timestamp) + (binary::raw_size(args) + ... + size_t{0}))};
+  destination = binary::put_raw(destination, site.id);
+  destination = binary::put_raw(destination, timestamp);
+  ((destination = binary::put_raw(destination, args)), ...);
+  ++stats.records;
+}
+
+inline bool binary_log::is_enabled(levels const line_level) const {
+  /// Whether a line at this level would be recorded
+  return compiled_in(line_level) && line_level >= level;
+}
+
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#ifndef LOGSTORM_MIN_LEVEL
+  #define LOGSTORM_MIN_LEVEL trace                                              // name of the least severe level compiled in, e.g. -DLOGSTORM_MIN_LEVEL=info
+#endif // LOGSTORM_MIN_LEVEL
+
+/// Log a line at a given severity, streaming into the result as with logger << ...:
+///   LOGSTORM_DEBUG(logger) << "Features: " << expensive_description();
+/// The line's arguments are only evaluated if the level is enabled, and
+/// levels below LOGSTORM_MIN_LEVEL compile to nothing.  Lines logged
+/// without a level count as info.
+#define LOGSTORM_AT(logger, level) \
+  if(!(logstorm::compiled_in(logstorm::levels::level) && (logger).is_enabled(logstorm::levels::level))) {} else (logger).at(logstorm::levels::level)
+#define LOGSTORM_TRACE(logger) LOGSTORM_AT(logger, trace)
+#define LOGSTORM_DEBUG(logger) LOGSTORM_AT(logger, debug)
+#define LOGSTORM_INFO(logger) LOGSTORM_AT(logger, info)
+#define LOGSTORM_WARNING(logger) LOGSTORM_AT(logger, warning)
+#define LOGSTORM_ERROR(logger) LOGSTORM_AT(logger, error)
+
+namespace logstorm {
+
+enum class levels : unsigned char {
+  trace,
+  debug,
+  info,
+  warning,
+  error,
+  none,                                                                         // as a minimum, disables everything
+};
+
+levels constexpr min_level{levels::LOGSTORM_MIN_LEVEL};
+
+inline constexpr bool compiled_in(levels level) {
+  /// Whether lines at this level are built in at all
+  return level >= min_level;
+}
+
+}
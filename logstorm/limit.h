@@ -0,0 +1,172 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "level.h"
+
+/// Log a line at a given severity, but only some of the times the line is reached:
+///   LOGSTORM_EVERY_N(logger, debug, 100) << "Frame " << frame;                    // the first of every 100
+///   LOGSTORM_RATE_LIMITED(logger, info, 1.0f, 5.0f) << "Waiting for " << name;    // up to 1 a second, in bursts of up to 5
+///   LOGSTORM_DEDUPLICATED(logger, warning) << "Queue full: " << depth;            // not when identical to the last line from here
+/// Each call site keeps its own state in a static, constant-initialised
+/// object, so sampling and rate limiting check a counter before any
+/// arguments are evaluated.  Deduplication compares the formatted line with
+/// a copy of the last one, so it always evaluates the arguments.  The next
+/// line let through notes how many were held back, or for duplicates, a
+/// separate line does.  Sampling and rate limiting update their state
+/// without read-modify-write instructions, and deduplication lets a line
+/// through rather than wait for another thread comparing its own, so
+/// threads racing on one call site may let through an occasional extra line.
+#define LOGSTORM_LIMITED(logger, level, limit_type, ...) \
+  if(!(logstorm::compiled_in(logstorm::levels::level) && (logger).is_enabled(logstorm::levels::level))) {} else \
+  if(auto &logstorm_limit{[]() -> logstorm::limits::limit_type& { \
+      static logstorm::limits::limit_type site{__VA_ARGS__}; \
+      return site; \
+    }()}; !logstorm_limit.admit()) {} else \
+    (logger).at(logstorm::levels::level).note_suppressed(logstorm_limit.take_suppressed())
+#define LOGSTORM_EVERY_N(logger, level, n) LOGSTORM_LIMITED(logger, level, sampler, n)
+#define LOGSTORM_RATE_LIMITED(logger, level, per_second, burst) LOGSTORM_LIMITED(logger, level, token_bucket, per_second, burst)
+#define LOGSTORM_DEDUPLICATED(logger, level) \
+  if(!(logstorm::compiled_in(logstorm::levels::level) && (logger).is_enabled(logstorm::levels::level))) {} else \
+    (logger).at(logstorm::levels::level).deduplicate([]() -> logstorm::limits::duplicates& { \
+      static logstorm::limits::duplicates site{__FILE__, __LINE__}; \
+      return site; \
+    }())
+
+namespace logstorm::limits {
+
+class sampler {
+  /// Lets through the first of every n lines
+  uint32_t const every;
+  std::atomic<uint32_t> count{0};                                               // position within the current group of every lines
+  std::atomic<uint64_t> suppressed{0};
+
+public:
+  constexpr explicit sampler(uint32_t every);
+
+  inline bool admit();
+  inline uint64_t take_suppressed();
+};
+
+class token_bucket {
+  /// Lets through up to burst lines at once, with the allowance refilling at a steady rate
+  using clock = std::chrono::steady_clock;
+
+  float const per_second;
+  float const burst;
+  std::atomic<float> tokens;
+  std::atomic<clock::rep> last_refill{0};
+  std::atomic<uint64_t> suppressed{0};
+
+public:
+  constexpr token_bucket(float per_second, float burst);
+
+  inline bool admit();
+  inline uint64_t take_suppressed();
+};
+
+class duplicates {
+  /// Holds back lines identical to the last one let through from the same call site
+public:
+  char const *const file;
+  unsigned int const line;
+
+private:
+  std::string last;                                                             // the last line let through, reusing its allocation
+  bool seen{false};                                                             // whether there is a last line, which may be empty
+  std::atomic_flag comparing;                                                   // held while reading or replacing the last line
+  std::atomic<uint64_t> suppressed{0};
+
+public:
+  constexpr duplicates(char const *file, unsigned int line);
+
+  inline bool admit(std::string_view text);
+  inline uint64_t take_suppressed();
+};
+
+constexpr sampler::sampler(uint32_t const this_every)
+  : every{std::max<uint32_t>(this_every, 1)} {
+  /// Constant initialiser, so a call site's static needs no guard
+}
+
+inline bool sampler::admit() {
+  /// Count a line, and return whether it's the first of its group
+  uint32_t const seen{count.load(std::memory_order_relaxed)};
+  count.store(seen + 1 == every ? 0 : seen + 1, std::memory_order_relaxed);
+  if(seen == 0) return true;
+  suppressed.store(suppressed.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  return false;
+}
+
+inline uint64_t sampler::take_suppressed() {
+  /// Return how many lines were held back since the last one let through
+  uint64_t const result{suppressed.load(std::memory_order_relaxed)};
+  if(result != 0) suppressed.store(0, std::memory_order_relaxed);
+  return result;
+}
+
+constexpr token_bucket::token_bucket(float const this_per_second, float const this_burst)
+  : per_second{this_per_second},
+    burst{std::max(this_burst, 1.0f)},
+    tokens{std::max(this_burst, 1.0f)} {
+  /// Constant initialiser, so a call site's static needs no guard; the bucket starts full
+}
+
+inline bool token_bucket::admit() {
+  /// Spend a token if there is one, only reading the clock to refill an empty bucket
+  float available{tokens.load(std::memory_order_relaxed)};
+  if(available < 1.0f) {
+    clock::rep const now{clock::now().time_since_epoch().count()};
+    clock::rep const previous{last_refill.load(std::memory_order_relaxed)};
+    float const elapsed{previous == 0 ? 0.0f : std::chrono::duration<float>{clock::duration{now - previous}}.count()}; // the first refill only starts the clock
+    last_refill.store(now, std::memory_order_relaxed);
+    available = std::min(burst, available + elapsed * per_second);
+    if(available < 1.0f) {
+      tokens.store(available, std::memory_order_relaxed);
+      suppressed.store(suppressed.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      return false;
+    }
+  }
+  tokens.store(available - 1.0f, std::memory_order_relaxed);
+  return true;
+}
+
+inline uint64_t token_bucket::take_suppressed() {
+  /// Return how many lines were held back since the last one let through
+  uint64_t const result{suppressed.load(std::memory_order_relaxed)};
+  if(result != 0) suppressed.store(0, std::memory_order_relaxed);
+  return result;
+}
+
+constexpr duplicates::duplicates(char const *this_file, unsigned int const this_line)
+  : file{this_file},
+    line{this_line} {
+  /// Constant initialiser, so a call site's static needs no dynamic initialisation
+}
+
+inline bool duplicates::admit(std::string_view const text) {
+  /// Return whether a formatted line differs from the last one let through, counting it if not
+  if(comparing.test_and_set(std::memory_order_acquire)) return true;            // another thread is comparing its line, so let this one through rather than wait
+  bool const repeat{seen && text == last};
+  if(repeat) {
+    suppressed.store(suppressed.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  } else {
+    last = text;
+    seen = true;
+  }
+  comparing.clear(std::memory_order_release);
+  return !repeat;
+}
+
+inline uint64_t duplicates::take_suppressed() {
+  /// Return how many duplicates were held back since the last line let through
+  uint64_t const result{suppressed.load(std::memory_order_relaxed)};
+  if(result != 0) suppressed.store(0, std::memory_order_relaxed);
+  return result;
+}
+
+}
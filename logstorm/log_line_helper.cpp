@@ -1,16 +1,21 @@
 #include "log_line_helper.h"
 #include <iostream>
-#include "sink/base.h"
+#include "limit.h"
+#include "manager.h"
 
 namespace logstorm {
 
-log_line_helper::log_line_helper(std::vector<std::shared_ptr<sink::base>> &sinks_to_use)
-  : sinks(sinks_to_use) {
+log_line_helper::log_line_helper(manager &this_owner, levels this_level)
+  : owner(this_owner),
+    level(this_level),
+    enabled(this_owner.is_enabled(this_level)) {
   /// Default constructor
 }
 
 log_line_helper::log_line_helper(log_line_helper const &other)
-  : sinks(other.sinks) {
+  : owner(other.owner),
+    level(other.level),
+    enabled(other.enabled) {
   /// Copy constructor
   std::cout << "LogStorm: WARNING: Return value optimisation appears to have failed, copy constructor called - log entries may be duplicated." << std::endl;
 }
@@ -18,9 +23,46 @@ log_line_helper::log_line_helper(log_line_helper const &other)
 log_line_helper::~log_line_helper() {
   /// Default destructor
   // output all lines in one go when we destruct
-  for(auto const &thissink : sinks) {
-    thissink->log(aggregator.str());
+  if(!enabled) return;
+  if(duplicates) {
+    if(!duplicates->admit(view())) return;
+    if(uint64_t const repeats{duplicates->take_suppressed()}; repeats != 0) {
+      log_line_helper{owner, level} << "LogStorm: suppressed " << repeats << " duplicate lines from " << duplicates->file << ':' << duplicates->line;
+    }
   }
+  if(suppressed != 0) *this << " (suppressed " << suppressed << " similar lines)";
+  owner.log(view(), level);
+}
+
+log_line_helper &log_line_helper::note_suppressed(uint64_t const count) {
+  /// Note how many lines from the same call site were held back before this one, to be mentioned at the end of the line
+  suppressed = count;
+  return *this;
+}
+
+log_line_helper &log_line_helper::deduplicate(limits::duplicates &site) {
+  /// Drop this line if it's identical to the last one logged from the same call site
+  duplicates = &site;
+  return *this;
+}
+
+log_line_helper::line_streambuf::line_streambuf(log_line_helper &this_target)
+  : target(this_target) {
+  /// Default constructor
+}
+
+log_line_helper::line_streambuf::int_type log_line_helper::line_streambuf::overflow(int_type character) {
+  /// Append a single character, as there is no put area
+  if(traits_type::eq_int_type(character, traits_type::eof())) return traits_type::not_eof(character);
+  char const output{traits_type::to_char_type(character)};
+  target.append({&output, 1});
+  return character;
+}
+
+std::streamsize log_line_helper::line_streambuf::xsputn(char const *text, std::streamsize count) {
+  /// Append a run of characters
+  target.append({text, static_cast<size_t>(count)});
+  return count;
 }
 
 }
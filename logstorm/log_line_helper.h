@@ -1,34 +1,133 @@
 #pragma once
 
-#include <memory>
-#include <vector>
-#include <sstream>
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include "level.h"
 
 namespace logstorm {
 
-namespace sink {
-class base;
+class manager;
+
+namespace limits {
+class duplicates;
 }
 
 class log_line_helper {
+  /// Builds a line in place, without allocating unless it outgrows the inline buffer
+public:
+  static size_t constexpr inline_capacity{256};
+
 private:
-  std::vector<std::shared_ptr<sink::base>> &sinks;
-  std::stringstream aggregator;
+  class line_streambuf final : public std::streambuf {
+    /// Stream buffer appending to a line, for types that only have a stream operator
+    log_line_helper &target;
+
+  public:
+    explicit line_streambuf(log_line_helper &target);
+
+  protected:
+    virtual int_type overflow(int_type character) override final;
+    virtual std::streamsize xsputn(char const *text, std::streamsize count) override final;
+  };
+
+  manager &owner;                                                               // which sends the finished line to its sinks, directly or through its queue
+  levels const level;
+  bool const enabled;                                                           // whether the manager logs this level, so formatting can be skipped if not
+  std::array<char, inline_capacity> buffer;                                     // deliberately uninitialised, only the first length characters are used
+  size_t length{0};
+  std::string spill;                                                            // the whole line once it outgrows the buffer
+  uint64_t suppressed{0};                                                       // lines held back at this call site since the last, noted at the end
+  limits::duplicates *duplicates{nullptr};                                      // when set, the line is dropped if it repeats the call site's last
+
+  template<typename T> static bool constexpr is_character{                      // a stream prints these as characters, or rejects them
+    std::is_same_v<T, signed char> ||                                           // including int8_t
+    std::is_same_v<T, unsigned char> ||                                         // and uint8_t
+    std::is_same_v<T, wchar_t> ||
+    std::is_same_v<T, char8_t> ||
+    std::is_same_v<T, char16_t> ||
+    std::is_same_v<T, char32_t>
+  };
 
 public:
-  explicit log_line_helper(std::vector<std::shared_ptr<sink::base>> &sinks_to_use);
+  explicit log_line_helper(manager &owner, levels level = levels::info);
   ~log_line_helper();
 
   log_line_helper(log_line_helper const &other);
 
-  template<typename T> inline constexpr log_line_helper &operator<<(T const &rhs);
+  template<typename T> inline log_line_helper &operator<<(T const &rhs);
+  log_line_helper &note_suppressed(uint64_t count);
+  log_line_helper &deduplicate(limits::duplicates &site);
+
+  inline std::string_view view() const;
+
+private:
+  inline void append(std::string_view text);
+  template<typename T> void append_streamed(T const &rhs);
 };
 
 template<typename T>
-inline constexpr log_line_helper &log_line_helper::operator<<(T const &rhs) {
-  /// Input operator forwarding to all sinks in string format
-  aggregator << rhs;
+inline log_line_helper &log_line_helper::operator<<(T const &rhs) {
+  /// Append a value to the line: text as it is, numbers through to_chars, anything else through its stream operator
+  if(!enabled) return *this;
+  if constexpr(std::is_same_v<T, char>) {
+    append({&rhs, 1});
+  } else if constexpr(is_character<T>) {
+    append_streamed(rhs);                                                       // not numbers, so exactly as a stream would have it
+  } else if constexpr(std::is_convertible_v<T const&, char const*>) {
+    char const *text{rhs};
+    if(text) append(text);                                                      // a stream would print nothing for a null pointer too
+  } else if constexpr(std::is_convertible_v<T const&, std::string_view>) {
+    append(std::string_view{rhs});
+  } else if constexpr(std::is_same_v<T, bool>) {
+    append(rhs ? "1" : "0");                                                    // as a stream prints it by default
+  } else if constexpr(std::is_integral_v<T>) {
+    std::array<char, 24> digits;
+    auto const result{std::to_chars(digits.data(), digits.data() + digits.size(), rhs)};
+    append({digits.data(), result.ptr});
+  } else if constexpr(std::is_floating_point_v<T>) {
+    std::array<char, 32> digits;
+    auto const result{std::to_chars(digits.data(), digits.data() + digits.size(), rhs, std::chars_format::general, 6)}; // matches a stream's default precision
+    append({digits.data(), result.ptr});
+  } else {
+    append_streamed(rhs);
+  }
   return *this;
 }
 
+inline std::string_view log_line_helper::view() const {
+  /// Return the line so far
+  if(!spill.empty()) return spill;
+  return {buffer.data(), length};
+}
+
+inline void log_line_helper::append(std::string_view const text) {
+  /// Add text to the line, moving it to the heap if it outgrows the inline buffer
+  if(spill.empty()) {
+    if(text.size() <= inline_capacity - length) {
+      std::memcpy(buffer.data() + length, text.data(), text.size());
+      length += text.size();
+      return;
+    }
+    spill.reserve(std::max(inline_capacity * 2, length + text.size()));
+    spill.assign(buffer.data(), length);
+  }
+  spill += text;
+}
+
+template<typename T>
+void log_line_helper::append_streamed(T const &rhs) {
+  /// Append a value using its stream operator, writing straight into the line
+  line_streambuf destination{*this};
+  std::ostream stream{&destination};
+  stream << rhs;
+}
+
 }
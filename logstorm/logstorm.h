@@ -1,7 +1,9 @@
 #pragma once
 
 /// Defines:
-///   LOGSTORM_SINGLE_THREADED - Don't use synchronisation to protect sinks.
+///   LOGSTORM_SINGLE_THREADED - Don't use synchronisation to protect sinks,
+///     and leave async mode's queue to be flushed by the caller rather than
+///     by a consumer thread.
 ///   LOGSTORM_COMPOSE_FRAGMENTS_SEPARATELY - Don't append fragments with
 ///     log_fragment() to the current line, but store them until they receive
 ///     a std::endl() and then send the line as a whole.
@@ -14,9 +16,13 @@
 #include "sink/console_err.h"
 #include "sink/fstream.h"
 #include "sink/file.h"
-#ifdef LOGSTORM_HAS_BOOST
-  #include "sink/circular_buffer.h"
-#endif // LOGSTORM_HAS_BOOST
+#include "sink/buffered_file.h"
+#include "sink/circular_buffer.h"
+#include "sink/queued.h"
+
+#ifndef __EMSCRIPTEN__
+  #include "sink/mapped_file.h"
+#endif // __EMSCRIPTEN__
 
 #ifdef __EMSCRIPTEN__
   #include "sink/emscripten_out.h"
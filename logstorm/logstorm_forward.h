@@ -10,7 +10,10 @@ class console;
 class console_err;
 class fstream;
 class file;
+class buffered_file;
 class circular_buffer;
+class queued;
+class mapped_file;
 }
 
 class manager;
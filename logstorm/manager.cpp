@@ -1,12 +1,19 @@
 #include "manager.h"
+#include "async_dispatcher.h"
 #include "sink/base.h"
 
 namespace logstorm {
 
+manager::manager() = default;
+manager::manager(manager&&) = default;
+manager &manager::operator=(manager&&) = default;
+manager::~manager() = default;                                                  // stopping async mode writes out anything still queued
+
 size_t manager::add_sink(std::shared_ptr<sink::base> newsink) {
   /// Add a logging sink, and return its id for later reference
   sinks.emplace_back(newsink);
   sinks.shrink_to_fit();                                                        // we assume that adding sinks is an infrequent operation and minimising over-allocated memory is more important than avoiding reallocations here
+  if(async) async->set_sinks(sinks);
   return sinks.size() - 1;
 }
 
@@ -22,18 +29,84 @@ void manager::remove_sink(size_t sink_id) {
   }
   sinks.erase(sinks.begin() + static_cast<ptrdiff_t>(sink_id));
   sinks.shrink_to_fit();
+  if(async) async->set_sinks(sinks);
 }
 
 void manager::clear_sinks() {
   /// Remove all logging sinks
   sinks.clear();
+  if(async) async->set_sinks(sinks);
+}
+
+void manager::log(std::string_view log_entry, levels const line_level) {
+  /// Log this line if its level is enabled, and write it out at once if it's severe enough
+  if(!is_enabled(line_level)) return;
+  if(async) {
+    async->push(log_entry);
+  } else {
+    for(auto const &thissink : sinks) {
+      thissink->log(log_entry);
+    }
+  }
+  if(line_level < flush_level) return;
+  if(async) {
+    async->request_flush();                                                     // the consumer writes it out, so the caller doesn't wait for the queue to empty
+  } else {
+    for(auto const &thissink : sinks) {
+      thissink->request_flush();                                                // a queued sink wakes its worker rather than waiting for it
+    }
+  }
+}
+
+levels manager::get_level() const {
+  /// Return the least severe level logged
+  return level;
+}
+
+void manager::set_level(levels const new_level) {
+  /// Set the least severe level logged; levels below LOGSTORM_MIN_LEVEL stay disabled regardless
+  level = new_level;
+}
+
+levels manager::get_flush_level() const {
+  /// Return the least severe level that's written out as soon as it's logged
+  return flush_level;
 }
 
-void manager::log(std::string const &log_entry) {
-  /// Log this line
+void manager::set_flush_level(levels const new_level) {
+  /// Set the least severe level that's written out as soon as it's logged; levels::none never forces a flush
+  flush_level = new_level;
+}
+
+void manager::start_async(async_settings const &config) {
+  /// Queue lines and write them to the sinks in the background from now on, writing out anything queued under previous settings first
+  async.reset();
+  async = std::make_unique<async_dispatcher>(sinks, config);
+}
+
+void manager::stop_async() {
+  /// Write out anything queued, then go back to writing each line to the sinks as it's logged
+  async.reset();
+}
+
+bool manager::is_async() const {
+  /// Whether lines are being queued rather than written directly
+  return static_cast<bool>(async);
+}
+
+size_t manager::flush() {
+  /// Write out queued lines, then anything the sinks have buffered; call regularly when there's no consumer thread
+  size_t const count{async ? async->flush() : 0};
   for(auto const &thissink : sinks) {
-    thissink->log(log_entry);
+    thissink->flush();
   }
+  return count;
+}
+
+async_statistics manager::get_async_statistics() const {
+  /// Return queue counters, or zeroes when not in async mode
+  if(!async) return {};
+  return async->get_statistics();
 }
 
 }
@@ -2,6 +2,10 @@
 
 #include <memory>
 #include <type_traits>
+#include <vector>
+#include "async_settings.h"
+#include "level.h"
+#include "limit.h"
 #include "log_line_helper.h"
 
 #ifdef __clang__
@@ -12,6 +16,8 @@
 
 namespace logstorm {
 
+class async_dispatcher;
+
 namespace sink {
 class base;
 }
@@ -29,10 +35,31 @@ class manager {
   ///   logger("hello world");
   ///   logger("hello ", "world ", 1234);
   ///   logger << "Hello world! " << 1234;   // note: newline is added automagically
+  ///   // at a severity, evaluating arguments only if that severity is enabled:
+  ///   LOGSTORM_DEBUG(logger) << "Details: " << describe();
+  ///   // the level applies to every line; the ways above log at info, formatting nothing if that's disabled:
+  ///   logger.set_level(logstorm::levels::warning);
+  ///   // per call site sampling, rate limiting and duplicate suppression, see limit.h:
+  ///   LOGSTORM_RATE_LIMITED(logger, info, 1.0f, 5.0f) << "Still waiting";
+  ///   // lines at or above the flush level are written out immediately, even by buffering sinks;
+  ///   // in async mode, the consumer thread does this as soon as it reaches them, without the caller waiting:
+  ///   logger.set_flush_level(logstorm::levels::warning);
+  ///   // optionally, write to sinks from a background thread instead:
+  ///   logger.start_async({.overflow{logstorm::async_overflow_policies::drop}});
+  ///   // or give just one slow sink its own queue and worker:
+  ///   logger.add_sink(std::make_shared<logstorm::sink::queued>(std::make_shared<logstorm::sink::file>("slow.log")));
 private:
   std::vector<std::shared_ptr<sink::base>> sinks;                               // the output sinks we're logging to
+  std::unique_ptr<async_dispatcher> async;                                      // when set, lines are queued for the sinks rather than written directly
+  levels level{levels::trace};                                                  // least severe level logged, at run time
+  levels flush_level{levels::error};                                            // lines at least this severe are written out at once, by flushing queues and sinks
 
 public:
+  manager();
+  manager(manager&&);
+  manager &operator=(manager&&);
+  ~manager();                                                                   // out of line, where async_dispatcher is complete
+
   template<typename T, class... Args, typename = std::enable_if_t<std::is_base_of<sink::base, T>::value>>
   size_t add_sink(Args&&... args);
   size_t add_sink(std::shared_ptr<sink::base> newsink);
@@ -43,11 +70,24 @@ public:
 
   void clear_sinks();
 
-  void log(std::string const &log_entry);
+  void log(std::string_view log_entry, levels line_level = levels::info);
+
+  inline bool is_enabled(levels line_level) const;
+  levels get_level() const;
+  void set_level(levels new_level);
+  levels get_flush_level() const;
+  void set_flush_level(levels new_level);
+
+  void start_async(async_settings const &config = {});
+  void stop_async();
+  bool is_async() const;
+  size_t flush();
+  async_statistics get_async_statistics() const;
 
   template<typename T> inline CONSTEXPR_IF_NO_CLANG void operator()(T entry);
   template<typename... Args> inline CONSTEXPR_IF_NO_CLANG void operator()(Args&&... entries);
   template<typename T> inline CONSTEXPR_IF_NO_CLANG log_line_helper operator<<(T const &rhs);
+  inline log_line_helper at(levels line_level);
 
   template<typename T, class... Args, typename = std::enable_if_t<std::is_base_of<sink::base, T>::value>>
   static logstorm::manager build_with_sink(Args&&... args);
@@ -58,16 +98,21 @@ size_t manager::add_sink(Args&&... args) {
   return add_sink(std::make_shared<T>(args...));
 }
 
+inline bool manager::is_enabled(levels const line_level) const {
+  /// Whether a line at this level would be logged
+  return compiled_in(line_level) && line_level >= level;
+}
+
 template<typename T>
 inline CONSTEXPR_IF_NO_CLANG void manager::operator()(T entry) {
   /// Convenience function to log a single entry
-  log_line_helper helper{sinks};
+  log_line_helper helper{*this};
   helper << entry;
 }
 template<typename... Args>
 inline CONSTEXPR_IF_NO_CLANG void manager::operator()(Args&&... entries) {
   /// Convenience function to log any number of arguments
-  log_line_helper helper{sinks};
+  log_line_helper helper{*this};
   // now this is a hack... this is the hack of hacks.
   using unpack = int[];
   unpack{0, (helper << entries, 0)...};
@@ -76,11 +121,16 @@ inline CONSTEXPR_IF_NO_CLANG void manager::operator()(Args&&... entries) {
 template<typename T>
 inline CONSTEXPR_IF_NO_CLANG log_line_helper manager::operator<<(T const &rhs) {
   /// Produce a log line helper and return it for further streaming
-  log_line_helper helper{sinks};
+  log_line_helper helper{*this};
   helper << rhs;
   return helper;
 }
 
+inline log_line_helper manager::at(levels const line_level) {
+  /// Produce a log line helper for a line at the given level, for further streaming
+  return log_line_helper{*this, line_level};
+}
+
 template<typename T, class... Args, typename>
 logstorm::manager manager::build_with_sink(Args&&... args) {
   /// Build a manager class and initialise it with an initial sink
@@ -0,0 +1,40 @@
+#include "ring.h"
+#include <algorithm>
+#include <bit>
+
+namespace logstorm {
+
+ring::ring(size_t minimum_capacity, size_t record_reserve)
+  : capacity{std::bit_ceil(std::max<size_t>(minimum_capacity, 2))},
+    mask{capacity - 1},
+    records{std::make_unique<record[]>(capacity)} {
+  /// Allocate every record up front, each with room for a line of record_reserve characters
+  for(size_t i{0}; i != capacity; ++i) {
+    records[i].sequence.store(i, std::memory_order_relaxed);
+    records[i].text.reserve(record_reserve);
+  }
+}
+
+size_t ring::get_capacity() const {
+  /// Return the number of records
+  return capacity;
+}
+
+size_t ring::get_pushed() const {
+  /// Return the number of lines ever claimed by producers
+  return tail.load(std::memory_order_relaxed);
+}
+
+size_t ring::get_completed() const {
+  /// Return the number of lines ever read and released by consumers
+  return completed.load(std::memory_order_acquire);
+}
+
+size_t ring::get_depth() const {
+  /// Return the number of lines waiting to be read, approximately while producers or consumers are active
+  size_t const read{head.load(std::memory_order_relaxed)};
+  size_t const written{tail.load(std::memory_order_relaxed)};
+  return written > read ? written - read : 0;
+}
+
+}
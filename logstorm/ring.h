@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace logstorm {
+
+class ring {
+  /// Lock-free bounded queue of log lines, safe for any number of producers and consumers.
+  ///
+  /// Records are allocated once, and each keeps its string's capacity as it
+  /// is reused, so pushing a line no longer than record_reserve is a copy
+  /// into memory that's already there.  Each record's sequence number says
+  /// whose turn it is: a producer claims a position by advancing tail, fills
+  /// the record and publishes it; a consumer claims it by advancing head,
+  /// reads it in place and hands the record back to producers a lap later.
+  /// Producers may stamp each line with the time it was pushed, which the
+  /// consumer receives alongside it.
+public:
+  using clock = std::chrono::steady_clock;
+
+private:
+  struct alignas(64) record {                                                   // one per cache line, so neighbouring producers don't contend
+    std::atomic<size_t> sequence{0};
+    clock::time_point pushed;
+    std::string text;
+  };
+
+  size_t const capacity;                                                        // a power of two
+  size_t const mask;
+  std::unique_ptr<record[]> records;
+  alignas(64) std::atomic<size_t> tail{0};                                      // next position to write
+  alignas(64) std::atomic<size_t> head{0};                                      // next position to read
+  alignas(64) std::atomic<size_t> completed{0};                                 // positions read and handed back
+
+public:
+  ring(size_t minimum_capacity, size_t record_reserve);
+
+  inline bool try_push(std::string_view text, clock::time_point pushed = {});
+  template<typename F> inline bool try_pop(F &&consume);
+
+  size_t get_capacity() const;
+  size_t get_pushed() const;
+  size_t get_completed() const;
+  size_t get_depth() const;
+};
+
+inline bool ring::try_push(std::string_view const text, clock::time_point const pushed) {
+  /// Copy a line into the next free record, or return false if the ring is full
+  size_t position{tail.load(std::memory_order_relaxed)};
+  for(;;) {
+    auto &slot{records[position & mask]};
+    auto const lag{static_cast<intptr_t>(slot.sequence.load(std::memory_order_acquire)) - static_cast<intptr_t>(position)};
+    if(lag == 0) {
+      if(tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+        slot.pushed = pushed;
+        slot.text.assign(text);
+        slot.sequence.store(position + 1, std::memory_order_release);           // publish to consumers
+        return true;
+      }
+    } else if(lag < 0) {
+      return false;                                                             // the record a lap behind hasn't been read yet
+    } else {
+      position = tail.load(std::memory_order_relaxed);                          // another producer took this position
+    }
+  }
+}
+
+template<typename F>
+inline bool ring::try_pop(F &&consume) {
+  /// Pass the oldest line and the time it was pushed to a function in place and release its record, or return false if the ring is empty
+  size_t position{head.load(std::memory_order_relaxed)};
+  for(;;) {
+    auto &slot{records[position & mask]};
+    auto const lag{static_cast<intptr_t>(slot.sequence.load(std::memory_order_acquire)) - static_cast<intptr_t>(position + 1)};
+    if(lag == 0) {
+      if(head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+        consume(std::string_view{slot.text}, slot.pushed);
+        slot.sequence.store(position + capacity, std::memory_order_release);    // hand back to producers for the next lap
+        completed.fetch_add(1, std::memory_order_release);
+        return true;
+      }
+    } else if(lag < 0) {
+      return false;                                                             // not yet published
+    } else {
+      position = head.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+}
@@ -9,4 +9,13 @@ base::base(timestamp::types timestamp_type)
 
 base::~base() = default;
 
+void base::flush() {
+  /// Write out anything buffered; most sinks write each line as it's logged, so have nothing to do
+}
+
+void base::request_flush() {
+  /// Have anything buffered written out, as a line severe enough was logged; sinks that would make the caller wait can do it later instead
+  flush();
+}
+
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include "logstorm/timestamp.h"
 
 namespace logstorm::sink {
@@ -18,8 +19,10 @@ protected:
 public:
   virtual ~base();
 
-  virtual void log(std::string const &log_entry) = 0;
-  virtual void log_fragment(std::string const &log_entry) = 0;
+  virtual void log(std::string_view log_entry) = 0;
+  virtual void log_fragment(std::string_view log_entry) = 0;
+  virtual void flush();
+  virtual void request_flush();
 };
 
 }
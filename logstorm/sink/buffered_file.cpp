@@ -0,0 +1,368 @@
+#include "buffered_file.h"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include "lz4_block.h"
+
+namespace logstorm::sink {
+
+namespace {
+
+size_t constexpr max_vectors{16};                                               // the least IOV_MAX POSIX allows
+std::chrono::seconds constexpr max_rotation_backoff{300};                       // longest wait between attempts to rotate a file that won't rename
+size_t constexpr lz4_frame_block{4u << 20};                                     // the largest block size an LZ4 frame can declare
+std::array<unsigned char, 7> constexpr lz4_frame_header{
+  0x04, 0x22, 0x4d, 0x18,                                                       // magic number
+  0x60,                                                                         // version 1, independent blocks, no checksums
+  0x70,                                                                         // blocks of up to 4MB
+  0x73,                                                                         // second byte of the xxHash32 of the two bytes above
+};
+
+void put_u32(std::ofstream &stream, uint32_t value) {
+  /// Write a little-endian 32-bit value
+  std::array<char, 4> const bytes{
+    static_cast<char>(value),
+    static_cast<char>(value >> 8),
+    static_cast<char>(value >> 16),
+    static_cast<char>(value >> 24),
+  };
+  stream.write(bytes.data(), bytes.size());
+}
+
+uint64_t compress_file(std::string const &source_name) {
+  /// Compress a file to an LZ4 frame alongside it, removing the original on success, and return the compressed size or 0 on failure
+  std::ifstream source{source_name, std::ios_base::binary};
+  if(!source.good()) return 0;
+  std::string const destination_name{source_name + ".lz4"};
+  std::ofstream destination{destination_name, std::ios_base::binary | std::ios_base::trunc};
+  destination.write(reinterpret_cast<char const*>(lz4_frame_header.data()), lz4_frame_header.size());
+  std::vector<std::byte> block(lz4_frame_block);
+  std::vector<std::byte> output;
+  output.reserve(lz4_block::compress_bound(lz4_frame_block));
+  while(source.read(reinterpret_cast<char*>(block.data()), static_cast<std::streamsize>(block.size())) || source.gcount() != 0) {
+    auto const size{static_cast<size_t>(source.gcount())};
+    output.clear();
+    size_t const compressed_size{lz4_block::compress({block.data(), size}, output)};
+    if(compressed_size < size) {
+      put_u32(destination, static_cast<uint32_t>(compressed_size));
+      destination.write(reinterpret_cast<char const*>(output.data()), static_cast<std::streamsize>(compressed_size));
+    } else {
+      put_u32(destination, static_cast<uint32_t>(size) | 0x8000'0000u);         // stored uncompressed
+      destination.write(reinterpret_cast<char const*>(block.data()), static_cast<std::streamsize>(size));
+    }
+  }
+  put_u32(destination, 0);                                                      // end mark
+  uint64_t const compressed_size{static_cast<uint64_t>(destination.tellp())};
+  destination.close();
+  std::error_code error;
+  if(!destination.good() || !source.eof()) {
+    std::cout << "LogStorm: WARNING: Couldn't compress rotated logfile " << source_name << std::endl;
+    std::filesystem::remove(destination_name, error);
+    return 0;
+  }
+  std::filesystem::remove(source_name, error);
+  return compressed_size;
+}
+
+} // anonymous namespace
+
+buffered_file::buffered_file(std::string const &target_filename, timestamp::types timestamp_type)
+  : buffered_file(target_filename, settings{}, timestamp_type) {
+  /// Construct with the default settings
+}
+
+buffered_file::buffered_file(std::string const &target_filename, settings const &this_config, timestamp::types timestamp_type)
+  : base(timestamp_type),
+    filename{target_filename},
+    config{this_config} {
+  /// Open the file, carry on the numbering of any files already rotated, and start the background thread if there is to be one
+  std::filesystem::path const path{filename};
+  std::string const prefix{path.filename().string() + "."};
+  std::error_code error;
+  auto const directory{path.has_parent_path() ? path.parent_path() : std::filesystem::path{"."}};
+  for(auto const &entry : std::filesystem::directory_iterator{directory, error}) {
+    std::string const name{entry.path().filename().string()};
+    if(!name.starts_with(prefix)) continue;
+    uint64_t number{0};
+    auto const result{std::from_chars(name.data() + prefix.size(), name.data() + name.size(), number)};
+    if(result.ec != std::errc{} || result.ptr == name.data() + prefix.size()) continue;
+    next_rotation = std::max(next_rotation, number + 1);
+  }
+  open();
+  #ifdef LOGSTORM_CONSUMER_THREAD
+    background = std::thread{[this]{
+      std::unique_lock lock{buffer_mutex};
+      while(!stopping) {
+        wake.wait_for(lock, config.commit_interval);
+        if(stopping) break;
+        lock.unlock();
+        commit();
+        compress_rotated();
+        lock.lock();
+      }
+    }};
+  #endif // LOGSTORM_CONSUMER_THREAD
+}
+
+buffered_file::~buffered_file() {
+  /// Stop the background thread, then write out anything pending and finish compressing rotated files
+  #ifdef LOGSTORM_CONSUMER_THREAD
+    {
+      std::scoped_lock lock{buffer_mutex};
+      stopping = true;
+    }
+    wake.notify_one();
+    background.join();
+  #endif // LOGSTORM_CONSUMER_THREAD
+  commit();
+  compress_rotated();
+  if(descriptor >= 0) ::close(descriptor);
+}
+
+void buffered_file::log(std::string_view log_entry) {
+  /// Log this line
+  bool due;
+  {
+    #ifndef LOGSTORM_SINGLE_THREADED
+      std::scoped_lock lock{buffer_mutex};
+    #endif // LOGSTORM_SINGLE_THREADED
+    append(time());
+    append(log_entry);
+    append("\n");
+    ++stats.lines;
+    due = commit_due();
+  }
+  if(due) {
+    commit();
+    if(!has_background_thread()) compress_rotated();
+  }
+}
+void buffered_file::log_fragment(std::string_view log_entry) {
+  /// Log this fragment without ending the line
+  bool due;
+  {
+    #ifndef LOGSTORM_SINGLE_THREADED
+      std::scoped_lock lock{buffer_mutex};
+    #endif // LOGSTORM_SINGLE_THREADED
+    #ifdef LOGSTORM_COMPOSE_FRAGMENTS_SEPARATELY
+      if(line_in_progress.empty()) {                                            // if this is the start of a line, add a timestamp and cache it
+        line_in_progress = time();
+      }
+      line_in_progress += log_entry;
+      if(log_entry.back() == '\n') {                                            // if this is a newline, push it to the buffer
+        append(line_in_progress);
+        line_in_progress.clear();
+        ++stats.lines;
+      }
+    #else
+      append(log_entry);
+      if(!log_entry.empty() && log_entry.back() == '\n') ++stats.lines;
+    #endif // LOGSTORM_COMPOSE_FRAGMENTS_SEPARATELY
+    due = commit_due();
+  }
+  if(due) {
+    commit();
+    if(!has_background_thread()) compress_rotated();
+  }
+}
+
+void buffered_file::flush() {
+  /// Write out everything pending now
+  commit();
+  if(!has_background_thread()) compress_rotated();
+}
+
+buffered_file::statistics buffered_file::get_statistics() {
+  /// Return counters, including how much is waiting to be written
+  #ifndef LOGSTORM_SINGLE_THREADED
+    std::scoped_lock lock{buffer_mutex};
+  #endif // LOGSTORM_SINGLE_THREADED
+  statistics result{stats};
+  result.pending_bytes = pending_bytes;
+  return result;
+}
+
+void buffered_file::append(std::string_view text) {
+  /// Copy text onto the end of the pending chunks, taking another chunk whenever one fills; call with the buffer locked
+  if(pending_bytes == 0) oldest_pending = std::chrono::steady_clock::now();
+  while(!text.empty()) {
+    if(pending.empty() || pending.back().used == config.chunk_bytes) {
+      if(spare.empty()) {
+        pending.emplace_back(std::make_unique_for_overwrite<char[]>(config.chunk_bytes));
+      } else {
+        pending.emplace_back(std::move(spare.back()));
+        spare.pop_back();
+      }
+    }
+    auto &current{pending.back()};
+    size_t const size{std::min(text.size(), config.chunk_bytes - current.used)};
+    std::memcpy(current.data.get() + current.used, text.data(), size);
+    current.used += size;
+    pending_bytes += size;
+    text.remove_prefix(size);
+  }
+}
+
+bool buffered_file::commit_due() {
+  /// Decide whether the caller should write out the pending lines itself, waking the background thread instead where there is one; call with the buffer locked
+  if(pending_bytes >= config.buffer_bytes) return true;                         // the background thread has fallen behind
+  if(has_background_thread()) {
+    #ifdef LOGSTORM_CONSUMER_THREAD
+      if(pending_bytes >= config.commit_bytes) wake.notify_one();
+    #endif // LOGSTORM_CONSUMER_THREAD
+    return false;
+  }
+  return pending_bytes >= config.commit_bytes || std::chrono::steady_clock::now() - oldest_pending >= config.commit_interval;
+}
+
+void buffered_file::commit() {
+  /// Write out all pending chunks with as few writev() calls as possible, leaving the buffer free for more lines meanwhile, then rotate the file if it's due
+  #ifndef LOGSTORM_SINGLE_THREADED
+    std::scoped_lock output_lock{output_mutex};
+  #endif // LOGSTORM_SINGLE_THREADED
+  {
+    #ifndef LOGSTORM_SINGLE_THREADED
+      std::scoped_lock lock{buffer_mutex};
+    #endif // LOGSTORM_SINGLE_THREADED
+    if(pending_bytes == 0) return;
+    writing.swap(pending);
+    pending_bytes = 0;
+  }
+
+  vectors.clear();
+  size_t batch_bytes{0};
+  for(auto const &this_chunk : writing) {
+    vectors.emplace_back(iovec{.iov_base{this_chunk.data.get()}, .iov_len{this_chunk.used}});
+    batch_bytes += this_chunk.used;
+  }
+  size_t next{0};
+  while(descriptor >= 0 && next != vectors.size()) {
+    ssize_t written{::writev(descriptor, vectors.data() + next, static_cast<int>(std::min(vectors.size() - next, max_vectors)))};
+    if(written < 0) {
+      if(errno == EINTR) continue;
+      std::cout << "LogStorm: WARNING: Couldn't write to logfile " << filename << ": " << std::strerror(errno) << std::endl;
+      break;
+    }
+    while(written != 0) {                                                       // step past what was written, which may end partway through a chunk
+      auto &vector{vectors[next]};
+      auto const step{std::min(static_cast<size_t>(written), vector.iov_len)};
+      vector.iov_base = static_cast<char*>(vector.iov_base) + step;
+      vector.iov_len -= step;
+      written -= static_cast<ssize_t>(step);
+      if(vector.iov_len == 0) ++next;
+    }
+  }
+  file_bytes += batch_bytes;
+
+  {
+    #ifndef LOGSTORM_SINGLE_THREADED
+      std::scoped_lock lock{buffer_mutex};
+    #endif // LOGSTORM_SINGLE_THREADED
+    for(auto &this_chunk : writing) {
+      this_chunk.used = 0;
+      spare.emplace_back(std::move(this_chunk));
+    }
+    stats.bytes += batch_bytes;
+    ++stats.commits;
+  }
+  writing.clear();
+
+  auto const now{std::chrono::steady_clock::now()};
+  if(now < rotation_retry) return;
+  if((config.rotate_bytes != 0 && file_bytes >= config.rotate_bytes) ||
+     (config.rotate_interval.count() != 0 && now - file_opened >= config.rotate_interval)) {
+    rotate();
+  }
+}
+
+void buffered_file::open() {
+  /// Open the file for appending, noting how large it already is; call with the output locked
+  descriptor = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if(descriptor < 0) {
+    std::cout << "LogStorm: WARNING: Couldn't open logfile " << filename << ": " << std::strerror(errno) << std::endl;
+    file_bytes = 0;
+  } else {
+    file_bytes = static_cast<uint64_t>(std::max<off_t>(::lseek(descriptor, 0, SEEK_END), 0));
+  }
+  file_opened = std::chrono::steady_clock::now();
+}
+
+void buffered_file::rotate() {
+  /// Rename the file with the next number and start a new one, queueing the old one for compression and deleting any beyond those kept; call with the output locked
+  ::close(descriptor);
+  descriptor = -1;
+  std::string const rotated{rotated_name(next_rotation)};
+  std::error_code error;
+  std::filesystem::rename(filename, rotated, error);
+  if(error) {                                                                   // carry on with the same file, and don't try again on every commit
+    rotation_backoff = std::min(rotation_backoff.count() == 0 ? std::chrono::seconds{1} : rotation_backoff * 2, max_rotation_backoff);
+    rotation_retry = std::chrono::steady_clock::now() + rotation_backoff;
+    std::cout << "LogStorm: WARNING: Couldn't rotate logfile " << filename << ": " << error.message() << ", retrying in " << rotation_backoff.count() << "s" << std::endl;
+    open();
+    return;
+  }
+  rotation_backoff = std::chrono::seconds{0};
+  uint64_t const number{next_rotation++};
+  open();
+  if(number > config.keep_rotated) {
+    std::string const expired{rotated_name(number - config.keep_rotated)};
+    std::filesystem::remove(expired, error);
+    std::filesystem::remove(expired + ".lz4", error);
+  }
+  #ifndef LOGSTORM_SINGLE_THREADED
+    std::scoped_lock lock{buffer_mutex};
+  #endif // LOGSTORM_SINGLE_THREADED
+  ++stats.rotations;
+  if(config.compress_rotated && config.keep_rotated != 0) {
+    to_compress.emplace_back(rotated);
+    #ifdef LOGSTORM_CONSUMER_THREAD
+      wake.notify_one();
+    #endif // LOGSTORM_CONSUMER_THREAD
+  }
+}
+
+std::string buffered_file::rotated_name(uint64_t const number) const {
+  /// Name of the file rotated with a given number
+  return filename + "." + std::to_string(number);
+}
+
+void buffered_file::compress_rotated() {
+  /// Compress each rotated file waiting, without holding any lock while compressing
+  while(true) {
+    std::string source_name;
+    {
+      #ifndef LOGSTORM_SINGLE_THREADED
+        std::scoped_lock lock{buffer_mutex};
+      #endif // LOGSTORM_SINGLE_THREADED
+      if(to_compress.empty()) return;
+      source_name = std::move(to_compress.front());
+      to_compress.erase(to_compress.begin());
+    }
+    uint64_t const compressed_size{compress_file(source_name)};
+    #ifndef LOGSTORM_SINGLE_THREADED
+      std::scoped_lock lock{buffer_mutex};
+    #endif // LOGSTORM_SINGLE_THREADED
+    if(compressed_size != 0) {
+      ++stats.compressed_files;
+      stats.compressed_bytes += compressed_size;
+    }
+  }
+}
+
+bool buffered_file::has_background_thread() const {
+  /// Whether a background thread is writing out and compressing
+  #ifdef LOGSTORM_CONSUMER_THREAD
+    return background.joinable();
+  #else
+    return false;
+  #endif // LOGSTORM_CONSUMER_THREAD
+}
+
+}
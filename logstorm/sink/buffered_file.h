@@ -0,0 +1,113 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/uio.h>
+#include "base.h"
+#include "logstorm/threading.h"
+#ifndef LOGSTORM_SINGLE_THREADED
+  #include <mutex>
+#endif // LOGSTORM_SINGLE_THREADED
+#ifdef LOGSTORM_CONSUMER_THREAD
+  #include <condition_variable>
+  #include <thread>
+#endif // LOGSTORM_CONSUMER_THREAD
+
+namespace logstorm::sink {
+
+class buffered_file : public base {
+  /// A file sink that gathers lines in memory and writes them out in batches.
+  ///
+  /// Logging only copies the line into a chunk of a user-space buffer.  The
+  /// chunks are written together with one writev() call when enough is
+  /// pending, when the oldest pending line is old enough, or on flush(),
+  /// which the manager calls after any line at its flush level.  Lines keep
+  /// being gathered into fresh chunks while a batch is being written.
+  ///
+  /// Once the file reaches a size or an age, it's renamed with the next
+  /// number and a new file started.  Rotated files are compressed to
+  /// LZ4 frames, readable with lz4 -d, and only the most recent are kept.
+  /// Where threads are available, a background thread does the time-based
+  /// writes and the compression; otherwise they happen while logging.
+public:
+  struct settings {
+    size_t chunk_bytes{256 * 1024};                                             // unit of the buffer, and of each writev() entry
+    size_t commit_bytes{1u << 20};                                              // write out once this much is pending
+    size_t buffer_bytes{8u << 20};                                              // most that may be pending before logging writes out itself rather than leaving it to the background thread
+    std::chrono::milliseconds commit_interval{1'000};                           // most a line waits to be written out
+    uint64_t rotate_bytes{64u << 20};                                           // start a new file at this size, or 0 for never
+    std::chrono::seconds rotate_interval{0};                                    // start a new file at this age, or 0 for never
+    unsigned int keep_rotated{8};                                               // older rotated files are deleted
+    bool compress_rotated{true};
+  };
+
+  struct statistics {
+    uint64_t lines{0};
+    uint64_t bytes{0};                                                          // written out
+    uint64_t commits{0};                                                        // writev() batches
+    uint64_t rotations{0};
+    uint64_t compressed_files{0};
+    uint64_t compressed_bytes{0};                                               // size of the compressed files
+    size_t pending_bytes{0};
+  };
+
+private:
+  struct chunk {
+    std::unique_ptr<char[]> data;
+    size_t used{0};
+  };
+
+  std::string const filename;
+  settings const config;
+  int descriptor{-1};
+  uint64_t file_bytes{0};                                                       // in the current file
+  std::chrono::steady_clock::time_point file_opened;
+  uint64_t next_rotation{1};                                                    // number given to the next rotated file
+  std::chrono::steady_clock::time_point rotation_retry;                         // after a failed rotation, don't try again before this
+  std::chrono::seconds rotation_backoff{0};                                     // doubled after each failed rotation, reset by a successful one
+
+  std::vector<chunk> pending;                                                   // filled in order, the last one being filled
+  std::vector<chunk> spare;                                                     // emptied chunks, reused so logging doesn't allocate
+  std::vector<chunk> writing;                                                   // the batch being written out
+  std::vector<iovec> vectors;                                                   // one per chunk in the batch
+  size_t pending_bytes{0};
+  std::chrono::steady_clock::time_point oldest_pending;
+  std::vector<std::string> to_compress;                                         // rotated files waiting to be compressed
+  statistics stats;
+
+  #ifndef LOGSTORM_SINGLE_THREADED
+    std::mutex buffer_mutex;                                                    // guards pending, spare, to_compress and stats; held only while copying
+    std::mutex output_mutex;                                                    // guards the file and writing; held while writing out
+  #endif // LOGSTORM_SINGLE_THREADED
+  #ifdef LOGSTORM_CONSUMER_THREAD
+    std::condition_variable wake;
+    bool stopping{false};
+    std::thread background;
+  #endif // LOGSTORM_CONSUMER_THREAD
+
+public:
+  explicit buffered_file(std::string const &target_filename, timestamp::types timestamp_type = timestamp::types::DATE_TIME);
+  buffered_file(std::string const &target_filename, settings const &config, timestamp::types timestamp_type = timestamp::types::DATE_TIME);
+  virtual ~buffered_file() override;
+
+  virtual void log(std::string_view log_entry) override final;
+  virtual void log_fragment(std::string_view log_entry) override final;
+  virtual void flush() override final;
+
+  statistics get_statistics();
+
+private:
+  void append(std::string_view text);
+  bool commit_due();
+  void commit();
+  void open();
+  void rotate();
+  std::string rotated_name(uint64_t number) const;
+  void compress_rotated();
+  bool has_background_thread() const;
+};
+
+}
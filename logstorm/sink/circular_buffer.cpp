@@ -1,43 +1,112 @@
 #include "circular_buffer.h"
-#ifndef LOGSTORM_SINGLE_THREADED
-  #include <mutex>
-#endif // LOGSTORM_SINGLE_THREADED
+#include <algorithm>
+#include <cstring>
+#include <limits>
 
 namespace logstorm::sink {
 
-circular_buffer::circular_buffer(unsigned int this_size, timestamp::types timestamp_type)
+circular_buffer::circular_buffer(size_t budget_bytes, timestamp::types timestamp_type)
   : base(timestamp_type),
-    size(this_size),
-    data(size) {
-  /// Default constructor
+    capacity{std::max<size_t>(budget_bytes, 256)},
+    max_line{std::min<size_t>(capacity / 4, std::numeric_limits<length_type>::max()) - sizeof(length_type)},
+    data{std::make_unique_for_overwrite<std::byte[]>(capacity)},
+    index_capacity{std::max<size_t>(capacity / 64, 16)},                        // plenty for lines of typical length, which are evicted for space first
+    index{std::make_unique<std::atomic<uint64_t>[]>(index_capacity)} {
+  /// Allocate the whole budget up front, so logging never allocates
 }
 
 circular_buffer::~circular_buffer() = default;
 
-void circular_buffer::log(std::string const &log_entry) {
+void circular_buffer::log(std::string_view log_entry) {
   /// Log this line
   #ifndef LOGSTORM_SINGLE_THREADED
-    std::unique_lock lock{data_mutex};                                          // lock for writing (unique)
+    std::scoped_lock lock{write_mutex};
   #endif // LOGSTORM_SINGLE_THREADED
-  data.push_back(time() + log_entry);
+  push(time(), log_entry);
 }
-void circular_buffer::log_fragment(std::string const &log_entry) {
-  /// Log this fragment without ending the line
+void circular_buffer::log_fragment(std::string_view log_entry) {
+  /// Log this fragment, storing the line once it's complete, as the buffer's lines can't grow in place
   #ifndef LOGSTORM_SINGLE_THREADED
-    std::unique_lock lock{data_mutex};                                          // lock for writing (unique)
+    std::scoped_lock lock{write_mutex};
   #endif // LOGSTORM_SINGLE_THREADED
-  #ifdef LOGSTORM_COMPOSE_FRAGMENTS_SEPARATELY
-    if(line_in_progress.empty()) {                                              // if this is the start of a line, add a timestamp and cache it
-      line_in_progress = time();
-    }
-    line_in_progress += log_entry;
-    if(log_entry.back() == '\n') {                                              // if this is a newline, push it to the buffer
-      data.push_back(line_in_progress);
-      line_in_progress.clear();
-    }
-  #else
-    data.back() += log_entry;
-  #endif // LOGSTORM_COMPOSE_FRAGMENTS_SEPARATELY
+  if(fragments.empty()) fragments = time();                                     // if this is the start of a line, add a timestamp and cache it
+  fragments += log_entry;
+  if(!log_entry.empty() && log_entry.back() == '\n') {                          // if this is a newline, push it to the buffer
+    fragments.pop_back();
+    push({}, fragments);
+    fragments.clear();
+  }
+}
+
+circular_buffer::snapshot circular_buffer::get_snapshot() const {
+  /// Return the range of line numbers currently held; lines may be evicted from the front at any time after
+  uint64_t const end{end_line.load(std::memory_order_acquire)};
+  return {
+    .first{std::min(first_line.load(std::memory_order_acquire), end)},
+    .end{end},
+  };
+}
+
+bool circular_buffer::read(uint64_t const line, std::string &destination) const {
+  /// Copy a line into the destination, returning false if it isn't held, including if it was evicted while being read
+  if(line >= end_line.load(std::memory_order_acquire)) return false;            // acquiring the end makes the line's bytes and index entry visible
+  if(line < first_line.load(std::memory_order_acquire)) return false;
+  uint64_t const position{index[line % index_capacity].load(std::memory_order_relaxed)};
+  size_t const offset{position % capacity};
+  length_type length;
+  std::memcpy(&length, data.get() + offset, sizeof(length));
+  if(length <= capacity - offset - sizeof(length)) {                            // a torn length is caught below, but mustn't read out of bounds first
+    destination.assign(reinterpret_cast<char const*>(data.get() + offset + sizeof(length)), length);
+  } else {
+    destination.clear();
+  }
+  // a writer announces an eviction before overwriting any of its bytes, so
+  // if the line is still held after copying it, the copy is whole
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return line >= first_line.load(std::memory_order_relaxed);
+}
+
+circular_buffer::statistics circular_buffer::get_statistics() const {
+  /// Return how much of the budget is in use and how many lines have passed through
+  #ifndef LOGSTORM_SINGLE_THREADED
+    std::scoped_lock lock{write_mutex};
+  #endif // LOGSTORM_SINGLE_THREADED
+  auto const [first, end]{get_snapshot()};
+  return {
+    .lines{end - first},
+    .logged{end},
+    .evicted{first},
+    .used_bytes{static_cast<size_t>(tail - head)},
+    .capacity_bytes{capacity},
+  };
+}
+
+void circular_buffer::push(std::string_view const prefix, std::string_view text) {
+  /// Append a line, evicting the oldest lines until it fits contiguously after the newest
+  text = text.substr(0, max_line - std::min(prefix.size(), max_line));
+  auto const length{static_cast<length_type>(prefix.size() + text.size())};
+  size_t const record{sizeof(length) + length};
+
+  uint64_t start{tail};
+  if(size_t const offset{start % capacity}; offset + record > capacity) start += capacity - offset; // wrap rather than split the line, leaving a gap at the end
+
+  uint64_t first{first_line.load(std::memory_order_relaxed)};
+  uint64_t const end{end_line.load(std::memory_order_relaxed)};
+  while(first != end && (start + record - head > capacity || end - first >= index_capacity)) {
+    ++first;
+    head = first == end ? start : index[first % index_capacity].load(std::memory_order_relaxed);
+  }
+  if(first == end) head = start;
+  first_line.store(first, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);                          // readers see the eviction before any of the evicted bytes change
+
+  std::byte *destination{data.get() + start % capacity};
+  std::memcpy(destination, &length, sizeof(length));
+  auto *const characters{reinterpret_cast<char*>(destination + sizeof(length))};
+  std::ranges::copy(text, std::ranges::copy(prefix, characters).out);
+  index[end % index_capacity].store(start, std::memory_order_relaxed);
+  tail = start + record;
+  end_line.store(end + 1, std::memory_order_release);
 }
 
 }
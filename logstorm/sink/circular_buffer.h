@@ -1,27 +1,70 @@
 #pragma once
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include "base.h"
 #ifndef LOGSTORM_SINGLE_THREADED
-  #include <shared_mutex>
+  #include <mutex>
 #endif // LOGSTORM_SINGLE_THREADED
-#include <boost/circular_buffer.hpp>
 
 namespace logstorm::sink {
 
 class circular_buffer : public base {
-  /// A sink that stores strings in a circular buffer up to a fixed number of lines
+  /// A sink that keeps the most recent lines in a fixed number of bytes, evicting the oldest to make room.
+  ///
+  /// Lines are stored end to end in one contiguous block, each preceded by
+  /// its length, so logging copies the text once and never allocates.  Lines
+  /// are numbered from 0 in the order they were logged; readers take the
+  /// range of lines held with get_snapshot() and copy out the ones they want
+  /// with read(), without locking.  A read that races with the line being
+  /// evicted is detected afterwards and fails, rather than returning text
+  /// torn between two lines.
 public:
-  unsigned int const size{256};
-  boost::circular_buffer<std::string> data;
+  struct snapshot {
+    uint64_t first{0};                                                          // oldest line held
+    uint64_t end{0};                                                            // one past the newest line
+  };
+
+  struct statistics {
+    uint64_t lines{0};                                                          // held now
+    uint64_t logged{0};                                                         // since construction
+    uint64_t evicted{0};
+    size_t used_bytes{0};                                                       // including length prefixes and the gap left where a line wrapped
+    size_t capacity_bytes{0};
+  };
+
+private:
+  using length_type = uint32_t;
+
+  size_t const capacity;                                                        // bytes of line data
+  size_t const max_line;                                                        // longer lines are truncated, so any one line can always make room for itself
+  std::unique_ptr<std::byte[]> data;
+  size_t const index_capacity;                                                  // most lines held at once
+  std::unique_ptr<std::atomic<uint64_t>[]> index;                               // byte position of each line held, by line number modulo index_capacity
+  uint64_t head{0};                                                             // byte position of the oldest line, counting from the start of the first lap
+  uint64_t tail{0};                                                             // byte position after the newest line
+  std::atomic<uint64_t> first_line{0};
+  std::atomic<uint64_t> end_line{0};
+  std::string fragments;                                                        // the line being built by log_fragment(), reused
   #ifndef LOGSTORM_SINGLE_THREADED
-    mutable std::shared_mutex data_mutex;
+    mutable std::mutex write_mutex;                                             // between writers only, readers never lock
   #endif // LOGSTORM_SINGLE_THREADED
 
-  circular_buffer(unsigned int max_lines, timestamp::types timestamp_type = timestamp::types::NONE);
+public:
+  explicit circular_buffer(size_t budget_bytes, timestamp::types timestamp_type = timestamp::types::NONE);
   ~circular_buffer() override;
 
-  virtual void log(std::string const &log_entry) override final;
-  virtual void log_fragment(std::string const &log_entry) override final;
+  virtual void log(std::string_view log_entry) override final;
+  virtual void log_fragment(std::string_view log_entry) override final;
+
+  snapshot get_snapshot() const;
+  bool read(uint64_t line, std::string &destination) const;
+  statistics get_statistics() const;
+
+private:
+  void push(std::string_view prefix, std::string_view text);
 };
 
 }
@@ -10,14 +10,14 @@ console::console(timestamp::types timestamp_type)
 
 console::~console() = default;
 
-void console::log(std::string const &log_entry) {
+void console::log(std::string_view log_entry) {
   /// Log this line
   #ifndef LOGSTORM_SINGLE_THREADED
     std::scoped_lock lock{output_mutex};
   #endif // LOGSTORM_SINGLE_THREADED
   std::cout << time() << log_entry << std::endl;
 }
-void console::log_fragment(std::string const &log_entry) {
+void console::log_fragment(std::string_view log_entry) {
   /// Log this fragment without ending the line
   #ifndef LOGSTORM_SINGLE_THREADED
     std::scoped_lock lock{output_mutex};
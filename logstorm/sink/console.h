@@ -17,8 +17,8 @@ public:
   explicit console(timestamp::types timestamp_type = timestamp::types::NONE);
   virtual ~console() override;
 
-  virtual void log(std::string const &log_entry) override final;
-  virtual void log_fragment(std::string const &log_entry) override final;
+  virtual void log(std::string_view log_entry) override final;
+  virtual void log_fragment(std::string_view log_entry) override final;
 };
 
 }
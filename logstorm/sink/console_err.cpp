@@ -10,14 +10,14 @@ console_err::console_err(timestamp::types timestamp_type)
 
 console_err::~console_err() = default;
 
-void console_err::log(std::string const &log_entry) {
+void console_err::log(std::string_view log_entry) {
   /// Log this line
   #ifndef LOGSTORM_SINGLE_THREADED
     std::scoped_lock lock{output_mutex};
   #endif // LOGSTORM_SINGLE_THREADED
   std::cerr << time() << log_entry << std::endl;
 }
-void console_err::log_fragment(std::string const &log_entry) {
+void console_err::log_fragment(std::string_view log_entry) {
   /// Log this fragment without ending the line
   #ifndef LOGSTORM_SINGLE_THREADED
     std::scoped_lock lock{output_mutex};
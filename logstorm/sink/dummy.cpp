@@ -9,10 +9,10 @@ dummy::dummy(timestamp::types timestamp_type)
 
 dummy::~dummy() = default;
 
-void dummy::log(std::string const &log_entry [[maybe_unused]]) {
+void dummy::log(std::string_view log_entry [[maybe_unused]]) {
   /// Dummy function to not do anything (for use in a non-logging environment)
 }
-void dummy::log_fragment(std::string const &log_entry [[maybe_unused]]) {
+void dummy::log_fragment(std::string_view log_entry [[maybe_unused]]) {
   /// Dummy function to not do anything (for use in a non-logging environment)
 }
 
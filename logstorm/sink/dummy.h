@@ -11,8 +11,8 @@ public:
   explicit dummy(timestamp::types timestamp_type = timestamp::types::NONE);
   virtual ~dummy() override;
 
-  virtual void log(std::string const &log_entry) override final;
-  virtual void log_fragment(std::string const &log_entry) override final;
+  virtual void log(std::string_view log_entry) override final;
+  virtual void log_fragment(std::string_view log_entry) override final;
 };
 
 }
@@ -13,13 +13,13 @@ emscripten_dbg_backtrace::emscripten_dbg_backtrace(timestamp::types timestamp_ty
 
 emscripten_dbg_backtrace::~emscripten_dbg_backtrace() = default;
 
-void emscripten_dbg_backtrace::log(std::string const &log_entry) {
+void emscripten_dbg_backtrace::log(std::string_view log_entry) {
   /// Log this line
   #ifdef __EMSCRIPTEN__
-    ::emscripten_dbg_backtrace((time() + log_entry).c_str());
+    ::emscripten_dbg_backtrace(std::string{time()}.append(log_entry).c_str());
   #endif // __EMSCRIPTEN__
 }
-void emscripten_dbg_backtrace::log_fragment(std::string const &log_entry) {
+void emscripten_dbg_backtrace::log_fragment(std::string_view log_entry) {
   /// Log this fragment without ending the line
   #ifdef __EMSCRIPTEN__
     #ifdef LOGSTORM_COMPOSE_FRAGMENTS_SEPARATELY
@@ -32,7 +32,7 @@ void emscripten_dbg_backtrace::log_fragment(std::string const &log_entry) {
         line_in_progress.clear();
       }
     #else
-      ::emscripten_dbg_backtrace(log_entry.c_str());
+      ::emscripten_dbg_backtrace(std::string{log_entry}.c_str());
     #endif // LOGSTORM_COMPOSE_FRAGMENTS_SEPARATELY
   #endif // __EMSCRIPTEN__
 }
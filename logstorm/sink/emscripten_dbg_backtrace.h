@@ -10,8 +10,8 @@ public:
   explicit emscripten_dbg_backtrace(timestamp::types timestamp_type = timestamp::types::NONE);
   virtual ~emscripten_dbg_backtrace() override;
 
-  virtual void log(std::string const &log_entry) override final;
-  virtual void log_fragment(std::string const &log_entry) override final;
+  virtual void log(std::string_view log_entry) override final;
+  virtual void log_fragment(std::string_view log_entry) override final;
 };
 
 }
@@ -13,13 +13,13 @@ emscripten_err::emscripten_err(timestamp::types timestamp_type)
 
 emscripten_err::~emscripten_err() = default;
 
-void emscripten_err::log(std::string const &log_entry) {
+void emscripten_err::log(std::string_view log_entry) {
   /// Log this line
   #ifdef __EMSCRIPTEN__
-    ::emscripten_err((time() + log_entry).c_str());
+    ::emscripten_err(std::string{time()}.append(log_entry).c_str());
   #endif // __EMSCRIPTEN__
 }
-void emscripten_err::log_fragment(std::string const &log_entry) {
+void emscripten_err::log_fragment(std::string_view log_entry) {
   /// Log this fragment without ending the line
   #ifdef __EMSCRIPTEN__
     #ifdef LOGSTORM_COMPOSE_FRAGMENTS_SEPARATELY
@@ -32,7 +32,7 @@ void emscripten_err::log_fragment(std::string const &log_entry) {
         line_in_progress.clear();
       }
     #else
-      ::emscripten_err(log_entry.c_str());
+      ::emscripten_err(std::string{log_entry}.c_str());
     #endif // LOGSTORM_COMPOSE_FRAGMENTS_SEPARATELY
   #endif // __EMSCRIPTEN__
 }
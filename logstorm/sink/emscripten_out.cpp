@@ -13,13 +13,13 @@ emscripten_out::emscripten_out(timestamp::types timestamp_type)
 
 emscripten_out::~emscripten_out() = default;
 
-void emscripten_out::log(std::string const &log_entry) {
+void emscripten_out::log(std::string_view log_entry) {
   /// Log this line
   #ifdef __EMSCRIPTEN__
-    ::emscripten_out((time() + log_entry).c_str());
+    ::emscripten_out(std::string{time()}.append(log_entry).c_str());
   #endif // __EMSCRIPTEN__
 }
-void emscripten_out::log_fragment(std::string const &log_entry) {
+void emscripten_out::log_fragment(std::string_view log_entry) {
   /// Log this fragment without ending the line
   #ifdef __EMSCRIPTEN__
     #ifdef LOGSTORM_COMPOSE_FRAGMENTS_SEPARATELY
@@ -32,7 +32,7 @@ void emscripten_out::log_fragment(std::string const &log_entry) {
         line_in_progress.clear();
       }
     #else
-      ::emscripten_out(log_entry.c_str());
+      ::emscripten_out(std::string{log_entry}.c_str());
     #endif // LOGSTORM_COMPOSE_FRAGMENTS_SEPARATELY
   #endif // __EMSCRIPTEN__
 }
@@ -20,7 +20,7 @@ file::~file() {
   stream.close();
 }
 
-void file::log(std::string const &log_entry) {
+void file::log(std::string_view log_entry) {
   /// Log this line
   if(stream.good()) {
     #ifndef LOGSTORM_SINGLE_THREADED
@@ -29,7 +29,7 @@ void file::log(std::string const &log_entry) {
     stream << time() << log_entry << std::endl;
   }
 }
-void file::log_fragment(std::string const &log_entry) {
+void file::log_fragment(std::string_view log_entry) {
   /// Log this fragment without ending the line
   #ifdef LOGSTORM_COMPOSE_FRAGMENTS_SEPARATELY
     if(line_in_progress.empty()) {                                              // if this is the start of a line, add a timestamp and cache it
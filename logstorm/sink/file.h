@@ -19,8 +19,8 @@ public:
   file(std::string const &target_filename, timestamp::types timestamp_type = timestamp::types::DATE_TIME);
   virtual ~file() override;
 
-  virtual void log(std::string const &log_entry) override final;
-  virtual void log_fragment(std::string const &log_entry) override final;
+  virtual void log(std::string_view log_entry) override final;
+  virtual void log_fragment(std::string_view log_entry) override final;
 };
 
 }
@@ -10,7 +10,7 @@ fstream::fstream(std::ofstream &target_stream, timestamp::types timestamp_type)
 
 fstream::~fstream() = default;
 
-void fstream::log(std::string const &log_entry) {
+void fstream::log(std::string_view log_entry) {
   /// Log this line
   if(stream.good()) {
     #ifndef LOGSTORM_SINGLE_THREADED
@@ -19,7 +19,7 @@ void fstream::log(std::string const &log_entry) {
     stream << time() << log_entry << std::endl;
   }
 }
-void fstream::log_fragment(std::string const &log_entry) {
+void fstream::log_fragment(std::string_view log_entry) {
   /// Log this fragment without ending the line
   #ifdef LOGSTORM_COMPOSE_FRAGMENTS_SEPARATELY
     if(line_in_progress.empty()) {                                              // if this is the start of a line, add a timestamp and cache it
@@ -0,0 +1,250 @@
+#include "mapped_file.h"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace logstorm::sink {
+
+namespace {
+
+size_t page_size() {
+  /// Return the granularity mappings start at
+  return static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+}
+
+} // anonymous namespace
+
+mapped_file::mapped_file(std::string const &target_filename, timestamp::types timestamp_type)
+  : mapped_file(target_filename, settings{}, timestamp_type) {
+  /// Construct with the default settings
+}
+
+mapped_file::mapped_file(std::string const &target_filename, settings const &this_config, timestamp::types timestamp_type)
+  : base(timestamp_type),
+    filename{target_filename},
+    config{this_config},
+    window_bytes{std::max((this_config.window_bytes + page_size() - 1) / page_size(), size_t{4}) * page_size()} {
+  /// Carry on the numbering of any files already rotated, then open the file and map the window after what it already holds
+  std::filesystem::path const path{filename};
+  std::string const prefix{path.filename().string() + "."};
+  std::error_code error;
+  auto const directory{path.has_parent_path() ? path.parent_path() : std::filesystem::path{"."}};
+  for(auto const &entry : std::filesystem::directory_iterator{directory, error}) {
+    std::string const name{entry.path().filename().string()};
+    if(!name.starts_with(prefix)) continue;
+    uint64_t number{0};
+    auto const result{std::from_chars(name.data() + prefix.size(), name.data() + name.size(), number)};
+    if(result.ec != std::errc{} || result.ptr == name.data() + prefix.size()) continue;
+    next_rotation = std::max(next_rotation, number + 1);
+  }
+  uint64_t const start{open()};
+  if(descriptor >= 0) current.store(map(start), std::memory_order_release);
+}
+
+mapped_file::~mapped_file() {
+  /// Unmap every window and truncate the file to what was written
+  if(window *const last{current.load(std::memory_order_acquire)}) {
+    last->used = std::min(last->reserved.load(std::memory_order_relaxed), last->size);
+    last->closes_file = true;
+  } else if(descriptor >= 0) {
+    ::close(descriptor);
+  }
+  for(auto const &this_window : windows) {
+    if(!this_window->data) continue;
+    ::munmap(this_window->data, this_window->size);
+    if(this_window->closes_file) {
+      if(::ftruncate(this_window->descriptor, static_cast<off_t>(this_window->base + this_window->used)) != 0) {
+        std::cout << "LogStorm: WARNING: Couldn't truncate logfile " << filename << ": " << std::strerror(errno) << std::endl;
+      }
+      ::close(this_window->descriptor);
+    }
+  }
+}
+
+void mapped_file::log(std::string_view log_entry) {
+  /// Log this line
+  push(time(), log_entry);
+}
+void mapped_file::log_fragment(std::string_view log_entry) {
+  /// Gather fragments, writing the line once it's complete, as lines can't grow once written
+  #ifndef LOGSTORM_SINGLE_THREADED
+    std::scoped_lock lock{fragments_mutex};
+  #endif // LOGSTORM_SINGLE_THREADED
+  if(fragments.empty()) fragments = time();                                     // if this is the start of a line, add a timestamp and cache it
+  fragments += log_entry;
+  if(!log_entry.empty() && log_entry.back() == '\n') {
+    fragments.pop_back();
+    push({}, fragments);
+    fragments.clear();
+  }
+}
+
+void mapped_file::flush() {
+  /// Lines are in the page cache as soon as they're logged, so only wait for them to reach the disk if asked to
+  if(!config.sync_on_flush) return;
+  #ifndef LOGSTORM_SINGLE_THREADED
+    std::scoped_lock lock{remap_mutex};
+  #endif // LOGSTORM_SINGLE_THREADED
+  for(auto const &this_window : windows) {
+    if(this_window->data) ::msync(this_window->data, this_window->size, MS_SYNC);
+  }
+}
+
+mapped_file::statistics mapped_file::get_statistics() {
+  /// Return counters, approximately while lines are being logged
+  #ifndef LOGSTORM_SINGLE_THREADED
+    std::scoped_lock lock{remap_mutex};
+  #endif // LOGSTORM_SINGLE_THREADED
+  statistics result{stats};
+  result.bytes = bytes_before;
+  if(window const *const target{current.load(std::memory_order_acquire)}) {
+    result.bytes += std::min(target->reserved.load(std::memory_order_relaxed), target->size) - target->start;
+  }
+  return result;
+}
+
+void mapped_file::push(std::string_view const prefix, std::string_view text) {
+  /// Reserve room for a line in the current window and copy it in, moving to the next window if it doesn't fit
+  size_t const max_line{window_bytes / 2};                                      // a new window always has at least this much free
+  text = text.substr(0, max_line - std::min(prefix.size() + 1, max_line));
+  size_t const length{prefix.size() + text.size() + 1};
+  while(true) {
+    window *const target{current.load(std::memory_order_acquire)};
+    if(!target) return;                                                         // the file couldn't be mapped
+    size_t const offset{target->reserved.fetch_add(length, std::memory_order_relaxed)};
+    if(offset + length <= target->size) {
+      auto *const destination{reinterpret_cast<char*>(target->data + offset)};
+      std::memcpy(destination, prefix.data(), prefix.size());
+      std::memcpy(destination + prefix.size(), text.data(), text.size());
+      destination[length - 1] = '\n';
+      target->committed.fetch_add(length, std::memory_order_release);
+      return;
+    }
+    if(offset <= target->size) {
+      next_window(*target, offset);                                             // this is the first line not to fit, so its writer moves everyone on
+    } else {
+      while(current.load(std::memory_order_acquire) == target) {                // wait for the writer moving everyone on
+        std::this_thread::yield();
+      }
+    }
+  }
+}
+
+void mapped_file::next_window(window &full, size_t const used) {
+  /// Close off a full window at the end of its last line, and map the next, in a new file if it's time to rotate
+  #ifndef LOGSTORM_SINGLE_THREADED
+    std::scoped_lock lock{remap_mutex};
+  #endif // LOGSTORM_SINGLE_THREADED
+  full.used = used;
+  bytes_before += used - full.start;
+  uint64_t start{full.base + used};
+  if(config.rotate_bytes != 0 && start >= config.rotate_bytes && rotate()) {
+    full.closes_file = true;
+    start = 0;
+  }
+  current.store(descriptor >= 0 ? map(start) : nullptr, std::memory_order_release);
+  unmap_finished();
+}
+
+uint64_t mapped_file::open() {
+  /// Open the file, and return where new lines should start: after its contents, less any zeros left by a crash
+  descriptor = ::open(filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if(descriptor < 0) {
+    std::cout << "LogStorm: WARNING: Couldn't open logfile " << filename << ": " << std::strerror(errno) << std::endl;
+    return 0;
+  }
+  struct stat status;
+  if(::fstat(descriptor, &status) != 0) return 0;
+  auto end{static_cast<uint64_t>(status.st_size)};
+  std::array<char, 64 * 1024> block;
+  while(end != 0) {                                                             // scan back over trailing zeros
+    size_t const size{static_cast<size_t>(std::min<uint64_t>(end, block.size()))};
+    if(::pread(descriptor, block.data(), size, static_cast<off_t>(end - size)) != static_cast<ssize_t>(size)) break;
+    auto const last{std::find_if(block.rbegin() + static_cast<ptrdiff_t>(block.size() - size), block.rend(), [](char const character){return character != '\0';})};
+    end -= static_cast<uint64_t>(last - (block.rbegin() + static_cast<ptrdiff_t>(block.size() - size)));
+    if(last != block.rend()) break;
+  }
+  return end;
+}
+
+mapped_file::window *mapped_file::map(uint64_t const start) {
+  /// Allocate and map the window of the file containing a starting offset, or return null on failure; call with the remap lock held
+  uint64_t const first{start / page_size() * page_size()};
+  uint64_t const end{first + window_bytes};
+  int allocated{EOPNOTSUPP};
+  #ifdef __linux__
+    do {
+      allocated = ::posix_fallocate(descriptor, static_cast<off_t>(first), static_cast<off_t>(window_bytes)); // reserve the blocks, so a full disk fails here rather than with SIGBUS while logging
+    } while(allocated == EINTR);
+  #endif // __linux__
+  if(allocated != 0 && allocated != EOPNOTSUPP && allocated != EINVAL) {        // only extend a sparse file where the filesystem can't reserve blocks at all
+    std::cout << "LogStorm: WARNING: Couldn't allocate space for logfile " << filename << ": " << std::strerror(allocated) << std::endl;
+    return nullptr;
+  }
+  struct stat status;
+  if(allocated != 0 && ::fstat(descriptor, &status) == 0 && static_cast<uint64_t>(status.st_size) < end) {
+    if(::ftruncate(descriptor, static_cast<off_t>(end)) != 0) {
+      std::cout << "LogStorm: WARNING: Couldn't extend logfile " << filename << ": " << std::strerror(errno) << std::endl;
+      return nullptr;
+    }
+  }
+  void *const data{::mmap(nullptr, window_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, static_cast<off_t>(first))};
+  if(data == MAP_FAILED) {
+    std::cout << "LogStorm: WARNING: Couldn't map logfile " << filename << ": " << std::strerror(errno) << std::endl;
+    return nullptr;
+  }
+  auto &result{*windows.emplace_back(std::make_unique<window>())};
+  result.data = static_cast<std::byte*>(data);
+  result.size = window_bytes;
+  result.base = first;
+  result.start = static_cast<size_t>(start - first);
+  result.descriptor = descriptor;
+  result.reserved.store(result.start, std::memory_order_relaxed);
+  ++stats.windows;
+  return &result;
+}
+
+bool mapped_file::rotate() {
+  /// Rename the file with the next number, delete any beyond those kept, and open a new one, returning false to carry on with this one if it can't be renamed; call with the remap lock held
+  uint64_t const number{next_rotation};
+  std::string const rotated{filename + "." + std::to_string(number)};
+  std::error_code error;
+  std::filesystem::rename(filename, rotated, error);
+  if(error) {
+    std::cout << "LogStorm: WARNING: Couldn't rotate logfile " << filename << ": " << error.message() << std::endl;
+    return false;
+  }
+  ++next_rotation;
+  ++stats.rotations;
+  if(number > config.keep_rotated) std::filesystem::remove(filename + "." + std::to_string(number - config.keep_rotated), error);
+  open();
+  return true;
+}
+
+void mapped_file::unmap_finished() {
+  /// Unmap full windows that every writer has finished with, truncating rotated files to their contents; call with the remap lock held
+  window const *const target{current.load(std::memory_order_relaxed)};
+  for(auto const &this_window : windows) {
+    if(!this_window->data || this_window.get() == target) continue;
+    if(this_window->committed.load(std::memory_order_acquire) != this_window->used - this_window->start) continue;
+    ::munmap(this_window->data, this_window->size);
+    this_window->data = nullptr;
+    if(this_window->closes_file) {
+      if(::ftruncate(this_window->descriptor, static_cast<off_t>(this_window->base + this_window->used)) != 0) {
+        std::cout << "LogStorm: WARNING: Couldn't truncate rotated logfile from " << filename << ": " << std::strerror(errno) << std::endl;
+      }
+      ::close(this_window->descriptor);
+    }
+  }
+}
+
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "base.h"
+#ifndef LOGSTORM_SINGLE_THREADED
+  #include <mutex>
+#endif // LOGSTORM_SINGLE_THREADED
+
+namespace logstorm::sink {
+
+class mapped_file : public base {
+  /// A file sink for native builds that writes lines straight into a memory mapping of the file.
+  ///
+  /// A window of the file is allocated on disk and mapped up front.  Logging
+  /// reserves room for the line by advancing an atomic offset, copies the
+  /// line in, and counts it as committed, so threads write concurrently and
+  /// no line makes a system call.  The mapping is shared with the kernel's
+  /// page cache, so everything copied survives the process crashing; flush()
+  /// can optionally sync it to disk as well.
+  ///
+  /// When a window fills, the writer whose line crosses its end maps the
+  /// next window of the file, starting where the last line ended, while
+  /// other writers wait for it.  Once the file reaches rotate_bytes, it's
+  /// renamed with the next number instead and a new file mapped.  A window
+  /// is unmapped once every line reserved in it is committed.  On a clean
+  /// shutdown the file is truncated to what was written; after a crash, it
+  /// ends in zero bytes up to the end of the last window.
+public:
+  struct settings {
+    size_t window_bytes{16u << 20};                                             // mapped at a time, rounded up to whole pages
+    uint64_t rotate_bytes{256u << 20};                                          // start a new file at this size, or 0 for never
+    unsigned int keep_rotated{8};                                               // older rotated files are deleted
+    bool sync_on_flush{false};                                                  // make flush() wait for the disk, to survive power loss too
+  };
+
+  struct statistics {
+    uint64_t bytes{0};                                                          // reserved, over all files
+    uint64_t windows{0};                                                        // mapped so far
+    uint64_t rotations{0};
+  };
+
+private:
+  struct window {
+    std::byte *data{nullptr};                                                   // null once unmapped
+    size_t size{0};
+    uint64_t base{0};                                                           // offset in the file
+    size_t start{0};                                                            // where the first line begins
+    int descriptor{-1};
+    std::atomic<size_t> reserved{0};                                            // bytes claimed by writers, which may run past the end
+    std::atomic<size_t> committed{0};                                           // bytes copied in
+    size_t used{0};                                                             // where the last line to fit ends, once the window is full
+    bool closes_file{false};                                                    // the last window of a rotated file
+  };
+
+  std::string const filename;
+  settings const config;
+  size_t const window_bytes;
+  int descriptor{-1};
+  uint64_t next_rotation{1};
+  std::vector<std::unique_ptr<window>> windows;                                 // every window, kept until destruction as a late writer may still look at one
+  std::atomic<window*> current{nullptr};
+  uint64_t bytes_before{0};                                                     // reserved in full windows
+  statistics stats;
+  std::string fragments;                                                        // the line being built by log_fragment(), reused
+  #ifndef LOGSTORM_SINGLE_THREADED
+    std::mutex remap_mutex;                                                     // taken only to change window, and by get_statistics()
+    std::mutex fragments_mutex;
+  #endif // LOGSTORM_SINGLE_THREADED
+
+public:
+  explicit mapped_file(std::string const &target_filename, timestamp::types timestamp_type = timestamp::types::DATE_TIME);
+  mapped_file(std::string const &target_filename, settings const &config, timestamp::types timestamp_type = timestamp::types::DATE_TIME);
+  virtual ~mapped_file() override;
+
+  virtual void log(std::string_view log_entry) override final;
+  virtual void log_fragment(std::string_view log_entry) override final;
+  virtual void flush() override final;
+
+  statistics get_statistics();
+
+private:
+  void push(std::string_view prefix, std::string_view text);
+  void next_window(window &full, size_t used);
+  uint64_t open();
+  window *map(uint64_t start);
+  bool rotate();
+  void unmap_finished();
+};
+
+}
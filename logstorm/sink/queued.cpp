@@ -0,0 +1,57 @@
+#include "queued.h"
+#include "logstorm/async_dispatcher.h"
+
+namespace logstorm::sink {
+
+queued::queued(std::shared_ptr<base> this_target)
+  : queued(std::move(this_target), async_settings{}) {
+  /// Construct with the default queue settings
+}
+
+queued::queued(std::shared_ptr<base> this_target, async_settings const &config)
+  : target{std::move(this_target)},
+    dispatcher{std::make_unique<async_dispatcher>(std::vector{target}, config)} {
+  /// Start the queue and its worker in front of the target sink
+}
+
+queued::~queued() = default;                                                    // the dispatcher writes out anything still queued
+
+void queued::log(std::string_view log_entry) {
+  /// Queue this line for the target sink
+  dispatcher->push(log_entry);
+}
+void queued::log_fragment(std::string_view log_entry) {
+  /// Gather fragments, queueing the line once it's complete, as queued lines can't grow
+  #ifndef LOGSTORM_SINGLE_THREADED
+    std::scoped_lock lock{fragments_mutex};
+  #endif // LOGSTORM_SINGLE_THREADED
+  fragments += log_entry;
+  if(!log_entry.empty() && log_entry.back() == '\n') {
+    fragments.pop_back();
+    dispatcher->push(fragments);
+    fragments.clear();
+  }
+}
+
+void queued::flush() {
+  /// Write out everything queued, then flush the target sink
+  dispatcher->flush();
+  target->flush();
+}
+
+void queued::request_flush() {
+  /// Wake the worker to write out everything queued and flush the target sink, without waiting for it
+  dispatcher->request_flush();
+}
+
+std::shared_ptr<base> queued::get_target() const {
+  /// Return the sink being written to
+  return target;
+}
+
+async_statistics queued::get_statistics() const {
+  /// Return the queue's counters and latencies
+  return dispatcher->get_statistics();
+}
+
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include "base.h"
+#include "logstorm/async_settings.h"
+#ifndef LOGSTORM_SINGLE_THREADED
+  #include <mutex>
+#endif // LOGSTORM_SINGLE_THREADED
+
+namespace logstorm {
+class async_dispatcher;
+}
+
+namespace logstorm::sink {
+
+class queued : public base {
+  /// Runs another sink behind its own bounded queue and worker, so a slow sink doesn't hold up the caller or the other sinks.
+  ///
+  /// Usage:
+  ///   logger.add_sink(std::make_shared<logstorm::sink::queued>(
+  ///     std::make_shared<logstorm::sink::emscripten_dbg_backtrace>(),
+  ///     logstorm::async_settings{.overflow{logstorm::async_overflow_policies::drop}}
+  ///   ));
+  /// Logging copies the line into the queue; the worker passes it on.  When
+  /// the queue is full, the overflow policy decides whether the caller waits
+  /// (backpressure) or a line is discarded.  Without threads, lines wait in
+  /// the queue until flush(), which the manager's flush() calls.  A line at
+  /// the manager's flush level only wakes the worker to write out the queue
+  /// and flush the wrapped sink, rather than waiting for it.  The wrapped
+  /// sink adds its timestamp when it writes the line.
+  std::shared_ptr<base> const target;
+  std::unique_ptr<async_dispatcher> const dispatcher;                           // created in queued.cpp, so including this header needs no threads
+  std::string fragments;                                                        // the line being built by log_fragment(), reused
+  #ifndef LOGSTORM_SINGLE_THREADED
+    std::mutex fragments_mutex;
+  #endif // LOGSTORM_SINGLE_THREADED
+
+public:
+  explicit queued(std::shared_ptr<base> target);
+  queued(std::shared_ptr<base> target, async_settings const &config);
+  virtual ~queued() override;
+
+  virtual void log(std::string_view log_entry) override final;
+  virtual void log_fragment(std::string_view log_entry) override final;
+  virtual void flush() override final;
+  virtual void request_flush() override final;
+
+  std::shared_ptr<base> get_target() const;
+  async_statistics get_statistics() const;
+};
+
+}
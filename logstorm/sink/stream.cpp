@@ -10,14 +10,14 @@ stream::stream(std::ostream &target_ostream, timestamp::types timestamp_type)
 
 stream::~stream() = default;
 
-void stream::log(std::string const &log_entry) {
+void stream::log(std::string_view log_entry) {
   /// Log this line
   #ifndef LOGSTORM_SINGLE_THREADED
     std::scoped_lock lock{output_mutex};
   #endif // LOGSTORM_SINGLE_THREADED
   ostream << time() << log_entry << std::endl;
 }
-void stream::log_fragment(std::string const &log_entry) {
+void stream::log_fragment(std::string_view log_entry) {
   /// Log this fragment without ending the line
   #ifndef LOGSTORM_SINGLE_THREADED
     std::scoped_lock lock{output_mutex};
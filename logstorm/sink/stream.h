@@ -19,8 +19,8 @@ public:
   stream(std::ostream &target_ostream, timestamp::types timestamp_type = timestamp::types::NONE);
   virtual ~stream() override;
 
-  virtual void log(std::string const &log_entry) override final;
-  virtual void log_fragment(std::string const &log_entry) override final;
+  virtual void log(std::string_view log_entry) override final;
+  virtual void log_fragment(std::string_view log_entry) override final;
 };
 
 }
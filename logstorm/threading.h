@@ -0,0 +1,5 @@
+#pragma once
+
+#if !defined(LOGSTORM_SINGLE_THREADED) && !(defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__))
+  #define LOGSTORM_CONSUMER_THREAD                                              // threads are available to write lines out in the background
+#endif // LOGSTORM_SINGLE_THREADED
@@ -1,5 +1,9 @@
 #include "timestamp.h"
+#include <array>
+#include <charconv>
 #include <ctime>
+#include <stdexcept>
+#include <string>
 #ifndef LOGSTORM_SINGLE_THREADED
   #include <mutex>
 #endif // LOGSTORM_SINGLE_THREADED
@@ -8,6 +12,19 @@ namespace logstorm {
 
 namespace {
 
+size_t constexpr type_count{static_cast<size_t>(timestamp::types::DATE_TIME_MICROSECONDS) + 1};
+
+struct cached_text {
+  /// A timestamp formatted for one second, reused until the second changes
+  std::time_t second{-1};
+  std::array<char, 48> text;                                                    // deliberately uninitialised, only the first length characters are used
+  size_t length{0};
+  size_t fraction_offset{0};                                                    // where the microsecond digits go, if the type has them
+};
+
+thread_local std::array<cached_text, type_count> cache;
+thread_local std::array<char, 32> elapsed_text;
+
 std::tm localtime_copy(std::time_t time) {
   #ifndef LOGSTORM_SINGLE_THREADED
     static std::mutex localtime_mutex;
@@ -16,6 +33,56 @@ std::tm localtime_copy(std::time_t time) {
   return *std::localtime(&time);
 }
 
+void write_digits(char *destination, uint64_t value, size_t count) {
+  /// Write a number as exactly count digits, zero padded, right to left
+  for(size_t i{count}; i != 0; --i) {
+    destination[i - 1] = static_cast<char>('0' + value % 10);
+    value /= 10;
+  }
+}
+
+void format_second(cached_text &entry, timestamp::types type, std::time_t second) {
+  /// Format the parts of a timestamp that only change once a second, leaving room for any sub-second digits
+  entry.second = second;
+  entry.fraction_offset = 0;
+  char const *format{nullptr};
+  switch(type) {
+  case timestamp::types::TIME:
+    format = "%H:%M:%S ";
+    break;
+  case timestamp::types::DATE:
+    format = "%Y-%m-%d ";
+    break;
+  case timestamp::types::DATE_TIME:
+    format = "%Y-%m-%d %H:%M:%S ";
+    break;
+  case timestamp::types::TIME_MICROSECONDS:
+    format = "%H:%M:%S.";
+    break;
+  case timestamp::types::DATE_TIME_MICROSECONDS:
+    format = "%Y-%m-%d %H:%M:%S.";
+    break;
+  case timestamp::types::UNIX:
+    {
+      auto const result{std::to_chars(entry.text.data(), entry.text.data() + entry.text.size() - 1, second)};
+      *result.ptr = ' ';
+      entry.length = static_cast<size_t>(result.ptr + 1 - entry.text.data());
+    }
+    return;
+  case timestamp::types::NONE:
+  case timestamp::types::SINCE_START:
+    entry.length = 0;
+    return;
+  }
+  std::tm const time_info{localtime_copy(second)};
+  entry.length = std::strftime(entry.text.data(), entry.text.size(), format, &time_info);
+  if(type == timestamp::types::TIME_MICROSECONDS || type == timestamp::types::DATE_TIME_MICROSECONDS) {
+    entry.fraction_offset = entry.length;
+    entry.text[entry.length + 6] = ' ';
+    entry.length += 7;
+  }
+}
+
 } // anonymous namespace
 
 timestamp::timestamp(types this_type)
@@ -25,48 +92,37 @@ timestamp::timestamp(types this_type)
 
 timestamp::~timestamp() = default;
 
-std::string timestamp::operator()() {
+std::string_view timestamp::operator()() const {
   /// Generate a timestamp as appropriate to this timestamp's type
   switch(type) {
   case types::NONE:
     return {};
-  case types::TIME:
+  case types::SINCE_START:
     {
-      std::time_t time{std::time(nullptr)};
-      std::tm time_info{localtime_copy(time)};
-      std::stringstream ss;
-      ss << std::put_time(&time_info, "%Y-%m-%d ");
-      return ss.str();
+      // give time in seconds to two decimal places
+      auto const centiseconds{static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - time_start).count() / 10)};
+      auto const result{std::to_chars(elapsed_text.data(), elapsed_text.data() + elapsed_text.size() - 4, centiseconds / 100)};
+      result.ptr[0] = '.';
+      write_digits(result.ptr + 1, centiseconds % 100, 2);
+      result.ptr[3] = ' ';
+      return {elapsed_text.data(), static_cast<size_t>(result.ptr + 4 - elapsed_text.data())};
     }
+  case types::TIME:
   case types::DATE:
-    {
-      std::time_t time{std::time(nullptr)};
-      std::tm time_info{localtime_copy(time)};
-      std::stringstream ss;
-      ss << std::put_time(&time_info, "%H:%M:%S ");
-      return ss.str();
-    }
   case types::DATE_TIME:
-    {
-      std::time_t time{std::time(nullptr)};
-      std::tm time_info{localtime_copy(time)};
-      std::stringstream ss;
-      ss << std::put_time(&time_info, "%Y-%m-%d %H:%M:%S ");
-      return ss.str();
-    }
   case types::UNIX:
+  case types::TIME_MICROSECONDS:
+  case types::DATE_TIME_MICROSECONDS:
     {
-      std::stringstream ss;
-      ss << std::time(nullptr) << " ";
-      return ss.str();
-    }
-  case types::SINCE_START:
-    {
-      // give time in seconds to two decimal places
-      std::chrono::duration<float> const time_elapsed{std::chrono::system_clock::now() - time_start};
-      std::stringstream ss;
-      ss << std::fixed << std::setprecision(2) << time_elapsed.count() << " ";
-      return ss.str();
+      auto const since_epoch{std::chrono::system_clock::now().time_since_epoch()};
+      auto const second{static_cast<std::time_t>(std::chrono::duration_cast<std::chrono::seconds>(since_epoch).count())};
+      auto &entry{cache[static_cast<size_t>(type)]};
+      if(entry.second != second) format_second(entry, type, second);
+      if(entry.fraction_offset != 0) {
+        auto const microseconds{static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(since_epoch).count() % 1'000'000)};
+        write_digits(entry.text.data() + entry.fraction_offset, microseconds, 6);
+      }
+      return {entry.text.data(), entry.length};
     }
   }
   #ifdef DISABLE_EXCEPTION_THROWING
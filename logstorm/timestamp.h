@@ -1,13 +1,17 @@
 #pragma once
 
 #include <chrono>
-#include <iomanip>
-#include <sstream>
+#include <string_view>
 
 namespace logstorm {
 
 class timestamp {
-  std::chrono::time_point<std::chrono::system_clock> time_start{std::chrono::system_clock::now()};
+  /// Formats the time for the start of a log line.
+  ///
+  /// Wall clock formats are cached per thread, per type and per second, so
+  /// most lines only copy the cached text and patch in the sub-second
+  /// digits, without locking.  Elapsed time is measured on a monotonic clock.
+  std::chrono::steady_clock::time_point time_start{std::chrono::steady_clock::now()};
 public:
   enum class types {
     NONE,
@@ -16,10 +20,12 @@ public:
     DATE_TIME,
     UNIX,
     SINCE_START,
+    TIME_MICROSECONDS,
+    DATE_TIME_MICROSECONDS,
     DEFAULT = NONE
   } type{types::DEFAULT};
 
-  std::string operator()();
+  std::string_view operator()() const;                                          // valid until the next timestamp is taken on the same thread
 
   explicit timestamp(types this_type = types::NONE);
   ~timestamp();
@@ -0,0 +1,202 @@
+#include "lz4_block.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace lz4_block {
+
+namespace {
+
+size_t constexpr min_match{4};
+size_t constexpr last_literals{5};                                              // the format requires the last 5 bytes to be literals
+size_t constexpr match_safe_distance{12};                                       // and the last match to start at least 12 bytes before the end
+size_t constexpr max_offset{65'535};
+unsigned int constexpr hash_bits{14};
+size_t constexpr wild_copy_size{16};
+
+uint32_t load32(std::byte const *ptr) {
+  /// Unaligned load
+  uint32_t value;
+  std::memcpy(&value, ptr, sizeof(value));
+  return value;
+}
+
+uint32_t hash_sequence(uint32_t const sequence) {
+  /// Fibonacci hash of four bytes into the match table
+  return (sequence * 2'654'435'761u) >> (32 - hash_bits);
+}
+
+std::byte *write_length(std::byte *op, size_t length) {
+  /// Write the continuation bytes of a literal or match length that didn't fit in its token nibble
+  while(length >= 255) {
+    *op++ = std::byte{255};
+    length -= 255;
+  }
+  *op++ = static_cast<std::byte>(length);
+  return op;
+}
+
+bool read_length(std::byte const *&ip, std::byte const *const end, size_t &length) {
+  /// Read the continuation bytes of a length, returning false if the input ends first
+  for(;;) {
+    if(ip == end) return false;
+    auto const value{static_cast<uint8_t>(*ip++)};
+    length += value;
+    if(value != 255) return true;
+  }
+}
+
+} // anonymous namespace
+
+size_t compress_bound(size_t const input_size) {
+  /// Worst-case compressed size for incompressible input
+  return input_size + input_size / 255 + 16;
+}
+
+size_t compress(std::span<std::byte const> input, std::vector<std::byte> &output, std::span<std::byte const> dictionary) {
+  /// Compress a block, appending it to the output, and return the compressed size
+  if(input.empty()) {                                                           // a lone token with no literals, and nothing to copy from a possibly null pointer
+    output.emplace_back(std::byte{0});
+    return 1;
+  }
+  size_t const output_start{output.size()};
+  output.resize(output_start + compress_bound(input.size()));                   // write through a pointer, and trim at the end
+  std::byte *op{output.data() + output_start};
+
+  // matches are found in a window of the dictionary's tail followed by the input
+  thread_local std::vector<std::byte> window;
+  thread_local std::vector<uint32_t> table;
+  if(dictionary.size() > max_dictionary_size) dictionary = dictionary.last(max_dictionary_size);
+  std::byte const *data{input.data()};
+  if(!dictionary.empty()) {
+    window.resize(dictionary.size() + input.size());
+    std::copy(dictionary.begin(), dictionary.end(), window.begin());
+    std::copy(input.begin(), input.end(), window.begin() + static_cast<ptrdiff_t>(dictionary.size()));
+    data = window.data();
+  }
+  size_t const start{dictionary.size()};
+  size_t const end{start + input.size()};
+
+  uint32_t constexpr empty{UINT32_MAX};
+  table.assign(size_t{1} << hash_bits, empty);
+  if(dictionary.size() >= min_match) {
+    for(size_t position{0}; position + min_match <= start; ++position) {
+      table[hash_sequence(load32(data + position))] = static_cast<uint32_t>(position);
+    }
+  }
+
+  auto const emit_sequence{[&](size_t const anchor, size_t const literal_end, size_t const offset, size_t const match_length){
+    size_t const literal_length{literal_end - anchor};
+    std::byte *const token{op++};
+    *token = static_cast<std::byte>(std::min<size_t>(literal_length, 15) << 4);
+    if(literal_length >= 15) op = write_length(op, literal_length - 15);
+    std::memcpy(op, data + anchor, literal_length);
+    op += literal_length;
+    if(match_length == 0) return;                                               // final literal-only sequence
+    *op++ = static_cast<std::byte>(offset & 0xFF);
+    *op++ = static_cast<std::byte>(offset >> 8);
+    size_t const match_code{match_length - min_match};
+    *token |= static_cast<std::byte>(std::min<size_t>(match_code, 15));
+    if(match_code >= 15) op = write_length(op, match_code - 15);
+  }};
+
+  size_t anchor{start};
+  if(input.size() > match_safe_distance) {
+    size_t const match_limit{end - match_safe_distance};
+    size_t const extend_limit{end - last_literals};
+    size_t position{start};
+    while(position < match_limit) {
+      uint32_t const sequence{load32(data + position)};
+      uint32_t &slot{table[hash_sequence(sequence)]};
+      size_t const candidate{slot};
+      slot = static_cast<uint32_t>(position);
+      if(candidate == empty || position - candidate > max_offset || load32(data + candidate) != sequence) {
+        position += 1 + ((position - anchor) >> 6);                             // skip faster through incompressible data
+        continue;
+      }
+
+      size_t match_start{position};
+      size_t reference{candidate};
+      while(match_start > anchor && reference > 0 && data[match_start - 1] == data[reference - 1]) { // extend backwards over pending literals
+        --match_start;
+        --reference;
+      }
+      size_t match_end{position + min_match};
+      while(match_end < extend_limit && data[match_end] == data[reference + (match_end - match_start)]) {
+        ++match_end;
+      }
+
+      emit_sequence(anchor, match_start, match_start - reference, match_end - match_start);
+      anchor = match_end;
+      position = match_end;
+      if(position - 2 < match_limit) {
+        table[hash_sequence(load32(data + position - 2))] = static_cast<uint32_t>(position - 2); // cheap extra insertion improves the ratio of the next match
+      }
+    }
+  }
+  emit_sequence(anchor, end, 0, 0);
+  auto const compressed_size{static_cast<size_t>(op - (output.data() + output_start))};
+  output.resize(output_start + compressed_size);
+  return compressed_size;
+}
+
+bool decompress(std::span<std::byte const> input, std::span<std::byte> output, std::span<std::byte const> dictionary) {
+  /// Decompress a block into an output buffer of exactly the original size, returning false if the input is malformed
+  if(output.empty()) return input.empty() || (input.size() == 1 && input.front() == std::byte{0}); // nothing to copy to a possibly null pointer
+  std::byte const *ip{input.data()};
+  std::byte const *const input_end{ip + input.size()};
+  std::byte *op{output.data()};
+  std::byte *const output_end{op + output.size()};
+
+  while(ip != input_end) {
+    auto const token{static_cast<uint8_t>(*ip++)};
+
+    size_t literal_length{static_cast<size_t>(token >> 4)};
+    if(literal_length == 15 && !read_length(ip, input_end, literal_length)) return false;
+    if(literal_length > static_cast<size_t>(input_end - ip) || literal_length > static_cast<size_t>(output_end - op)) return false;
+    if(literal_length <= wild_copy_size && static_cast<size_t>(input_end - ip) >= wild_copy_size && static_cast<size_t>(output_end - op) >= wild_copy_size) {
+      std::memcpy(op, ip, wild_copy_size);                                      // fixed-size copy of the common short run, overwriting bytes written later anyway
+    } else {
+      std::memcpy(op, ip, literal_length);
+    }
+    ip += literal_length;
+    op += literal_length;
+    if(ip == input_end) break;                                                  // the last sequence has no match
+
+    if(input_end - ip < 2) return false;
+    size_t const offset{static_cast<size_t>(static_cast<uint8_t>(ip[0])) | static_cast<size_t>(static_cast<uint8_t>(ip[1])) << 8};
+    ip += 2;
+    size_t match_length{static_cast<size_t>(token & 0x0F)};
+    if(match_length == 15 && !read_length(ip, input_end, match_length)) return false;
+    match_length += min_match;
+    if(offset == 0 || match_length > static_cast<size_t>(output_end - op)) return false;
+
+    auto const produced{static_cast<size_t>(op - output.data())};
+    std::byte const *match{offset > produced ? output.data() : op - offset};    // a dictionary match continues from the start of the output
+    if(offset > produced) {                                                     // the match starts in the dictionary
+      size_t const dictionary_back{offset - produced};
+      if(dictionary_back > dictionary.size()) return false;
+      size_t const from_dictionary{std::min(match_length, dictionary_back)};
+      std::memcpy(op, dictionary.data() + dictionary.size() - dictionary_back, from_dictionary);
+      op += from_dictionary;
+      match_length -= from_dictionary;
+    }
+    auto const distance{static_cast<size_t>(op - match)};
+    if(distance >= wild_copy_size && static_cast<size_t>(output_end - op) >= match_length + wild_copy_size) {
+      for(size_t i{0}; i < match_length; i += wild_copy_size) {                 // chunks never overlap their own source, and may overrun into space written later
+        std::memcpy(op + i, match + i, wild_copy_size);
+      }
+      op += match_length;
+    } else if(distance >= match_length) {
+      std::memcpy(op, match, match_length);
+      op += match_length;
+    } else {
+      for(size_t i{0}; i != match_length; ++i) {                                // overlapping copy repeats the pattern
+        *op++ = *match++;
+      }
+    }
+  }
+  return op == output_end;
+}
+
+} // namespace lz4_block
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include <vector>
+
+namespace lz4_block {
+  /// Compressor and decompressor for the LZ4 block format, with optional preset dictionary.
+  ///
+  /// Output is compatible with LZ4_compress_fast_usingDict / LZ4_decompress_safe_usingDict.
+  /// The compressor favours speed over ratio (single hash probe, greedy parsing);
+  /// the decompressor validates all lengths and offsets, so is safe on untrusted input.
+
+size_t constexpr max_dictionary_size{64 * 1024};                                // matches can reach back at most this far
+
+size_t compress_bound(size_t input_size);
+size_t compress(std::span<std::byte const> input, std::vector<std::byte> &output, std::span<std::byte const> dictionary = {});
+bool decompress(std::span<std::byte const> input, std::span<std::byte> output, std::span<std::byte const> dictionary = {});
+
+} // namespace lz4_block
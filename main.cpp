@@ -3,13 +3,21 @@
 #include <emscripten/fetch.h>
 #include <imgui/imgui_impl_wgpu.h>
 #include "logstorm/logstorm.h"
+#include "emscripten_fetch_manager.h"
 #include "gui/gui_renderer.h"
 #include "render/webgpu_renderer.h"
 
 class game_manager {
-  logstorm::manager logger{logstorm::manager::build_with_sink<logstorm::sink::emscripten_out>()}; // logging system
+  std::shared_ptr<logstorm::sink::circular_buffer> log_history{std::make_shared<logstorm::sink::circular_buffer>(100u << 20, logstorm::timestamp::types::TIME_MICROSECONDS)}; // the most recent 100MB of log lines, for the log viewer
+  logstorm::manager logger{[&]{                                                 // logging system
+    auto result{logstorm::manager::build_with_sink<logstorm::sink::emscripten_out>()};
+    result.add_sink(log_history);
+    return result;
+  }()};
   render::webgpu_renderer renderer{logger};                                     // WebGPU rendering system
-  gui::gui_renderer gui{logger};                                                // GUI top level
+  gui::gui_renderer gui{logger, log_history};                                   // GUI top level
+
+  std::chrono::microseconds completion_budget{4'000};                           // time per frame for network callbacks, with the rest carried over
 
   void loop_main();
 
@@ -37,6 +45,7 @@ game_manager::game_manager() {
 
 void game_manager::loop_main() {
   /// Main pseudo-loop
+  emscripten_fetch_manager::dispatch_completions(completion_budget);            // network callbacks change state only here, before the GUI reads it
   gui.draw();
   renderer.draw();
 }
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+// Compile-time reflection of aggregates: field count, references to fields, and field names.
+//
+// Fields are counted by how many initialisers the aggregate accepts, bound
+// with structured bindings, and named by parsing __PRETTY_FUNCTION__ for a
+// template instantiated with a pointer to each field, as magic_enum does for
+// enumerators.  Aggregates may not have base classes or C array members.
+
+namespace reflect {
+
+size_t constexpr max_fields{24};
+
+namespace detail {
+
+struct any_initialiser {
+  template<typename T>
+  operator T() const;                                                           // only used unevaluated, so never defined
+};
+
+template<typename T, size_t... I>
+consteval bool initialisable_with(std::index_sequence<I...>) {
+  /// Whether an aggregate can be initialised from this many values
+  return requires{T{(static_cast<void>(I), any_initialiser{})...};};
+}
+
+template<typename T, size_t N = 0>
+consteval size_t count_fields() {
+  /// Count an aggregate's fields as the most initialisers it accepts
+  if constexpr(N == max_fields || !initialisable_with<T>(std::make_index_sequence<N + 1>{})) {
+    static_assert(N != max_fields, "reflect: aggregate has too many fields");
+    return N;
+  } else {
+    return count_fields<T, N + 1>();
+  }
+}
+
+} // namespace detail
+
+template<typename T>
+concept reflectable = std::is_aggregate_v<T> && std::is_class_v<T>;
+
+template<reflectable T>
+inline size_t constexpr field_count{detail::count_fields<T>()};
+
+template<reflectable T>
+constexpr auto tie(T &object) {
+  /// Return a tuple of references to each of an aggregate's fields, in declaration order
+  size_t constexpr count{field_count<std::remove_const_t<T>>};
+  if constexpr(count == 0) {
+    return std::tie();
+  } else if constexpr(count == 1) {
+    auto &[f0]{object};
+    return std::tie(f0);
+  } else if constexpr(count == 2) {
+    auto &[f0, f1]{object};
+    return std::tie(f0, f1);
+  } else if constexpr(count == 3) {
+    auto &[f0, f1, f2]{object};
+    return std::tie(f0, f1, f2);
+  } else if constexpr(count == 4) {
+    auto &[f0, f1, f2, f3]{object};
+    return std::tie(f0, f1, f2, f3);
+  } else if constexpr(count == 5) {
+    auto &[f0, f1, f2, f3, f4]{object};
+    return std::tie(f0, f1, f2, f3, f4);
+  } else if constexpr(count == 6) {
+    auto &[f0, f1, f2, f3, f4, f5]{object};
+    return std::tie(f0, f1, f2, f3, f4, f5);
+  } else if constexpr(count == 7) {
+    auto &[f0, f1, f2, f3, f4, f5, f6]{object};
+    return std::tie(f0, f1, f2, f3, f4, f5, f6);
+  } else if constexpr(count == 8) {
+    auto &[f0, f1, f2, f3, f4, f5, f6, f7]{object};
+    return std::tie(f0, f1, f2, f3, f4, f5, f6, f7);
+  } else if constexpr(count == 9) {
+    auto &[f0, f1, f2, f3, f4, f5, f6, f7, f8]{object};
+    return std::tie(f0, f1, f2, f3, f4, f5, f6, f7, f8);
+  } else if constexpr(count == 10) {
+    auto &[f0, f1, f2, f3, f4, f5, f6, f7, f8, f9]{object};
+    return std::tie(f0, f1, f2, f3, f4, f5, f6, f7, f8, f9);
+  } else if constexpr(count == 11) {
+    auto &[f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10]{object};
+    return std::tie(f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10);
+  } else if constexpr(count == 12) {
+    auto &[f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11]{object};
+    return std::tie(f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11);
+  } else if constexpr(count == 13) {
+    auto &[f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12]{object};
+    return std::tie(f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12);
+  } else if constexpr(count == 14) {
+    auto &[f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13]{object};
+    return std::tie(f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13);
+  } else if constexpr(count == 15) {
+    auto &[f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14]{object};
+    return std::tie(f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14);
+  } else if constexpr(count == 16) {
+    auto &[f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15]{object};
+    return std::tie(f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15);
+  } else if constexpr(count == 17) {
+    auto &[f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15, f16]{object};
+    return std::tie(f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15, f16);
+  } else if constexpr(count == 18) {
+    auto &[f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15, f16, f17]{object};
+    return std::tie(f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15, f16, f17);
+  } else if constexpr(count == 19) {
+    auto &[f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15, f16, f17, f18]{object};
+    return std::tie(f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15, f16, f17, f18);
+  } else if constexpr(count == 20) {
+    auto &[f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15, f16, f17, f18, f19]{object};
+    return std::tie(f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15, f16, f17, f18, f19);
+  } else if constexpr(count == 21) {
+    auto &[f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15, f16, f17, f18, f19, f20]{object};
+    return std::tie(f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15, f16, f17, f18, f19, f20);
+  } else if constexpr(count == 22) {
+    auto &[f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15, f16, f17, f18, f19, f20, f21]{object};
+    return std::tie(f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15, f16, f17, f18, f19, f20, f21);
+  } else if constexpr(count == 23) {
+    auto &[f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15, f16, f17, f18, f19, f20, f21, f22]{object};
+    return std::tie(f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15, f16, f17, f18, f19, f20, f21, f22);
+  } else if constexpr(count == 24) {
+    auto &[f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15, f16, f17, f18, f19, f20, f21, f22, f23]{object};
+    return std::tie(f0, f1, f2, f3, f4, f5, f6, f7, f8, f9, f10, f11, f12, f13, f14, f15, f16, f17, f18, f19, f20, f21, f22, f23);
+  }
+}
+
+namespace detail {
+
+template<typename T>
+struct external {
+  T const value;
+};
+
+template<typename T>
+extern external<T> const external_object;                                       // never defined: only the addresses of its fields are taken, at compile time
+
+template<typename T>
+struct pointer_wrapper {                                                        // clang only accepts pointers to subobjects as template arguments when wrapped
+  T const *pointer;
+};
+
+template<typename T, auto Wrapper>
+consteval std::string_view pretty_name() {
+  /// The signature of this function, which names the field Wrapper points to
+  return __PRETTY_FUNCTION__;
+}
+
+consteval std::string_view parse_field_name(std::string_view signature) {
+  /// Extract the field name from the end of the template argument list in a pretty_name() signature
+  signature = signature.substr(0, signature.find_first_of(";]", signature.find("Wrapper"))); // gcc appends typedef expansions after a semicolon
+  size_t end{signature.find_last_not_of(")} ")};
+  size_t begin{end};
+  while(begin != 0) {
+    char const c{signature[begin - 1]};
+    if(!(c == '_' || (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))) break;
+    --begin;
+  }
+  return signature.substr(begin, end + 1 - begin);
+}
+
+#ifdef __clang__
+  #pragma clang diagnostic push
+  #pragma clang diagnostic ignored "-Wundefined-var-template"                   // external_object is deliberately never defined
+#endif // __clang__
+template<typename T, size_t I>
+consteval std::string_view unstable_field_name() {
+  /// The name of a field, as a view of a function's signature
+  return parse_field_name(pretty_name<T, pointer_wrapper{&std::get<I>(reflect::tie(external_object<T>.value))}>());
+}
+#ifdef __clang__
+  #pragma clang diagnostic pop
+#endif // __clang__
+
+template<typename T, size_t I>
+struct stored_name {                                                            // copied out of the signature, so only the name is kept in the binary
+  static size_t constexpr size{unstable_field_name<T, I>().size()};
+  static std::array<char, size> constexpr chars{[]{
+    std::array<char, size> result{};
+    std::string_view const name{unstable_field_name<T, I>()};
+    for(size_t i{0}; i != size; ++i) result[i] = name[i];
+    return result;
+  }()};
+};
+
+} // namespace detail
+
+template<reflectable T, size_t I>
+using field_type = std::remove_reference_t<std::tuple_element_t<I, decltype(reflect::tie(std::declval<T&>()))>>;
+
+template<reflectable T, size_t I>
+inline std::string_view constexpr field_name{detail::stored_name<T, I>::chars.data(), detail::stored_name<T, I>::size};
+
+template<reflectable T, typename F>
+constexpr void for_each_field(T &object, F &&function) {
+  /// Call a function with the name and a reference to each field of an aggregate, in declaration order
+  auto fields{reflect::tie(object)};
+  [&]<size_t... I>(std::index_sequence<I...>){
+    (function(field_name<std::remove_const_t<T>, I>, std::get<I>(fields)), ...);
+  }(std::make_index_sequence<field_count<std::remove_const_t<T>>>{});
+}
+
+} // namespace reflect
@@ -109,7 +109,7 @@ void webgpu_renderer::init(std::function<void(webgpu_data const&)> &&this_postin
         {
           // see https://developer.mozilla.org/en-US/docs/Web/API/GPUSupportedFeatures and https://www.w3.org/TR/webgpu/#feature-index
           auto const count{adapter.EnumerateFeatures(nullptr)};
-          logger << "DEBUG: WebGPU adapter features count: " << count;
+          LOGSTORM_DEBUG(logger) << "DEBUG: WebGPU adapter features count: " << count;
           std::vector<wgpu::FeatureName> adapter_features_arr(count);
           adapter.EnumerateFeatures(adapter_features_arr.data());
           for(unsigned int i{0}; i != adapter_features_arr.size(); ++i) {
@@ -117,7 +117,7 @@ void webgpu_renderer::init(std::function<void(webgpu_data const&)> &&this_postin
           }
         }
         for(auto const feature : adapter_features) {
-          logger << "DEBUG: WebGPU adapter features: " << enum_wgpu_name<wgpu::FeatureName, WGPUFeatureName>(feature);
+          LOGSTORM_DEBUG(logger) << "DEBUG: WebGPU adapter features: " << enum_wgpu_name<wgpu::FeatureName, WGPUFeatureName>(feature);
         }
 
         wgpu::SupportedLimits adapter_limits;
@@ -281,7 +281,7 @@ void webgpu_renderer::init(std::function<void(webgpu_data const&)> &&this_postin
               }
             }
             for(auto const feature : device_features) {
-              logger << "DEBUG: WebGPU device features: " << magic_enum::enum_name(feature);
+              LOGSTORM_DEBUG(logger) << "DEBUG: WebGPU device features: " << magic_enum::enum_name(feature);
             }
 
             device.SetUncapturedErrorCallback(
@@ -326,7 +326,7 @@ void webgpu_renderer::wait_to_configure_loop() {
   /// Check if initialisation has completed and the WebGPU system is ready for configuration
   /// Since init occurs asynchronously, some emscripten ticks are needed before this becomes true
   if(!webgpu.device) {
-    logger << "WebGPU: Waiting for device to become available";
+    LOGSTORM_RATE_LIMITED(logger, info, 1.0f, 1.0f) << "WebGPU: Waiting for device to become available"; // once a second rather than every frame
     // TODO: sensible timeout
     return;
   }
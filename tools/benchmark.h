@@ -0,0 +1,48 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string_view>
+#include <vector>
+
+namespace benchmark {
+
+template<typename T>
+inline void keep(T const &value) {
+  /// Stop the compiler discarding a result that's otherwise unused
+  asm volatile("" : : "g"(&value) : "memory");
+}
+
+template<typename F>
+double median_ns(unsigned int const repeats, F &&function) {
+  /// Time a function over a number of runs, returning the median in nanoseconds
+  std::vector<double> times;
+  times.reserve(repeats);
+  for(unsigned int i{0}; i != repeats; ++i) {
+    auto const start{std::chrono::steady_clock::now()};
+    function();
+    times.emplace_back(std::chrono::duration<double, std::nano>{std::chrono::steady_clock::now() - start}.count());
+  }
+  std::ranges::nth_element(times, times.begin() + times.size() / 2);
+  return times[times.size() / 2];
+}
+
+inline void report(std::string_view const name, double const nanoseconds, std::string_view const note = "") {
+  /// Print one result line, scaled to a readable unit
+  char const *unit{"ns"};
+  double value{nanoseconds};
+  if(value >= 1e9) {
+    value /= 1e9;
+    unit = "s";
+  } else if(value >= 1e6) {
+    value /= 1e6;
+    unit = "ms";
+  } else if(value >= 1e3) {
+    value /= 1e3;
+    unit = "us";
+  }
+  std::printf("%-48.*s %10.3f %-2s  %.*s\n", static_cast<int>(name.size()), name.data(), value, unit, static_cast<int>(note.size()), note.data());
+}
+
+}
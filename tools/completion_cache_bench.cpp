@@ -0,0 +1,85 @@
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "benchmark.h"
+#include "chat/completion_cache.h"
+
+int main() {
+  /// Time building cache keys, and lookups in the memory and persistent tiers, with ten thousand cached completions
+  size_t constexpr entry_count{10'000};
+  size_t constexpr response_bytes{1'500};                                       // fits all entries in the default 16MiB memory tier
+
+  std::mt19937 random{12345};
+  auto make_request{[&](size_t const index){
+    /// A reproducible request with a few turns of conversation
+    nlohmann::json request{
+      {"model", "gpt-4o-mini"},
+      {"temperature", 0.0},
+      {"messages", nlohmann::json::array()},
+    };
+    for(size_t turn{0}; turn != 6; ++turn) {
+      request["messages"].emplace_back(nlohmann::json{
+        {"role", turn % 2 == 0 ? "user" : "assistant"},
+        {"content", "Message " + std::to_string(turn) + " of conversation " + std::to_string(index) + std::string(200, 'x')},
+      });
+    }
+    return request;
+  }};
+  std::vector<hash_128> keys;
+  keys.reserve(entry_count);
+  std::string const response(response_bytes, 'r');
+
+  std::string const path{(std::filesystem::temp_directory_path() / "completion_cache_bench.cache").string()};
+  std::filesystem::remove(path);
+  chat::completion_cache cache{path};
+  cache.set_persistent(true);
+  nlohmann::json const sample_request{make_request(0)};
+  double const key_ns{benchmark::median_ns(1001, [&]{
+    benchmark::keep(chat::completion_cache::make_key(sample_request.dump()));
+  })};
+  benchmark::report("canonical dump and key", key_ns, std::to_string(sample_request.dump().size()) + " byte request");
+  for(size_t i{0}; i != entry_count; ++i) {
+    keys.emplace_back(chat::completion_cache::make_key(make_request(i).dump()));
+  }
+  double const put_ns{benchmark::median_ns(1, [&]{
+    for(auto const &key : keys) {
+      cache.put(key, response);
+    }
+  })};
+  benchmark::report("put, memory and file, per entry", put_ns / entry_count);
+
+  std::uniform_int_distribution<size_t> key_distribution{0, entry_count - 1};
+  auto time_lookups{[&](char const *name){
+    /// Time random lookups, checking every one hits
+    size_t hits{0};
+    double const ns{benchmark::median_ns(10'001, [&]{
+      cache.get(keys[key_distribution(random)], [&](std::optional<std::string_view> result){
+        if(result) ++hits;
+      });
+    })};
+    benchmark::report(name, ns, std::to_string(hits) + " of 10001 hit");
+  }};
+  time_lookups("memory hit");
+
+  chat::completion_cache reopened{path, 0};                                     // no memory tier, so every lookup goes to the file
+  reopened.set_persistent(true);
+  hash_128 const missing{chat::completion_cache::make_key("not cached")};
+  double const miss_ns{benchmark::median_ns(10'001, [&]{
+    reopened.get(missing, [](std::optional<std::string_view> result){
+      benchmark::keep(result);
+    });
+  })};
+  benchmark::report("miss", miss_ns);
+  size_t file_hits{0};
+  double const file_ns{benchmark::median_ns(10'001, [&]{
+    reopened.get(keys[key_distribution(random)], [&](std::optional<std::string_view> result){
+      if(result) ++file_hits;
+    });
+  })};
+  benchmark::report("persistent file hit", file_ns, std::to_string(file_hits) + " of 10001 hit");
+  std::filesystem::remove(path);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "benchmark.h"
+#include "chat/embedding_index.h"
+
+int main(int argc, char *argv[]) {
+  /// Index clustered random vectors the size of small embeddings, then time searches and measure recall against exhaustive search
+  size_t vector_count{50'000};                                                  // quick by default; pass 1000000 to measure at the scale the index is meant for
+  if(argc > 1 && std::from_chars(argv[1], argv[1] + std::strlen(argv[1]), vector_count).ec != std::errc{}) {
+    std::fprintf(stderr, "Usage: %s [vector count]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  unsigned int constexpr dimensions{256};
+  size_t constexpr cluster_count{500};
+  size_t constexpr query_count{200};
+  size_t constexpr k{10};
+
+  std::mt19937 random{12345};
+  std::normal_distribution<float> normal;
+  auto make_vectors{[&](size_t const count, std::vector<std::vector<float>> const &centres, float const spread){
+    /// Scatter vectors around randomly chosen centres, as embeddings of related texts are
+    std::uniform_int_distribution<size_t> centre_distribution{0, centres.size() - 1};
+    std::vector<std::vector<float>> vectors(count, std::vector<float>(dimensions));
+    for(auto &vector : vectors) {
+      auto const &centre{centres[centre_distribution(random)]};
+      for(unsigned int i{0}; i != dimensions; ++i) {
+        vector[i] = centre[i] + normal(random) * spread;
+      }
+    }
+    return vectors;
+  }};
+  std::vector<std::vector<float>> const centres{make_vectors(cluster_count, {std::vector<float>(dimensions)}, 1.0f)};
+  std::vector<std::vector<float>> vectors{make_vectors(vector_count, centres, 0.5f)};
+  std::vector<std::vector<float>> const queries{make_vectors(query_count, centres, 0.5f)};
+
+  chat::embedding_index index{dimensions};
+  index.reserve(vector_count);
+  double const build_ns{benchmark::median_ns(1, [&]{
+    for(auto const &vector : vectors) {
+      index.add(vector);
+    }
+  })};
+  std::printf("%zu vectors of %u dimensions in %zu clusters\n", vector_count, dimensions, cluster_count);
+  benchmark::report("add, per vector", build_ns / static_cast<double>(vector_count));
+
+  // exhaustive search over the vectors normalised in place, as the index has its own copies, for the true nearest neighbours
+  auto &normalised{vectors};
+  for(auto &vector : normalised) {
+    float length{0.0f};
+    for(float const value : vector) length += value * value;
+    length = std::sqrt(length);
+    for(float &value : vector) value /= length;
+  }
+  std::vector<std::vector<chat::embedding_index::slot>> truth(query_count);
+  double const exhaustive_ns{benchmark::median_ns(1, [&]{
+    std::vector<std::pair<float, chat::embedding_index::slot>> scored(vector_count);
+    for(size_t q{0}; q != query_count; ++q) {
+      for(size_t i{0}; i != vector_count; ++i) {
+        float dot{0.0f};
+        for(unsigned int d{0}; d != dimensions; ++d) dot += queries[q][d] * normalised[i][d];
+        scored[i] = {-dot, static_cast<chat::embedding_index::slot>(i)};
+      }
+      std::partial_sort(scored.begin(), scored.begin() + k, scored.end());
+      for(size_t i{0}; i != k; ++i) truth[q].emplace_back(scored[i].second);
+    }
+  })};
+  benchmark::report("exhaustive search, per query", exhaustive_ns / query_count);
+
+  for(unsigned int const ef : {16u, 32u, 64u, 128u}) {
+    size_t found{0};
+    double const search_ns{benchmark::median_ns(5, [&]{
+      found = 0;
+      for(size_t q{0}; q != query_count; ++q) {
+        auto const results{index.search(queries[q], k, ef)};
+        for(auto const &result : results) {
+          found += static_cast<size_t>(std::ranges::count(truth[q], result.id));
+        }
+        benchmark::keep(results);
+      }
+    })};
+    char note[64];
+    std::snprintf(note, sizeof(note), "recall@%zu %.3f", k, static_cast<double>(found) / static_cast<double>(query_count * k));
+    benchmark::report("search ef " + std::to_string(ef) + ", per query", search_ns / query_count, note);
+  }
+  return EXIT_SUCCESS;
+}
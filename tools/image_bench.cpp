@@ -0,0 +1,124 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+#include "base64.h"
+#include "benchmark.h"
+#include "chat/image.h"
+
+namespace {
+
+std::string reference_base64(std::vector<std::byte> const &input) {
+  /// Plain bit-shifting encoder, to check the vectorised one against
+  static char constexpr alphabet[]{"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"};
+  std::string output;
+  for(size_t i{0}; i < input.size(); i += 3) {
+    size_t const remaining{std::min<size_t>(input.size() - i, 3)};
+    uint32_t group{0};
+    for(size_t j{0}; j != 3; ++j) {
+      group = group << 8 | (j < remaining ? static_cast<uint32_t>(input[i + j]) : 0u);
+    }
+    for(size_t j{0}; j != 4; ++j) {
+      output += j <= remaining ? alphabet[group >> (18 - 6 * j) & 63] : '=';
+    }
+  }
+  return output;
+}
+
+std::vector<uint8_t> make_photo(chat::image::size const size) {
+  /// Smooth gradients with some noise, roughly like a photo
+  std::vector<uint8_t> pixels(static_cast<size_t>(size.width) * size.height * 4);
+  std::mt19937 random{42};
+  std::uniform_int_distribution<int> noise{-8, 8};
+  for(unsigned int y{0}; y != size.height; ++y) {
+    for(unsigned int x{0}; x != size.width; ++x) {
+      uint8_t *const pixel{pixels.data() + (static_cast<size_t>(y) * size.width + x) * 4};
+      pixel[0] = static_cast<uint8_t>(std::clamp(static_cast<int>(x * 255 / size.width) + noise(random), 0, 255));
+      pixel[1] = static_cast<uint8_t>(std::clamp(static_cast<int>(y * 255 / size.height) + noise(random), 0, 255));
+      pixel[2] = static_cast<uint8_t>(std::clamp(128 + noise(random) * 8, 0, 255));
+      pixel[3] = 255;
+    }
+  }
+  return pixels;
+}
+
+double weight(unsigned int const pixel, double const start, double const end) {
+  /// How much of a source pixel lies between two edges
+  return std::max(0.0, std::min(end, pixel + 1.0) - std::max(start, static_cast<double>(pixel)));
+}
+
+int max_error(std::vector<uint8_t> const &source, chat::image::size const source_size, std::vector<uint8_t> const &destination, chat::image::size const destination_size) {
+  /// Largest difference on any channel from an exact area average, computed in double precision
+  double const scale_x{static_cast<double>(source_size.width) / destination_size.width};
+  double const scale_y{static_cast<double>(source_size.height) / destination_size.height};
+  int worst{0};
+  for(unsigned int y{0}; y != destination_size.height; ++y) {
+    double const top{y * scale_y};
+    double const bottom{(y + 1) * scale_y};
+    for(unsigned int x{0}; x != destination_size.width; ++x) {
+      double const left{x * scale_x};
+      double const right{(x + 1) * scale_x};
+      double sums[4]{};
+      for(auto row{static_cast<unsigned int>(top)}; row < std::min(static_cast<unsigned int>(std::ceil(bottom)), source_size.height); ++row) {
+        for(auto column{static_cast<unsigned int>(left)}; column < std::min(static_cast<unsigned int>(std::ceil(right)), source_size.width); ++column) {
+          double const area{weight(row, top, bottom) * weight(column, left, right)};
+          for(unsigned int channel{0}; channel != 4; ++channel) {
+            sums[channel] += source[(static_cast<size_t>(row) * source_size.width + column) * 4 + channel] * area;
+          }
+        }
+      }
+      for(unsigned int channel{0}; channel != 4; ++channel) {
+        auto const exact{static_cast<int>(std::lround(sums[channel] / (scale_x * scale_y)))};
+        int const actual{destination[(static_cast<size_t>(y) * destination_size.width + x) * 4 + channel]};
+        worst = std::max(worst, std::abs(exact - actual));
+      }
+    }
+  }
+  return worst;
+}
+
+}
+
+int main() {
+  /// Time base64 encoding and downscaling of image attachments; build image_bench_scalar for the same without the vector paths
+  #if defined(__SSSE3__) && defined(__SSE4_1__)
+    std::printf("vectorised build\n");
+  #else
+    std::printf("scalar build\n");
+  #endif
+
+  for(size_t const bytes : {size_t{150'000}, size_t{3'500'000}}) {
+    std::vector<std::byte> input(bytes);
+    std::mt19937 random{1};
+    for(auto &byte : input) byte = static_cast<std::byte>(random());
+    std::string encoded;
+    encoded.reserve(base64::encoded_size(bytes));
+    double const encode_ns{benchmark::median_ns(201, [&]{
+      encoded.clear();
+      base64::encode_append(input, encoded);
+      benchmark::keep(encoded);
+    })};
+    bool const matches{encoded == reference_base64(input)};
+    char const *const note{matches ? "matches reference" : "MISMATCH"};
+    benchmark::report(("base64::encode_append " + std::to_string(bytes / 1000) + " KB").c_str(), encode_ns, note);
+  }
+
+  chat::image::size const photo_size{.width{4032}, .height{3024}};
+  std::vector<uint8_t> const photo{make_photo(photo_size)};
+  for(auto const detail : {chat::image::details::high, chat::image::details::low}) {
+    chat::image::size const fitted{chat::image::fit_for_upload(photo_size, detail)};
+    std::vector<uint8_t> downscaled(static_cast<size_t>(fitted.width) * fitted.height * 4);
+    double const downscale_ns{benchmark::median_ns(11, [&]{
+      chat::image::downscale(photo, photo_size, downscaled, fitted);
+      benchmark::keep(downscaled);
+    })};
+    std::string const name{"image::downscale 4032x3024 to " + std::to_string(fitted.width) + "x" + std::to_string(fitted.height)};
+    std::string const note{"max error " + std::to_string(max_error(photo, photo_size, downscaled, fitted))};
+    benchmark::report(name, downscale_ns, note);
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,120 @@
+#include <cstdio>
+#include <cstdlib>
+#include <optional>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "benchmark.h"
+#include "json_reflect.h"
+
+namespace {
+
+enum class priorities {
+  low,
+  normal,
+  high,
+};
+NLOHMANN_JSON_SERIALIZE_ENUM(priorities, {
+  {priorities::low,    "low"},
+  {priorities::normal, "normal"},
+  {priorities::high,   "high"},
+})
+
+struct location {
+  double latitude{0.0};
+  double longitude{0.0};
+};
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(location, latitude, longitude)
+
+struct item {
+  std::string name;
+  int quantity{0};
+  double price{0.0};
+  bool in_stock{false};
+  std::optional<std::string> note;
+  std::vector<std::string> tags;
+  priorities priority{priorities::normal};
+  location origin;
+};
+
+void from_json(nlohmann::json const &json, item &value) {
+  /// The conventional DOM decoder, for comparison
+  json.at("name").get_to(value.name);
+  json.at("quantity").get_to(value.quantity);
+  json.at("price").get_to(value.price);
+  json.at("in_stock").get_to(value.in_stock);
+  if(auto const &note{json.at("note")}; note.is_null()) {
+    value.note.reset();
+  } else {
+    value.note = note.get<std::string>();
+  }
+  json.at("tags").get_to(value.tags);
+  json.at("priority").get_to(value.priority);
+  json.at("origin").get_to(value.origin);
+}
+
+struct order {
+  std::string id;
+  std::vector<item> items;
+};
+NLOHMANN_DEFINE_TYPE_NON_INTRUSIVE(order, id, items)
+
+std::string make_document(size_t const item_count) {
+  /// An order with a number of nested items, serialised as a model's structured output would be
+  nlohmann::json items = nlohmann::json::array();
+  for(size_t i{0}; i != item_count; ++i) {
+    items.emplace_back(nlohmann::json{
+      {"name", "Item number " + std::to_string(i) + " with a \"quoted\" name"},
+      {"quantity", static_cast<int>(i * 3)},
+      {"price", 9.99 + static_cast<double>(i)},
+      {"in_stock", i % 3 != 0},
+      {"note", i % 2 == 0 ? nlohmann::json("Handle with care\nThis side up") : nlohmann::json{}},
+      {"tags", {"alpha", "beta", "gamma"}},
+      {"priority", i % 3 == 0 ? "low" : i % 3 == 1 ? "normal" : "high"},
+      {"origin", {{"latitude", 51.5 + static_cast<double>(i) * 0.01}, {"longitude", -0.12}}},
+    });
+  }
+  return nlohmann::json{
+    {"id", "order-12345"},
+    {"items", std::move(items)},
+  }.dump();
+}
+
+}
+
+int main() {
+  /// Compare decoding structured output straight into a struct with parsing a DOM and converting it
+  std::string const document{make_document(50)};
+  std::printf("%zu byte document, 50 nested objects\n", document.size());
+
+  order reused;
+  if(auto const result{json_reflect::decode_into(document, reused)}; !result) {
+    std::printf("ERROR decoding: %s\n", result.error().c_str());
+    return EXIT_FAILURE;
+  }
+  double const reuse_ns{benchmark::median_ns(1001, [&]{
+    benchmark::keep(json_reflect::decode_into(document, reused).has_value());
+    benchmark::keep(reused);
+  })};
+  benchmark::report("json_reflect::decode_into, reusing the struct", reuse_ns);
+
+  double const fresh_ns{benchmark::median_ns(1001, [&]{
+    benchmark::keep(json_reflect::decode<order>(document));
+  })};
+  benchmark::report("json_reflect::decode into a fresh struct", fresh_ns);
+
+  double const dom_ns{benchmark::median_ns(1001, [&]{
+    benchmark::keep(nlohmann::json::parse(document).get<order>());
+  })};
+  benchmark::report("nlohmann::json::parse then get<order>", dom_ns);
+
+  double const schema_ns{benchmark::median_ns(1001, [&]{
+    benchmark::keep(json_reflect::response_format<order>("order"));
+  })};
+  benchmark::report("json_reflect::response_format", schema_ns);
+
+  auto const dom{nlohmann::json::parse(document).get<order>()};
+  bool const same{dom.items.size() == reused.items.size() && dom.items.back().name == reused.items.back().name && dom.items.front().note == reused.items.front().note};
+  std::printf("decoders agree: %s\n", same ? "yes" : "NO");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,302 @@
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "benchmark.h"
+#include "chat/local_model.h"
+
+namespace {
+
+class gguf_writer {
+  /// Just enough of a GGUF writer to build a model with random weights in memory
+  struct tensor_info {
+    std::string name;
+    std::vector<uint64_t> dimensions;
+    chat::gguf::tensor_types type;
+    std::vector<std::byte> data;
+  };
+
+  std::vector<std::byte> metadata;
+  uint64_t metadata_count{0};
+  std::vector<tensor_info> tensors;
+
+  template<typename T>
+  static void put(std::vector<std::byte> &output, T const value) {
+    auto const *const bytes{reinterpret_cast<std::byte const*>(&value)};
+    output.insert(output.end(), bytes, bytes + sizeof(value));
+  }
+
+  static void put_string(std::vector<std::byte> &output, std::string_view const text) {
+    put<uint64_t>(output, text.size());
+    auto const *const bytes{reinterpret_cast<std::byte const*>(text.data())};
+    output.insert(output.end(), bytes, bytes + text.size());
+  }
+
+  void key(std::string_view const name, uint32_t const type) {
+    ++metadata_count;
+    put_string(metadata, name);
+    put<uint32_t>(metadata, type);
+  }
+
+public:
+  void add_uint(std::string_view const name, uint32_t const value) {
+    key(name, 4);
+    put<uint32_t>(metadata, value);
+  }
+
+  void add_string(std::string_view const name, std::string_view const value) {
+    key(name, 8);
+    put_string(metadata, value);
+  }
+
+  void add_strings(std::string_view const name, std::vector<std::string> const &values) {
+    key(name, 9);
+    put<uint32_t>(metadata, 8);
+    put<uint64_t>(metadata, values.size());
+    for(auto const &value : values) put_string(metadata, value);
+  }
+
+  void add_floats(std::string_view const name, std::vector<float> const &values) {
+    key(name, 9);
+    put<uint32_t>(metadata, 6);
+    put<uint64_t>(metadata, values.size());
+    for(float const value : values) put<float>(metadata, value);
+  }
+
+  void add_ints(std::string_view const name, std::vector<int32_t> const &values) {
+    key(name, 9);
+    put<uint32_t>(metadata, 5);
+    put<uint64_t>(metadata, values.size());
+    for(int32_t const value : values) put<int32_t>(metadata, value);
+  }
+
+  void add_tensor(std::string name, std::vector<uint64_t> dimensions, chat::gguf::tensor_types const type, std::vector<std::byte> data) {
+    tensors.emplace_back(tensor_info{std::move(name), std::move(dimensions), type, std::move(data)});
+  }
+
+  std::vector<std::byte> finish() const {
+    /// Header, metadata, tensor directory, then the tensor data, each tensor aligned to 32 bytes
+    std::vector<std::byte> output;
+    put<uint32_t>(output, 0x46554747);
+    put<uint32_t>(output, 3);
+    put<uint64_t>(output, tensors.size());
+    put<uint64_t>(output, metadata_count);
+    output.insert(output.end(), metadata.begin(), metadata.end());
+    uint64_t offset{0};
+    for(auto const &tensor : tensors) {
+      put_string(output, tensor.name);
+      put<uint32_t>(output, static_cast<uint32_t>(tensor.dimensions.size()));
+      for(uint64_t const dimension : tensor.dimensions) put<uint64_t>(output, dimension);
+      put<uint32_t>(output, static_cast<uint32_t>(tensor.type));
+      put<uint64_t>(output, offset);
+      offset = (offset + tensor.data.size() + 31) & ~uint64_t{31};
+    }
+    for(auto const &tensor : tensors) {
+      output.resize((output.size() + 31) & ~size_t{31});
+      output.insert(output.end(), tensor.data.begin(), tensor.data.end());
+    }
+    return output;
+  }
+};
+
+struct model_shape {
+  unsigned int embedding;
+  unsigned int layers;
+  unsigned int heads;
+  unsigned int kv_heads;
+  unsigned int feed_forward;
+  unsigned int context;
+};
+
+std::vector<std::string> const words{
+  "the", "model", "runs", "in", "browser", "with", "a", "small", "vocabulary", "and", "quantised", "weights",
+  "each", "token", "is", "evaluated", "one", "at", "time", "so", "prompt", "grows", "by", "turn", "only",
+  "new", "messages", "are", "cache", "keeps", "keys", "values", "between", "requests", "user", "assistant",
+  "system", "you", "helpful", "answer", "question", "about", "weather", "today", "tomorrow", "please", "short",
+};
+
+std::vector<std::byte> make_model(model_shape const &shape, std::mt19937 &random) {
+  /// A llama model with random Q8_0 weights, unit norms, and a SentencePiece vocabulary of byte tokens and word prefixes
+  std::vector<std::string> pieces{"<unk>", "<s>", "</s>", "<|im_start|>", "<|im_end|>"};
+  std::vector<int32_t> types{2, 3, 3, 3, 3};
+  for(unsigned int byte{0}; byte != 256; ++byte) {
+    char name[8];
+    std::snprintf(name, sizeof(name), "<0x%02X>", byte);
+    pieces.emplace_back(name);
+    types.emplace_back(6);
+  }
+  std::vector<float> scores(pieces.size(), 0.0f);
+  auto const add_piece{[&](std::string const &piece){
+    if(std::ranges::find(pieces, piece) != pieces.end()) return;
+    pieces.emplace_back(piece);
+    types.emplace_back(1);
+    scores.emplace_back(static_cast<float>(piece.size()));                      // longer merges first
+  }};
+  for(char c{' '}; c <= '~'; ++c) add_piece(std::string{c});
+  for(auto const &word : words) {
+    std::string const marked{"▁" + word};
+    for(size_t length{1}; length <= word.size(); ++length) {
+      add_piece(marked.substr(0, 3 + length));                                  // every prefix, so merges can build the word
+      add_piece(word.substr(0, length));
+    }
+  }
+  while(pieces.size() % 32 != 0) add_piece("<unused" + std::to_string(pieces.size()) + ">");
+  auto const vocabulary{static_cast<unsigned int>(pieces.size())};
+
+  gguf_writer writer;
+  writer.add_string("general.architecture", "llama");
+  writer.add_string("general.name", "bench");
+  writer.add_uint("llama.embedding_length", shape.embedding);
+  writer.add_uint("llama.block_count", shape.layers);
+  writer.add_uint("llama.attention.head_count", shape.heads);
+  writer.add_uint("llama.attention.head_count_kv", shape.kv_heads);
+  writer.add_uint("llama.feed_forward_length", shape.feed_forward);
+  writer.add_uint("llama.context_length", shape.context);
+  writer.add_string("tokenizer.ggml.model", "llama");
+  writer.add_strings("tokenizer.ggml.tokens", pieces);
+  writer.add_floats("tokenizer.ggml.scores", scores);
+  writer.add_ints("tokenizer.ggml.token_type", types);
+  writer.add_uint("tokenizer.ggml.bos_token_id", 1);
+  writer.add_uint("tokenizer.ggml.eos_token_id", 2);
+
+  std::uniform_int_distribution<int> weight{-127, 127};
+  auto const q8_0{[&](unsigned int const columns, unsigned int const rows){
+    std::vector<std::byte> data;
+    data.reserve(static_cast<size_t>(columns) / 32 * 34 * rows);
+    for(size_t block{0}; block != static_cast<size_t>(columns) / 32 * rows; ++block) {
+      data.emplace_back(std::byte{0x00});                                       // an f16 scale of 2^-7, little-endian
+      data.emplace_back(std::byte{0x20});
+      for(unsigned int i{0}; i != 32; ++i) data.emplace_back(static_cast<std::byte>(weight(random)));
+    }
+    return data;
+  }};
+  auto const ones{[](unsigned int const size){
+    std::vector<std::byte> data(size * sizeof(float));
+    for(unsigned int i{0}; i != size; ++i) {
+      float const one{1.0f};
+      std::memcpy(data.data() + i * sizeof(float), &one, sizeof(one));
+    }
+    return data;
+  }};
+  using types_enum = chat::gguf::tensor_types;
+  unsigned int const kv_dimension{shape.embedding / shape.heads * shape.kv_heads};
+  writer.add_tensor("token_embd.weight", {shape.embedding, vocabulary}, types_enum::q8_0, q8_0(shape.embedding, vocabulary));
+  for(unsigned int l{0}; l != shape.layers; ++l) {
+    std::string const prefix{"blk." + std::to_string(l) + "."};
+    writer.add_tensor(prefix + "attn_norm.weight", {shape.embedding}, types_enum::f32, ones(shape.embedding));
+    writer.add_tensor(prefix + "attn_q.weight", {shape.embedding, shape.embedding}, types_enum::q8_0, q8_0(shape.embedding, shape.embedding));
+    writer.add_tensor(prefix + "attn_k.weight", {shape.embedding, kv_dimension}, types_enum::q8_0, q8_0(shape.embedding, kv_dimension));
+    writer.add_tensor(prefix + "attn_v.weight", {shape.embedding, kv_dimension}, types_enum::q8_0, q8_0(shape.embedding, kv_dimension));
+    writer.add_tensor(prefix + "attn_output.weight", {shape.embedding, shape.embedding}, types_enum::q8_0, q8_0(shape.embedding, shape.embedding));
+    writer.add_tensor(prefix + "ffn_norm.weight", {shape.embedding}, types_enum::f32, ones(shape.embedding));
+    writer.add_tensor(prefix + "ffn_gate.weight", {shape.embedding, shape.feed_forward}, types_enum::q8_0, q8_0(shape.embedding, shape.feed_forward));
+    writer.add_tensor(prefix + "ffn_up.weight", {shape.embedding, shape.feed_forward}, types_enum::q8_0, q8_0(shape.embedding, shape.feed_forward));
+    writer.add_tensor(prefix + "ffn_down.weight", {shape.feed_forward, shape.embedding}, types_enum::q8_0, q8_0(shape.feed_forward, shape.embedding));
+  }
+  writer.add_tensor("output_norm.weight", {shape.embedding}, types_enum::f32, ones(shape.embedding));
+  return writer.finish();                                                       // output weights are tied to the embeddings
+}
+
+std::vector<std::byte> make_crafted(std::vector<uint64_t> const &dimensions) {
+  /// A file whose only tensor claims a shape whose size in bytes wraps to almost nothing
+  gguf_writer writer;
+  writer.add_string("general.architecture", "llama");
+  writer.add_tensor("token_embd.weight", dimensions, chat::gguf::tensor_types::f32, std::vector<std::byte>(64));
+  return writer.finish();
+}
+
+}
+
+int main() {
+  /// Time loading, tokenising and evaluating a local model with random weights; build local_model_bench_scalar for the same without the vector paths
+  #ifdef __SSE4_1__
+    std::printf("vectorised build\n");
+  #else
+    std::printf("scalar build\n");
+  #endif
+  std::mt19937 random{7};
+  model_shape const shape{.embedding{768}, .layers{12}, .heads{12}, .kv_heads{4}, .feed_forward{1536}, .context{512}};
+  std::vector<std::byte> const file{make_model(shape, random)};
+  std::printf("%u layers, %u wide, %zu MB\n", shape.layers, shape.embedding, file.size() >> 20);
+
+  double const load_ns{benchmark::median_ns(5, [&]{
+    benchmark::keep(chat::local_model::load(std::vector<std::byte>{file}, shape.context).has_value());
+  })};
+  benchmark::report("load, including copying the file", load_ns);
+  auto model{chat::local_model::load(std::vector<std::byte>{file}, shape.context)};
+  if(!model) {
+    std::printf("ERROR loading: %s\n", model.error().c_str());
+    return EXIT_FAILURE;
+  }
+
+  std::string conversation;
+  std::uniform_int_distribution<size_t> pick{0, words.size() - 1};
+  for(unsigned int turn{0}; turn != 8; ++turn) {
+    conversation += turn % 2 == 0 ? "<|im_start|>user\n" : "<|im_start|>assistant\n";
+    for(unsigned int i{0}; i != 40; ++i) conversation += words[pick(random)] + (i % 9 == 8 ? ". " : " ");
+    conversation += "<|im_end|>\n";
+  }
+  auto const &vocabulary{model->get_tokenizer()};
+  std::vector<chat::tokenizer::token> prompt;
+  double const encode_ns{benchmark::median_ns(101, [&]{
+    prompt.assign(1, vocabulary.get_bos());
+    vocabulary.encode(conversation, prompt);
+    benchmark::keep(prompt);
+  })};
+  benchmark::report("tokenise a " + std::to_string(conversation.size()) + " byte conversation", encode_ns, std::to_string(prompt.size()) + " tokens");
+  prompt.resize(std::min<size_t>(prompt.size(), 128));
+
+  auto const prompt_rate{[&](double const ns){
+    return std::to_string(static_cast<int>(static_cast<double>(prompt.size()) * 1e9 / ns)) + " tok/s";
+  }};
+  std::vector<float> single_logits;
+  double const single_ns{benchmark::median_ns(3, [&]{
+    model->reuse_prefix({});
+    std::span<float const> logits;
+    for(size_t i{0}; i != prompt.size(); ++i) logits = model->evaluate(prompt[i], i + 1 == prompt.size());
+    single_logits.assign(logits.begin(), logits.end());
+  })};
+  benchmark::report("evaluate a " + std::to_string(prompt.size()) + " token prompt a token at a time", single_ns, prompt_rate(single_ns));
+  std::vector<float> batched_logits;
+  double const prompt_ns{benchmark::median_ns(5, [&]{
+    model->reuse_prefix({});
+    auto const logits{model->evaluate(prompt, true)};
+    batched_logits.assign(logits.begin(), logits.end());
+  })};
+  benchmark::report("evaluate a " + std::to_string(prompt.size()) + " token prompt in batches of " + std::to_string(chat::local_model::batch_size), prompt_ns, prompt_rate(prompt_ns));
+  bool const batched_identical{batched_logits == single_logits};                // each position's arithmetic is the same in a batch as alone
+  std::printf("batched prompt gives identical logits: %s\n", batched_identical ? "yes" : "NO");
+
+  std::vector<float> first_logits;
+  std::ranges::copy(model->evaluate(prompt.back(), true), std::back_inserter(first_logits)); // the prompt's last token again, at the next position
+  chat::tokenizer::token next{0};
+  double const token_ns{benchmark::median_ns(64, [&]{
+    auto const logits{model->evaluate(next, true)};
+    next = static_cast<chat::tokenizer::token>(std::ranges::max_element(logits) - logits.begin());
+  })};
+  benchmark::report("generate a token", token_ns, std::to_string(static_cast<int>(1e9 / token_ns)) + " tok/s");
+
+  std::vector<chat::tokenizer::token> extended{prompt};
+  extended.emplace_back(prompt.back());
+  model->reuse_prefix(extended);                                                // keeps the prompt, so only the repeated token is evaluated again
+  bool const identical{std::ranges::equal(model->evaluate(extended.back(), true), first_logits)};
+  std::printf("reused prefix gives identical logits: %s\n", identical ? "yes" : "NO");
+
+  auto const wrapping{chat::local_model::load(make_crafted({32, uint64_t{1} << 57}))}; // 2^62 floats, so 2^64 bytes
+  std::printf("tensor size that wraps: %s\n", wrapping ? "ACCEPTED" : wrapping.error().c_str());
+  auto const overflowing{chat::local_model::load(make_crafted({uint64_t{1} << 32, uint64_t{1} << 32}))};
+  std::printf("element count that wraps: %s\n", overflowing ? "ACCEPTED" : overflowing.error().c_str());
+  model_shape const long_context{.embedding{32}, .layers{1}, .heads{1}, .kv_heads{1}, .feed_forward{32}, .context{1u << 30}};
+  auto const huge_cache{chat::local_model::load(make_model(long_context, random), UINT_MAX)};
+  std::printf("oversized cache: %s\n", huge_cache ? "ACCEPTED" : huge_cache.error().c_str());
+  return batched_identical && identical ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,153 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include "benchmark.h"
+#include "logstorm/manager.h"
+#include "logstorm/sink/base.h"
+
+namespace {
+
+uint64_t allocations{0};                                                        // counted by the replaced operator new below
+
+}
+
+void *operator new(size_t size) {
+  /// Count every allocation, to show which ways of building a line allocate
+  ++allocations;
+  if(void *const result{std::malloc(size == 0 ? 1 : size)}) return result;
+  throw std::bad_alloc{};
+}
+[[gnu::noinline]] void operator delete(void *pointer) noexcept {                // kept out of line, or GCC warns of free() on memory from new
+  /// Release an allocation made above
+  std::free(pointer);
+}
+[[gnu::noinline]] void operator delete(void *pointer, size_t) noexcept {
+  /// Release an allocation made above
+  std::free(pointer);
+}
+
+namespace {
+
+template<typename F>
+std::string allocations_per_line(unsigned int const lines, F &&function) {
+  /// Run a batch of lines once, and describe how many allocations each line made on average
+  uint64_t const before{allocations};
+  function();
+  char note[64];
+  std::snprintf(note, sizeof(note), "per line, %.2f allocations", static_cast<double>(allocations - before) / lines);
+  return note;
+}
+
+class capture : public logstorm::sink::base {
+  /// Sink keeping the last line logged, to compare with a stream's output
+public:
+  std::string last;
+
+  virtual void log(std::string_view log_entry) override final {
+    /// Keep the line
+    last = log_entry;
+  }
+  virtual void log_fragment(std::string_view log_entry) override final {
+    /// Keep the fragment
+    last = log_entry;
+  }
+};
+
+struct values {
+  int frame;
+  double milliseconds;
+  uint64_t bytes;
+  bool ok;
+  float ratio;
+  int64_t offset;
+  double tiny;
+  char separator;
+  signed char grade;
+  uint8_t code;
+};
+
+template<typename Destination>
+void write_line(Destination &destination, values const &line) {
+  /// A typical line mixing text, integers, floating point and characters
+  destination << "frame " << line.frame << " took " << line.milliseconds << "ms, " << line.bytes << " bytes, ok " << line.ok
+              << " ratio " << line.ratio << " offset " << line.offset << " tiny " << line.tiny
+              << line.separator << " grade " << line.grade << " code " << line.code;
+}
+
+std::string streamed(values const &line) {
+  /// The line as a std::ostringstream builds it, which is how every line was built before
+  std::ostringstream stream;
+  write_line(stream, line);
+  return stream.str();
+}
+
+std::string logged(logstorm::manager &logger, capture const &sink, values const &line) {
+  /// The line as log_line_helper builds it
+  {
+    auto helper{logger.at(logstorm::levels::info)};
+    write_line(helper, line);
+  }
+  return sink.last;
+}
+
+}
+
+int main() {
+  /// Time building log lines in place against a stream per line, and check the output is identical
+  values const samples[]{
+    {.frame{1}, .milliseconds{16.6667}, .bytes{1'048'576}, .ok{true}, .ratio{0.5f}, .offset{-12'345}, .tiny{1e-7}, .separator{';'}, .grade{'A'}, .code{'z'}},
+    {.frame{-2'147'483'647 - 1}, .milliseconds{123456789.0}, .bytes{UINT64_MAX}, .ok{false}, .ratio{3.40282e38f}, .offset{INT64_MIN}, .tiny{0.0}, .separator{','}, .grade{'-'}, .code{'0'}},
+    {.frame{0}, .milliseconds{1.0 / 3.0}, .bytes{0}, .ok{true}, .ratio{-0.0f}, .offset{0}, .tiny{-2.5e-300}, .separator{' '}, .grade{'~'}, .code{'!'}},
+  };
+
+  auto sink{std::make_shared<capture>()};
+  logstorm::manager logger;
+  logger.add_sink(sink);
+  logger.set_flush_level(logstorm::levels::none);
+
+  bool identical{true};
+  for(auto const &sample : samples) {
+    std::string const expected{streamed(sample)};
+    std::string const actual{logged(logger, *sink, sample)};
+    if(actual != expected) {
+      std::printf("MISMATCH\n  stream: %s\n  helper: %s\n", expected.c_str(), actual.c_str());
+      identical = false;
+    }
+  }
+  std::printf("output matches a stream: %s\n", identical ? "yes" : "NO");
+
+  unsigned int constexpr lines{1'000};
+  auto const stream_batch{[&]{
+    for(unsigned int i{0}; i != lines; ++i) {
+      benchmark::keep(streamed(samples[i % std::size(samples)]));
+    }
+  }};
+  benchmark::report("std::ostringstream per line", benchmark::median_ns(101, stream_batch) / lines, allocations_per_line(lines, stream_batch));
+
+  auto const helper_batch{[&]{
+    for(unsigned int i{0}; i != lines; ++i) {
+      auto helper{logger.at(logstorm::levels::info)};
+      write_line(helper, samples[i % std::size(samples)]);
+    }
+    benchmark::keep(sink->last);
+  }};
+  benchmark::report("log_line_helper, in place", benchmark::median_ns(101, helper_batch) / lines, allocations_per_line(lines, helper_batch) + ", including the sink");
+
+  std::string const long_text(300, 'x');
+  auto const spill_batch{[&]{
+    for(unsigned int i{0}; i != lines; ++i) {
+      auto helper{logger.at(logstorm::levels::info)};
+      helper << long_text << ' ';
+      write_line(helper, samples[i % std::size(samples)]);
+    }
+    benchmark::keep(sink->last);
+  }};
+  benchmark::report("log_line_helper, outgrowing the inline buffer", benchmark::median_ns(101, spill_batch) / lines, allocations_per_line(lines, spill_batch) + ", including the sink");
+
+  return identical ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,37 @@
+#include <fstream>
+#include <iostream>
+#include <string_view>
+#include "logstorm/binary_decoder.h"
+
+int main(int argc, char *argv[]) {
+  /// Decode a LogStorm binary log to text on standard output
+  logstorm::binary::decode_options options;
+  char const *filename{nullptr};
+  for(int i{1}; i != argc; ++i) {
+    std::string_view const arg{argv[i]};
+    if(arg == "--sites") {
+      options.show_sites = true;
+    } else if(!filename) {
+      filename = argv[i];
+    } else {
+      filename = nullptr;
+      break;
+    }
+  }
+  if(!filename) {
+    std::cerr << "Usage: " << argv[0] << " [--sites] <binary log>" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::ifstream input{filename, std::ios_base::binary};
+  if(!input.good()) {
+    std::cerr << "ERROR opening " << filename << std::endl;
+    return EXIT_FAILURE;
+  }
+  if(auto const result{logstorm::binary::decode(input, std::cout, options)}; !result) {
+    std::cout.flush();
+    std::cerr << "ERROR decoding " << filename << ": " << result.error() << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
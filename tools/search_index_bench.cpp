@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+#include "benchmark.h"
+#include "chat/search_index.h"
+
+namespace {
+
+std::vector<std::string> make_vocabulary(size_t const size) {
+  /// Make distinct pronounceable words, the commonest first and shortest
+  static char const *const syllables[]{"ka", "lo", "mi", "ne", "ru", "sa", "ti", "vo", "de", "pa", "qui", "zen", "bor", "fel", "gan", "hil"};
+  std::vector<std::string> words;
+  words.reserve(size);
+  for(size_t i{0}; words.size() != size; ++i) {
+    std::string word;
+    for(size_t n{i + 1}; n != 0; n /= 17) {
+      if(n % 17 == 0) break;
+      word += syllables[n % 17 - 1];
+    }
+    if(!word.empty()) words.emplace_back(std::move(word));
+  }
+  return words;
+}
+
+}
+
+int main() {
+  /// Index a million generated messages with a Zipf vocabulary, then time typical queries
+  size_t constexpr message_count{1'000'000};
+  size_t constexpr vocabulary_size{50'000};
+  std::vector<std::string> const vocabulary{make_vocabulary(vocabulary_size)};
+  std::vector<double> weights(vocabulary_size);
+  for(size_t i{0}; i != vocabulary_size; ++i) {
+    weights[i] = 1.0 / std::pow(static_cast<double>(i + 1), 1.07);
+  }
+  std::mt19937 random{12345};
+  std::discrete_distribution<size_t> word_distribution{weights.begin(), weights.end()};
+  std::uniform_int_distribution<size_t> length_distribution{4, 60};
+
+  std::vector<std::string> messages(message_count);
+  size_t tokens{0};
+  for(auto &message : messages) {
+    size_t const length{length_distribution(random)};
+    tokens += length;
+    for(size_t i{0}; i != length; ++i) {
+      if(i != 0) message += ' ';
+      message += vocabulary[word_distribution(random)];
+    }
+  }
+
+  chat::search_index index;
+  double const index_ns{benchmark::median_ns(1, [&]{
+    for(size_t i{0}; i != message_count; ++i) {
+      index.update(static_cast<chat::search_index::message_id>(i), messages[i]);
+    }
+  })};
+  std::printf("%zu messages, %zu tokens, %zu words in the vocabulary\n", message_count, tokens, vocabulary_size);
+  benchmark::report("index everything", index_ns);
+  benchmark::report("index, per message", index_ns / static_cast<double>(message_count));
+
+  struct query {
+    char const *name;
+    std::string text;
+  };
+  std::vector<query> const queries{
+    {"common term",                    vocabulary[0] + ' '},
+    {"rare term",                      vocabulary[20'000] + ' '},
+    {"rare and common terms",          vocabulary[20'000] + ' ' + vocabulary[0] + ' '},
+    {"mid and common terms",           vocabulary[500] + ' ' + vocabulary[1] + ' '},
+    {"two common terms",               vocabulary[0] + ' ' + vocabulary[1] + ' '},
+    {"phrase of common terms",         '"' + vocabulary[0] + ' ' + vocabulary[1] + '"'},
+    {"phrase with a rare term",        '"' + vocabulary[0] + ' ' + vocabulary[5'000] + '"'},
+    {"rare term and common phrase",    vocabulary[20'000] + " \"" + vocabulary[0] + ' ' + vocabulary[1] + '"'},
+    {"prefix",                         vocabulary[3].substr(0, 2) + '*'},
+    {"rare term and prefix, typing",   vocabulary[20'000] + ' ' + vocabulary[3].substr(0, 2)},
+  };
+  bool identical{true};                                                         // whether passing over documents that can't make the top results ever loses one
+  for(auto const &this_query : queries) {
+    auto const exhaustive{index.search(this_query.text, std::numeric_limits<size_t>::max())};
+    auto const top{index.search(this_query.text, 50)};
+    bool const same{top.size() == std::min<size_t>(50, exhaustive.size()) && std::equal(top.begin(), top.end(), exhaustive.begin(), [](auto const &lhs, auto const &rhs){
+      return std::abs(lhs.score - rhs.score) <= 1e-5f * rhs.score;              // lists may be summed in another order
+    })};
+    if(!same) std::printf("MISMATCH against an exhaustive search: %s\n", this_query.name);
+    identical = identical && same;
+  }
+  std::printf("top results match an exhaustive search: %s\n", identical ? "yes" : "NO");
+
+  for(auto const &this_query : queries) {
+    size_t results{0};
+    double const ns{benchmark::median_ns(21, [&]{
+      auto const found{index.search(this_query.text, 50)};
+      results = found.size();
+      benchmark::keep(found);
+    })};
+    benchmark::report(this_query.name, ns, std::to_string(results) + " results");
+  }
+  return identical ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,118 @@
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+#include "benchmark.h"
+#include "chat/conversation_tree.h"
+#include "chat/snapshot.h"
+
+namespace {
+
+size_t count_images(chat::conversation_tree const &conversation) {
+  /// Count the images attached across every branch
+  size_t count{0};
+  conversation.for_each_node([&](chat::conversation_tree::node const &node){
+    count += conversation.get_images(node).size();
+  });
+  return count;
+}
+
+bool removing_active_last_branch_resets_path() {
+  /// Regression check: removing the active branch when it's the last one must drop the cached path to its freed messages
+  chat::conversation_tree conversation;
+  conversation.append({.role{chat::message::roles::user}, .text{"first"}});
+  conversation.append({.role{chat::message::roles::assistant}, .text{"second"}});
+  conversation.fork(0);
+  conversation.append({.role{chat::message::roles::assistant}, .text{"only on the new branch"}});
+  static_cast<void>(conversation.path());                                       // cache the new branch's path
+  conversation.remove_branch(conversation.get_active_branch());
+  auto const path{conversation.path()};
+  return path.size() == 2 && conversation.get_text(*path.back()) == "second";
+}
+
+}
+
+int main() {
+  /// Save, open and restore a large branching conversation, with and without compression
+  size_t constexpr message_count{200'000};
+  size_t constexpr fork_every{1'000};
+  size_t constexpr image_every{2'000};
+  size_t constexpr image_bytes{100 * 1024};
+
+  static char const *const words[]{"the", "model", "returns", "a", "function", "which", "should", "value", "error", "because", "we", "can", "index", "of", "message", "branch", "and", "string", "vector", "result"};
+  std::mt19937 random{12345};
+  std::uniform_int_distribution<size_t> word_distribution{0, std::size(words) - 1};
+  std::uniform_int_distribution<size_t> length_distribution{10, 200};
+  std::uniform_int_distribution<unsigned int> byte_distribution{0, 255};
+
+  if(!removing_active_last_branch_resets_path()) {
+    std::printf("ERROR: removing the active last branch left a stale path\n");
+    return EXIT_FAILURE;
+  }
+
+  chat::conversation_tree conversation;
+  size_t text_bytes{0};
+  for(size_t i{0}; i != message_count; ++i) {
+    std::string text;
+    for(size_t length{length_distribution(random)}; length != 0; --length) {
+      text += words[word_distribution(random)];
+      text += ' ';
+    }
+    text_bytes += text.size();
+    conversation.append({
+      .role{i % 2 == 0 ? chat::message::roles::user : chat::message::roles::assistant},
+      .text{std::move(text)},
+    });
+    if(i % image_every == 0) {
+      chat::image attachment{
+        .media_type{"image/jpeg"},
+        .data{std::vector<std::byte>(image_bytes)},
+        .dimensions{.width{512}, .height{512}},
+      };
+      for(auto &value : attachment.data) value = static_cast<std::byte>(byte_distribution(random));
+      conversation.attach_image(conversation.path().size() - 1, std::move(attachment));
+    }
+    if(i % fork_every == fork_every - 1) conversation.fork(conversation.path().size() / 2);
+  }
+  size_t const images{count_images(conversation)};
+  std::printf("%zu messages (%zu MiB of text) on %zu branches, %zu images of %zu KiB\n", conversation.size(), text_bytes >> 20, conversation.get_branches().size(), images, image_bytes >> 10);
+
+  std::string const path{(std::filesystem::temp_directory_path() / "snapshot_bench.snapshot").string()};
+  for(bool const compress : {false, true}) {
+    std::string const label{compress ? "lz4" : "raw"};
+    double const save_ns{benchmark::median_ns(3, [&]{
+      if(auto const result{chat::snapshot::save(conversation, path, {.compress{compress}})}; !result) {
+        std::printf("ERROR: %s\n", result.error().c_str());
+      }
+    })};
+    benchmark::report(label + " save", save_ns, std::to_string(std::filesystem::file_size(path) >> 20) + " MiB");
+
+    double const open_ns{benchmark::median_ns(5, [&]{
+      benchmark::keep(chat::snapshot::open(path));
+    })};
+    benchmark::report(label + " open", open_ns);
+
+    double const read_ns{benchmark::median_ns(5, [&]{
+      auto const loaded{chat::snapshot::open(path)};
+      size_t bytes{0};
+      for(size_t i{0}; i != loaded->size(); ++i) {
+        bytes += loaded->get(i).text.size();
+      }
+      benchmark::keep(bytes);
+    })};
+    benchmark::report(label + " open and read every text", read_ns);
+
+    chat::conversation_tree restored;
+    double const restore_ns{benchmark::median_ns(3, [&]{
+      auto const loaded{chat::snapshot::open(path)};
+      if(auto const result{loaded->restore(restored)}; !result) {
+        std::printf("ERROR: %s\n", result.error().c_str());
+      }
+    })};
+    bool const intact{restored.size() == conversation.size() && count_images(restored) == images && restored.get_branches().size() == conversation.get_branches().size()};
+    benchmark::report(label + " open and restore", restore_ns, intact ? "round trip intact" : "ROUND TRIP MISMATCH");
+  }
+  std::filesystem::remove(path);
+  return EXIT_SUCCESS;
+}